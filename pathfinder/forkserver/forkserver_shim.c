@@ -0,0 +1,117 @@
+// Fork server for checker programs, loaded with LD_PRELOAD.
+//
+// When PATHFINDER_FORKSERVER_FD is set, the program stops right before main
+// and serves requests on that socket instead. Each request carries the argv
+// for one run, plus the stdout and stderr fds for it. The server forks, the
+// child runs main with that argv, and the server replies with the child's pid
+// and then its wait status. Everything before main (dynamic linking, library
+// constructors) is only done once.
+//
+// Messages (SOCK_SEQPACKET):
+//   server -> pathfinder: int32 0 once ready
+//   pathfinder -> server: NUL-separated argv, SCM_RIGHTS {stdout, stderr}
+//   server -> pathfinder: int32 pid, then int32 wait status
+
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define FORKSERVER_FD_ENV "PATHFINDER_FORKSERVER_FD"
+#define MAX_REQUEST (1 << 16)
+#define MAX_ARGS 4096
+
+typedef int (*main_fn)(int, char **, char **);
+typedef int (*libc_start_main_fn)(main_fn, int, char **, void (*)(void),
+                                  void (*)(void), void (*)(void), void *);
+
+extern char **environ;
+
+static main_fn real_main;
+
+static int send_int(int fd, int32_t v) {
+    return send(fd, &v, sizeof(v), MSG_NOSIGNAL) == sizeof(v) ? 0 : -1;
+}
+
+// Returns the number of bytes in buf, 0 once pathfinder hangs up
+static ssize_t recv_request(int fd, char *buf, size_t len, int fds[2]) {
+    char control[CMSG_SPACE(2 * sizeof(int))];
+    struct iovec iov = {buf, len - 1};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do {
+        n = recvmsg(fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0) return 0;
+
+    struct cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    if (!c || c->cmsg_type != SCM_RIGHTS || c->cmsg_len != CMSG_LEN(2 * sizeof(int))) {
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(c), 2 * sizeof(int));
+    buf[n] = '\0';
+    return n;
+}
+
+static int serve(int ctl) {
+    static char buf[MAX_REQUEST];
+    static char *argv[MAX_ARGS + 1];
+
+    if (send_int(ctl, 0)) return 1;
+
+    while (1) {
+        int fds[2];
+        ssize_t n = recv_request(ctl, buf, sizeof(buf), fds);
+        if (n == 0) return 0;
+        if (n < 0) return 1;
+
+        int argc = 0;
+        for (char *p = buf; p < buf + n && argc < MAX_ARGS; p += strlen(p) + 1) {
+            argv[argc++] = p;
+        }
+        argv[argc] = NULL;
+
+        pid_t pid = fork();
+        if (pid == 0) {
+            close(ctl);
+            dup2(fds[0], STDOUT_FILENO);
+            dup2(fds[1], STDERR_FILENO);
+            close(fds[0]);
+            close(fds[1]);
+            unsetenv(FORKSERVER_FD_ENV);
+            exit(real_main(argc, argv, environ));
+        }
+        close(fds[0]);
+        close(fds[1]);
+        if (send_int(ctl, pid < 0 ? -1 : pid)) return 1;
+        if (pid < 0) continue;
+
+        int status;
+        while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {}
+        if (send_int(ctl, status)) return 1;
+    }
+}
+
+static int forkserver_main(int argc, char **argv, char **envp) {
+    const char *fd_str = getenv(FORKSERVER_FD_ENV);
+    if (!fd_str) return real_main(argc, argv, envp);
+    exit(serve(atoi(fd_str)));
+}
+
+int __libc_start_main(main_fn main, int argc, char **argv, void (*init)(void),
+                      void (*fini)(void), void (*rtld_fini)(void), void *stack_end) {
+    libc_start_main_fn next = (libc_start_main_fn)dlsym(RTLD_NEXT, "__libc_start_main");
+    real_main = main;
+    return next(forkserver_main, argc, argv, init, fini, rtld_fini, stack_end);
+}
@@ -1,8 +1,13 @@
 #include "persistence_graph.hpp"
 
+#include <algorithm>
+#include <chrono>
 #include <cstdlib>
+#include <future>
 #include <iostream>
 #include <memory>
+#include <numeric>
+#include <random>
 #include <tuple>
 #include <unordered_map>
 #include <unordered_set>
@@ -17,21 +22,16 @@ namespace pathfinder {
 
 /* utils */
 
-bool has_path(const graph_type &g, vertex a, vertex b) {
-    list<vertex> frontier{a};
+bool has_path(const csr_graph &g, vertex a, vertex b) {
+    vector<vertex> frontier{a};
     unordered_set<vertex> visited;
-    while (!frontier.empty()) {
-        vertex v = frontier.front();
-        frontier.pop_front();
-
-        graph_type::out_edge_iterator it, end;
-        for (boost::tie(it, end) = boost::out_edges(v, g); it != end; ++it) {
-            if (visited.count(it->m_target)) continue;
-            visited.insert(it->m_target);
-            if (b == it->m_target) return true;
-            if (it->m_target < b) {
+    for (size_t i = 0; i < frontier.size(); ++i) {
+        for (vertex u : g.out_neighbors(frontier[i])) {
+            if (!visited.insert(u).second) continue;
+            if (b == u) return true;
+            if (u < b) {
                 // this part is PM specific. No back edges.
-                frontier.push_back(it->m_target);
+                frontier.push_back(u);
             }
         }
     }
@@ -39,6 +39,257 @@ bool has_path(const graph_type &g, vertex a, vertex b) {
     return false;
 }
 
+/* reachability_index */
+
+reachability_index::reachability_index(const csr_graph &g, unsigned num_labels, bool parallel)
+    : g_(g), num_labels_(num_labels), forward_only_(true) {
+    for (vertex v = 0; v < g_.num_vertices() && forward_only_; ++v) {
+        for (vertex u : g_.out_neighbors(v)) {
+            if (u <= v) {
+                forward_only_ = false;
+                break;
+            }
+        }
+    }
+    if (!forward_only_) {
+        cerr << "Reachability index: graph has backward edges, using BFS instead" << endl;
+        return;
+    }
+
+    labels_.resize(g_.num_vertices() * num_labels_);
+    // Labelings write disjoint entries, so they can be built concurrently.
+    vector<future<void>> builds;
+    for (unsigned i = 0; i < num_labels_; ++i) {
+        if (parallel) {
+            builds.push_back(async(launch::async, &reachability_index::build_labeling, this, i));
+        } else {
+            build_labeling(i);
+        }
+    }
+    for (auto &f : builds) f.get();
+}
+
+void reachability_index::build_labeling(unsigned i) {
+    size_t n = g_.num_vertices();
+    mt19937_64 rng(i + 1);
+
+    vector<uint32_t> roots(n);
+    std::iota(roots.begin(), roots.end(), 0);
+    std::shuffle(roots.begin(), roots.end(), rng);
+
+    // Each frame visits its children starting from a random one.
+    struct frame {
+        uint32_t v, next, start;
+    };
+    uint32_t pre = 0, post = 0;
+    auto make_frame = [&] (uint32_t v) {
+        labels_[(size_t)v * num_labels_ + i].pre = pre++;
+        size_t deg = g_.out_neighbors(v).size();
+        return frame{v, 0, deg ? (uint32_t)(rng() % deg) : 0};
+    };
+
+    vector<bool> visited(n, false);
+    vector<frame> stack;
+    for (uint32_t root : roots) {
+        if (visited[root]) continue;
+        visited[root] = true;
+        stack.push_back(make_frame(root));
+
+        while (!stack.empty()) {
+            frame &f = stack.back();
+            csr_graph::neighbor_range children = g_.out_neighbors(f.v);
+            if (f.next < children.size()) {
+                uint32_t u = children.begin()[(f.start + f.next++) % children.size()];
+                if (!visited[u]) {
+                    visited[u] = true;
+                    stack.push_back(make_frame(u));
+                }
+                continue;
+            }
+
+            // In a DAG, every child is done by the time its parent is.
+            label &l = labels_[(size_t)f.v * num_labels_ + i];
+            l.post = post++;
+            l.low = l.post;
+            for (uint32_t u : children) {
+                l.low = std::min(l.low, labels_[(size_t)u * num_labels_ + i].low);
+            }
+            stack.pop_back();
+        }
+    }
+}
+
+bool reachability_index::may_reach(vertex a, vertex b) const {
+    const label *la = &labels_[a * num_labels_];
+    const label *lb = &labels_[b * num_labels_];
+    for (unsigned i = 0; i < num_labels_; ++i) {
+        if (lb[i].low < la[i].low || lb[i].post > la[i].post) return false;
+    }
+    return true;
+}
+
+bool reachability_index::must_reach(vertex a, vertex b) const {
+    const label *la = &labels_[a * num_labels_];
+    const label *lb = &labels_[b * num_labels_];
+    for (unsigned i = 0; i < num_labels_; ++i) {
+        if (la[i].pre <= lb[i].pre && lb[i].post <= la[i].post) return true;
+    }
+    return false;
+}
+
+bool reachability_index::reachable(vertex a, vertex b) const {
+    if (!forward_only_) return has_path(g_, a, b);
+    if (b <= a || !may_reach(a, b)) return false;
+    if (must_reach(a, b)) return true;
+
+    vector<vertex> stack{a};
+    unordered_set<vertex> visited;
+    while (!stack.empty()) {
+        vertex v = stack.back();
+        stack.pop_back();
+        for (vertex u : g_.out_neighbors(v)) {
+            if (u == b) return true;
+            if (u > b || !visited.insert(u).second) continue;
+            if (!may_reach(u, b)) continue;
+            if (must_reach(u, b)) return true;
+            stack.push_back(u);
+        }
+    }
+
+    return false;
+}
+
+/* ideal_enumerator */
+
+ideal_enumerator::ideal_enumerator(const graph_type &g, optional<vertex> root) {
+    size_t n = boost::num_vertices(g);
+    vector<size_t> in_degree(n, 0);
+    graph_type::vertex_iterator vi, vend;
+    for (boost::tie(vi, vend) = boost::vertices(g); vi != vend; ++vi) {
+        graph_type::out_edge_iterator ei, eend;
+        for (boost::tie(ei, eend) = boost::out_edges(*vi, g); ei != eend; ++ei) {
+            // remove_vertex in posix_graph::generate_subgraph can leave edges
+            // to vertices past the end. Skip them, like the old generator did.
+            if (boost::target(*ei, g) < n) in_degree[boost::target(*ei, g)]++;
+        }
+    }
+
+    // Kahn's algorithm, so predecessors always get lower bits.
+    vector<vertex> ready;
+    for (vertex v = 0; v < n; ++v) {
+        if (!in_degree[v]) ready.push_back(v);
+    }
+    vector<vertex> topo;
+    for (size_t i = 0; i < ready.size(); ++i) {
+        vertex v = ready[i];
+        topo.push_back(v);
+        graph_type::out_edge_iterator ei, eend;
+        for (boost::tie(ei, eend) = boost::out_edges(v, g); ei != eend; ++ei) {
+            vertex u = boost::target(*ei, g);
+            if (u < n && !--in_degree[u]) ready.push_back(u);
+        }
+    }
+    BOOST_ASSERT_MSG(topo.size() == n, "Can only enumerate the ideals of a DAG!");
+
+    vector<size_t> bit(n, SIZE_MAX);
+    for (vertex v : topo) {
+        if (root && v == *root) continue;
+        bit[v] = order_.size();
+        order_.push_back(v);
+    }
+
+    preds_.assign(order_.size(), ideal(order_.size()));
+    for (vertex v : order_) {
+        graph_type::out_edge_iterator ei, eend;
+        for (boost::tie(ei, eend) = boost::out_edges(v, g); ei != eend; ++ei) {
+            vertex u = boost::target(*ei, g);
+            if (u < n) preds_[bit[u]].set(bit[v]);
+        }
+    }
+}
+
+bool ideal_enumerator::enumerate(const function<bool(const ideal&)> &visit,
+                                 const atomic<bool> &cancel_flag) const {
+    size_t n = order_.size();
+    ideal current(n);
+    // Whether bit i is still to be tried as left out.
+    vector<bool> can_drop(n, false);
+
+    size_t i = 0;
+    while (true) {
+        if (i < n) {
+            if (preds_[i].is_subset_of(current)) {
+                current.set(i);
+                can_drop[i] = true;
+            } else {
+                can_drop[i] = false;
+            }
+            ++i;
+            continue;
+        }
+
+        if (cancel_flag.load() || !visit(current)) return false;
+
+        // Back up to the last vertex we added, and leave it out instead.
+        do {
+            if (i == 0) return true;
+            --i;
+        } while (!can_drop[i]);
+        current.reset(i);
+        can_drop[i] = false;
+        ++i;
+    }
+}
+
+/* csr_graph */
+
+csr_graph::csr_graph(const graph_type &g) {
+    size_t n = boost::num_vertices(g);
+    BOOST_ASSERT(n < UINT32_MAX && boost::num_edges(g) < UINT32_MAX);
+
+    nodes_.resize(n);
+    events_.resize(n);
+    types_.resize(n);
+    out_offsets_.assign(n + 1, 0);
+    in_offsets_.assign(n + 1, 0);
+
+    const_property_map pmap = boost::get(pnode_property_t(), g);
+    for (vertex v = 0; v < n; ++v) {
+        nodes_[v] = boost::get(pmap, v);
+        if (nodes_[v]) {
+            events_[v] = nodes_[v]->event();
+            types_[v] = events_[v]->type;
+        }
+
+        graph_type::out_edge_iterator it, end;
+        for (boost::tie(it, end) = boost::out_edges(v, g); it != end; ++it) {
+            out_offsets_[v + 1]++;
+            in_offsets_[it->m_target + 1]++;
+        }
+    }
+    std::partial_sum(out_offsets_.begin(), out_offsets_.end(), out_offsets_.begin());
+    std::partial_sum(in_offsets_.begin(), in_offsets_.end(), in_offsets_.begin());
+
+    // Sources are visited in order, so each in-neighbor list comes out sorted.
+    out_targets_.resize(out_offsets_[n]);
+    in_sources_.resize(in_offsets_[n]);
+    vector<uint32_t> in_fill(in_offsets_.begin(), in_offsets_.end() - 1);
+    for (vertex v = 0; v < n; ++v) {
+        uint32_t *out = out_targets_.data() + out_offsets_[v];
+        graph_type::out_edge_iterator it, end;
+        for (boost::tie(it, end) = boost::out_edges(v, g); it != end; ++it) {
+            *out++ = it->m_target;
+            in_sources_[in_fill[it->m_target]++] = v;
+        }
+        std::sort(out_targets_.begin() + out_offsets_[v], out_targets_.begin() + out_offsets_[v + 1]);
+    }
+}
+
+bool csr_graph::has_edge(vertex a, vertex b) const {
+    neighbor_range r = out_neighbors(a);
+    return std::binary_search(r.begin(), r.end(), (uint32_t)b);
+}
+
 vector<vector<vertex>> split_vector(const vector<vertex> &verts,
     const vector<int> &idxs) {
     vector<vector<vertex>> ret;
@@ -124,6 +375,68 @@ vector<vector<vertex>> split_vector(const vector<vertex> &verts,
 //     return {};  // If no order is found, return an empty vector indicating completion
 // }
 
+void persistence_graph::freeze_graph(void) {
+    csr_ = csr_graph(graph_);
+
+    graph_type frozen(boost::num_vertices(graph_));
+    property_map pmap = boost::get(pnode_property_t(), frozen);
+    for (vertex v = 0; v < boost::num_vertices(frozen); ++v) {
+        boost::put(pmap, v, boost::get(pnode_property_t(), graph_, v));
+    }
+    graph_.swap(frozen);
+}
+
+void persistence_graph::build_reachability_index(unsigned num_labels, bool parallel) {
+    reachability_.reset();
+    if (!num_labels) return;
+
+    auto start = chrono::steady_clock::now();
+    reachability_.reset(new reachability_index(csr_, num_labels, parallel));
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    cerr << "Reachability index: " << num_labels << " labeling(s) of "
+        << csr_.num_vertices() << " vertices in " << elapsed.count() << " s" << endl;
+}
+
+bool persistence_graph::has_path(vertex a, vertex b) const {
+    if (reachability_) return reachability_->reachable(a, b);
+    return pathfinder::has_path(csr_, a, b);
+}
+
+void persistence_graph::benchmark_has_path(size_t npairs, ostream &out) const {
+    size_t n = csr_.num_vertices();
+    if (n < 2 || !npairs) return;
+
+    // Half the pairs are close together, like the queries from
+    // split_by_epochs, and half are uniform.
+    mt19937_64 rng(0);
+    vector<pair<vertex, vertex>> pairs;
+    for (size_t i = 0; i < npairs; ++i) {
+        vertex a = rng() % n;
+        vertex b = (i % 2) ? rng() % n : std::min(n - 1, a + 1 + rng() % 64);
+        pairs.push_back(make_pair(std::min(a, b), std::max(a, b)));
+    }
+
+    auto run = [&] (auto &&query, vector<bool> &answers) {
+        auto start = chrono::steady_clock::now();
+        for (const auto &p : pairs) answers.push_back(query(p.first, p.second));
+        return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    };
+
+    vector<bool> bfs, indexed;
+    double bfs_time = run([&] (vertex a, vertex b) { return pathfinder::has_path(csr_, a, b); }, bfs);
+    double index_time = run([&] (vertex a, vertex b) { return has_path(a, b); }, indexed);
+
+    if (bfs != indexed) {
+        cerr << "has_path benchmark: reachability index disagrees with BFS!" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    out << "has_path benchmark: " << npairs << " pairs (" << std::count(bfs.begin(), bfs.end(), true)
+        << " reachable) on " << n << " vertices, " << csr_.num_edges() << " edges\n"
+        << "\tBFS: " << bfs_time << " s, "
+        << (reachability_ ? "index" : "no index") << ": " << index_time << " s" << endl;
+}
+
 void persistence_graph::visualize(const string &filename, const graph_type &graph) const {
     ofstream out(filename);
     boost::write_graphviz(out, graph, node_label_writer(graph));
@@ -187,7 +500,7 @@ tuple<graph_type*, vertex, unordered_map<vertex, vertex>> persistence_graph::gen
     vertex shadow_root = add_vertex(*subgraph);
 
     for (auto v : vertex_list) {
-        vertex new_v = add_vertex(boost::get(pnode_property_t(), graph_, v), *subgraph);
+        vertex new_v = add_vertex(csr_.node(v), *subgraph);
         // get the trace_event
         // shared_ptr<trace_event> te = boost::get(pnode_property_t(), graph_, v)->event();
         // cout << "vertex: " << v << " event: " << te->timestamp << endl;
@@ -195,10 +508,32 @@ tuple<graph_type*, vertex, unordered_map<vertex, vertex>> persistence_graph::gen
         new_to_old[new_v] = v;
     }
 
-    for (auto v : vertex_list) {
-        for (auto adj = adjacent_vertices(v, graph_).first; adj != adjacent_vertices(v, graph_).second; ++adj) {
-            if (find(vertex_list.begin(), vertex_list.end(), *adj) != vertex_list.end()) {
-                add_edge(old_to_new[v], old_to_new[*adj], *subgraph);
+    // Two vertices of the list are ordered if there is a path between them,
+    // which may go through vertices outside of the list, so edges come from a
+    // search per vertex rather than from its direct out-edges. A search stops
+    // at the list's vertices: what is past them is found by their own search,
+    // and would only add edges that the transitive reduction below drops.
+    // Whether the graph has all edges or just enough for the same transitive
+    // closure, the subgraph comes out the same. Like has_path, this relies on
+    // there being no back edges.
+    if (!vertex_list.empty()) {
+        vertex last = *max_element(vertex_list.begin(), vertex_list.end());
+        vector<size_t> visited(last + 1, 0);
+        vector<vertex> frontier;
+        for (size_t i = 0; i < vertex_list.size(); ++i) {
+            vertex v = vertex_list[i];
+            frontier.assign(1, v);
+            for (size_t j = 0; j < frontier.size(); ++j) {
+                for (vertex u : csr_.out_neighbors(frontier[j])) {
+                    if (u > last || visited[u] == i + 1) continue;
+                    visited[u] = i + 1;
+                    auto it = old_to_new.find(u);
+                    if (it != old_to_new.end()) {
+                        add_edge(old_to_new[v], it->second, *subgraph);
+                    } else {
+                        frontier.push_back(u);
+                    }
+                }
             }
         }
     }
@@ -254,16 +589,14 @@ tuple<graph_type*, vertex, unordered_map<vertex, vertex>> persistence_graph::gen
     return make_tuple(subgraph, new_shadow_root, new_to_old_updated);
 }
 
-set<set<vertex>> persistence_graph::generate_all_orders(vector<vertex> vertex_list, atomic<bool>& cancel_flag) {
+bool persistence_graph::for_each_order(vector<vertex> vertex_list, atomic<bool>& cancel_flag,
+                                       const function<bool(const vector<vertex>&)> &visit) {
     tuple<graph_type*, vertex, unordered_map<vertex, vertex>> res = generate_subgraph(vertex_list);
     graph_type *subgraph = get<0>(res);
     vertex shadow_root = get<1>(res);
     unordered_map<vertex, vertex> new_to_old = get<2>(res);
 
-    PartialOrderGenerator *og = new PartialOrderGenerator(*subgraph);
-
     // prevent memory leak
-    order_generators_.push_back(og);
     subgraphs_.push_back(subgraph);
     stringstream ss;
 
@@ -271,21 +604,30 @@ set<set<vertex>> persistence_graph::generate_all_orders(vector<vertex> vertex_li
     ss << "/subgraph_" << subgraphs_.size()-1 << ".dot";
     visualize(output_dir_.string() + ss.str(), *subgraph);
 
-    set<set<vertex>> orders = og->generate_all_orders(cancel_flag, shadow_root);
-    set<set<vertex>> processed_orders;
-    for (auto order : orders) {
-        if (order.size() == 0) continue;
-        set<vertex> processed_order;
-        for (auto v : order) {
-            if (v == shadow_root) continue;
-            processed_order.insert(new_to_old[v]);
-        }
-        processed_orders.insert(processed_order);
+    ideal_enumerator enumerator(*subgraph, shadow_root);
+    vector<vertex> old_vertices;
+    for (vertex v : enumerator.vertices()) {
+        old_vertices.push_back(new_to_old.at(v));
     }
 
-    // free(og);
-    // free(subgraph);
-    
+    vector<vertex> order;
+    return enumerator.enumerate([&] (const ideal_enumerator::ideal &ideal) {
+        order.clear();
+        for (size_t i = ideal.find_first(); i != ideal.npos; i = ideal.find_next(i)) {
+            order.push_back(old_vertices[i]);
+        }
+        std::sort(order.begin(), order.end());
+        return visit(order);
+    }, cancel_flag);
+}
+
+set<set<vertex>> persistence_graph::generate_all_orders(vector<vertex> vertex_list, atomic<bool>& cancel_flag) {
+    set<set<vertex>> processed_orders;
+    for_each_order(vertex_list, cancel_flag, [&] (const vector<vertex> &order) {
+        processed_orders.insert(set<vertex>(order.begin(), order.end()));
+        return true;
+    });
+
     return processed_orders;
 }
 
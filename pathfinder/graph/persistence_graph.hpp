@@ -1,13 +1,19 @@
 #pragma once
 
+#include <atomic>
+#include <cstdint>
+#include <functional>
 #include <numeric>
 #include <memory>
+#include <optional>
 #include <tuple>
 #include <unordered_map>
+#include <vector>
 
 #include <llvm/IR/Module.h>
 #include <llvm/IR/Type.h>
 
+#include <boost/dynamic_bitset.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/icl/discrete_interval.hpp>
 #include <boost/graph/graph_traits.hpp>
@@ -97,6 +103,57 @@ typedef boost::property_map<graph_type, pnode_property_t>::type property_map;
 typedef boost::property_map<graph_type, pnode_property_t>::const_type const_property_map;
 
 typedef std::vector<vertex> update_mechanism;
+
+/**
+ * @brief Read-only copy of a persistence graph in compressed sparse row form.
+ *
+ * Out- and in-neighbors of each vertex are contiguous, sorted arrays, and
+ * the node, event and event type of each vertex are plain tables, so queries
+ * do not go through the boost property map. Parallel edges are kept.
+ */
+class csr_graph {
+public:
+    struct neighbor_range {
+        const uint32_t *first, *last;
+        const uint32_t *begin(void) const { return first; }
+        const uint32_t *end(void) const { return last; }
+        size_t size(void) const { return last - first; }
+    };
+
+    csr_graph() = default;
+    explicit csr_graph(const graph_type &g);
+
+    size_t num_vertices(void) const { return nodes_.size(); }
+    size_t num_edges(void) const { return out_targets_.size(); }
+
+    neighbor_range out_neighbors(vertex v) const {
+        return {out_targets_.data() + out_offsets_[v], out_targets_.data() + out_offsets_[v + 1]};
+    }
+    neighbor_range in_neighbors(vertex v) const {
+        return {in_sources_.data() + in_offsets_[v], in_sources_.data() + in_offsets_[v + 1]};
+    }
+
+    bool has_edge(vertex a, vertex b) const;
+
+    const persistence_node *node(vertex v) const { return nodes_[v]; }
+
+    // The node type is fixed per graph, so this only checks in debug builds.
+    template <typename Node>
+    const Node *node(vertex v) const {
+        BOOST_ASSERT(dynamic_cast<const Node*>(nodes_[v]));
+        return static_cast<const Node*>(nodes_[v]);
+    }
+
+    const std::shared_ptr<trace_event> &event(vertex v) const { return events_[v]; }
+    event_type type(vertex v) const { return types_[v]; }
+
+private:
+    std::vector<uint32_t> out_offsets_, out_targets_;
+    std::vector<uint32_t> in_offsets_, in_sources_;
+    std::vector<const persistence_node*> nodes_;
+    std::vector<std::shared_ptr<trace_event>> events_;
+    std::vector<event_type> types_;
+};
 /**
  * @brief The representative is the first node.
  *
@@ -113,7 +170,47 @@ typedef std::vector<update_mechanism> update_mechanism_group;
  * @return true
  * @return false
  */
-bool has_path(const graph_type &g, vertex a, vertex b);
+bool has_path(const csr_graph &g, vertex a, vertex b);
+
+/**
+ * @brief Answers has_path() queries with GRAIL interval labels.
+ *
+ * Each labeling is a randomized DFS post-order, where vertex v gets the
+ * interval [lowest post-order number below v, post-order number of v]. If b
+ * is reachable from a, b's interval is inside a's in every labeling, so most
+ * negative queries need no traversal at all. The pre-order number also
+ * proves reachability when b is below a in the DFS tree. The rest run a DFS
+ * that skips vertices whose labels already rule b out.
+ *
+ * Only the edge direction from lower to higher vertex is supported, as in
+ * has_path(). Other graphs fall back to has_path().
+ */
+class reachability_index {
+public:
+    reachability_index(const csr_graph &g, unsigned num_labels, bool parallel);
+
+    bool reachable(vertex a, vertex b) const;
+
+    unsigned num_labels(void) const { return num_labels_; }
+
+private:
+    struct label {
+        uint32_t low, pre, post;
+    };
+
+    const csr_graph &g_;
+    unsigned num_labels_;
+    bool forward_only_;
+    // Labeling i of vertex v is at labels_[v * num_labels_ + i].
+    std::vector<label> labels_;
+
+    void build_labeling(unsigned i);
+
+    // Whether the labels of b are all inside those of a.
+    bool may_reach(vertex a, vertex b) const;
+    // Whether b is below a in one of the DFS trees.
+    bool must_reach(vertex a, vertex b) const;
+};
 
 /**
  * @brief Split the vertex at the points given, not including beginning and end.
@@ -195,118 +292,41 @@ std::vector<std::vector<vertex>> split_vector(
 //     }
 // };
 
-class PartialOrderGenerator {
-private:
-    graph_type& subgraph;
-    std::vector<int> in_degree;
-    std::set<vertex> order;
-    std::set<std::set<vertex>> orders;
-    std::vector<bool> visited;
-    std::vector<std::set<vertex>::iterator> pointers;
-    int num_vertices;
-
+/**
+ * @brief Enumerates the down-sets (ideals) of a DAG: every set of vertices
+ * that contains all the predecessors of its members. These are the crash
+ * states of an update mechanism.
+ *
+ * Vertices are decided in topological order; each is either added, if all of
+ * its predecessors are in, or left out. Every leaf of that search is a
+ * different ideal, so each ideal is reported exactly once, as it is found.
+ */
+class ideal_enumerator {
 public:
-    PartialOrderGenerator(graph_type& graph) : subgraph(graph), num_vertices(boost::num_vertices(subgraph)) {
-        in_degree.resize(num_vertices, 0);
-        visited.resize(num_vertices, false);
-        pointers.resize(num_vertices);
-
-        // Initialize in_degree
-        boost::graph_traits<graph_type>::vertex_iterator vi, vend;
-        for (boost::tie(vi, vend) = vertices(subgraph); vi != vend; ++vi) {
-            boost::graph_traits<graph_type>::out_edge_iterator ei, edge_end;
-            for (boost::tie(ei, edge_end) = out_edges(*vi, subgraph); ei != edge_end; ++ei) {
-                // in_degree[target(*ei, subgraph)]++;
-                auto idx = boost::get(boost::vertex_index, subgraph, target(*ei, subgraph));
-                if (idx < num_vertices) {
-                    in_degree[idx]++;
-                }
-            }
-        }
-    }
-
-    // Resets all orders and visited information to start generating from scratch
-    void reset() {
-        std::fill(visited.begin(), visited.end(), false);
-        order.clear();
-    }
-
-    // Function to generate all partial orders
-    bool generate_orders(vertex v, std::atomic<bool>& cancel_flag, bool root = true) {
-        if (cancel_flag.load()) {
-            return false;
-        }
-        if (!root) {
-            // Decrement inDegrees of all successors
-            boost::graph_traits<graph_type>::out_edge_iterator ei, edge_end;
-            for (boost::tie(ei, edge_end) = out_edges(v, subgraph); ei != edge_end; ++ei) {
-                // vertex u = target(*ei, subgraph);
-                auto idx = boost::get(boost::vertex_index, subgraph, target(*ei, subgraph));
-                if (idx < num_vertices) {
-                    in_degree[idx]--;
-                }
-            }
-
-            visited[v] = true;
-            // order.push_back(v);
-            order.insert(v);
-        }
-
-        // Output the current partial order
-        // for (Vertex u : order) {
-        //     std::cout << u << " ";
-        // }
-        // std::cout << std::endl;
-        bool existed = false;
-        for (const auto &existing_order : orders) {
-            if (order == existing_order)
-                existed = true;
-        }
-        if (!existed)
-            orders.insert(order);
-
-        bool extended = false;
-        boost::graph_traits<graph_type>::vertex_iterator vi, vend;
-        for (boost::tie(vi, vend) = vertices(subgraph); vi != vend; ++vi) {
-            if (in_degree[*vi] == 0 && !visited[*vi]) {
-                extended = true;
-                generate_orders(*vi, cancel_flag, false);  // Recursive call
-            }
-        }
+    // Bit i stands for vertices()[i].
+    typedef boost::dynamic_bitset<> ideal;
 
-        if (!root) {
-            // Restore the state for other branches of the exploration
-            boost::graph_traits<graph_type>::out_edge_iterator ei, edge_end;
-            for (boost::tie(ei, edge_end) = out_edges(v, subgraph); ei != edge_end; ++ei) {
-                auto idx = boost::get(boost::vertex_index, subgraph, target(*ei, subgraph));
-                if (idx < num_vertices) {
-                    in_degree[idx]++;
-                }
-            }
-            visited[v] = false;
-            // order.pop_back();
-            order.erase(v);
-        }
+    /**
+     * @param g DAG to enumerate.
+     * @param root If given, a vertex that comes before every other one and
+     * is left out of the ideals, like the shadow root of generate_subgraph.
+     */
+    ideal_enumerator(const graph_type &g, std::optional<vertex> root = std::nullopt);
 
-        return extended;
-    }
+    const std::vector<vertex> &vertices(void) const { return order_; }
 
-    // Function to initiate the generation of orders
-    std::set<std::set<vertex>> generate_all_orders(std::atomic<bool>& cancel_flag, vertex root=0) {
-        reset(); // Reset state
-        generate_orders(root, cancel_flag, true); // Start generation from root
-        return orders;
-    }
+    /**
+     * Calls visit on each ideal, the empty one included, until visit returns
+     * false or cancel_flag is set.
+     *
+     * @return true if every ideal was visited.
+     */
+    bool enumerate(const std::function<bool(const ideal&)> &visit,
+                   const std::atomic<bool> &cancel_flag) const;
 
-    // Function to print all orders
-    void print_orders() {
-        for (const auto &order : orders) {
-            for (vertex u : order) {
-                std::cout << u << " ";
-            }
-            std::cout << std::endl;
-        }
-    }
+private:
+    std::vector<vertex> order_;
+    std::vector<ideal> preds_;
 };
 
 class persistence_graph {
@@ -314,7 +334,8 @@ protected:
     const trace &trace_;
     std::vector<persistence_node*> nodes_;
     graph_type graph_;
-    std::vector<PartialOrderGenerator*> order_generators_;
+    csr_graph csr_;
+    std::unique_ptr<reachability_index> reachability_;
     std::vector<graph_type*> subgraphs_;
     // map from trace_event to vertex
     // we may not need a map from vertex to trace event, since we can get the trace event from the vertex's node property
@@ -339,6 +360,12 @@ protected:
      */
     virtual graph_type construct_graph(void) = 0;
 
+    /**
+     * Copy the edges of graph_ into csr_ and drop them from graph_, which
+     * keeps its vertices and node properties. Call once construct_graph is done.
+     */
+    void freeze_graph(void);
+
     /**
      * Given a list of vertices, generate a subgraph.
     */
@@ -353,10 +380,6 @@ public:
             delete n;
         }
 
-        for (auto og : order_generators_) {
-            delete og;
-        }
-
         for (auto sg : subgraphs_) {
             delete sg;
         }
@@ -381,9 +404,34 @@ public:
 
     // generate all partial orders given a list of vertex in the persistence graph
     std::set<std::set<vertex>> generate_all_orders(std::vector<vertex> vertex_list, std::atomic<bool>& cancel_flag);
-    
-    // get the boost graph representation
-    const graph_type &whole_program_graph(void) const { return graph_; }
+
+    /**
+     * Stream the partial orders of vertex_list, i.e. the down-sets of its
+     * subgraph, to visit as sorted vertices of this graph. Stops early if
+     * visit returns false or cancel_flag is set.
+     *
+     * @return true if every order was visited.
+     */
+    bool for_each_order(std::vector<vertex> vertex_list, std::atomic<bool>& cancel_flag,
+                        const std::function<bool(const std::vector<vertex>&)> &visit);
+
+    // The graph, once construct_graph is done: vertices, their nodes and edges.
+    const csr_graph &csr(void) const { return csr_; }
+
+    /**
+     * Build the index that has_path() uses, with num_labels labelings (0
+     * drops the index). If parallel, each labeling is built on its own thread.
+     */
+    void build_reachability_index(unsigned num_labels, bool parallel);
+
+    // Same answer as has_path(csr(), a, b), from the index if there is one.
+    bool has_path(vertex a, vertex b) const;
+
+    /**
+     * Time has_path() with and without the index on npairs random vertex
+     * pairs, and exit if any answer differs.
+     */
+    void benchmark_has_path(size_t npairs, std::ostream &out) const;
 
 };
 
@@ -1,5 +1,8 @@
 #include "pm_graph.hpp"
 
+#include <algorithm>
+#include <unordered_set>
+
 using namespace std;
 using namespace llvm;
 namespace icl = boost::icl;
@@ -173,10 +176,13 @@ vector<persistence_node*> pm_graph::create_nodes(void) const {
     return nodes;
 }
 
-pm_graph::pm_graph(const Module &m, const class trace &t, const fs::path &output_dir)
-    : persistence_graph(t, output_dir), module_(m), type_crawler_(m, t) {
+pm_graph::pm_graph(const Module &m, const class trace &t, const fs::path &output_dir,
+                   bool frontier_edges)
+    : persistence_graph(t, output_dir), module_(m), type_crawler_(m, t),
+      frontier_edges_(frontier_edges) {
 
     graph_ = construct_graph();
+    freeze_graph();
 }
 
 graph_type pm_graph::construct_graph() {
@@ -197,12 +203,53 @@ graph_type pm_graph::construct_graph() {
     icl::interval_map<uint64_t, vertex_set> dirty_tree, flush_tree;
     vertex_set clean_list;
 
+    /**
+     * For frontier_edges_. The clean vertices are added in batches, one per
+     * fence or msync. Every store gets an edge from each frontier vertex, so
+     * a frontier vertex that is clean before some vertex of a new batch is
+     * stored already reaches that vertex, and everything after it. Dropping
+     * it from the frontier keeps the same reachability.
+     */
+    vector<vertex> frontier;
+    vector<vector<vertex>> clean_batches;
+    if (frontier_edges_) {
+        clean_epoch_.assign(nodes_.size(), NOT_CLEAN);
+        store_epoch_.assign(nodes_.size(), 0);
+    }
+
+    auto make_clean = [&] (const vertex_set &vs) {
+        if (!frontier_edges_) {
+            clean_list.insert(vs.begin(), vs.end());
+            return;
+        }
+
+        size_t batch = clean_batches.size();
+        vector<vertex> fresh;
+        size_t newest = 0;
+        for (vertex v : vs) {
+            if (clean_epoch_[v] != NOT_CLEAN) continue;
+            clean_epoch_[v] = batch;
+            fresh.push_back(v);
+            newest = std::max(newest, store_epoch_[v]);
+        }
+        if (fresh.empty()) return;
+        std::sort(fresh.begin(), fresh.end());
+
+        frontier.erase(std::remove_if(frontier.begin(), frontier.end(),
+            [&] (vertex f) { return clean_epoch_[f] < newest; }), frontier.end());
+        frontier.insert(frontier.end(), fresh.begin(), fresh.end());
+        clean_batches.push_back(std::move(fresh));
+    };
+
     // - Need to acutally iterate through all trace events, since they have
     // - the flushes/fences too.
     for (shared_ptr<trace_event> te : trace_.events()) {
 
         if (te->is_store()) {
             const vertex &curr_v = vmap[te];
+            if (frontier_edges_) {
+                store_epoch_[curr_v] = clean_batches.size();
+            }
 
             // A. Force flush the dirty range if there is overlap
             vertex_set implicit_flush;
@@ -211,7 +258,25 @@ graph_type pm_graph::construct_graph() {
                 implicit_flush = it->second;
             }
 
-            if (!implicit_flush.empty()) {
+            if (!implicit_flush.empty() && frontier_edges_) {
+                // Vertices that were clean when "flushed" was stored already
+                // reach it, so only look at the batches since then.
+                for (const vertex &flushed : implicit_flush) {
+                    const pm_node *flushed_node = dynamic_cast<const pm_node*>(boost::get(pmap, flushed));
+                    assert(flushed_node);
+                    for (size_t b = store_epoch_[flushed]; b < clean_batches.size(); ++b) {
+                        for (const vertex &clean : clean_batches[b]) {
+                            const pm_node *clean_node = dynamic_cast<const pm_node*>(boost::get(pmap, clean));
+                            assert(clean_node);
+                            if (clean_node->ts() < flushed_node->ts()) {
+                                boost::add_edge(clean, flushed, graph_);
+                            }
+                        }
+                    }
+                }
+
+                flush_tree.subtract(*it);
+            } else if (!implicit_flush.empty()) {
                 for (const vertex &clean : clean_list) {
                     for (const vertex &flushed : implicit_flush) {
                         /*
@@ -251,6 +316,10 @@ graph_type pm_graph::construct_graph() {
             }
 
             // C. Add an edge between this store and anything that's clean.
+            for (const vertex &prior : frontier) {
+                assert(prior < curr_v);
+                boost::add_edge(prior, curr_v, graph_);
+            }
             for (const vertex &prior : clean_list) {
                 assert(get(pmap, prior)->ts() < get(pmap, curr_v)->ts());
                 assert(prior < curr_v);
@@ -307,9 +376,11 @@ graph_type pm_graph::construct_graph() {
             // Now clean it all up.
             if (!flush_tree.empty()) {
                 // clean_list.clear();
+                vertex_set persisted;
                 for (const auto &p : flush_tree) {
-                    clean_list.insert(p.second.begin(), p.second.end());
+                    persisted.insert(p.second.begin(), p.second.end());
                 }
+                make_clean(persisted);
                 flush_tree.clear();
             }
         // for MMIO, we need to also take care of msync
@@ -321,9 +392,7 @@ graph_type pm_graph::construct_graph() {
             if (it != dirty_tree.end()) {
                 flushed = it->second;
             }
-            for (auto v : flushed) {
-                clean_list.insert(v);
-            }
+            make_clean(flushed);
         }
     }
 
@@ -337,9 +406,33 @@ graph_type pm_graph::construct_graph() {
 }
 
 
+bool pm_graph::has_edge(vertex a, vertex b) const {
+    if (frontier_edges_ && clean_epoch_[a] < store_epoch_[b]) return true;
+    return csr_.has_edge(a, b);
+}
+
+set<pair<vertex, vertex>> pm_graph::edges_within(const vector<vertex> &verts) const {
+    set<pair<vertex, vertex>> edges;
+    unordered_set<vertex> members(verts.begin(), verts.end());
+    for (vertex v : verts) {
+        for (vertex u : csr_.out_neighbors(v)) {
+            if (members.count(u)) edges.insert(make_pair(v, u));
+        }
+    }
+
+    if (frontier_edges_) {
+        for (vertex a : verts) {
+            for (vertex b : verts) {
+                if (clean_epoch_[a] < store_epoch_[b]) edges.insert(make_pair(a, b));
+            }
+        }
+    }
+
+    return edges;
+}
+
 int pm_graph::get_event_idx(vertex v) const {
-    const_property_map pmap = boost::get(pnode_property_t(), graph_);
-    shared_ptr<trace_event> te = boost::get(pmap, v)->event();
+    const shared_ptr<trace_event> &te = csr_.event(v);
     // The timestamp should be an acceptable proxy
     assert(trace_.events()[te->timestamp] == te);
     return te->timestamp;
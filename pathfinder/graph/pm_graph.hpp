@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstdint>
+#include <set>
+
 #include "persistence_graph.hpp"
 
 namespace pathfinder
@@ -37,6 +40,12 @@ class pm_graph: public persistence_graph {
 
     const llvm::Module &module_;
     type_crawler type_crawler_;
+    // Only draw edges from the frontier of clean vertices.
+    bool frontier_edges_;
+    // Index of the fence/msync that made each vertex clean (NOT_CLEAN if
+    // never), and the number of such batches before each store.
+    std::vector<size_t> clean_epoch_;
+    std::vector<size_t> store_epoch_;
 
     /**
      * Constructs the graph nodes with type information.
@@ -54,7 +63,16 @@ class pm_graph: public persistence_graph {
     graph_type construct_graph();
 
 public:
-    pm_graph(const llvm::Module &m, const trace &t, const boost::filesystem::path &output_dir);
+    static constexpr size_t NOT_CLEAN = SIZE_MAX;
+
+    /**
+     * With frontier_edges, a store only gets edges from the clean vertices
+     * that no later clean vertex is ordered after, instead of from every
+     * clean vertex. Reachability is unchanged, and the edges a clean vertex
+     * implies are still reported by has_edge() and edges_within().
+     */
+    pm_graph(const llvm::Module &m, const trace &t, const boost::filesystem::path &output_dir,
+             bool frontier_edges = false);
 
     const type_crawler &type_crawler(void) const { return type_crawler_; }
     const trace &trace(void) const { return trace_; }
@@ -62,6 +80,19 @@ public:
 
     int get_event_idx(vertex v) const;
 
+    bool frontier_edges(void) const { return frontier_edges_; }
+
+    /**
+     * @brief Whether the uncompressed graph has the edge a -> b.
+     */
+    bool has_edge(vertex a, vertex b) const;
+
+    /**
+     * @brief The edges of the uncompressed graph with both ends in verts.
+     * Parallel edges are only reported once.
+     */
+    std::set<std::pair<vertex, vertex>> edges_within(const std::vector<vertex> &verts) const;
+
 };
 
 } // namespace pathfinder
\ No newline at end of file
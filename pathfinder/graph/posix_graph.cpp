@@ -1,5 +1,10 @@
 #include "posix_graph.hpp"
 
+#include <algorithm>
+#include <optional>
+
+#include <boost/dynamic_bitset.hpp>
+
 using namespace std;
 using namespace llvm;
 namespace icl = boost::icl;
@@ -26,15 +31,7 @@ bool posix_node::is_equivalent(string function, const posix_node& other) const {
         // exit(EXIT_FAILURE);
 
         // this may be the margin event we add at the end of update mechanism, as a best effort, we compare if the stack frame are all the same
-        if (event_->backtrace().size() != other.event_->backtrace().size()) {
-            return false;
-        }
-        for (int i = 0; i < event_->backtrace().size(); i++) {
-            if (event_->backtrace()[i] != other.event_->backtrace()[i]) {
-                return false;
-            }
-        }
-        return true;
+        return event_->stack == other.event_->stack;
     }
     for (const auto &sf : other.event_->backtrace()) {
         if (sf.function == function) {
@@ -65,9 +62,12 @@ vector<persistence_node*> posix_graph::create_nodes(void) const {
 
 }
 
-posix_graph::posix_graph(const class trace &t, const fs::path &output_dir, bool decompose_syscall=true)
-    : persistence_graph(t, output_dir), decompose_syscall_(decompose_syscall) {
+posix_graph::posix_graph(const class trace &t, const fs::path &output_dir, bool decompose_syscall,
+                         bool sweep_construction, bool validate_construction)
+    : persistence_graph(t, output_dir), decompose_syscall_(decompose_syscall),
+      sweep_construction_(sweep_construction), validate_construction_(validate_construction) {
     graph_ = construct_graph();
+    freeze_graph();
 }
 
 bool posix_graph::is_dependent(const persistence_node *a, const persistence_node *b) {
@@ -88,7 +88,7 @@ bool posix_graph::is_dependent(const persistence_node *a, const persistence_node
     if (eb->is_fsync()) {
         // any updates on the same file/dir should be persisted, we use both file path and fd to identify the file as fd can be reused
         // we assume per file fsync effect
-        if (ea->file_path != "" && ea->file_path == eb->file_path && ea->fd == eb->fd) {
+        if (ea->file_path != "" && ea->file_path_id == eb->file_path_id && ea->fd == eb->fd) {
             return true;
         }
         // rename and a sync on dir
@@ -102,7 +102,7 @@ bool posix_graph::is_dependent(const persistence_node *a, const persistence_node
         // any updates on the file will be persisted
         // TODO: does fdatasync affect ftruncate and fallocate -> I dont think so
         // we consider per file fdatasync effect
-        if ((ea->is_write_family() || eb->is_write_family()) && ea->file_path != "" && ea->file_path == eb->file_path && ea->fd == eb->fd) {
+        if ((ea->is_write_family() || eb->is_write_family()) && ea->file_path != "" && ea->file_path_id == eb->file_path_id && ea->fd == eb->fd) {
             return true;
         }
     }
@@ -118,7 +118,7 @@ bool posix_graph::is_dependent(const persistence_node *a, const persistence_node
     if (eb->is_sync_file_range()) {
         if (eb->flags & (SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER)) {
             // any updates on the file with same blocks will be persisted
-            if ((ea->is_write()) && ea->file_path != "" && ea->file_path == eb->file_path && ea->fd == eb->fd) {
+            if ((ea->is_write()) && ea->file_path != "" && ea->file_path_id == eb->file_path_id && ea->fd == eb->fd) {
                 assert(ea->block_ids && eb->block_ids);
                 pair<int, int> block_ids_a = *ea->block_ids;
                 pair<int, int> block_ids_b = *eb->block_ids;
@@ -156,17 +156,17 @@ bool posix_graph::is_dependent(const persistence_node *a, const persistence_node
     }
     if ((ea->is_open() && ea->flags & O_CREAT) || ea->is_creat()) {
         // if the file is created, then any subsequent events preceding the open/creat should be persisted
-        if (eb->file_path != "" && ea->file_path == eb->file_path) return true;
+        if (eb->file_path != "" && ea->file_path_id == eb->file_path_id) return true;
     }
     // D2: close should follow any previous call on this fd
     if (eb->is_close()) {
         if (eb->fd == ea->fd && eb->event_idx() > ea->event_idx()) return true;
     }
     // D3: to deal with open then close then open and possibly same fd, we add a close to open dependency for any same fd where timestamp of close is earlier than the timestamp of the second open
-    if (ea->is_close() && eb->is_open() && ea->fd == eb->fd && ea->file_path == eb->file_path && ea->event_idx() < eb->event_idx()) return true;
+    if (ea->is_close() && eb->is_open() && ea->fd == eb->fd && ea->file_path_id == eb->file_path_id && ea->event_idx() < eb->event_idx()) return true;
 
     // Ad-hoc D4: rename to a new file name should happen before the open to this file(
-    if (ea->is_rename() && eb->is_open() && ea->new_path == eb->file_path && ea->event_idx() < eb->event_idx()) return true; 
+    if (ea->is_rename() && eb->is_open() && ea->new_path_id == eb->file_path_id && ea->event_idx() < eb->event_idx()) return true; 
     // E: check dependencies arised from decomposed syscalls
     
 
@@ -185,7 +185,7 @@ bool posix_graph::is_dependent_decomposed(shared_ptr<trace_event> ea, shared_ptr
     // A: check block-overlapping updates
     // We do this outside of check for micro_events, as fallocate/ftruncate/sync_file_range may also have block ids and thus dependencies
     // Here we only check block id overlapping if they happen on the same file, without worrying about micro events actually
-    if (ea->block_ids && eb->block_ids && ea->file_path == eb->file_path) {
+    if (ea->block_ids && eb->block_ids && ea->file_path_id == eb->file_path_id) {
         pair<int, int> block_ids_a = *ea->block_ids;
         pair<int, int> block_ids_b = *eb->block_ids;
         result = is_block_ids_overlapping(block_ids_a, block_ids_b);
@@ -193,7 +193,7 @@ bool posix_graph::is_dependent_decomposed(shared_ptr<trace_event> ea, shared_ptr
 
     // if no micro events, then stop here
     if (ea->micro_events->empty() || eb->micro_events->empty()) return result;
-    if (ea->is_write_family() && eb->is_write_family() && ea->file_path == eb->file_path) {
+    if (ea->is_write_family() && eb->is_write_family() && ea->file_path_id == eb->file_path_id) {
 
         // B: check if eb is an extend
         for (const auto &me : *eb->micro_events) {
@@ -267,6 +267,271 @@ bool posix_graph::is_dependent_decomposed(shared_ptr<trace_event> ea, shared_ptr
     return result;
 }
 
+void posix_graph::add_pairwise_edges(graph_type &g) {
+    // enumerate over all pairs of nodes and add edges based on dependency
+    for (auto it1 = nodes_.begin(); it1 != nodes_.end(); ++it1) {
+        for (auto it2 = it1 + 1; it2 != nodes_.end(); ++it2) {
+            if (is_dependent(*it1, *it2)) {
+                boost::add_edge(vmap[(*it1)->event()], vmap[(*it2)->event()], g);
+            }
+        }
+    }
+}
+
+// Nodes that is_dependent orders before every later node.
+static bool is_forward_barrier(const trace_event &te) {
+    return te.is_fsync() || te.is_fdatasync() || te.is_sync() || te.is_syncfs() ||
+        (te.is_sync_file_range() && te.flags);
+}
+
+void posix_graph::add_sweep_edges(graph_type &g) {
+    typedef vector<size_t> node_list;
+    struct path_fd_hash {
+        size_t operator()(const pair<path_id, int> &k) const {
+            return std::hash<uint64_t>()(((uint64_t)k.first << 32) | (uint32_t)k.second);
+        }
+    };
+
+    /**
+     * Earlier non-barrier nodes, indexed by what the rules in is_dependent and
+     * is_dependent_decomposed match on. Where a rule is transitive (e.g., a
+     * close is ordered after everything on its fd, including the previous
+     * close), the index only keeps the newest node.
+     */
+    // A1, A2, A4: same path and fd as an fsync, fdatasync or sync_file_range.
+    unordered_map<pair<path_id, int>, node_list, path_fd_hash> by_path_fd;
+    // A1 (rename), C1, C2: parent directories an fsync orders.
+    unordered_map<string, node_list> by_parent_dir;
+    // D1: the newest open/creat of an fd.
+    unordered_map<int, size_t> open_by_fd;
+    // D1: the newest O_CREAT open/creat of a path.
+    unordered_map<path_id, size_t> create_by_path;
+    // D2: everything on an fd since its last close.
+    unordered_map<int, node_list> by_fd;
+    // D3: the newest close of an fd and path.
+    unordered_map<pair<path_id, int>, size_t, path_fd_hash> close_by_path_fd;
+    // D4: renames, by new path.
+    unordered_map<path_id, node_list> renames_by_new_path;
+    // is_dependent_decomposed, only for nodes outside LOG files.
+    unordered_map<path_id, node_list> blocks_by_path;
+    unordered_map<path_id, node_list> writes_by_path;
+    unordered_map<string, node_list> metadata_by_path, inode_data_by_path, add_inode_by_path;
+
+    // The last node ordered before everything after it, and the last sync,
+    // which everything before it is ordered before.
+    optional<size_t> last_barrier, last_sync;
+    // Nodes with an edge to a barrier already reach every later node.
+    vector<bool> retired(nodes_.size(), false);
+
+    vector<size_t> seen(nodes_.size(), SIZE_MAX);
+    node_list candidates;
+    size_t ndependent_checks = 0;
+
+    for (size_t j = 0; j < nodes_.size(); ++j) {
+        const trace_event &te = *nodes_[j]->event();
+        assert(vmap[nodes_[j]->event()] == j);
+
+        if (te.is_sync() || te.is_syncfs()) {
+            // Everything before the last sync already reaches it.
+            for (size_t i = last_sync.value_or(0); i < j; ++i) {
+                boost::add_edge(i, j, g);
+            }
+
+            last_barrier = j;
+            last_sync = j;
+            // Every indexed node now reaches any later node through this sync.
+            by_path_fd.clear();
+            by_parent_dir.clear();
+            open_by_fd.clear();
+            create_by_path.clear();
+            by_fd.clear();
+            close_by_path_fd.clear();
+            renames_by_new_path.clear();
+            blocks_by_path.clear();
+            writes_by_path.clear();
+            metadata_by_path.clear();
+            inode_data_by_path.clear();
+            add_inode_by_path.clear();
+            continue;
+        }
+
+        if (last_barrier) {
+            boost::add_edge(*last_barrier, j, g);
+        }
+
+        candidates.clear();
+        auto add_candidate = [&] (size_t i) {
+            if (!retired[i] && seen[i] != j) {
+                seen[i] = j;
+                candidates.push_back(i);
+            }
+        };
+        auto add_list = [&] (auto &index, const auto &key) {
+            auto it = index.find(key);
+            if (it == index.end()) return;
+            node_list &nodes = it->second;
+            nodes.erase(remove_if(nodes.begin(), nodes.end(),
+                [&] (size_t i) { return retired[i]; }), nodes.end());
+            for (size_t i : nodes) add_candidate(i);
+        };
+        auto add_newest = [&] (const auto &index, const auto &key) {
+            auto it = index.find(key);
+            if (it != index.end()) add_candidate(it->second);
+        };
+
+        bool decomposed = decompose_syscall_ && te.file_path.find("LOG") == string::npos;
+        bool has_metadata_update = false;
+
+        if (te.is_fsync() || te.is_fdatasync() ||
+            (te.is_sync_file_range() && (te.flags & (SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER)))) {
+            add_list(by_path_fd, make_pair(te.file_path_id, te.fd));
+        }
+        if (te.is_fsync()) {
+            add_list(by_parent_dir, te.file_path);
+        }
+        add_newest(open_by_fd, te.fd);
+        if (!te.file_path.empty()) {
+            add_newest(create_by_path, te.file_path_id);
+        }
+        if (te.is_close()) {
+            add_list(by_fd, te.fd);
+        }
+        if (te.is_open()) {
+            add_newest(close_by_path_fd, make_pair(te.file_path_id, te.fd));
+            add_list(renames_by_new_path, te.file_path_id);
+        }
+        if (decomposed) {
+            if (te.block_ids) {
+                add_list(blocks_by_path, te.file_path_id);
+            }
+            if (te.micro_events) {
+                for (const micro_event &me : *te.micro_events) {
+                    if (me.is_metadata_update()) {
+                        has_metadata_update = true;
+                        add_list(metadata_by_path, me.file_path);
+                    } else if (me.is_inode_data_update()) {
+                        add_list(inode_data_by_path, me.file_path);
+                    }
+                    if (me.is_metadata_update() || me.is_inode_data_update()) {
+                        add_list(add_inode_by_path, me.file_path);
+                    }
+                }
+            }
+            if (te.is_write_family() && has_metadata_update) {
+                add_list(writes_by_path, te.file_path_id);
+            }
+        }
+
+        bool barrier = is_forward_barrier(te);
+        for (size_t i : candidates) {
+            ++ndependent_checks;
+            if (is_dependent(nodes_[i], nodes_[j])) {
+                boost::add_edge(i, j, g);
+                if (barrier) retired[i] = true;
+            }
+        }
+
+        if (barrier) {
+            // Reaches every later node through the barrier chain.
+            last_barrier = j;
+            continue;
+        }
+
+        // Index this node. Lists that a rule orders transitively restart here,
+        // since every node in them now has an edge to this one.
+        if (!te.file_path.empty()) {
+            by_path_fd[make_pair(te.file_path_id, te.fd)].push_back(j);
+        }
+        if (te.is_fallocate() || te.is_ftruncate() || te.is_unlink() || te.is_rename()) {
+            by_parent_dir[get_dir_name(te.file_path)].push_back(j);
+        }
+        if (te.is_rename()) {
+            by_parent_dir[get_dir_name(te.new_path)].push_back(j);
+            by_parent_dir[get_dir_name(te.old_path)].push_back(j);
+            renames_by_new_path[te.new_path_id].push_back(j);
+        }
+        if (te.is_open() || te.is_creat()) {
+            open_by_fd[te.fd] = j;
+            if (((te.is_open() && te.flags & O_CREAT) || te.is_creat()) && !te.file_path.empty()) {
+                create_by_path[te.file_path_id] = j;
+            }
+        }
+        if (te.is_close()) {
+            by_fd[te.fd] = {j};
+            close_by_path_fd[make_pair(te.file_path_id, te.fd)] = j;
+        } else {
+            by_fd[te.fd].push_back(j);
+        }
+        if (decomposed) {
+            if (te.block_ids) {
+                blocks_by_path[te.file_path_id].push_back(j);
+            }
+            if (te.micro_events && !te.micro_events->empty()) {
+                if (te.is_write_family()) {
+                    node_list &writes = writes_by_path[te.file_path_id];
+                    if (has_metadata_update) writes.clear();
+                    writes.push_back(j);
+                }
+                for (const micro_event &me : *te.micro_events) {
+                    node_list *nodes = nullptr;
+                    if (me.is_metadata_update()) {
+                        nodes = &metadata_by_path[me.file_path];
+                        if (!nodes->empty() && nodes->back() != j) nodes->clear();
+                    } else if (me.is_inode_data_update()) {
+                        nodes = &inode_data_by_path[me.file_path];
+                        if (!nodes->empty() && nodes->back() != j) nodes->clear();
+                    } else if (me.is_add_file_inode() || me.is_add_dir_inode()) {
+                        nodes = &add_inode_by_path[me.file_path];
+                    }
+                    if (nodes && (nodes->empty() || nodes->back() != j)) nodes->push_back(j);
+                }
+            }
+        }
+    }
+
+    cout << "Sweep graph construction: " << nodes_.size() << " nodes, "
+        << boost::num_edges(g) << " edges, " << ndependent_checks << " dependency checks" << endl;
+}
+
+void posix_graph::validate_sweep_edges(void) {
+    graph_type pairwise;
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+        boost::add_vertex(pairwise);
+    }
+    add_pairwise_edges(pairwise);
+
+    // All edges point forward, so the closure can be built back to front.
+    auto closure = [&] (const graph_type &g) {
+        vector<boost::dynamic_bitset<>> reach(nodes_.size(), boost::dynamic_bitset<>(nodes_.size()));
+        for (size_t v = nodes_.size(); v-- > 0; ) {
+            boost::graph_traits<graph_type>::adjacency_iterator ai, ai_end;
+            for (boost::tie(ai, ai_end) = boost::adjacent_vertices(v, g); ai != ai_end; ++ai) {
+                assert(*ai > v);
+                reach[v].set(*ai);
+                reach[v] |= reach[*ai];
+            }
+        }
+        return reach;
+    };
+
+    vector<boost::dynamic_bitset<>> expected = closure(pairwise);
+    vector<boost::dynamic_bitset<>> actual = closure(graph_);
+    for (size_t v = 0; v < nodes_.size(); ++v) {
+        if (expected[v] != actual[v]) {
+            boost::dynamic_bitset<> diff = expected[v] ^ actual[v];
+            size_t u = diff.find_first();
+            cerr << "Sweep graph construction differs from all pairs: node " << v
+                << " (event " << nodes_[v]->event()->event_idx() << ") "
+                << (expected[v].test(u) ? "should" : "should not") << " reach node " << u
+                << " (event " << nodes_[u]->event()->event_idx() << ")" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    cout << "Sweep graph construction validated: same transitive closure as all pairs ("
+        << boost::num_edges(graph_) << " vs " << boost::num_edges(pairwise) << " edges)" << endl;
+}
+
 graph_type posix_graph::construct_graph() {
     // 1. Create all the nodes.
     nodes_ = create_nodes();
@@ -278,13 +543,13 @@ graph_type posix_graph::construct_graph() {
         vmap[node->event()] = v;
     }
 
-    // enumerate over all pairs of nodes and add edges based on dependency
-    for (auto it1 = nodes_.begin(); it1 != nodes_.end(); ++it1) {
-        for (auto it2 = it1 + 1; it2 != nodes_.end(); ++it2) {
-            if (is_dependent(*it1, *it2)) {
-                boost::add_edge(vmap[(*it1)->event()], vmap[(*it2)->event()], graph_);
-            }
+    if (sweep_construction_) {
+        add_sweep_edges(graph_);
+        if (validate_construction_) {
+            validate_sweep_edges();
         }
+    } else {
+        add_pairwise_edges(graph_);
     }
 
     // // 2. Traverse through the events tracking fsyncs/fdatasyncs/msyncs to add edges.
@@ -580,8 +845,7 @@ tuple<graph_type*, vertex, unordered_map<vertex, vertex>> posix_graph::generate_
         shared_ptr<trace_event> te = new_node->event();
         for (auto it = new_to_old.begin(); it != new_to_old.end(); ++it) {
             vertex old_v = it->second;
-            const posix_node *old_node = dynamic_cast<const posix_node*>(boost::get(boost::get(pnode_property_t(), graph_), old_v));
-            if (old_node->event() == te) {
+            if (csr_.event(old_v) == te) {
                 new_to_old_updated[new_v] = old_v;
                 break;
             }
@@ -15,6 +15,10 @@ public:
 class posix_graph: public persistence_graph {
 private:
     bool decompose_syscall_;
+    // Build edges with one indexed pass over the trace instead of all pairs.
+    bool sweep_construction_;
+    // Check that both constructions have the same transitive closure.
+    bool validate_construction_;
     /**
      * Constructs the graph nodes with type information.
      */
@@ -31,6 +35,27 @@ private:
     */
     bool is_dependent_decomposed(std::shared_ptr<trace_event> ea, std::shared_ptr<trace_event> eb);
 
+    /**
+     * Add an edge for every pair of nodes that is_dependent orders. O(n^2).
+     */
+    void add_pairwise_edges(graph_type &g);
+
+    /**
+     * Add edges in one pass over the nodes, with the same transitive closure
+     * as add_pairwise_edges. Each node is only checked with is_dependent
+     * against earlier nodes that share a path, fd, parent directory or
+     * micro-event path. Nodes that order everything after them (fsync,
+     * fdatasync, sync, ...) only get an edge to each node up to the next such
+     * node. Nodes ordered before one of them are never checked again.
+     */
+    void add_sweep_edges(graph_type &g);
+
+    /**
+     * Exit if the graph does not have the same transitive closure as the
+     * all-pairs construction. Needs O(n^2) bits, so only for small traces.
+     */
+    void validate_sweep_edges(void);
+
     /**
      * Construct all ordering relationships.
      */
@@ -39,7 +64,8 @@ private:
     std::tuple<graph_type*, vertex, std::unordered_map<vertex, vertex>> generate_subgraph(std::vector<vertex> vertex_list);
 
 public:
-    posix_graph(const trace &t, const boost::filesystem::path &output_dir, bool decompose_syscall);
+    posix_graph(const trace &t, const boost::filesystem::path &output_dir, bool decompose_syscall,
+                bool sweep_construction = false, bool validate_construction = false);
 };
 
 
@@ -68,6 +68,8 @@ static po::options_description get_config_file_opt(const fs::path &config_path)
             "results file output path (templated)")
         ("general.max_nproc", po::value<int>()->default_value(nthreads / 2),
             "max number of threads to use")
+        ("general.test_queue_size", po::value<int>()->default_value(0),
+            "max number of tests waiting for a free worker, so workers stay busy between batches. 0 for max_nproc")
         ("general.output_to_tmpfs", po::value<bool>()->default_value(false),
             "output results to TMPFS, then move to permanent storage at the end")
         ("general.use_induced_subgraph", po::value<bool>()->default_value(false),
@@ -107,18 +109,53 @@ static po::options_description get_config_file_opt(const fs::path &config_path)
         ("general.op_tracing", po::value<bool>()->default_value(false),
             "trace operations in the workload that are completed and inform the checker, this is for checker that does advanced verification")
         ("general.decompose_syscall", po::value<bool>()->default_value(true), "decompose syscalls into micro events")
+        ("general.posix_graph_sweep", po::value<bool>()->default_value(false),
+            "build the POSIX persistence graph in one indexed pass instead of checking all pairs of events. Same transitive closure and the same subgraph orderings, far fewer edges")
+        ("general.validate_posix_graph", po::value<bool>()->default_value(false),
+            "with posix_graph_sweep, also build the all-pairs graph and exit if the transitive closures differ (small traces only)")
+        ("general.pm_graph_frontier", po::value<bool>()->default_value(false),
+            "only add edges from the frontier of clean stores when building the PM persistence graph. Same reachability, linear instead of quadratic edges")
+        ("general.reachability_labels", po::value<int>()->default_value(2),
+            "number of interval labelings in the reachability index for PM graph path queries, 0 to always search the graph")
+        ("general.benchmark_has_path", po::value<int>()->default_value(0),
+            "time this many random PM graph path queries with and without the reachability index, and check they agree")
         ("general.count_crash_state", po::value<bool>()->default_value(false), "count number of crash states tested and number of crash states being represented")
         ("general.max_um_size", po::value<int>()->default_value(40),
             "max number of events in an update mechanism that will be model checked")
+        ("general.order_queue_size", po::value<int>()->default_value(256),
+            "POSIX: max number of crash states generated ahead of the model checker")
+        ("general.prefix_snapshots", po::value<int>()->default_value(0),
+            "POSIX: max number of trace prefix states kept, so tests restore the nearest one instead of replaying the trace from the start. 0 to disable")
+        ("general.prefix_snapshot_interval", po::value<int>()->default_value(1000),
+            "POSIX: with prefix_snapshots, also snapshot every this many events")
+        ("general.pmdir_snapshot", po::value<string>()->default_value("auto"),
+            "how to back up the pmdir around each test: reflink (FICLONE), layered (only recopy changed files), copy (copy_file_range), or auto to pick by file system")
+        ("general.result_db", po::value<string>()->default_value(""),
+            "PM: file that keeps representative test outcomes across runs; representatives found consistent before are skipped. Keep it outside the output directory. Empty to disable")
 
         // tracing settings (i.e., pmemcheck / Pin tool)
         // --- options
         ("trace.verbose", po::value<bool>()->default_value(false), "print process output")
+        ("trace.stream", po::value<bool>()->default_value(false),
+            "POSIX/MMIO mode: parse the Pin trace from a pipe while the workload runs, instead of from a file after it exits")
+        ("trace.stream_reorder_window", po::value<int>()->default_value(1 << 16),
+            "with trace.stream, how many records to hold back to put them in timestamp order. Threads finish their records out of order")
         ("trace.trace_path", po::value<string>()->default_value(""), "skip trace generation and use offline trace specified by the path")
         ("trace.root_dir", po::value<string>()->default_value(""), "root dir used in offline trace, useful for pathfinder to derive file and dir relations between workload and checker")
+        ("trace.parse_threads", po::value<int>()->default_value(nthreads),
+            "number of parser threads used when reading the trace")
+        ("trace.benchmark_ingest", po::value<bool>()->default_value(false),
+            "with an offline trace_path, report trace loading throughput for 1 and trace.parse_threads parser threads, check both loads agree, then exit")
+        ("trace.save_binary_trace", po::value<bool>()->default_value(false),
+            "also save the parsed trace as tracer.ptrace in the output dir, which can be passed as trace_path to skip text parsing in later runs")
+        ("trace.convert_binary_trace", po::value<bool>()->default_value(false),
+            "with an offline text trace_path, save it as tracer.ptrace in the output dir like trace.save_binary_trace, then exit")
         // --- templated
         ("trace.cmd_tmpl", po::value<string>(), "program + args (required). If daemon is not set, this is traced")
         ("trace.daemon_tmpl", po::value<string>()->default_value(""), "path to daemon program + args (templated)")
+        ("trace.daemon_ready_tmpl", po::value<string>()->default_value(""),
+            "how to tell the traced daemon is up: tcp:HOST:PORT, unix:PATH, file:PATH or probe:COMMAND (templated). Empty to wait 10 seconds")
+        ("trace.daemon_ready_timeout", po::value<int>()->default_value(60), "max seconds to wait for trace.daemon_ready_tmpl")
         ("trace.setup_tmpl", po::value<string>()->default_value(""), "command for test setup, run once (templated)")
         ("trace.setup_daemon_tmpl", po::value<string>()->default_value(""), "command for test setup, run once (templated)")
         ("trace.cleanup_tmpl", po::value<string>()->default_value(""), "command for test setup, run once (templated)")
@@ -128,9 +165,15 @@ static po::options_description get_config_file_opt(const fs::path &config_path)
         // --- non-templated
         ("test.timeout", po::value<int>()->default_value(30), "timeout per check in seconds (default=30)")
         ("test.save_pm_images", po::value<bool>()->default_value(false), "save the compressed PM images for offline debugging")
+        ("test.daemon_ready_timeout", po::value<int>()->default_value(30), "max seconds to wait for test.daemon_ready_tmpl")
+        ("test.forkserver", po::value<bool>()->default_value(false), "start the checker program once and fork it for every test, instead of running it from scratch (dynamically linked checkers only)")
+        ("test.result_cache", po::value<bool>()->default_value(false), "skip the checker for crash states byte-identical to one already checked, reusing its result (assumes a deterministic checker)")
+        ("test.incremental_checkpoints", po::value<bool>()->default_value(false), "PM/MMIO: after each test only copy back the cache lines that changed, instead of whole mapped files")
         // --- templated
         ("test.checker_tmpl", po::value<string>(), "path to validation program + args (templated)")
         ("test.daemon_tmpl", po::value<string>()->default_value(""), "path to daemon program + args (templated)")
+        ("test.daemon_ready_tmpl", po::value<string>()->default_value(""),
+            "how to tell the test daemon is up: tcp:HOST:PORT, unix:PATH, file:PATH, stdout:MARKER or probe:COMMAND (templated). Empty to wait 5 seconds")
         ("test.setup_tmpl", po::value<string>()->default_value(""), "command for test setup, run once (templated)")
         ("test.cleanup_tmpl", po::value<string>()->default_value(""), "command for test setup, run once (templated)")
     ;
@@ -0,0 +1,225 @@
+#include "forkserver.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <boost/process/extend.hpp>
+
+#include <fstream>
+#include <iostream>
+
+#include "../utils/common.hpp"
+#include "../utils/util.hpp"
+
+namespace bp = boost::process;
+using namespace std;
+using namespace std::chrono;
+
+namespace pathfinder {
+
+// max time for the server to get to main
+#define FORKSERVER_START_TIMEOUT_MS 10000
+
+// Receive one int32 from the server, waiting at most timeout_ms (-1 forever)
+static bool recv_int(int fd, int32_t &v, int timeout_ms) {
+    pollfd pfd = {fd, POLLIN, 0};
+    int r;
+    do {
+        r = poll(&pfd, 1, timeout_ms);
+    } while (r < 0 && errno == EINTR);
+    if (r != 1) return false;
+    return recv(fd, &v, sizeof(v), 0) == sizeof(v);
+}
+
+forkserver::forkserver(const string &program) {
+    int fds[2];
+    // both ends close on exec, so other children started meanwhile by other
+    // threads cannot inherit them; only the server gets its end, below
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds)) return;
+    ctl_ = fds[0];
+
+    auto env = get_pm_env();
+    string preload = FORKSERVER_SHIM_PATH;
+    if (env.count("LD_PRELOAD")) preload += ":" + env["LD_PRELOAD"].to_string();
+    env["LD_PRELOAD"] = preload;
+    env["PATHFINDER_FORKSERVER_FD"] = to_string(fds[1]);
+
+    try {
+        // children write to the fds of each request, not to these
+        const int server_fd = fds[1];
+        server_ = bp::child(bp::args(list<string>{program}), env,
+            bp::std_out > bp::null, bp::std_err > bp::null,
+            bp::extend::on_exec_setup = [server_fd](auto &) {
+                fcntl(server_fd, F_SETFD, 0);
+            });
+    } catch (const bp::process_error &e) {
+        close(fds[1]);
+        return;
+    }
+    close(fds[1]);
+
+    int32_t hello;
+    alive_ = recv_int(ctl_, hello, FORKSERVER_START_TIMEOUT_MS) && hello == 0;
+}
+
+forkserver::~forkserver() {
+    if (ctl_ != -1) close(ctl_);
+    // the server exits once the socket is closed
+    if (server_.valid() && server_.running()) {
+        if (!server_.wait_for(milliseconds(100))) {
+            server_.terminate();
+        }
+    }
+}
+
+int forkserver::run(const list<string> &args, string &output, seconds timeout) {
+    if (!alive_) return -1;
+
+    string request;
+    for (const auto &a : args) {
+        request += a;
+        request.push_back('\0');
+    }
+
+    int out[2], err[2];
+    if (pipe2(out, O_CLOEXEC)) return -1;
+    if (pipe2(err, O_CLOEXEC)) {
+        close(out[0]);
+        close(out[1]);
+        return -1;
+    }
+
+    char control[CMSG_SPACE(2 * sizeof(int))] = {};
+    iovec iov = {(void*)request.data(), request.size()};
+    msghdr msg = {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr *c = CMSG_FIRSTHDR(&msg);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    int child_fds[2] = {out[1], err[1]};
+    memcpy(CMSG_DATA(c), child_fds, sizeof(child_fds));
+
+    bool sent = sendmsg(ctl_, &msg, MSG_NOSIGNAL) == (ssize_t)request.size();
+    close(out[1]);
+    close(err[1]);
+    int32_t pid = -1;
+    if (!sent || !recv_int(ctl_, pid, FORKSERVER_START_TIMEOUT_MS) || pid <= 0) {
+        close(out[0]);
+        close(err[0]);
+        alive_ = false;
+        return -1;
+    }
+
+    // Collect output until the child closes both pipes, killing it on timeout
+    string outs, errs;
+    pollfd pfds[2] = {{out[0], POLLIN, 0}, {err[0], POLLIN, 0}};
+    const auto deadline = steady_clock::now() + timeout;
+    bool killed = false;
+    while (pfds[0].fd != -1 || pfds[1].fd != -1) {
+        auto left = duration_cast<milliseconds>(deadline - steady_clock::now());
+        if (left.count() <= 0 && !killed) {
+            kill(pid, SIGKILL);
+            killed = true;
+        }
+        // anything the checker started may still hold the pipes open
+        int r = poll(pfds, 2, killed ? 1000 : left.count());
+        if ((r < 0 && errno != EINTR) || (r == 0 && killed)) break;
+        for (int i = 0; i < 2; ++i) {
+            if (pfds[i].fd == -1 || !pfds[i].revents) continue;
+            char buf[4096];
+            ssize_t n = read(pfds[i].fd, buf, sizeof(buf));
+            if (n > 0) {
+                (i == 0 ? outs : errs).append(buf, n);
+            } else if (n == 0 || errno != EINTR) {
+                close(pfds[i].fd);
+                pfds[i].fd = -1;
+            }
+        }
+    }
+    for (auto &p : pfds) {
+        if (p.fd != -1) close(p.fd);
+    }
+
+    // the checker may have closed its pipes and still be running
+    int32_t status;
+    bool got = false;
+    if (!killed) {
+        auto left = duration_cast<milliseconds>(deadline - steady_clock::now());
+        got = recv_int(ctl_, status, max(left.count(), (milliseconds::rep)0));
+        if (!got) {
+            kill(pid, SIGKILL);
+            killed = true;
+        }
+    }
+    if (!got && !recv_int(ctl_, status, FORKSERVER_START_TIMEOUT_MS)) {
+        alive_ = false;
+        return -1;
+    }
+
+    output = format_command_output(outs, errs);
+
+    if (WIFEXITED(status)) return WEXITSTATUS(status);
+    if (WIFSIGNALED(status)) return WTERMSIG(status);
+    return status;
+}
+
+// The shim hooks the C runtime's entry point, so it only works on
+// dynamically linked programs, not on scripts
+static bool can_serve(const string &program) {
+    ifstream f(program, ios::binary);
+    char magic[4] = {};
+    f.read(magic, sizeof(magic));
+    return f && !memcmp(magic, "\x7f" "ELF", 4);
+}
+
+int forkserver_pool::run(const list<string> &args, string &output, seconds timeout) {
+    const string &program = args.front();
+
+    unique_ptr<forkserver> server;
+    {
+        lock_guard<mutex> lock(mtx_);
+        if (unsupported_.count(program)) return run_command(args, output, timeout);
+        auto &idle = idle_[program];
+        if (!idle.empty()) {
+            server = std::move(idle.back());
+            idle.pop_back();
+        }
+    }
+
+    if (!server) {
+        if (!can_serve(program)) {
+            lock_guard<mutex> lock(mtx_);
+            unsupported_.insert(program);
+            return run_command(args, output, timeout);
+        }
+        server.reset(new forkserver(program));
+        if (!server->alive()) {
+            cerr << "Fork server did not start for " << program << ", running it directly\n";
+            lock_guard<mutex> lock(mtx_);
+            unsupported_.insert(program);
+            return run_command(args, output, timeout);
+        }
+    }
+
+    int ret = server->run(args, output, timeout);
+    if (ret == -1 && !server->alive()) {
+        // the server died, do this one the slow way and start over next time
+        return run_command(args, output, timeout);
+    }
+
+    lock_guard<mutex> lock(mtx_);
+    idle_[program].push_back(std::move(server));
+    return ret;
+}
+
+}
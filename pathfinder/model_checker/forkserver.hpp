@@ -0,0 +1,61 @@
+#pragma once
+
+#include <boost/process.hpp>
+#include <chrono>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+namespace pathfinder {
+
+/**
+ * @brief A checker program started once under the fork server shim, which
+ * forks a fresh copy of it, stopped right before main, for every run.
+ *
+ * See forkserver/forkserver_shim.c for the protocol.
+ */
+class forkserver {
+    boost::process::child server_;
+    // our end of the control socket
+    int ctl_ = -1;
+    bool alive_ = false;
+
+public:
+    /**
+     * @brief Start program under the shim and wait until it serves requests.
+     * Check alive() to see if that worked.
+     */
+    explicit forkserver(const std::string &program);
+    ~forkserver();
+
+    bool alive(void) const { return alive_; }
+
+    /**
+     * @brief Like run_command(args, output, timeout), but forks the checker
+     * from the server instead of starting it from scratch.
+     *
+     * @return int The exit code, or the signal that killed it. -1 if the
+     * server is gone, in which case nothing was run.
+     */
+    int run(const std::list<std::string> &args, std::string &output, std::chrono::seconds timeout);
+};
+
+/**
+ * @brief Fork servers shared by concurrent tests, one per test in flight and
+ * checker program. Falls back to run_command for programs the shim cannot
+ * serve, e.g. scripts or static binaries.
+ */
+class forkserver_pool {
+    std::mutex mtx_;
+    std::map<std::string, std::vector<std::unique_ptr<forkserver>>> idle_;
+    std::set<std::string> unsupported_;
+
+public:
+    int run(const std::list<std::string> &args, std::string &output, std::chrono::seconds timeout);
+};
+
+}
@@ -69,6 +69,8 @@ model_checker_state* model_checker::initialize_state(
     state->cleanup_args = cleanup_args;
     state->setup_args = setup_args;
     state->save_file_images = save_pm_images;
+    state->incremental_checkpoints = incremental_checkpoints;
+    state->pmdir_snapshot = pmdir_snapshot;
     state->timeout = timeout_;
     state->baseline_timeout = baseline_timeout;
     state->start_time = start_time;
@@ -76,6 +78,9 @@ model_checker_state* model_checker::initialize_state(
     state->mode_ = mode_;
     state->op_tracing_ = op_tracing_;
     state->persevere_ = persevere_;
+    state->prefix_snapshots = prefix_snapshots;
+    state->forkservers = forkservers;
+    state->cached_results = cached_results;
 
     // Setup init data
     // TODO: implement for new pmdir stuff
@@ -154,36 +159,49 @@ shared_ptr<model_checker_state> model_checker::create_state(
     return shared_ptr<model_checker_state>(state);
 }
 
+test_scheduler &model_checker::scheduler(void) {
+    if (!scheduler_) {
+        scheduler_.reset(new test_scheduler(max_nproc,
+            test_queue_size > 0 ? test_queue_size : max_nproc));
+    }
+    return *scheduler_;
+}
+
 shared_future<model_checker_code> model_checker::run_test(
-    shared_ptr<model_checker_state> state) {
+    shared_ptr<model_checker_state> state, test_priority priority) {
+
+    auto p = make_shared<promise<model_checker_code>>();
+    shared_future<model_checker_code> f = p->get_future().share();
 
-    promise<model_checker_code> p;
-    shared_future<model_checker_code> f = p.get_future().share();
+    // the task keeps the state alive until the test is done
+    function<void()> run;
     if (mode_ == POSIX) {
         if (state->all_event_orders.empty()) {
-            thread t(&model_checker_state::run_posix, state.get(), std::move(p));
-            threads_.push_back(std::move(t));
+            run = [state, p] { state->run_posix(std::move(*p)); };
         }
         else {
-            thread t(&model_checker_state::run_posix_with_orders, state.get(), std::move(p));
-            threads_.push_back(std::move(t));
+            run = [state, p] { state->run_posix_with_orders(std::move(*p)); };
         }
     }
     else {
-        thread t(&model_checker_state::run_pm, state.get(), std::move(p));
-        threads_.push_back(std::move(t));
+        run = [state, p] { state->run_pm(std::move(*p)); };
     }
 
+    scheduler().submit(priority, run, [p] {
+        p->set_exception(make_exception_ptr(runtime_error("test cancelled")));
+    });
+
     return f;
 }
 
 shared_future<model_checker_code> model_checker::run_sanity_test(
     shared_ptr<model_checker_state> state) {
 
-    promise<model_checker_code> p;
-    shared_future<model_checker_code> f = p.get_future().share();
-    thread t(&model_checker_state::run_sanity_check, state.get(), std::move(p));
-    threads_.push_back(std::move(t));
+    auto p = make_shared<promise<model_checker_code>>();
+    shared_future<model_checker_code> f = p->get_future().share();
+    scheduler().submit(REPRESENTATIVE_TEST,
+        [state, p] { state->run_sanity_check(std::move(*p)); },
+        [p] { p->set_exception(make_exception_ptr(runtime_error("test cancelled"))); });
     return f;
 }
 
@@ -261,26 +279,20 @@ model_checker::model_checker(const trace &t, fs::path outdir, chrono::seconds ti
     }
 }
 
-void model_checker::join(void) {
-    for (auto &t : threads_) {
-        if (t.joinable()) {
-            t.join();
-        }
-    }
+uint64_t model_checker::tests_completed(void) {
+    return scheduler_ ? scheduler_->num_completed() : 0;
 }
 
-void model_checker::kill(void) {
-    for (thread &t : threads_) {
-        auto pthread_handle = t.native_handle();
+void model_checker::wait_for_tests(uint64_t seen) {
+    if (scheduler_) scheduler_->wait_completed(seen);
+}
 
-        if (pthread_handle != 0) {
-            pthread_cancel(pthread_handle);
-        }
+void model_checker::join(void) {
+    if (scheduler_) scheduler_->wait_idle();
+}
 
-        if (t.joinable()) {
-            t.join();
-        }
-    }
+void model_checker::kill(void) {
+    if (scheduler_) scheduler_->kill();
 }
 
 }  // namespace pathfinder
\ No newline at end of file
@@ -16,6 +16,7 @@
 #include <sched.h>
 
 #include "model_checker_state.hpp"
+#include "test_scheduler.hpp"
 #include "../graph/persistence_graph.hpp"
 #include "../graph/pm_graph.hpp"
 #include "../graph/posix_graph.hpp"
@@ -36,7 +37,8 @@ class model_checker {
     const trace &trace_;
     const persistence_graph *pg_;
     boost::filesystem::path output_dir_;
-    std::list<std::thread> threads_;
+    // created on the first test, with max_nproc workers
+    std::unique_ptr<test_scheduler> scheduler_;
     test_type ttype_;
     pathfinder_mode mode_;
     bool op_tracing_;
@@ -46,6 +48,8 @@ class model_checker {
 
     std::shared_ptr<std::mutex> stdout_mutex_;
 
+    test_scheduler &scheduler(void);
+
     /**
      * @brief Dump the trace information for all the trace events into a CSV
      * file in the output directory.
@@ -70,8 +74,20 @@ class model_checker {
 public:
     // TODO: this is error-pruning as users may forget to set the fields, should remove and set using constructor
     bool save_pm_images = false;
+    bool incremental_checkpoints = false;
+    std::string pmdir_snapshot = "auto";
     std::vector<char> init_data;
     std::chrono::minutes baseline_timeout;
+    // For POSIX. Prefix snapshots shared by all tests, none if null
+    std::shared_ptr<prefix_cache> prefix_snapshots;
+    // Fork servers for the checker program, run it directly if null
+    std::shared_ptr<forkserver_pool> forkservers;
+    // Checker results by crash state, none cached if null
+    std::shared_ptr<result_cache> cached_results;
+    // number of tests run at once
+    int max_nproc = 1;
+    // number of tests that may wait for a worker, 0 for max_nproc
+    int test_queue_size = 0;
 
     model_checker(const trace &t, boost::filesystem::path outdir, std::chrono::seconds timeout=std::chrono::seconds(30), const persistence_graph *pg=nullptr, test_type ttype=PATHFINDER, pathfinder_mode mode=PM, bool op_tracing=false,bool persevere=false);
 
@@ -112,15 +128,34 @@ public:
         jinja2::ValuesMap pmcheck_vals,
         std::chrono::time_point<std::chrono::system_clock> start_time);
 
+    /**
+     * @brief Queue a test on the worker pool. Blocks while the queue is full.
+     * If the test is cancelled before it runs, its future holds an exception.
+     */
     std::shared_future<model_checker_code> run_test(
-        std::shared_ptr<model_checker_state> state);
+        std::shared_ptr<model_checker_state> state,
+        test_priority priority=REPRESENTATIVE_TEST);
 
     std::shared_future<model_checker_code> run_sanity_test(
         std::shared_ptr<model_checker_state> state);
 
+    // number of tests finished so far
+    uint64_t tests_completed(void);
+    // block until more than seen tests have finished, or none are left
+    void wait_for_tests(uint64_t seen);
+
+    // wait for all queued and running tests
     void join(void);
     void kill(void);
 
+    /**
+     * @brief Max number of tests queued or running at once. Callers that keep
+     * their own list of pending tests should not let it grow beyond this.
+     */
+    size_t capacity(void) const {
+        return max_nproc + (test_queue_size > 0 ? test_queue_size : max_nproc);
+    }
+
     int get_current_test_id(void) {
         
         return next_id_ - 1;
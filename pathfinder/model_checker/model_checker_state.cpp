@@ -1,4 +1,5 @@
 #include "model_checker_state.hpp"
+#include "result_cache.hpp"
 
 #include <algorithm>
 #include <cassert>
@@ -15,7 +16,12 @@
 #include <vector>
 #include <iomanip>
 #include <errno.h>
+#include <fcntl.h>
+#include <linux/magic.h>
+#include <sys/stat.h>
+#include <sys/vfs.h>
 
+#include <boost/algorithm/string/replace.hpp>
 #include <boost/archive/iterators/base64_from_binary.hpp>
 #include <boost/archive/iterators/insert_linebreaks.hpp>
 #include <boost/archive/iterators/ostream_iterator.hpp>
@@ -53,6 +59,9 @@ using namespace std;
 
 #define DEBUG_PRINTS 0
 
+// Granularity of incremental checkpoints
+#define DIRTY_LINE_SIZE 64
+
 // whether to output possible ordering generated for debugging
 #define OUTPUT_ORDERINGS 1
 
@@ -141,6 +150,24 @@ void dump_test_result_locked(mutex &m, fs::path resfile,
     }
 }
 
+/**
+ * @brief Whether the file system of path updates the mtime on the first write
+ * through a shared mapping, which is how checker writes to PM files are seen.
+ * tmpfs, for one, does not.
+ */
+static bool mmap_writes_update_mtime(const string &path) {
+    struct statfs sfs;
+    if (statfs(path.c_str(), &sfs)) return false;
+    switch (sfs.f_type) {
+        case EXT4_SUPER_MAGIC:
+        case XFS_SUPER_MAGIC:
+        case BTRFS_SUPER_MAGIC:
+            return true;
+        default:
+            return false;
+    }
+}
+
 fs::path model_checker_state::construct_outdir_path(
         int perm_id, string suffix) const {
 
@@ -221,6 +248,7 @@ bool model_checker_state::do_store(shared_ptr<trace_event> te) {
 
     if (translated) {
         memcpy(translated, (void*)te->value_bytes.data(), te->value_bytes.size());
+        mark_dirty((uintptr_t)translated, te->value_bytes.size());
     } else {
         cerr << "Store "<< te->store_id() << " address is not translated :( \n";
         exit(EXIT_FAILURE);
@@ -1070,6 +1098,7 @@ model_checker_code model_checker_state::test_exhaustive_orderings(
         fs::remove_all(backup_dir);
         error_if_exists(backup_dir);
     }
+    snapshots_.reset();
 
 
     #if DEBUG_PRINTS
@@ -1243,6 +1272,7 @@ model_checker_code model_checker_state::test_linear_orderings(
         fs::remove_all(backup_dir);
         error_if_exists(backup_dir);
     }
+    snapshots_.reset();
 
     BOOST_ASSERT(init_checkpoints == num_checkpoints());
 
@@ -1391,9 +1421,71 @@ void model_checker_state::record_file_images(test_result &res) {
     }
 }
 
+bool model_checker_state::crash_state_key(content_hasher::digest_t &key) {
+    const auto start = steady_clock::now();
+    content_hasher h;
+
+    // The commands name this test's own pmdir and files
+    auto add_args = [&] (const list<string> &args) {
+        h.update((uint64_t)args.size());
+        for (string arg : args) {
+            if (!pmdir.empty()) {
+                boost::replace_all(arg, pmdir.string(), "{{pmdir}}");
+            }
+            for (const auto &p : pmfile_map) {
+                boost::replace_all(arg, p.second.string(), "{{" + p.first + "}}");
+            }
+            h.update(arg);
+        }
+    };
+    add_args(checker_args);
+    add_args(daemon_args);
+
+    bool hashed = true;
+    if (!pmdir.empty()) {
+        hashed = h.update_tree(pmdir);
+    } else {
+        map<string, fs::path> files(pmfile_map.begin(), pmfile_map.end());
+        for (const auto &p : files) {
+            h.update(p.first);
+            hashed = hashed && h.update_file(p.second);
+        }
+    }
+
+    cached_results->record_hash_time(steady_clock::now() - start, hashed);
+    if (hashed) key = h.digest();
+    return hashed;
+}
+
 test_result model_checker_state::run_checker(void) {
     test_result res;
 
+    content_hasher::digest_t key;
+    const bool keyed = cached_results && crash_state_key(key);
+    if (keyed && cached_results->lookup(key, res)) {
+        res.output = "[PATHFINDER] same crash state as an earlier test, reusing its result\n" + res.output;
+        // the cache keeps no images; these are this test's own files
+        if (save_file_images) {
+            record_file_images(res);
+        }
+        return res;
+    }
+
+    // The checker runs on the same PM files, and its writes do not go through
+    // do_store. Back-date the files first: if the mtime moves, it wrote.
+    const timespec sentinel[2] = {{1, 0}, {1, 0}};
+    vector<string> watched;
+    if (incremental_checkpoints) {
+        for (const auto &p : file_memory_regions_) {
+            if (mmap_writes_update_mtime(p.first) &&
+                !utimensat(AT_FDCWD, p.first.c_str(), sentinel, 0)) {
+                watched.push_back(p.first);
+            } else {
+                mark_unknown_writes(p.first);
+            }
+        }
+    }
+
 // debugging info
 #if 1
     if (!daemon_args.empty()) {
@@ -1402,7 +1494,13 @@ test_result model_checker_state::run_checker(void) {
         bp::child d = start_command(daemon_args, out_is, err_is);
         // Wait for daemon to start up
         // d.wait_for(chrono::seconds(1));
-        std::this_thread::sleep_for(chrono::seconds(5));
+        string early_out;
+        if (daemon_ready.kind == daemon_readiness::NONE) {
+            std::this_thread::sleep_for(chrono::seconds(5));
+        } else if (!wait_for_daemon(daemon_ready, d, out_is.pipe().native_source(), early_out)) {
+            res.output += "[PATHFINDER] daemon not ready after " +
+                to_string(daemon_ready.timeout.count()) + "ms\n";
+        }
 
         // print checker args
         // cout << "Checker args: ";
@@ -1410,9 +1508,15 @@ test_result model_checker_state::run_checker(void) {
         //     cout << arg << " ";
         // }
         // cout << endl;
-        res.ret_code = run_command(checker_args, res.output, timeout);
+        res.ret_code = forkservers ? forkservers->run(checker_args, res.output, timeout)
+                                   : run_command(checker_args, res.output, timeout);
 
         (void)finish_command(d, out_is, err_is, daemon_out, timeout);
+        // what the readiness check read is not seen by finish_command
+        istringstream early(early_out);
+        for (string line; std::getline(early, line); ) {
+            res.output += "[STDOUT] " + line + "\n";
+        }
         res.output += daemon_out;
     } else {
         // print checker args
@@ -1421,7 +1525,8 @@ test_result model_checker_state::run_checker(void) {
         //     cout << arg << " ";
         // }
         // cout << endl;
-        res.ret_code = run_command(checker_args, res.output, timeout);
+        res.ret_code = forkservers ? forkservers->run(checker_args, res.output, timeout)
+                                   : run_command(checker_args, res.output, timeout);
     }
 #else
     if (!daemon_args.empty()) {
@@ -1439,11 +1544,20 @@ test_result model_checker_state::run_checker(void) {
     }
 #endif
 
-    if (save_file_images) {
-        record_file_images(res);
+    for (const auto &f : watched) {
+        struct stat st;
+        if (stat(f.c_str(), &st) || st.st_mtim.tv_sec != sentinel[1].tv_sec ||
+            st.st_mtim.tv_nsec != sentinel[1].tv_nsec) {
+            mark_unknown_writes(f);
+        }
     }
 
     assert(res.valid());
+    if (keyed) cached_results->insert(key, res);
+
+    if (save_file_images) {
+        record_file_images(res);
+    }
     return res;
 }
 
@@ -1761,6 +1875,7 @@ model_checker_code model_checker_state::test_possible_orderings(
         fs::remove_all(backup_dir);
         error_if_exists(backup_dir);
     }
+    snapshots_.reset();
 
     rstream.flush();
     rstream.close();
@@ -1843,6 +1958,8 @@ test_result model_checker_state::run_recovery_observer_posix(
 
     test_result res;
     res.ret_code = run_command(pintool_args, res.output, timeout);
+    // on a timeout the tool is killed before it merges its per-thread files
+    trace::merge_thread_traces(pintool_output);
 
     return res;
 }
@@ -1942,7 +2059,14 @@ void model_checker_state::setup_init_state(int until) {
     size_t init_checkpoints = num_checkpoints();
     
     assert(until <= event_trace.events().size());
-    for (int i = 0; i < until; ++i) {
+    int start = 0;
+    if (mode_ == POSIX && prefix_snapshots) {
+        start = restore_prefix_snapshot(until);
+    }
+    for (int i = start; i < until; ++i) {
+        if (mode_ == POSIX && prefix_snapshots && prefix_snapshots->should_save(i, until)) {
+            save_prefix_snapshot(i);
+        }
         const shared_ptr<trace_event> &te = event_trace.events()[i];
         if (te->is_register_file()) {
             // Record it for backup recovery later
@@ -1974,6 +2098,10 @@ void model_checker_state::setup_init_state(int until) {
         }
     }
 
+    if (mode_ == POSIX && prefix_snapshots && prefix_snapshots->should_save(until, until)) {
+        save_prefix_snapshot(until);
+    }
+
     prefix_event_id = until;
 
     record_lseek_offset();
@@ -1982,6 +2110,89 @@ void model_checker_state::setup_init_state(int until) {
 }
 
 
+int model_checker_state::restore_prefix_snapshot(int until) {
+    shared_ptr<const prefix_snapshot> snap = prefix_snapshots->nearest(until);
+    if (!snap || pmdir.empty()) return 0;
+
+    // the snapshot already includes whatever the setup command did
+    if (!snapshots().restore(snap->image, pmdir)) {
+        cerr << "Failed to restore prefix snapshot " << snap->image << "\n";
+        exit(EXIT_FAILURE);
+    }
+
+    mmio_events = snap->mmio_events;
+    fd_to_fd.clear();
+    for (const auto &p : snap->open_fds) {
+        fs::path path = pmdir / p.second.first;
+        int fd = open(path.c_str(), p.second.second);
+        if (fd == -1) {
+            cerr << "Failed to reopen " << path << " from prefix snapshot" << endl
+                << "Reason: " << strerror(errno) << endl;
+            exit(EXIT_FAILURE);
+        }
+        fd_to_fd[p.first] = fd;
+    }
+    file_to_fd.clear();
+    for (const auto &p : snap->file_to_trace_fd) {
+        file_to_fd[p.first] = (p.second == -1) ? -1 : fd_to_fd.at(p.second);
+    }
+    lseek_map = snap->lseek_map;
+    apply_lseek_offset();
+
+    fs = snap->fs;
+    fs.rebase("", pmdir.string());
+
+    return snap->until;
+}
+
+void model_checker_state::save_prefix_snapshot(int until) {
+    if (pmdir.empty()) return;
+    // live mmaps are not saved, and later stores and munmaps need them
+    if (!offset_mapping_.empty()) return;
+
+    auto snap = make_shared<prefix_snapshot>();
+    snap->until = until;
+    snap->mmio_events = mmio_events;
+
+    boost::system::error_code ec;
+    fs::path root = fs::canonical(pmdir, ec);
+    if (ec) return;
+
+    unordered_map<int, int> pfd_to_tfd;
+    for (const auto &p : fd_to_fd) {
+        int trace_fd = p.first;
+        int pathfinder_fd = p.second;
+        if (pathfinder_fd == -1) continue;
+        pfd_to_tfd[pathfinder_fd] = trace_fd;
+
+        // the file may have been renamed since it was opened, so ask the kernel
+        fs::path target = fs::read_symlink("/proc/self/fd/" + to_string(pathfinder_fd), ec);
+        fs::path rel = target.lexically_relative(root);
+        int flags = fcntl(pathfinder_fd, F_GETFL);
+        off_t offset = lseek(pathfinder_fd, 0, SEEK_CUR);
+        // unlinked while open, or not ours: cannot be reopened, so no snapshot
+        if (ec || rel.empty() || *rel.begin() == ".." || !fs::exists(target) || flags == -1 || offset == -1) {
+            return;
+        }
+        snap->open_fds[trace_fd] = make_pair(rel, flags);
+        snap->lseek_map[trace_fd] = offset;
+    }
+    for (const auto &p : file_to_fd) {
+        auto it = pfd_to_tfd.find(p.second);
+        snap->file_to_trace_fd[p.first] = (it == pfd_to_tfd.end()) ? -1 : it->second;
+    }
+
+    snap->fs = fs;
+    snap->fs.rebase(pmdir.string(), "");
+
+    snap->image = prefix_snapshots->new_image_path();
+    if (!snapshots().take(pmdir, snap->image)) {
+        cerr << "Failed to save prefix snapshot " << snap->image << "\n";
+        exit(EXIT_FAILURE);
+    }
+    prefix_snapshots->insert(snap);
+}
+
 void model_checker_state::run_pm(promise<model_checker_code> &&output_res) {
     model_checker_code res = NO_BUGS;
     event_config econfig;
@@ -2608,6 +2819,7 @@ end:
         fs::remove_all(backup_dir);
         error_if_exists(backup_dir);
     }
+    snapshots_.reset();
 
     output_res.set_value(res);
 }
@@ -2671,6 +2883,7 @@ end:
         fs::remove_all(backup_dir);
         error_if_exists(backup_dir);
     }
+    snapshots_.reset();
     
     output_res.set_value(res);
 }
@@ -2792,6 +3005,14 @@ void model_checker_state::checkpoint_push(void) {
             // // checkpoints_[r].push_back(gzip::compress(contents));
             checkpoints_[r].push_back(contents);
 
+            if (incremental_checkpoints) {
+                auto &d = dirty_[r];
+                d.lines.resize((r.upper() - r.lower() + DIRTY_LINE_SIZE - 1) / DIRTY_LINE_SIZE);
+                checkpoint_dirty_[r].push_back(d);
+                d.lines.reset();
+                d.unknown = false;
+            }
+
             // checkpoint_files_[r].push_back(fs::unique_path());
             // const auto &new_path = checkpoint_files_[r].back();
             // BOOST_ASSERT(!fs::exists(new_path));
@@ -2809,6 +3030,14 @@ void model_checker_state::checkpoint_pop(void) {
         stack.pop_back();
     }
 
+    // What differed from the popped checkpoint may differ from the one below
+    for (auto &p : checkpoint_dirty_) {
+        auto &stack = p.second;
+        BOOST_ASSERT(stack.size() >= 1);
+        dirty_[p.first] |= stack.back();
+        stack.pop_back();
+    }
+
     // for (auto &p : checkpoint_files_) {
     //     auto &stack = p.second;
     //     BOOST_ASSERT(stack.size() >= 1);
@@ -2840,7 +3069,14 @@ void model_checker_state::restore(void) {
 
         BOOST_ASSERT(backup.size() == r.upper() - r.lower());
 
-        memcpy((void*)r.lower(), backup.data(), backup.size());
+        if (incremental_checkpoints) {
+            auto &d = dirty_[r];
+            copy_back(r, backup, d);
+            d.lines.reset();
+            d.unknown = false;
+        } else {
+            memcpy((void*)r.lower(), backup.data(), backup.size());
+        }
     }
 
     // for (auto &p : checkpoint_files_) {
@@ -2873,7 +3109,73 @@ void model_checker_state::wipe_files(void) {
 
         assert(backup.size() == r.upper() - r.lower());
 
-        memcpy((void*)r.lower(), backup.data(), backup.size());
+        if (incremental_checkpoints) {
+            // lines where the first checkpoint differs from the latest
+            dirty_lines since_first;
+            since_first.lines.resize(dirty_[r].lines.size());
+            const auto &levels = checkpoint_dirty_[r];
+            for (auto it = std::next(levels.begin()); it != levels.end(); ++it) {
+                since_first |= *it;
+            }
+            dirty_lines d = dirty_[r];
+            d |= since_first;
+            copy_back(r, backup, d);
+            dirty_[r] = since_first;
+        } else {
+            memcpy((void*)r.lower(), backup.data(), backup.size());
+        }
+    }
+}
+
+void model_checker_state::mark_dirty(uintptr_t addr, size_t size) {
+    if (!incremental_checkpoints || !size) return;
+    for (auto &p : dirty_) {
+        const auto &r = p.first;
+        if (r.lower() <= addr && addr < r.upper()) {
+            size_t first = (addr - r.lower()) / DIRTY_LINE_SIZE;
+            size_t last = (std::min(addr + size, r.upper()) - 1 - r.lower()) / DIRTY_LINE_SIZE;
+            p.second.lines.set(first, last - first + 1, true);
+            return;
+        }
+    }
+}
+
+void model_checker_state::mark_unknown_writes(const string &pmfile) {
+    if (!incremental_checkpoints) return;
+    for (auto &p : dirty_) {
+        if (!pmfile.empty()) {
+            const auto &regions = file_memory_regions_[pmfile];
+            if (std::find(regions.begin(), regions.end(), p.first) == regions.end()) continue;
+        }
+        p.second.unknown = true;
+    }
+}
+
+void model_checker_state::copy_back(const icl::discrete_interval<uintptr_t> &r,
+                                    const raw_data &backup,
+                                    const dirty_lines &d) {
+    char *base = (char*)r.lower();
+    size_t len = backup.size();
+
+    if (d.unknown) {
+        // Reading is much cheaper than dirtying the whole mapping
+        for (size_t off = 0; off < len; off += BLOCK_SIZE) {
+            size_t n = std::min((size_t)BLOCK_SIZE, len - off);
+            if (memcmp(base + off, backup.data() + off, n)) {
+                memcpy(base + off, backup.data() + off, n);
+            }
+        }
+        return;
+    }
+
+    // copy runs of dirty lines at once
+    for (size_t i = d.lines.find_first(); i != d.lines.npos; ) {
+        size_t j = i;
+        while (j + 1 < d.lines.size() && d.lines.test(j + 1)) ++j;
+        size_t off = i * DIRTY_LINE_SIZE;
+        size_t end = std::min(len, (j + 1) * DIRTY_LINE_SIZE);
+        memcpy(base + off, backup.data() + off, end - off);
+        i = d.lines.find_next(j);
     }
 }
 
@@ -2904,13 +3206,23 @@ void model_checker_state::restore_write_files(void) {
     }
 }
 
+snapshot_backend &model_checker_state::snapshots(void) {
+    if (!snapshots_) {
+        // backups go next to the pmdir
+        snapshots_ = make_snapshot_backend(pmdir_snapshot, pmdir.parent_path());
+    }
+    return *snapshots_;
+}
+
 void model_checker_state::backup_pmdir(bool contains_sparse_file) {
     do {
         backup_dir = pmdir.parent_path() / fs::unique_path("%%%%-%%%%-%%%%-%%%%-BAK");
     } while (fs::exists(backup_dir));
 
-    copy_directory(pmdir, backup_dir, contains_sparse_file);
-
+    if (!snapshots().take(pmdir, backup_dir)) {
+        cerr << "Failed to back up " << pmdir << " with " << snapshots().name() << " snapshots\n";
+        exit(EXIT_FAILURE);
+    }
 }
 
 void model_checker_state::restore_pmdir(bool contains_sparse_file) {
@@ -2933,14 +3245,12 @@ void model_checker_state::restore_pmdir(bool contains_sparse_file) {
     file_to_fd.clear();
     fd_to_fd.clear();
 
-    for (const auto &path : fs::directory_iterator(pmdir)) {
-        fs::remove_all(path);
+    if (!snapshots().restore(backup_dir, pmdir)) {
+        cerr << "Failed to restore " << pmdir << " with " << snapshots().name() << " snapshots\n";
+        exit(EXIT_FAILURE);
     }
 
-    copy_directory(backup_dir, pmdir, contains_sparse_file);
-
-    fs::remove_all(backup_dir);
-    error_if_exists(backup_dir);
+    snapshots().drop(backup_dir);
 
     // iter = fd_map_backup.begin();
     // while (iter != fd_map_backup.end()) {
@@ -3049,6 +3359,11 @@ void model_checker_state::close_write_files() {
 }
 
 void model_checker_state::apply_trace_event(shared_ptr<trace_event> te) {
+        // these can land in a mapped PM file, somewhere we do not track
+        if (mode_ != POSIX &&
+            (te->is_write_family() || te->is_ftruncate() || te->is_fallocate())) {
+            mark_unknown_writes();
+        }
         if (te->is_write()) {
             do_write(te);
         } 
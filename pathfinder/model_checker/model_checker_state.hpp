@@ -1,5 +1,6 @@
 #pragma once
 
+#include <boost/dynamic_bitset.hpp>
 #include <boost/filesystem.hpp>
 #include <algorithm>
 #include <chrono>
@@ -18,13 +19,19 @@
 #include "../graph/pm_graph.hpp"
 #include "../graph/posix_graph.hpp"
 #include "../runtime/pathfinder_fs.hpp"
+#include "forkserver.hpp"
+#include "prefix_cache.hpp"
 #include "../trace/trace.hpp"
+#include "../utils/content_hash.hpp"
+#include "../utils/dir_snapshot.hpp"
 #include "../utils/file_utils.hpp"
 #include "../utils/util.hpp"
 
 
 namespace pathfinder {
 
+class result_cache;
+
 /**
  * @brief Maps timestamps to order in which they occur. -1 is not applied.
  *
@@ -130,6 +137,35 @@ class model_checker_state {
         hash
     > checkpoint_files_;
 
+    /**
+     * @brief For incremental checkpoints, the cache lines of a mapped region
+     * that may differ from a checkpoint.
+     */
+    struct dirty_lines {
+        boost::dynamic_bitset<> lines;
+        // written by something other than do_store, so compare every page
+        bool unknown = false;
+
+        dirty_lines &operator|=(const dirty_lines &o) {
+            lines |= o.lines;
+            unknown = unknown || o.unknown;
+            return *this;
+        }
+    };
+
+    // lines written since the region last matched its latest checkpoint
+    std::unordered_map<
+        boost::icl::discrete_interval<uintptr_t>,
+        dirty_lines,
+        hash
+    > dirty_;
+    // per checkpoint, the lines that may differ from the checkpoint below it
+    std::unordered_map<
+        boost::icl::discrete_interval<uintptr_t>,
+        std::list<dirty_lines>,
+        hash
+    > checkpoint_dirty_;
+
     // map from file in model checker to range in model checker
     std::map<std::string, std::list<boost::icl::discrete_interval<uintptr_t>>> file_memory_regions_;
 
@@ -166,6 +202,17 @@ class model_checker_state {
 
     size_t num_checkpoints(void) const;
 
+    // For incremental checkpoints. Record a write to mapped memory
+    void mark_dirty(uintptr_t addr, size_t size);
+
+    // For incremental checkpoints. Record a write we cannot place, to the given file or all files
+    void mark_unknown_writes(const std::string &pmfile = "");
+
+    // Copy the lines in d back from backup into region r
+    void copy_back(const boost::icl::discrete_interval<uintptr_t> &r,
+                   const raw_data &backup,
+                   const dirty_lines &d);
+
     /**
      * @brief Restore file to state before a test. Do this after running any test
      *
@@ -195,6 +242,11 @@ class model_checker_state {
 
     test_result run_checker(void);
 
+    /**
+     * @brief Hash the crash state as the checker would see it, for cached_results.
+     */
+    bool crash_state_key(content_hasher::digest_t &key);
+
     model_checker_code test_possible_orderings(
         const event_config &init_config,
         const event_set &stores,
@@ -244,10 +296,15 @@ class model_checker_state {
     void backup_write_files();
     // restore files to initial states
     void restore_write_files();
-    // backup the pmdir with sparse file support
+    // backup the pmdir. All snapshot backends support sparse files
     void backup_pmdir(bool contains_sparse_file=false);
-    // restore the pmdir with sparse file support
+    // restore the pmdir from the backup
     void restore_pmdir(bool contains_sparse_file=false);
+
+    // pmdir snapshot backend, created on first use. Reset it to delete any
+    // image it kept for reuse
+    std::unique_ptr<snapshot_backend> snapshots_;
+    snapshot_backend &snapshots(void);
     // open files needed for writes
     void open_write_files();
     // close file descripters before running the checker
@@ -336,6 +393,11 @@ class model_checker_state {
     // replay until the begin of event_idxs, which is the first event of the test
     void setup_init_state(int until);
 
+    // For POSIX. Start from the longest cached prefix of until, returns the number of events it covers
+    int restore_prefix_snapshot(int until);
+    // For POSIX. Save the state after the first `until` events to the prefix cache
+    void save_prefix_snapshot(int until);
+
     test_result process_permutation(std::ostream& rstream, const std::vector<int>& perm, const std::string& test_type);
 
     // lseek helper functions called between file checkpoing and restore
@@ -386,16 +448,22 @@ public:
 
     std::list<std::string> setup_args;
     std::list<std::string> daemon_args;
+    // how to tell the daemon is up, a fixed wait if none
+    daemon_readiness daemon_ready;
     std::list<std::string> checker_args;
     std::list<std::string> cleanup_args;
 
     bool save_file_images;
+    // only copy back what changed since a checkpoint, rather than whole regions
+    bool incremental_checkpoints = false;
+    // pmdir snapshot backend: auto, reflink, layered or copy
+    std::string pmdir_snapshot = "auto";
     bool map_direct;
     test_type ttype;
     std::chrono::seconds timeout;
     std::chrono::minutes baseline_timeout;
 
-    // For POSIX, we no longer enumerate order in model_checker_state, and instead reply on PartialOrderGenerator
+    // For POSIX, we no longer enumerate order in model_checker_state, and instead reply on ideal_enumerator
     std::vector<std::vector<int>> all_event_orders;
 
     // A filesystem wrapper for tracking synced items
@@ -403,6 +471,14 @@ public:
 
     std::optional<int> setup_until;
 
+    // For POSIX. Shared with the other tests of the same model checker, may be null
+    std::shared_ptr<prefix_cache> prefix_snapshots;
+
+    // Runs the checker if set, shared with the other tests of the same model checker
+    std::shared_ptr<forkserver_pool> forkservers;
+
+    // Results of earlier tests by crash state, shared with the other tests. May be null
+    std::shared_ptr<result_cache> cached_results;
 
     model_checker_state(uint64_t id, const trace &t, boost::filesystem::path o, std::shared_ptr<std::mutex> m);
 
@@ -0,0 +1,68 @@
+#include "prefix_cache.hpp"
+
+#include <iostream>
+
+namespace fs = boost::filesystem;
+using namespace std;
+
+namespace pathfinder {
+
+prefix_snapshot::~prefix_snapshot() {
+    boost::system::error_code ec;
+    fs::remove_all(image, ec);
+}
+
+prefix_cache::prefix_cache(fs::path dir, int interval, size_t max_snapshots)
+    : dir_(dir), interval_(interval), max_snapshots_(max_snapshots) {
+    if (interval_ <= 0 || max_snapshots_ == 0) {
+        cerr << "Invalid prefix snapshot interval " << interval_
+            << " or count " << max_snapshots_ << "\n";
+        exit(EXIT_FAILURE);
+    }
+    fs::create_directories(dir_);
+}
+
+prefix_cache::~prefix_cache() {
+    snapshots_.clear();
+    boost::system::error_code ec;
+    fs::remove_all(dir_, ec);
+}
+
+shared_ptr<const prefix_snapshot> prefix_cache::nearest(int until) {
+    lock_guard<mutex> lock(mtx_);
+    auto it = snapshots_.upper_bound(until);
+    if (it == snapshots_.begin()) return nullptr;
+    --it;
+    it->second.second = ++tick_;
+    return it->second.first;
+}
+
+bool prefix_cache::should_save(int i, int until) {
+    if (i <= 0 || (i % interval_ != 0 && i != until)) return false;
+    lock_guard<mutex> lock(mtx_);
+    return !snapshots_.count(i);
+}
+
+fs::path prefix_cache::new_image_path() {
+    lock_guard<mutex> lock(mtx_);
+    return dir_ / ("snapshot_" + to_string(next_image_++));
+}
+
+void prefix_cache::insert(shared_ptr<const prefix_snapshot> snapshot) {
+    // dropped snapshots are deleted outside the lock, by whoever drops the
+    // last reference
+    shared_ptr<const prefix_snapshot> evicted;
+    lock_guard<mutex> lock(mtx_);
+    if (snapshots_.count(snapshot->until)) return;
+    if (snapshots_.size() >= max_snapshots_) {
+        auto lru = snapshots_.begin();
+        for (auto it = snapshots_.begin(); it != snapshots_.end(); ++it) {
+            if (it->second.second < lru->second.second) lru = it;
+        }
+        evicted = lru->second.first;
+        snapshots_.erase(lru);
+    }
+    snapshots_[snapshot->until] = make_pair(snapshot, ++tick_);
+}
+
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+#include "../runtime/pathfinder_fs.hpp"
+#include "../trace/trace.hpp"
+
+namespace pathfinder {
+
+/**
+ * @brief The POSIX file system state after replaying the first `until` trace
+ * events, so tests with a later setup point only replay the delta.
+ *
+ * All paths are stored relative to the pmdir the snapshot was taken in, as
+ * every test has its own pmdir. The image directory is removed once the last
+ * state using the snapshot lets go of it. Snapshots are only taken while no
+ * file is memory-mapped, as mappings are not part of them.
+ */
+struct prefix_snapshot {
+    int until;
+    // copy of the pmdir contents
+    boost::filesystem::path image;
+    std::list<std::shared_ptr<trace_event>> mmio_events;
+    // trace fd -> (path relative to pmdir, open status flags), for fds open at `until`
+    std::unordered_map<int, std::pair<boost::filesystem::path, int>> open_fds;
+    // te:file -> trace fd it was last opened as, -1 if closed
+    std::unordered_map<std::string, int> file_to_trace_fd;
+    std::unordered_map<int, uint64_t> lseek_map;
+    // file sync bookkeeping, rebased to ""
+    pathfinder_fs fs;
+
+    ~prefix_snapshot();
+};
+
+/**
+ * @brief Prefix snapshots shared by all the tests of one model checker.
+ *
+ * Snapshots are taken every `interval` events and at each test's setup
+ * point. At most `max_snapshots` are kept; the least recently used one is
+ * dropped first.
+ */
+class prefix_cache {
+    std::mutex mtx_;
+    boost::filesystem::path dir_;
+    int interval_;
+    size_t max_snapshots_;
+    uint64_t tick_ = 0;
+    uint64_t next_image_ = 0;
+    // until -> (snapshot, last used tick)
+    std::map<int, std::pair<std::shared_ptr<const prefix_snapshot>, uint64_t>> snapshots_;
+
+public:
+    prefix_cache(boost::filesystem::path dir, int interval, size_t max_snapshots);
+    ~prefix_cache();
+
+    /**
+     * @brief The snapshot with the longest prefix that is at most until, or nullptr.
+     */
+    std::shared_ptr<const prefix_snapshot> nearest(int until);
+
+    /**
+     * @brief Whether a test replaying up to until should save the state after i events.
+     */
+    bool should_save(int i, int until);
+
+    /**
+     * @brief A fresh directory name for a snapshot image.
+     */
+    boost::filesystem::path new_image_path();
+
+    /**
+     * @brief Add a snapshot. Keeps the existing one if another test got there first.
+     */
+    void insert(std::shared_ptr<const prefix_snapshot> snapshot);
+};
+
+}
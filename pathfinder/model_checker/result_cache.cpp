@@ -0,0 +1,42 @@
+#include "result_cache.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+namespace pathfinder {
+
+bool result_cache::lookup(const key_t &key, test_result &res) {
+    lock_guard<mutex> lock(mtx_);
+    auto it = results_.find(key);
+    if (it == results_.end()) {
+        misses_++;
+        return false;
+    }
+    hits_++;
+    res = it->second;
+    return true;
+}
+
+void result_cache::insert(const key_t &key, const test_result &res) {
+    lock_guard<mutex> lock(mtx_);
+    auto it = results_.emplace(key, res).first;
+    it->second.file_images.clear();
+}
+
+void result_cache::record_hash_time(nanoseconds t, bool hashed) {
+    lock_guard<mutex> lock(mtx_);
+    hash_time_ += t;
+    if (!hashed) unhashed_++;
+}
+
+void result_cache::report(ostream &os) {
+    lock_guard<mutex> lock(mtx_);
+    uint64_t total = hits_ + misses_ + unhashed_;
+    os << "Result cache: " << hits_ << " hits, " << misses_ << " misses";
+    if (unhashed_) os << ", " << unhashed_ << " not hashed";
+    if (total) os << " (" << (100 * hits_ / total) << "% of checker runs skipped)";
+    os << ", " << results_.size() << " unique crash states, "
+       << duration_cast<milliseconds>(hash_time_).count() << " ms hashing\n";
+}
+
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <ostream>
+
+#include "model_checker_state.hpp"
+#include "../utils/content_hash.hpp"
+
+namespace pathfinder {
+
+/**
+ * @brief Checker results by crash state contents, so byte-identical crash
+ * states (e.g. reorderings of stores that write the same values) are only
+ * checked once.
+ *
+ * Keys hash the pmdir (or PM files) right before the checker runs, along
+ * with the checker and daemon commands. This assumes the checker is
+ * deterministic.
+ */
+class result_cache {
+public:
+    typedef content_hasher::digest_t key_t;
+
+private:
+    std::mutex mtx_;
+    std::map<key_t, test_result> results_;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    // states we could not hash
+    uint64_t unhashed_ = 0;
+    std::chrono::nanoseconds hash_time_{0};
+
+public:
+    /**
+     * @brief The stored result for key, if any. Counts a hit or a miss.
+     */
+    bool lookup(const key_t &key, test_result &res);
+
+    /**
+     * @brief Store res for key, without its file_images: those are the
+     * caller's own PM files, and every hit records its own.
+     */
+    void insert(const key_t &key, const test_result &res);
+
+    void record_hash_time(std::chrono::nanoseconds t, bool hashed);
+
+    /**
+     * @brief Print hit and miss counts.
+     */
+    void report(std::ostream &os);
+};
+
+}
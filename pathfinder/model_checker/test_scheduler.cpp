@@ -0,0 +1,129 @@
+#include "test_scheduler.hpp"
+
+#include <pthread.h>
+
+using namespace std;
+
+namespace pathfinder {
+
+test_scheduler::test_scheduler(size_t nworkers, size_t max_queued)
+    : max_queued_(max_queued ? max_queued : 1), busy_(nworkers ? nworkers : 1, false) {
+    for (size_t i = 0; i < busy_.size(); ++i) {
+        workers_.emplace_back(&test_scheduler::work, this, i);
+    }
+}
+
+test_scheduler::~test_scheduler() {
+    cancel_pending();
+    {
+        lock_guard<mutex> lock(mtx_);
+        stopping_ = true;
+    }
+    work_.notify_all();
+    for (auto &t : workers_) {
+        if (t.joinable()) t.join();
+    }
+}
+
+void test_scheduler::work(size_t id) {
+    unique_lock<mutex> lock(mtx_);
+    while (true) {
+        work_.wait(lock, [&] { return stopping_ || !queue_.empty(); });
+        if (queue_.empty()) return;
+
+        task t = std::move(queue_.begin()->second);
+        queue_.erase(queue_.begin());
+        running_++;
+        busy_[id] = true;
+        lock.unlock();
+        space_.notify_one();
+
+        t.run();
+        // drop whatever the test holds on to outside the lock
+        t = task();
+
+        lock.lock();
+        busy_[id] = false;
+        running_--;
+        completed_++;
+        done_.notify_all();
+        if (queue_.empty() && running_ == 0) idle_.notify_all();
+    }
+}
+
+void test_scheduler::submit(test_priority priority, function<void()> run, function<void()> cancel) {
+    {
+        unique_lock<mutex> lock(mtx_);
+        space_.wait(lock, [&] { return stopping_ || queue_.size() < max_queued_; });
+        if (!stopping_) {
+            queue_[make_pair((int)priority, next_seq_++)] = task{std::move(run), std::move(cancel)};
+            lock.unlock();
+            work_.notify_one();
+            return;
+        }
+    }
+    cancel();
+}
+
+size_t test_scheduler::cancel_pending(void) {
+    map<pair<int, uint64_t>, task> dropped;
+    {
+        lock_guard<mutex> lock(mtx_);
+        dropped.swap(queue_);
+        if (running_ == 0) {
+            idle_.notify_all();
+            done_.notify_all();
+        }
+    }
+    space_.notify_all();
+    for (auto &p : dropped) {
+        p.second.cancel();
+    }
+    return dropped.size();
+}
+
+void test_scheduler::wait_idle(void) {
+    unique_lock<mutex> lock(mtx_);
+    idle_.wait(lock, [&] { return queue_.empty() && running_ == 0; });
+}
+
+uint64_t test_scheduler::num_completed(void) {
+    lock_guard<mutex> lock(mtx_);
+    return completed_;
+}
+
+void test_scheduler::wait_completed(uint64_t seen) {
+    unique_lock<mutex> lock(mtx_);
+    done_.wait(lock, [&] {
+        return completed_ > seen || stopping_ || (queue_.empty() && running_ == 0);
+    });
+}
+
+void test_scheduler::kill(void) {
+    {
+        lock_guard<mutex> lock(mtx_);
+        stopping_ = true;
+    }
+    cancel_pending();
+    work_.notify_all();
+    space_.notify_all();
+
+    // idle workers exit on their own, the busy ones are stuck in a test
+    {
+        lock_guard<mutex> lock(mtx_);
+        for (size_t i = 0; i < workers_.size(); ++i) {
+            if (busy_[i]) pthread_cancel(workers_[i].native_handle());
+        }
+    }
+    for (auto &t : workers_) {
+        if (t.joinable()) t.join();
+    }
+    workers_.clear();
+
+    lock_guard<mutex> lock(mtx_);
+    running_ = 0;
+    idle_.notify_all();
+    done_.notify_all();
+}
+
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace pathfinder {
+
+// Lower runs first
+enum test_priority {
+    REPRESENTATIVE_TEST = 0,
+    FOLLOWUP_TEST = 1
+};
+
+/**
+ * @brief Runs model checker tests on a fixed pool of worker threads.
+ *
+ * Waiting tests are taken by priority, then in submission order. submit()
+ * blocks while max_queued tests are already waiting, so callers cannot get
+ * far ahead of the workers.
+ */
+class test_scheduler {
+    struct task {
+        std::function<void()> run;
+        // called instead of run if the task is dropped
+        std::function<void()> cancel;
+    };
+
+    std::mutex mtx_;
+    std::condition_variable work_, space_, idle_, done_;
+    // (priority, sequence number) -> task
+    std::map<std::pair<int, uint64_t>, task> queue_;
+    uint64_t next_seq_ = 0;
+    size_t max_queued_;
+    size_t running_ = 0;
+    uint64_t completed_ = 0;
+    bool stopping_ = false;
+
+    std::vector<std::thread> workers_;
+    // whether each worker is running a task
+    std::vector<bool> busy_;
+
+    void work(size_t id);
+
+public:
+    test_scheduler(size_t nworkers, size_t max_queued);
+    ~test_scheduler();
+
+    /**
+     * @brief Queue a test, blocking while the queue is full.
+     *
+     * If the scheduler has been shut down, cancel is called right away.
+     */
+    void submit(test_priority priority, std::function<void()> run, std::function<void()> cancel);
+
+    /**
+     * @brief Drop all waiting tests, calling their cancel functions. Running
+     * tests are not affected.
+     *
+     * @return size_t The number of tests dropped
+     */
+    size_t cancel_pending(void);
+
+    /**
+     * @brief Block until no tests are waiting or running.
+     */
+    void wait_idle(void);
+
+    /**
+     * @brief Number of tests that have finished running so far.
+     */
+    uint64_t num_completed(void);
+
+    /**
+     * @brief Block until more than seen tests have finished, or nothing is
+     * left to run. Lets callers wait for any of their tests without polling
+     * each future in turn.
+     */
+    void wait_completed(uint64_t seen);
+
+    /**
+     * @brief Drop all waiting tests and cancel the threads of the running
+     * ones. No tests can be run afterwards.
+     */
+    void kill(void);
+
+    size_t num_workers(void) const { return busy_.size(); }
+    size_t max_queued(void) const { return max_queued_; }
+};
+
+}
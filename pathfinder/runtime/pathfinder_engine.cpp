@@ -1,16 +1,20 @@
 #include "pathfinder_engine.hpp"
 
 #include <algorithm>
+#include <atomic>
 #include <numeric>
 #include <chrono>
 #include <cstdlib>
 #include <ctime>
+#include <deque>
 #include <filesystem>
 #include <iomanip>
 #include <iostream>
 #include <list>
 #include <sstream>
 #include <memory>
+#include <optional>
+#include <thread>
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/regex.hpp>
 #include <boost/iostreams/tee.hpp>
@@ -24,6 +28,9 @@
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/Support/SourceMgr.h>
 
+#include "../trace/binary_trace.hpp"
+#include "../utils/bounded_queue.hpp"
+
 #define DEBUGGING 1
 // #define UM_MAX_SIZE 100
 #define UM_CHUNK_SIZE 8
@@ -91,6 +98,13 @@ engine::engine(const po::variables_map &config) :
         exit(EXIT_FAILURE);
     }
 
+    if (config_enabled("test.forkserver")) {
+        forkservers_ = std::make_shared<forkserver_pool>();
+    }
+    if (config_enabled("test.result_cache")) {
+        cached_results_ = std::make_shared<result_cache>();
+    }
+
     /*
     Primary task here is to fill in the template values.
     */
@@ -165,12 +179,33 @@ trace engine::gather_process_trace(void) {
     if (!trace_path_str.empty()) {
         fs::path trace_path = fs::path(resolve_config_value(vals, "trace.trace_path"));
         // copy the log file to output_dir
-        fs::copy_file(trace_path, output_dir_ / "tracer.log");
+        bool binary = is_binary_trace(trace_path);
+        fs::copy_file(trace_path, output_dir_ / (binary ? "tracer" BINARY_TRACE_EXT : "tracer.log"));
+        if (config_enabled("trace.benchmark_ingest")) {
+            bool same = benchmark_trace_ingest(trace_path,
+                config_enabled("general.selective_testing"), mode_,
+                config_int("trace.parse_threads"), cout);
+            exit(same ? EXIT_SUCCESS : EXIT_FAILURE);
+        }
         trace prog_trace(config_enabled("general.selective_testing"), mode_);
+        prog_trace.set_parse_threads(config_int("trace.parse_threads"));
         prog_trace.read_offline_trace(trace_path);
+        if (config_enabled("trace.convert_binary_trace")) {
+            if (binary) {
+                cerr << "trace.convert_binary_trace: " << trace_path << " is already a binary trace\n";
+                exit(EXIT_FAILURE);
+            }
+            fs::path binary_path = output_dir_ / ("tracer" BINARY_TRACE_EXT);
+            prog_trace.write_binary_trace(binary_path);
+            cout << "Converted " << trace_path << " to " << binary_path << endl;
+            exit(EXIT_SUCCESS);
+        }
         string root_dir_str = config_["trace.root_dir"].as<string>();
         assert(!root_dir_str.empty() && "Root dir must be set for offline traces");
         prog_trace.set_root_dir(fs::path(root_dir_str));
+        if (!binary && config_enabled("trace.save_binary_trace")) {
+            prog_trace.write_binary_trace(output_dir_ / ("tracer" BINARY_TRACE_EXT));
+        }
         #if DEBUGGING
             prog_trace.validate_store_events();
         #endif
@@ -201,6 +236,7 @@ trace engine::gather_process_trace(void) {
     
     list<string> tracer_args;
     bp::pipe p;
+    bool stream_trace = mode_ != PM && config_enabled("trace.stream");
     // get current time in a string
     std::time_t t = std::time(nullptr);
     std::tm* now = std::localtime(&t);
@@ -245,6 +281,13 @@ trace engine::gather_process_trace(void) {
         list<string> pin_args = {
             "-follow-execv", "-t", PINTOOL_TRACER_PATH, "-o", log_path, "-tf", vals["pmdir"].asString(), "--"
         };
+        if (stream_trace) {
+            // the tool writes records in order into the pipe as they complete
+            pin_args = {
+                "-follow-execv", "-t", PINTOOL_TRACER_PATH, "-o", "/dev/fd/" + to_string(p.native_sink()),
+                "-stream", "1", "-tf", vals["pmdir"].asString(), "--"
+            };
+        }
         pin_args.insert(pin_args.end(), prog_args.begin(), prog_args.end());
         tracer_args = pin_args;
     }
@@ -315,6 +358,7 @@ trace engine::gather_process_trace(void) {
 
     // Now we can start reading in the trace
     trace prog_trace(config_enabled("general.selective_testing"), mode_);
+    prog_trace.set_parse_threads(config_int("trace.parse_threads"));
 
     prog_trace.set_root_dir(fs::path(vals["pmdir"].asString()));
 
@@ -330,7 +374,17 @@ trace engine::gather_process_trace(void) {
         //     cerr << "[CMD ARG] " << a << endl;
         // }
         // Wait for daemon to start up
-        c.wait_for(chrono::seconds(10));
+        if (config_not_empty("trace.daemon_ready_tmpl")) {
+            auto ready = daemon_readiness::parse(
+                resolve_config_value(vals, "trace.daemon_ready_tmpl"),
+                chrono::seconds(config_int("trace.daemon_ready_timeout")));
+            string consumed;
+            if (!wait_for_daemon(ready, c, -1, consumed)) {
+                cerr << "Warning: traced daemon is not ready, starting the workload anyway\n";
+            }
+        } else {
+            c.wait_for(chrono::seconds(10));
+        }
         test = start_command(cmd_args, tout, terr);
     }
 
@@ -346,10 +400,29 @@ trace engine::gather_process_trace(void) {
             prog_trace.read(c, stream);
         }
     }
+    else if (stream_trace) {
+        close(p.native_sink());
+
+        // parse while the workload runs, keeping a copy as tracer.log
+        prog_trace.copy_raw_trace(output_dir_ / "tracer.log");
+        prog_trace.set_reorder_window(config_["trace.stream_reorder_window"].as<int>());
+        bp::ipstream stream;
+        stream.pipe(p);
+        if (test.valid()) {
+            prog_trace.read(c, test, stream);
+        } else {
+            prog_trace.read(c, stream);
+        }
+    }
     else {
         // wait until child c is ready
         // don't need to do it for pmemcheck
         c.wait();
+        // records the tool did not write out itself, if it was killed
+        size_t recovered = trace::merge_thread_traces(log_path);
+        if (recovered) {
+            cerr << "Recovered " << recovered << " trace records the tracer left unmerged\n";
+        }
         std::ifstream stream(log_path);
         if (test.valid()) {
             prog_trace.read(c, test, stream);
@@ -366,10 +439,12 @@ trace engine::gather_process_trace(void) {
             exit(EXIT_FAILURE);
         }
     }
-    // copy the log file to output_dir
-    fs::copy_file(fs::path(log_path), output_dir_ / "tracer.log");
-    // remove the log file
-    fs::remove(fs::path(log_path));
+    if (!stream_trace) {
+        // copy the log file to output_dir
+        fs::copy_file(fs::path(log_path), output_dir_ / "tracer.log");
+        // remove the log file
+        fs::remove(fs::path(log_path));
+    }
 
     // --- If there is cleanup, run it now.
     if (config_not_empty("trace.cleanup_tmpl")) {
@@ -398,6 +473,10 @@ trace engine::gather_process_trace(void) {
     fs::remove_all(fs::path(vals["pmdir"].asString()));
     BOOST_ASSERT(!fs::exists(fs::path(vals["pmdir"].asString())));
 
+    if (config_enabled("trace.save_binary_trace")) {
+        prog_trace.write_binary_trace(output_dir_ / ("tracer" BINARY_TRACE_EXT));
+    }
+
     #if DEBUGGING
         prog_trace.validate_store_events();
     #endif
@@ -408,12 +487,12 @@ trace engine::gather_process_trace(void) {
 
 vector<update_mechanism> engine::split_by_epochs(
     const Type *instance_type,
-    const graph_type &g,
+    const pm_graph &pg,
     const vector<vertex> &iverts) const
 {
+    const csr_graph &g = pg.csr();
     // size_t MAX_RANGE = SIZE_MAX;
     // unordered_set<vertex> ivert_set(iverts.begin(), iverts.end());
-    const_property_map pmap = boost::get(pnode_property_t(), g);
 
     #ifdef DEBUG_MODE
     unordered_set<vertex> check(iverts.begin(), iverts.end());
@@ -439,10 +518,10 @@ vector<update_mechanism> engine::split_by_epochs(
 
     for (int i = 0; i < iverts.size() - 1; ++i) {
         const vertex &a = iverts[i];
-        const pm_node *na = dynamic_cast<const pm_node*>(get(pmap, a));
+        const pm_node *na = g.node<pm_node>(a);
 
         const vertex &b = iverts[i+1];
-        const pm_node *nb = dynamic_cast<const pm_node*>(get(pmap, b));
+        const pm_node *nb = g.node<pm_node>(b);
 
         assert(na && nb && "Should have a node for each vertex!");
 
@@ -452,11 +531,10 @@ vector<update_mechanism> engine::split_by_epochs(
         // else, Split if the gap between stores is bigger than the data structure
         size_t store_gap = nb->event()->store_id() - na->event()->store_id();
 
-        if (has_path(g, a, b)) {
+        if (pg.has_path(a, b)) {
             // Now, if they aren't connected, that means there's an interruption,
             // and we should split the graph.
-            auto res = boost::edge(a, b, g);
-            if (!res.second) {
+            if (!pg.has_edge(a, b)) {
                 // Non-inclusive end range.
                 split_idxs.push_back(i);
                 continue;
@@ -498,10 +576,10 @@ vector<update_mechanism> engine::split_by_epochs(
     for (const update_mechanism &epoch : interrupted_epochs) {
         vector<int> split_idxs;
 
-        const pm_node *last_node = dynamic_cast<const pm_node*>(boost::get(pmap, epoch[0]));
+        const pm_node *last_node = g.node<pm_node>(epoch[0]);
         assert(last_node);
         for (int x = 1; x < epoch.size(); ++x) {
-            const pm_node *node = dynamic_cast<const pm_node*>(boost::get(pmap, epoch[x]));
+            const pm_node *node = g.node<pm_node>(epoch[x]);
             assert(node);
             // the store num check is a check against successive, tmp updates.
             // -- Don't do this for array types,
@@ -531,7 +609,7 @@ vector<update_mechanism> engine::split_by_epochs(
         unordered_map<icl::discrete_interval<uint64_t>, vector<int>, interval_hash>
             fields;
         for (int x = 0; x < epoch.size(); ++x) {
-            const pm_node *node = dynamic_cast<const pm_node*>(boost::get(pmap, epoch[x]));
+            const pm_node *node = g.node<pm_node>(epoch[x]);
             auto f = node->field(instance_type);
             // Don't split consecutive field updates here either
             // if (!fields[f].empty()) {
@@ -584,20 +662,22 @@ vector<update_mechanism> engine::split_by_epochs(
     return field_epochs;
 }
 
-static size_t edge_count(const graph_type &g, const update_mechanism &um) {
+static size_t edge_count(const pm_graph &pg, const update_mechanism &um) {
+    if (pg.frontier_edges()) return pg.edges_within(um).size();
+
+    const csr_graph &g = pg.csr();
     size_t nedges = 0;
     for (vertex v : um) {
-        graph_type::out_edge_iterator it, end;
-        for (boost::tie(it, end) = boost::out_edges(v, g); it != end; ++it) {
-            if (std::count(um.begin(), um.end(), it->m_target)) nedges++;
+        for (vertex u : g.out_neighbors(v)) {
+            if (std::count(um.begin(), um.end(), u)) nedges++;
         }
     }
     return nedges;
 }
 
 // We want fewer edges: means more orderings
-static bool update_mechanism_edge_order(const graph_type &g, const update_mechanism &a, const update_mechanism &b) {
-    return edge_count(g, a) < edge_count(g, b);
+static bool update_mechanism_edge_order(const pm_graph &pg, const update_mechanism &a, const update_mechanism &b) {
+    return edge_count(pg, a) < edge_count(pg, b);
 }
 
 static bool update_mechanism_vertex_order(const update_mechanism &a, const update_mechanism &b) {
@@ -610,13 +690,11 @@ static icl::discrete_interval<vertex> update_mechanism_range(const update_mechan
 
 static bool is_induced_subgraph_in_type(
     const Type *ty,
-    const graph_type &g,
+    const pm_graph &pg,
     const update_mechanism &large,
     const update_mechanism &small)
 {
-    // It actually has to come from this one, we didn't create a property
-    // map for the fully connected version.
-    const_property_map pmap = boost::get(pnode_property_t(), g);
+    const csr_graph &g = pg.csr();
 
     /**
      * Map small vertices to the large graph.
@@ -632,8 +710,8 @@ static bool is_induced_subgraph_in_type(
         for (const vertex &sv : small) {
             if (s_to_l.count(sv)) continue;
 
-            const pm_node *sn = dynamic_cast<const pm_node*>(boost::get(pmap, sv));
-            const pm_node *ln = dynamic_cast<const pm_node*>(boost::get(pmap, lv));
+            const pm_node *sn = g.node<pm_node>(sv);
+            const pm_node *ln = g.node<pm_node>(lv);
             BOOST_ASSERT(sn && ln);
 
             if (sn->is_equivalent(ty, *ln)) {
@@ -660,26 +738,11 @@ static bool is_induced_subgraph_in_type(
     /**
      * Have to map small to large
      */
-    for (const vertex &v : small) {
-        graph_type::out_edge_iterator it, end;
-        for (boost::tie(it, end) = boost::out_edges(v, g); it != end; ++it) {
-            if (!std::count(small.begin(), small.end(), it->m_target)) continue;
-
-            small_edges.insert(
-                make_pair(s_to_l.at(it->m_source), s_to_l.at(it->m_target)));
-        }
+    for (const auto &e : pg.edges_within(small)) {
+        small_edges.insert(make_pair(s_to_l.at(e.first), s_to_l.at(e.second)));
     }
 
-    for (const vertex &v : large_subset) {
-        graph_type::out_edge_iterator it, end;
-        for (boost::tie(it, end) = boost::out_edges(v, g); it != end; ++it) {
-            if (!std::count(large_subset.begin(), large_subset.end(), it->m_target)) {
-                continue;
-            }
-
-            large_edges.insert(make_pair(it->m_source, it->m_target));
-        }
-    }
+    large_edges = pg.edges_within(large_subset);
 
     /**
      * Now, compare the edges. The edges need to be equal for all vertices in
@@ -699,13 +762,11 @@ static bool is_induced_subgraph_in_type(
 */
 static bool is_representative(
     const Type *ty,
-    const graph_type &g,
+    const pm_graph &pg,
     const update_mechanism &large,
     const update_mechanism &small)
 {
-    // It actually has to come from this one, we didn't create a property
-    // map for the fully connected version.
-    const_property_map pmap = boost::get(pnode_property_t(), g);
+    const csr_graph &g = pg.csr();
 
     /**
      * Map small vertices to the large graph.
@@ -721,8 +782,8 @@ static bool is_representative(
         for (const vertex &sv : small) {
             if (s_to_l.count(sv)) continue;
 
-            const pm_node *sn = dynamic_cast<const pm_node*>(boost::get(pmap, sv));
-            const pm_node *ln = dynamic_cast<const pm_node*>(boost::get(pmap, lv));
+            const pm_node *sn = g.node<pm_node>(sv);
+            const pm_node *ln = g.node<pm_node>(lv);
             assert(sn);
             assert(ln);
 
@@ -750,28 +811,11 @@ static bool is_representative(
     /**
      * Have to map small to large
      */
-    for (const vertex &v : small) {
-        graph_type::out_edge_iterator it, end;
-        for (boost::tie(it, end) = boost::out_edges(v, g); it != end; ++it) {
-            if (!std::count(small.begin(), small.end(), it->m_target)) {
-                continue;
-            }
-
-            small_edges.insert(
-                make_pair(s_to_l.at(it->m_source), s_to_l.at(it->m_target)));
-        }
+    for (const auto &e : pg.edges_within(small)) {
+        small_edges.insert(make_pair(s_to_l.at(e.first), s_to_l.at(e.second)));
     }
 
-    for (const vertex &v : large_subset) {
-        graph_type::out_edge_iterator it, end;
-        for (boost::tie(it, end) = boost::out_edges(v, g); it != end; ++it) {
-            if (!std::count(large_subset.begin(), large_subset.end(), it->m_target)) {
-                continue;
-            }
-
-            large_edges.insert(make_pair(it->m_source, it->m_target));
-        }
-    }
+    large_edges = pg.edges_within(large_subset);
 
     /**
      * Now, compare the edges. Large needs to have fewer edges.
@@ -790,14 +834,15 @@ static bool is_representative(
 
 vector<update_mechanism_group> engine::group_by_representative_in_type(
     const Type *ty,
-    const graph_type &g,
+    const pm_graph &pg,
     std::vector<update_mechanism> &mechanisms) const
 {
+    const csr_graph &g = pg.csr();
     vector<update_mechanism_group> groups;
     // First, have to sort by number of internal edges
     std::stable_sort(mechanisms.begin(), mechanisms.end(),
         [&] (const update_mechanism &a, const update_mechanism &b) {
-             return update_mechanism_edge_order(g, a, b); } );
+             return update_mechanism_edge_order(pg, a, b); } );
     // Then, we sort by size, largest to smallest.
     std::stable_sort(mechanisms.begin(), mechanisms.end(),
         update_mechanism_vertex_order);
@@ -805,17 +850,16 @@ vector<update_mechanism_group> engine::group_by_representative_in_type(
 
     // If these types are not structure types, then just group on location.
     if (isa<PointerType>(ty) || isa<IntegerType>(ty)) {
-        set<vector<stack_frame>> covered_locations;
-        const_property_map pmap = boost::get(pnode_property_t(), g);
+        unordered_set<interned_stack, interned_stack_hash> covered_locations;
         size_t skip_covered = 0;
         auto get_stack = [&] (vertex v) {
-            const pm_node *p = dynamic_cast<const pm_node*>(boost::get(pmap, v));
+            const pm_node *p = g.node<pm_node>(v);
             assert(p && "Node is null!");
             return p->event()->stack;
         };
 
         auto covers = [&] (const update_mechanism &a, const update_mechanism &b) {
-            set<vector<stack_frame>> covered_locations;
+            unordered_set<interned_stack, interned_stack_hash> covered_locations;
             for (vertex v : a) {
                 covered_locations.insert(get_stack(v));
             }
@@ -857,9 +901,9 @@ vector<update_mechanism_group> engine::group_by_representative_in_type(
         for (update_mechanism_group &group : groups) {
             bool represents = false;
             if (config_enabled("general.use_induced_subgraph")) {
-                represents = is_induced_subgraph_in_type(ty, g, group.front(), u);
+                represents = is_induced_subgraph_in_type(ty, pg, group.front(), u);
             } else {
-                represents = is_representative(ty, g, group.front(), u);
+                represents = is_representative(ty, pg, group.front(), u);
             }
 
             if (represents) {
@@ -887,7 +931,7 @@ type_to_group_of_um_group engine::get_update_mechanisms_by_type(
 
     unordered_map<const Type*, shared_future<vector<update_mechanism_group>>> future_umap;
 
-    const_property_map pmap = boost::get(pnode_property_t(), pg.whole_program_graph());
+    const csr_graph &g = pg.csr();
 
     // iangneal: HUGE memory sink for larger test cases, duh.
     // https://www.boost.org/doc/libs/1_47_0/libs/graph/doc/transitive_closure.html
@@ -907,10 +951,8 @@ type_to_group_of_um_group engine::get_update_mechanisms_by_type(
         // - Not making an explicit type subgraph here.
         unordered_map<uint64_t, vector<vertex>> instance_vertices;
 
-        graph_type::vertex_iterator it, end;
-        for (boost::tie(it, end) = boost::vertices(pg.whole_program_graph()); it != end; ++it) {
-            const vertex &v = *it;
-            const pm_node *node = dynamic_cast<const pm_node*>(boost::get(pmap, v));
+        for (vertex v = 0; v < g.num_vertices(); ++v) {
+            const pm_node *node = g.node<pm_node>(v);
             assert(node && "Node is null!");
 
             // iangneal: Filter out nodes if we are selectively testing
@@ -937,7 +979,7 @@ type_to_group_of_um_group engine::get_update_mechanisms_by_type(
             uint64_t iaddr = p.first;
             const vector<vertex> &instance = p.second;
             vector<update_mechanism> epochs = split_by_epochs(ty,
-                pg.whole_program_graph(), instance);
+                pg, instance);
 
             all_epochs.insert(all_epochs.end(), epochs.begin(), epochs.end());
         }
@@ -946,12 +988,12 @@ type_to_group_of_um_group engine::get_update_mechanisms_by_type(
         if (config_enabled("general.parallelize")) {
             future_umap[ty] = std::async(launch::async,
                 [&] (const Type *t, update_mechanism_group g) {
-                    return group_by_representative_in_type(t, pg.whole_program_graph(), g);
+                    return group_by_representative_in_type(t, pg, g);
                 }, ty, all_epochs).share();
             // future_umap[ty].wait();
         } else {
             vector<update_mechanism_group> groups = group_by_representative_in_type(
-                ty, pg.whole_program_graph(), all_epochs);
+                ty, pg, all_epochs);
 
             umap[ty].insert(umap[ty].end(), groups.begin(), groups.end());
         }
@@ -1015,10 +1057,7 @@ bool engine::is_induced_subgraph_in_function(
     const update_mechanism &large,
     const update_mechanism &small) const
 {
-    // It actually has to come from this one, we didn't create a property
-    // map for the fully connected version.
-    const graph_type &g = pg_->whole_program_graph();
-    const_property_map pmap = boost::get(pnode_property_t(), g);
+    const csr_graph &g = pg_->csr();
 
     /**
      * Map small vertices to the large graph.
@@ -1030,8 +1069,8 @@ bool engine::is_induced_subgraph_in_function(
         for (const vertex &sv : small) {
             if (s_to_l.count(sv)) continue;
 
-            const posix_node *sn = dynamic_cast<const posix_node*>(boost::get(pmap, sv));
-            const posix_node *ln = dynamic_cast<const posix_node*>(boost::get(pmap, lv));
+            const posix_node *sn = g.node<posix_node>(sv);
+            const posix_node *ln = g.node<posix_node>(lv);
             BOOST_ASSERT(sn && ln);
 
             if (sn->is_equivalent(function, *ln)) {
@@ -1059,23 +1098,20 @@ bool engine::is_induced_subgraph_in_function(
      * Have to map small to large
      */
     for (const vertex &v : small) {
-        graph_type::out_edge_iterator it, end;
-        for (boost::tie(it, end) = boost::out_edges(v, g); it != end; ++it) {
-            if (!std::count(small.begin(), small.end(), it->m_target)) continue;
+        for (vertex u : g.out_neighbors(v)) {
+            if (!std::count(small.begin(), small.end(), u)) continue;
 
-            small_edges.insert(
-                make_pair(s_to_l.at(it->m_source), s_to_l.at(it->m_target)));
+            small_edges.insert(make_pair(s_to_l.at(v), s_to_l.at(u)));
         }
     }
 
     for (const vertex &v : large_subset) {
-        graph_type::out_edge_iterator it, end;
-        for (boost::tie(it, end) = boost::out_edges(v, g); it != end; ++it) {
-            if (!std::count(large_subset.begin(), large_subset.end(), it->m_target)) {
+        for (vertex u : g.out_neighbors(v)) {
+            if (!std::count(large_subset.begin(), large_subset.end(), u)) {
                 continue;
             }
 
-            large_edges.insert(make_pair(it->m_source, it->m_target));
+            large_edges.insert(make_pair(v, u));
         }
     }
 
@@ -1180,12 +1216,12 @@ update_mechanism_group engine::group_by_parent_child(tree<shared_ptr<stack_tree_
 
 update_mechanism_group engine::split_by_clustering(const update_mechanism& um) const {
     unordered_map<uint64_t, vertex> event_id_to_vertex;
-    const_property_map pmap = boost::get(pnode_property_t(), pg_->whole_program_graph());
+    const csr_graph &nodes = pg_->csr();
 
     arma::mat data(1, um.size());
     for (int i = 0; i < um.size(); ++i) {
         vertex v = um[i];
-        const posix_node *node = dynamic_cast<const posix_node*>(get(pmap, v));
+        const posix_node *node = dynamic_cast<const posix_node*>(nodes.node(v));
         event_id_to_vertex[node->event()->event_idx()] = v;
         data(0, i) = node->event()->event_idx();
     }
@@ -1233,7 +1269,7 @@ update_mechanism engine::generate_continuous_update_mechanism(const update_mecha
     uint64_t max_event_id = 0;
     const trace &trace = pg_->get_trace();
     for (vertex v : um) {
-        const posix_node *node = dynamic_cast<const posix_node*>(get(pnode_property_t(), pg_->whole_program_graph(), v));
+        const posix_node *node = dynamic_cast<const posix_node*>(pg_->csr().node(v));
         uint64_t event_id = node->event()->event_idx();
         if (event_id < min_event_id) {
             min_event_id = event_id;
@@ -1307,7 +1343,7 @@ function_to_group_of_um_group engine::get_update_mechanisms_by_function(
         pair<string, int> prefix;
         stack_tree* st = thread_to_stack_tree[tid];
         tree<shared_ptr<stack_tree_node>>::iterator root_it = st->root();
-        const_property_map pmap = boost::get(pnode_property_t(), pg.whole_program_graph());
+        const csr_graph &nodes = pg.csr();
         for (int i = 0; i < events.size() - 1; ++i) {
             const shared_ptr<trace_event> &left_event = events[i];
             const shared_ptr<trace_event> &right_event = events[i+1];
@@ -1476,7 +1512,7 @@ function_to_group_of_um_group engine::get_update_mechanisms_by_function(
         //         cout << "Update protocol " << i << endl;
         //         for (int j = 0; j < it->second[i].size(); ++j) {
         //             // get source code line first
-        //             const posix_node *node = dynamic_cast<const posix_node*>(boost::get(pmap, it->second[i][j]));
+        //             const posix_node *node = dynamic_cast<const posix_node*>(nodes.node(it->second[i][j]));
         //             shared_ptr<trace_event> event = node->event();
         //             int line = -1;
         //             string file;
@@ -1575,6 +1611,11 @@ void engine::run_representative_testing_by_function(const trace &t, function_to_
     // we know that for fmap, in each group, the first is representative graph
     // our goal is to extract this front graph, generate all possible orders, feed it to model checker
     model_checker checker(t, output_dir_, chrono::seconds(config_int("test.timeout")), pg_, PATHFINDER, mode_, op_tracing_, persevere_);
+    checker.max_nproc = max_nproc_;
+    checker.test_queue_size = config_int("general.test_queue_size");
+    checker.forkservers = forkservers_;
+    checker.cached_results = cached_results_;
+    checker.prefix_snapshots = make_prefix_cache(output_dir_);
     int test_idx = 0;
     int global_instance_idx = 0;
     // store all inconsistent <global_id, test_id> pairs
@@ -1592,6 +1633,40 @@ void engine::run_representative_testing_by_function(const trace &t, function_to_
     bio::tee_device<ostream, ofstream> tout_dev(cout, info);
     bio::stream<bio::tee_device<ostream, ofstream>> tout(tout_dev);
 
+    // Crash states are tested concurrently unless they share one pmdir
+    bool parallel = config_enabled("general.parallelize") && !config_enabled("general.same_pmdir");
+
+    // Report finished tests until at most max_pending are left. Waits for
+    // the next test to finish rather than on any particular one.
+    auto collect_results = [&] (size_t max_pending) {
+        while (global_idx_to_state_and_res.size() > max_pending) {
+            uint64_t seen = checker.tests_completed();
+            for (auto it = global_idx_to_state_and_res.begin(); it != global_idx_to_state_and_res.end(); ) {
+                if (it->second.second.wait_for(chrono::seconds(0)) != future_status::ready) {
+                    ++it;
+                    continue;
+                }
+                int id = it->first;
+                auto code = it->second.second.get();
+                auto &function_and_idx = global_idx_to_function_and_idx[id];
+                string function = get<0>(function_and_idx);
+                int test_idx = get<1>(function_and_idx);
+                int instance_idx = get<2>(function_and_idx);
+                if (has_bugs(code)) {
+                    tout << id << "| Function " << function << " test "<< test_idx <<" instance " << instance_idx <<" is crash-inconsistent!" << endl;
+                    inconsistent_instances.push_back(make_tuple(id, test_idx));
+                } else {
+                    tout << id << "| Function " << function << " test "<< test_idx <<" instance " << instance_idx <<" is crash-consistent!" << endl;
+                }
+                global_idx_to_function_and_idx.erase(id);
+                it = global_idx_to_state_and_res.erase(it);
+            }
+            if (global_idx_to_state_and_res.size() > max_pending) {
+                checker.wait_for_tests(seen);
+            }
+        }
+    };
+
     for (auto &p : fmap) {
         string function = p.first;
         vector<update_mechanism_group> &groups = p.second;
@@ -1603,13 +1678,13 @@ void engine::run_representative_testing_by_function(const trace &t, function_to_
         int instance_idx = 0;
         for (auto &group : groups) {
             update_mechanism representative = group.front();
-            const_property_map pmap = boost::get(pnode_property_t(), pg_->whole_program_graph());
+            const csr_graph &nodes = pg_->csr();
             tout << "vertex:event ";
             // check if in the representative, all the events have no micro events
             // If so, that (probably) means this test is meaningless and we should skip (i.e. contains only open/close calls)
             bool valueable = false;
             for (auto &vertex : representative) {
-                const posix_node *node = dynamic_cast<const posix_node*>(boost::get(pmap, vertex));
+                const posix_node *node = dynamic_cast<const posix_node*>(nodes.node(vertex));
                 tout << vertex << ":" << node->event()->event_idx() << " ";
                 assert(node->event()->micro_events);
                 if (node->event()->micro_events->size() > 0) {
@@ -1639,6 +1714,37 @@ void engine::run_representative_testing_by_function(const trace &t, function_to_
             // }
             // instance_idx++;
 
+            // Runs one crash state as its own test, set up until event min_idx.
+            auto run_event_order = [&] (const vector<int> &event_order, int min_idx) {
+                // TODO: if this is invalid set of all_event_orders, skip it
+                // we may produce invalid orders since we do not split by timestamp
+                if (min_idx == INT_MAX) {
+                    tout << "Invalid set of all_event_orders in function " << function << " test "<< test_idx << " skip for now" << endl;
+                    test_idx++;
+                    return;
+                }
+                shared_ptr<model_checker_state> test = create_test(checker, event_order, min_idx);
+                if (!parallel) {
+                    shared_future<model_checker_code> res = checker.run_test(test);
+                    res.wait();
+                    auto code = res.get();
+                    if (has_bugs(code)) {
+                        tout << global_instance_idx << "| Function " << function << " test "<< test_idx <<" instance " << instance_idx <<" is crash-inconsistent!" << endl;
+                        inconsistent_instances.push_back(make_tuple(global_instance_idx, test_idx));
+                    } else {
+                        tout << global_instance_idx << "| Function " << function << " test "<< test_idx <<" instance " << instance_idx <<" is crash-consistent!" << endl;
+                    }
+                }
+                else {
+                    global_idx_to_function_and_idx[global_instance_idx] = make_tuple(function, test_idx, instance_idx);
+                    shared_future<model_checker_code> res = checker.run_test(test);
+                    global_idx_to_state_and_res[global_instance_idx] = make_pair(test, res);
+                    collect_results(checker.capacity());
+                }
+                instance_idx++;
+                global_instance_idx++;
+            };
+
             //TODO: currently file state restore has some issues, we will create one state for each ordering
             vector<vector<vector<int>>> vec_of_all_event_orders;
 
@@ -1661,7 +1767,7 @@ void engine::run_representative_testing_by_function(const trace &t, function_to_
                 vector<vector<int>> all_event_orders;
                 vector<int> event_order;
                 for (auto &v : representative) {
-                    const posix_node *node = dynamic_cast<const posix_node*>(boost::get(pmap, v));
+                    const posix_node *node = dynamic_cast<const posix_node*>(nodes.node(v));
                     event_order.push_back(node->event()->event_idx());
                     all_event_orders.push_back(event_order);
                 }
@@ -1676,114 +1782,35 @@ void engine::run_representative_testing_by_function(const trace &t, function_to_
                 vec_of_all_update_mechanisms_tested.push_back(representative);
             }
             else {
-                vector<set<set<vertex>>> vec_of_all_vertex_orders;
-                // set<set<vertex>> all_vertex_orders = pg_ptr->generate_all_orders(representative);
-                atomic<bool> cancel_flag(false);
-
-                auto future = async(launch::async, &persistence_graph::generate_all_orders, pg_ptr, representative, std::ref(cancel_flag));
-
-                // set<set<vertex>> all_vertex_orders;
+                // Crash states go to the model checker while they are still being
+                // enumerated; counting and Persevere only need the mechanisms.
+                bool run_tests = !config_enabled("general.count_crash_state") && !config_enabled("general.persevere");
+                auto consume = [&] (const vector<int> &event_order, int min_idx) {
+                    if (run_tests) run_event_order(event_order, min_idx);
+                };
                 int timeout_seconds = 5;
-        
 
-                if (future.wait_for(chrono::seconds(timeout_seconds)) == future_status::ready) {
+                if (stream_event_orders(*pg_ptr, representative, chrono::seconds(timeout_seconds), consume)) {
                     // Function completed within the timeout
                     vec_of_all_update_mechanisms_tested.push_back(representative);
-
-                    set<set<vertex>> all_vertex_orders = future.get();
-                    vec_of_all_vertex_orders.push_back(all_vertex_orders);
                     cout << "Function completed within the timeout." << endl;
-
-                    // if (config_enabled("general.count_crash_state")) {
-                    //     // crash state info
-                    //     get<0>(crash_state_info_instance) = all_vertex_orders.size();
-
-                    //     cancel_flag.store(false);
-
-                    //     // Launch an async task to compute crash states
-                    //     auto future_total = std::async(std::launch::async, [&]() {
-                    //         int sum = 0;
-                    //         for (auto &um : group) {
-                    //             // Check if we were cancelled
-                    //             if (cancel_flag.load()) {
-                    //                 break;
-                    //             }
-                    //             // Possibly update the "continuous update mechanism" first
-                    //             um = generate_continuous_update_mechanism(um);
-
-                    //             // compute the crash states for this update mechanism
-                    //             auto crash_states = pg_ptr->generate_all_orders(um, cancel_flag);
-                    //             sum += static_cast<int>(crash_states.size());
-                    //         }
-                    //         return sum;
-                    //     });
-
-                    //     int total_crash_states = 0;
-                    //     // Wait up to 1 minute for the result
-                    //     if (future_total.wait_for(std::chrono::minutes(1)) == std::future_status::timeout) {
-                    //         // Timed out -> set cancel_flag so the async task can stop
-                    //         cancel_flag.store(true);
-                    //         // Timed out: set result to representative size times group size
-                    //         cout << "Crash state calculation timed out, use representative size times group size as an approximation." << endl;
-                    //         total_crash_states = all_vertex_orders.size() * group.size();
-                    //     } else {
-                    //         // Completed within 1 minute
-                    //         total_crash_states = future_total.get();
-                    //     }
-
-                    //     get<1>(crash_state_info_instance) = total_crash_states;
-                    // }
-
                 } else {
-                    // Timeout occurred
+                    // Timeout occurred. Orders already handed to the checker
+                    // keep running, the rest of the representative is dropped.
                     cout << "Function timed out." << endl;
-                    // Optionally handle the timeout case here
-                    cancel_flag.store(true);
-                    future.wait();
-                    // skip this test
-                    // test_idx++;
                     // TODO: if timed out, chunk this region into smaller pieces, potentially overlapping
                     if (representative.size() >= UM_CHUNK_SIZE) {
-                        cancel_flag.store(false);
                         for (int i = 0; i < representative.size(); i += UM_CHUNK_GAP) {
                             int chunk_size = std::min(UM_CHUNK_SIZE, (int)representative.size() - i);
                             update_mechanism chunk(representative.begin() + i, representative.begin() + i + chunk_size);
-                            set<set<vertex>> chunk_vertex_orders = pg_ptr->generate_all_orders(chunk, cancel_flag);
-                            vec_of_all_vertex_orders.push_back(chunk_vertex_orders);
+                            stream_event_orders(*pg_ptr, chunk, chrono::seconds(0), consume);
                             vec_of_all_update_mechanisms_tested.push_back(chunk);
                         }
-                        // if (config_enabled("general.count_crash_state")) {
-                        //     // crash state info
-                        //     int representative_crash_states = 0;
-                        //     for (auto & avo : vec_of_all_vertex_orders) {
-                        //         representative_crash_states += avo.size();
-                        //     }
-                        //     // again, we cannot count the total crash states, so we approximate it by the crash states we tested times the group size
-                        //     get<0>(crash_state_info_instance) = representative_crash_states;
-                        //     get<1>(crash_state_info_instance) = representative_crash_states * group.size();
-                        // }
                     } else {
                         tout << "Function " << function << " test "<< test_idx << " is too large, skip for now" << endl;
                         test_idx++;
                         continue;
                     }
-                    // tout << "Function " << function << " test "<< test_idx << " is too large, skip for now" << endl;
-                    // test_idx++;
-                    // continue;
-                }
-                for (auto &all_vertex_orders : vec_of_all_vertex_orders) {
-                    vector<vector<int>> all_event_orders;
-                    for (auto &order : all_vertex_orders) {
-                        vector<int> event_order;
-                        for (auto &v : order) {
-                            const posix_node *node = dynamic_cast<const posix_node*>(boost::get(pmap, v));
-                            event_order.push_back(node->event()->event_idx());
-                        }
-                        // sort by event index
-                        std::sort(event_order.begin(), event_order.end());
-                        all_event_orders.push_back(event_order);
-                    }
-                    vec_of_all_event_orders.push_back(all_event_orders);
                 }
             }
 
@@ -1797,7 +1824,7 @@ void engine::run_representative_testing_by_function(const trace &t, function_to_
                     }
                     vector<int> event_order;
                     for (auto &v : um) {
-                        const posix_node *node = dynamic_cast<const posix_node*>(boost::get(pmap, v));
+                        const posix_node *node = dynamic_cast<const posix_node*>(nodes.node(v));
                         event_order.push_back(node->event()->event_idx());
                     }
                     // sort by event index
@@ -1819,7 +1846,11 @@ void engine::run_representative_testing_by_function(const trace &t, function_to_
                     int checker_test_id = checker.get_current_test_id();
                     assert (checker_test_id >= 0);
                     fs::path read_trace_path = output_dir_ / (std::to_string(checker_test_id) + "_0_0_pinout");
-                    assert (fs::exists(read_trace_path));
+                    // the observer can be killed before it writes anything out
+                    if (!fs::exists(read_trace_path)) {
+                        tout << "No recovery observer trace for test " << checker_test_id << " skip for now" << endl;
+                        continue;
+                    }
                     // read the trace
                     trace read_trace(config_enabled("general.selective_testing"), mode_);
                     read_trace.read_offline_trace(read_trace_path);
@@ -1838,7 +1869,7 @@ void engine::run_representative_testing_by_function(const trace &t, function_to_
                     }
                     update_mechanism new_um;
                     for (auto &v : um) {
-                        const posix_node *node = dynamic_cast<const posix_node*>(boost::get(pmap, v));
+                        const posix_node *node = dynamic_cast<const posix_node*>(nodes.node(v));
                         const shared_ptr<trace_event> &event = node->event();
                         if (event->file_path != "") {
                             // string file_name = event->file_path.substr(event->file_path.find_last_of("/")+1);
@@ -1885,101 +1916,24 @@ void engine::run_representative_testing_by_function(const trace &t, function_to_
                         }
                     }
 
-                    // TODO: if this is invalid set of all_event_orders, skip it
-                    // we may produce invalid orders since we do not split by timestamp
                     if (min_idx == INT_MAX) {
-                        tout << "Invalid set of all_event_orders in function " << function << " test "<< test_idx << " skip for now" << endl;
-                        test_idx++;
+                        run_event_order({}, min_idx);
                         continue;
                     }
 
-                    // if function contains RenameFile skip for now
-                    // if (function.find("RenameFile") != string::npos || function.find("Close") != string::npos) {
-                    //     tout << "Skip RenameFile & Close function " << function << " test "<< test_idx << endl;
-                    //     test_idx++;
-                    //     continue;
-                    // }
-                    // if (function.find("SetCurrentFile") == string::npos) {
-                    //     test_idx++;
-                    //     continue;
-                    // }
-
                     for (auto &event_order : all_event_orders) {
-                        shared_ptr<model_checker_state> test = create_test(checker, event_order, min_idx);
-                        if (!config_enabled("general.parallelize")) {
-                            shared_future<model_checker_code> res = checker.run_test(test);
-                            res.wait();
-                            auto code = res.get();
-                            if (has_bugs(code)) {
-                                tout << global_instance_idx << "| Function " << function << " test "<< test_idx <<" instance " << instance_idx <<" is crash-inconsistent!" << endl;
-                                inconsistent_instances.push_back(make_tuple(global_instance_idx, test_idx));
-                            } else {
-                                tout << global_instance_idx << "| Function " << function << " test "<< test_idx <<" instance " << instance_idx <<" is crash-consistent!" << endl;
-                            }
-                        }
-                        else {
-                            global_idx_to_function_and_idx[global_instance_idx] = make_tuple(function, test_idx, instance_idx);
-                            shared_future<model_checker_code> res = checker.run_test(test);
-                            global_idx_to_state_and_res[global_instance_idx] = make_pair(test, res);
-                            while (global_idx_to_state_and_res.size() > max_nproc_) {
-                                vector<int> ids;
-                                for (auto &p : global_idx_to_state_and_res) {
-                                    ids.push_back(p.first);
-                                }
-                                for (int id : ids) {
-                                    auto &p = global_idx_to_state_and_res[id];
-                                    if (p.second.wait_for(chrono::milliseconds(POLL_MILLIS)) == future_status::ready) {
-                                        auto code = p.second.get();
-                                        auto &function_and_idx = global_idx_to_function_and_idx[id];
-                                        string function = get<0>(function_and_idx);
-                                        int test_idx = get<1>(function_and_idx);
-                                        int instance_idx = get<2>(function_and_idx);
-                                        if (has_bugs(code)) {
-                                            tout << id << "| Function " << function << " test "<< test_idx <<" instance " << instance_idx <<" is crash-inconsistent!" << endl;
-                                            inconsistent_instances.push_back(make_tuple(id, test_idx));
-                                        } else {
-                                            tout << id << "| Function " << function << " test "<< test_idx <<" instance " << instance_idx <<" is crash-consistent!" << endl;
-                                        }
-                                        global_idx_to_state_and_res.erase(id);
-                                    }
-                                }
-                            }
-                        }
-                        instance_idx++;
-                        global_instance_idx++;
+                        run_event_order(event_order, min_idx);
                     }
                 }
             }
             test_idx++;
         }
     }
-    if (config_enabled("general.parallelize")) {
-        while (global_idx_to_state_and_res.size() > 0) {
-            vector<int> ids;
-            for (auto &p : global_idx_to_state_and_res) {
-                ids.push_back(p.first);
-            }
-            for (int id : ids) {
-                auto &p = global_idx_to_state_and_res[id];
-                if (p.second.wait_for(chrono::milliseconds(POLL_MILLIS)) == future_status::ready) {
-                    auto code = p.second.get();
-                    auto &function_and_idx = global_idx_to_function_and_idx[id];
-                    string function = get<0>(function_and_idx);
-                    int test_idx = get<1>(function_and_idx);
-                    int instance_idx = get<2>(function_and_idx);
-                    if (has_bugs(code)) {
-                        tout << id << "| Function " << function << " test "<< test_idx <<" instance " << instance_idx <<" is crash-inconsistent!" << endl;
-                        inconsistent_instances.push_back(make_tuple(id, test_idx));
-                    } else {
-                        tout << id << "| Function " << function << " test "<< test_idx <<" instance " << instance_idx <<" is crash-consistent!" << endl;
-                    }
-                    global_idx_to_state_and_res.erase(id);
-                }
-            }
-        }
-    }
+    collect_results(0);
     checker.join();
 
+    // in the order the tests were spawned, not the order they finished in
+    std::sort(inconsistent_instances.begin(), inconsistent_instances.end());
     tout<< "### Inconsistent Instance IDs ###" << endl;
     for (auto &p : inconsistent_instances) {
         tout << "Global instance id: " << get<0>(p) << " Test id: " << get<1>(p) << endl;
@@ -2038,6 +1992,15 @@ void engine::fill_args(
     boost::split(args, argstr, boost::is_space(), boost::token_compress_on);
 }
 
+void engine::set_daemon_readiness(
+    const jinja2::ValuesMap &vals, model_checker_state &state) const {
+    if (config_not_empty("test.daemon_ready_tmpl")) {
+        state.daemon_ready = daemon_readiness::parse(
+            resolve_config_value(vals, "test.daemon_ready_tmpl"),
+            chrono::seconds(config_int("test.daemon_ready_timeout")));
+    }
+}
+
 void engine::try_fill_args(
     const jinja2::ValuesMap &vals, list<string> &args, const char *key) const {
     if (config_not_empty(key)) {
@@ -2077,9 +2040,133 @@ shared_ptr<model_checker_state> engine::create_test(
         assert(!fs::exists(pmdir));
     }
 
-    return checker.create_state(pmfile, pmdir, event_idxs,
+    auto state = checker.create_state(pmfile, pmdir, event_idxs,
         setup_args, checker_args, daemon_args, cleanup_args,
         vals, pmcheck_vals_, start_time);
+    set_daemon_readiness(vals, *state);
+    return state;
+}
+
+shared_ptr<prefix_cache> engine::make_prefix_cache(const fs::path &output_dir) const {
+    if (mode_ != POSIX || config_int("general.prefix_snapshots") <= 0) return nullptr;
+    return make_shared<prefix_cache>(output_dir / "prefix_snapshots",
+        config_int("general.prefix_snapshot_interval"), config_int("general.prefix_snapshots"));
+}
+
+void engine::report_result_cache(ostream &os) const {
+    if (cached_results_) cached_results_->report(os);
+}
+
+content_hasher::digest_t engine::checker_fingerprint(void) const {
+    content_hasher h;
+    h.update(config_["test.checker_tmpl"].as<string>());
+    h.update(config_["test.daemon_tmpl"].as<string>());
+
+    auto vals = get_template_values(pmcheck_vals_.at("pmfile").asString());
+    list<string> args;
+    fill_args(vals, args, "test.checker_tmpl");
+    fs::path program(args.front());
+    if (!fs::exists(program)) program = bp::search_path(args.front());
+    if (program.empty() || !h.update_file(program)) {
+        cerr << "Error: could not read checker program " << args.front() << " for general.result_db\n";
+        exit(EXIT_FAILURE);
+    }
+    return h.digest();
+}
+
+result_db::fingerprint_t engine::fingerprint(
+    const pm_graph &graph,
+    const update_mechanism &mechanism,
+    const content_hasher::digest_t &checker) const {
+    content_hasher h;
+    h.update(checker.first);
+    h.update(checker.second);
+
+    const csr_graph &nodes = graph.csr();
+    unordered_map<vertex, uint64_t> position;
+    for (vertex v : mechanism) {
+        position.emplace(v, position.size());
+    }
+
+    // the direct csr edges would miss the ones implied by frontier compression
+    unordered_map<vertex, vector<uint64_t>> succs;
+    for (const auto &e : graph.edges_within(mechanism)) {
+        succs[e.first].push_back(position.at(e.second));
+    }
+
+    h.update((uint64_t)mechanism.size());
+    for (vertex v : mechanism) {
+        const shared_ptr<trace_event> &te = nodes.node(v)->event();
+        h.update((uint64_t)te->type);
+        h.update(te->size);
+        // binary addresses change with every build, so only source locations
+        h.update((uint64_t)te->stack.size());
+        for (const stack_frame &f : te->stack) {
+            h.update(f.function);
+            h.update(f.file);
+            h.update((uint64_t)f.line);
+        }
+
+        vector<uint64_t> &out = succs[v];
+        std::sort(out.begin(), out.end());
+        h.update((uint64_t)out.size());
+        for (uint64_t s : out) h.update(s);
+    }
+    return h.digest();
+}
+
+bool engine::stream_event_orders(
+    posix_graph &graph,
+    const update_mechanism &vertex_list,
+    chrono::seconds timeout,
+    const function<void(const vector<int>&, int)> &consume) {
+    bounded_queue<vector<int>> orders(config_int("general.order_queue_size"));
+    atomic<bool> cancel_flag(false);
+    atomic<bool> timed_out(false);
+    const csr_graph &nodes = graph.csr();
+
+    std::thread producer([&] {
+        chrono::steady_clock::duration busy(0);
+        auto last = chrono::steady_clock::now();
+        graph.for_each_order(vertex_list, cancel_flag, [&] (const vector<vertex> &order) {
+            busy += chrono::steady_clock::now() - last;
+            if (timeout.count() && busy > timeout) {
+                timed_out = true;
+                return false;
+            }
+            vector<int> event_order;
+            event_order.reserve(order.size());
+            for (vertex v : order) {
+                const posix_node *node = dynamic_cast<const posix_node*>(nodes.node(v));
+                event_order.push_back(node->event()->event_idx());
+            }
+            // sort by event index
+            std::sort(event_order.begin(), event_order.end());
+            // blocks while the checker is behind, which is not generation time
+            bool pushed = orders.push(std::move(event_order));
+            last = chrono::steady_clock::now();
+            return pushed;
+        });
+        orders.close();
+    });
+
+    int min_idx = INT_MAX;
+    bool first = true;
+    while (std::optional<vector<int>> event_order = orders.pop()) {
+        if (timed_out) break;
+        if (first) {
+            for (int idx : *event_order) {
+                min_idx = std::min(min_idx, idx);
+            }
+            first = false;
+        }
+        consume(*event_order, min_idx);
+    }
+    // unblocks the producer if we stopped early
+    orders.close();
+    producer.join();
+
+    return !timed_out;
 }
 
 shared_ptr<model_checker_state> engine::create_test(
@@ -2109,11 +2196,11 @@ shared_ptr<model_checker_state> engine::create_test(
     atomic<bool> cancel_flag(false);
     set<set<vertex>> all_vertex_orders = graph.generate_all_orders(vertex_vec, cancel_flag);
     vector<vector<int>> all_event_orders;
-    const_property_map pmap = boost::get(pnode_property_t(), graph.whole_program_graph());
+    const csr_graph &nodes = graph.csr();
     for (auto &order : all_vertex_orders) {
         vector<int> event_order;
         for (auto &v : order) {
-            const posix_node *node = dynamic_cast<const posix_node*>(boost::get(pmap, v));
+            const posix_node *node = dynamic_cast<const posix_node*>(nodes.node(v));
             event_order.push_back(node->event()->event_idx());
         }
         // sort by event index
@@ -2122,9 +2209,11 @@ shared_ptr<model_checker_state> engine::create_test(
     }
 
 
-    return checker.create_state(pmfile, pmdir, all_event_orders,
+    auto state = checker.create_state(pmfile, pmdir, all_event_orders,
         setup_args, checker_args, daemon_args, cleanup_args,
         vals, pmcheck_vals_, start_time);
+    set_daemon_readiness(vals, *state);
+    return state;
 }
 
 shared_ptr<model_checker_state> engine::create_test(
@@ -2152,9 +2241,11 @@ shared_ptr<model_checker_state> engine::create_test(
         assert(!fs::exists(pmdir));
     }
 
-    return checker.create_state(pmfile, pmdir, event_idxs,
+    auto state = checker.create_state(pmfile, pmdir, event_idxs,
         setup_args, checker_args, daemon_args, cleanup_args,
         vals, pmcheck_vals_, start_time, setup_until);
+    set_daemon_readiness(vals, *state);
+    return state;
 }
 
 shared_ptr<model_checker_state> engine::create_sanity_test(
@@ -2185,9 +2276,11 @@ shared_ptr<model_checker_state> engine::create_sanity_test(
         assert(!fs::exists(pmdir));
     }
 
-    return checker.create_state(pmfile, pmdir, event_idxs,
+    auto state = checker.create_state(pmfile, pmdir, event_idxs,
         setup_args, checker_args, daemon_args, cleanup_args,
         vals, pmcheck_vals_, start_time);
+    set_daemon_readiness(vals, *state);
+    return state;
 }
 
 
@@ -2285,7 +2378,13 @@ int engine::run(void) {
 
     if (config_enabled("general.sanity_test")) {
         model_checker checker(t, output_dir, chrono::seconds(config_int("test.timeout")), nullptr, PATHFINDER, mode_, op_tracing_);
+        checker.max_nproc = max_nproc_;
+        checker.test_queue_size = config_int("general.test_queue_size");
+        checker.forkservers = forkservers_;
+        checker.cached_results = cached_results_;
         checker.save_pm_images = config_enabled("test.save_pm_images");
+        checker.incremental_checkpoints = config_enabled("test.incremental_checkpoints");
+        checker.pmdir_snapshot = config_["general.pmdir_snapshot"].as<string>();
         checker.init_data = setup_file_data_;
 
         shared_ptr<model_checker_state> test = create_sanity_test(checker);
@@ -2318,7 +2417,8 @@ int engine::run(void) {
     if (config_["general.mode"].as<string>() == "posix") {
         bool decompose_syscall = config_enabled("general.decompose_syscall");
         start_time = system_clock::now();
-        pg_ = new posix_graph(t, output_dir, decompose_syscall);
+        pg_ = new posix_graph(t, output_dir, decompose_syscall,
+            config_enabled("general.posix_graph_sweep"), config_enabled("general.validate_posix_graph"));
         end_time = system_clock::now();
         tout << "Stage 2: Persistence graph generation takes "
              << duration_cast<seconds>(end_time - start_time).count() << " seconds\n";
@@ -2332,6 +2432,10 @@ int engine::run(void) {
             // split "[xxx],[xxx],[xxx]" into vector, each of it is a range of "[xxx]""
             boost::algorithm::split_regex(ranges, input, boost::regex("\\]\\s*,\\s*\\["));
             model_checker checker(t, output_dir, chrono::seconds(config_int("test.timeout")), pg_, PATHFINDER, mode_, op_tracing_);
+            checker.max_nproc = max_nproc_;
+            checker.test_queue_size = config_int("general.test_queue_size");
+            checker.forkservers = forkservers_;
+            checker.cached_results = cached_results_;
             for (auto range : ranges) {
                 // remove leading and trailing spaces
                 boost::algorithm::trim(range); 
@@ -2368,14 +2472,14 @@ int engine::run(void) {
                     v.push_back(pg_->get_vertex(t.events()[i]));
                 }
                 // call generator
-                const_property_map pmap = boost::get(pnode_property_t(), pg_->whole_program_graph());
+                const csr_graph &nodes = pg_->csr();
                 atomic<bool> cancel_flag(false);
                 set<set<vertex>> all_vertex_orders = pg_->generate_all_orders(v, cancel_flag);
                 vector<vector<int>> all_event_orders;
                 for (auto &order : all_vertex_orders) {
                     vector<int> event_order;
                     for (auto &v : order) {
-                        const posix_node *node = dynamic_cast<const posix_node*>(boost::get(pmap, v));
+                        const posix_node *node = dynamic_cast<const posix_node*>(nodes.node(v));
                         event_order.push_back(node->event()->event_idx());
                     }
                     // sort by event index
@@ -2390,19 +2494,29 @@ int engine::run(void) {
                         min_idx = std::min(min_idx, idx);
                     }
                 }
+                // Run the instances concurrently, reporting them in order
+                bool parallel = config_enabled("general.parallelize") && !config_enabled("general.same_pmdir");
+                size_t max_pending = parallel ? checker.capacity() : 0;
+                std::deque<shared_future<model_checker_code>> pending;
                 int test_idx = 0;
-                for (auto &event_order : all_event_orders) {
-                    shared_ptr<model_checker_state> test = create_test(checker, event_order, min_idx);
-                    shared_future<model_checker_code> res = checker.run_test(test);
-                    res.wait();
-                    auto code = res.get();
+                auto report_oldest = [&] () {
+                    auto code = pending.front().get();
+                    pending.pop_front();
                     if (has_bugs(code)) {
                         tout << "Instance " << test_idx <<" is crash-inconsistent!" << endl;
                     } else {
                         tout << "Instance " << test_idx <<" is crash-consistent!" << endl;
                     }
                     test_idx++;
+                };
+                for (auto &event_order : all_event_orders) {
+                    shared_ptr<model_checker_state> test = create_test(checker, event_order, min_idx);
+                    pending.push_back(checker.run_test(test));
+                    while (pending.size() > max_pending) report_oldest();
                 }
+                while (!pending.empty()) report_oldest();
+                report_result_cache(tout);
+                tout.flush();
 
                 // list<vertex> order;
                 // while (!(order = og->nextOrder()).empty()) {
@@ -2431,6 +2545,7 @@ int engine::run(void) {
         tout << "Stage 4: Representative testing by function takes "
              << duration_cast<seconds>(end_time - start_time).count() << " seconds\n";
         tout << "Total time: " << duration_cast<seconds>(end_time - start).count() << " seconds\n";
+        report_result_cache(tout);
         tout.flush();
 
     }
@@ -2449,7 +2564,12 @@ int engine::run(void) {
             analyze_trace(output_dir, *m, t);
             // return 0;
         }
-        pg_ = new pm_graph(*m, t, output_dir);
+        pg_ = new pm_graph(*m, t, output_dir, config_enabled("general.pm_graph_frontier"));
+        pg_->build_reachability_index(config_int("general.reachability_labels"),
+            config_enabled("general.parallelize"));
+        if (config_int("general.benchmark_has_path") > 0) {
+            pg_->benchmark_has_path(config_int("general.benchmark_has_path"), tout);
+        }
     }
 
 
@@ -2467,7 +2587,13 @@ int engine::run(void) {
     if (config_enabled("general.random_test")) {
         assert(config_["general.mode"].as<string>() == "pm" && "Random testing only works with pm mode now!");
         model_checker checker(t, output_dir, chrono::seconds(config_int("test.timeout")));
+        checker.max_nproc = max_nproc_;
+        checker.test_queue_size = config_int("general.test_queue_size");
+        checker.forkservers = forkservers_;
+        checker.cached_results = cached_results_;
         checker.save_pm_images = config_enabled("test.save_pm_images");
+        checker.incremental_checkpoints = config_enabled("test.incremental_checkpoints");
+        checker.pmdir_snapshot = config_["general.pmdir_snapshot"].as<string>();
         checker.init_data = setup_file_data_;
 
         int total_tests = 0;
@@ -2482,6 +2608,7 @@ int engine::run(void) {
         tout << "\nTotal random tests: " << total_tests << "\n";
         tout << "Bugs found in random testing: " << num_bugs << "/" << total_tests << "\n";
         tout << "\nTotal time: " << (testing_end - start) / 1s << " seconds" << endl;
+        report_result_cache(tout);
 
         tout.flush();
         tout.close();
@@ -2608,7 +2735,13 @@ int engine::run(void) {
      *
      */
     model_checker checker(t, output_dir, chrono::seconds(config_int("test.timeout")));
+    checker.max_nproc = max_nproc_;
+    checker.test_queue_size = config_int("general.test_queue_size");
+    checker.forkservers = forkservers_;
+    checker.cached_results = cached_results_;
     checker.save_pm_images = config_enabled("test.save_pm_images");
+    checker.incremental_checkpoints = config_enabled("test.incremental_checkpoints");
+    checker.pmdir_snapshot = config_["general.pmdir_snapshot"].as<string>();
     checker.init_data = setup_file_data_;
 
     bool do_followup_testing = config_enabled("general.do_followup_testing");
@@ -2646,11 +2779,11 @@ int engine::run(void) {
      * covered stack locations. If so, skip it, and add to the "skipped" list.
      */
 
-    set<vector<stack_frame>> covered_locations;
-    const_property_map pmap = boost::get(pnode_property_t(), graph.whole_program_graph());
+    unordered_set<interned_stack, interned_stack_hash> covered_locations;
+    const csr_graph &nodes = graph.csr();
     size_t skip_covered = 0;
     auto get_stack = [&] (vertex v) {
-        const pm_node *p = dynamic_cast<const pm_node*>(boost::get(pmap, v));
+        const pm_node *p = dynamic_cast<const pm_node*>(nodes.node(v));
         assert(p && "Node is null!");
         return p->event()->stack;
     };
@@ -2705,10 +2838,38 @@ int engine::run(void) {
 
     std::sort(begin(rep_vec), end(rep_vec), sort_um);
 
+    // Outcomes from earlier runs. Representatives known to be consistent are
+    // skipped along with their followups; known bugs are tested again.
+    std::unique_ptr<result_db> db;
+    content_hasher::digest_t checker_fp;
+    unordered_map<uint64_t, result_db::fingerprint_t> rep_fps;
+    if (config_not_empty("general.result_db")) {
+        db.reset(new result_db(config_["general.result_db"].as<string>()));
+        checker_fp = checker_fingerprint();
+    }
+    auto record_rep = [&] (uint64_t id, model_checker_code code) {
+        if (!db) return;
+        db->record(rep_fps.at(id), has_bugs(code) ? result_db::INCONSISTENT : result_db::CONSISTENT);
+    };
+
     for (const auto &rep: rep_vec) {
         const Type *t = rep_to_type[rep];
         const update_mechanism_group &g = *rep_to_group[rep];
 
+        if (db) {
+            result_db::fingerprint_t fp = fingerprint(graph, rep, checker_fp);
+            if (!do_fn_testing && db->lookup(fp) == result_db::CONSISTENT) {
+                tout << "Skipping " << get_type_name(t) << " at range ["
+                     << graph.get_event_idx(rep.front()) << ", "
+                     << graph.get_event_idx(rep.back()) << "), consistent in an earlier run"
+                     << endl;
+                db->count_skipped();
+                followup_skipped += g.size() - 1;
+                continue;
+            }
+            rep_fps[rep_id] = fp;
+        }
+
         tout << "Setting up test ID=" << nrep_tests << " for " <<
             get_type_name(t) << " at range ["
              << graph.get_event_idx(rep.front()) << ", "
@@ -2731,6 +2892,7 @@ int engine::run(void) {
         if (!config_enabled("general.parallelize")) {
             res.wait();
             auto code = res.get();
+            record_rep(rep_id, code);
             if (has_bugs(code)) {
                 rep_bugs++;
                 do_followup_testing = do_followup_testing && !all_inconsistent(code);
@@ -2745,7 +2907,7 @@ int engine::run(void) {
         } else {
             rep_states[rep_id] = test;
             rep_tests[rep_id] = res;
-            while (rep_states.size() > max_nproc_) {
+            while (rep_states.size() > checker.capacity()) {
                 list<uint64_t> keys;
                 for (const auto &p : rep_tests) {
                     keys.push_back(p.first);
@@ -2759,6 +2921,7 @@ int engine::run(void) {
                     auto status = old_res.wait_for(chrono::milliseconds(POLL_MILLIS));
                     if (status != future_status::ready) continue;
                     auto code = old_res.get();
+                    record_rep(key, code);
                     if (has_bugs(code)) {
                         rep_bugs++;
                         do_followup_testing = do_followup_testing && !all_inconsistent(code);
@@ -2831,6 +2994,7 @@ int engine::run(void) {
             }
 
             auto code = res.get();
+            record_rep(key, code);
             if (has_bugs(code)) {
                 rep_bugs++;
                 do_followup_testing = do_followup_testing && !all_inconsistent(code);
@@ -2852,7 +3016,7 @@ int engine::run(void) {
 
             // -- Skip all the ones that are already covered.
             while (!pending_followups.empty() &&
-                followup_states.size() + rep_tests.size() < max_nproc_)
+                followup_states.size() + rep_tests.size() < checker.capacity())
             {
                 while (!pending_followups.empty() && is_covered(pending_followups.front())) {
                     skip_covered++;
@@ -2866,7 +3030,7 @@ int engine::run(void) {
                     shared_ptr<model_checker_state> f_test = create_test(
                         checker, graph, f);
                     shared_future<model_checker_code> f_res =
-                        checker.run_test(f_test);
+                        checker.run_test(f_test, FOLLOWUP_TEST);
                     nfollowup_tests++;
 
                     followup_states.push_back(f_test);
@@ -2957,7 +3121,7 @@ int engine::run(void) {
             }
 
             shared_ptr<model_checker_state> test = create_test(checker, graph, mech);
-            shared_future<model_checker_code> res = checker.run_test(test);
+            shared_future<model_checker_code> res = checker.run_test(test, FOLLOWUP_TEST);
             nfollowup_tests++;
 
             if (!config_enabled("general.parallelize")) {
@@ -2973,7 +3137,7 @@ int engine::run(void) {
                     << skip_covered << "; already covered)...\n";
                 tout.flush();
 
-                while (followup_tests.size() > max_nproc_) {
+                while (followup_tests.size() > checker.capacity()) {
                     list<shared_ptr<model_checker_state>> remaining_states;
                     list<shared_future<model_checker_code>> remaining_tests;
 
@@ -3069,6 +3233,8 @@ int engine::run(void) {
     tout << "\t\tFollowup tesing: " << (testing_end - followup_start) / 1s <<
         " seconds" << endl;
     tout << "\n\tSkipped for coverage: " << skip_covered << endl;
+    report_result_cache(tout);
+    if (db) db->report(tout);
 
     tout << "***************************************************************\n";
     tout << "Representatives tests: " << nrep_tests << endl;
@@ -3112,7 +3278,14 @@ int engine::run_baseline_testing(
     }
 
     model_checker checker(t, output_dir, chrono::seconds(config_int("test.timeout")), pg_, ttype, mode_, op_tracing_);
+    checker.max_nproc = max_nproc_;
+    checker.test_queue_size = config_int("general.test_queue_size");
+    checker.forkservers = forkservers_;
+    checker.cached_results = cached_results_;
+    checker.prefix_snapshots = make_prefix_cache(output_dir);
     checker.save_pm_images = config_enabled("test.save_pm_images");
+    checker.incremental_checkpoints = config_enabled("test.incremental_checkpoints");
+    checker.pmdir_snapshot = config_["general.pmdir_snapshot"].as<string>();
     checker.baseline_timeout = chrono::minutes(config_int("general.baseline_timeout"));
     checker.init_data = setup_file_data_;
 
@@ -3124,8 +3297,9 @@ int engine::run_baseline_testing(
 
     // init graph objects
     bool decompose_syscall = config_enabled("general.decompose_syscall");
-    pg_ = new posix_graph(t, output_dir, decompose_syscall);
-    const_property_map pmap = boost::get(pnode_property_t(), pg_->whole_program_graph());
+    pg_ = new posix_graph(t, output_dir, decompose_syscall,
+        config_enabled("general.posix_graph_sweep"), config_enabled("general.validate_posix_graph"));
+    const csr_graph &nodes = pg_->csr();
     posix_graph *pg_ptr = dynamic_cast<posix_graph*>(pg_);
 
     // global instance idx to start_idx, end_idx, and instance_idx
@@ -3238,7 +3412,7 @@ loop_end:
                 // just do linear order for now if the size is too big
                 vector<int> event_order;
                 for (auto &v : v) {
-                    const posix_node *node = dynamic_cast<const posix_node*>(boost::get(pmap, v));
+                    const posix_node *node = dynamic_cast<const posix_node*>(nodes.node(v));
                     event_order.push_back(node->event()->event_idx());
                     all_event_orders.push_back(event_order);
                 }
@@ -3248,7 +3422,7 @@ loop_end:
                 for (auto &order : all_vertex_orders) {
                     vector<int> event_order;
                     for (auto &v : order) {
-                        const posix_node *node = dynamic_cast<const posix_node*>(boost::get(pmap, v));
+                        const posix_node *node = dynamic_cast<const posix_node*>(nodes.node(v));
                         event_order.push_back(node->event()->event_idx());
                     }
                     // sort by event index
@@ -3282,7 +3456,7 @@ loop_end:
                     global_idx_to_range_and_idx[ntest] = make_tuple(start_idx, end_idx, instance_idx);
                     shared_future<model_checker_code> res = checker.run_test(test);
                     global_idx_to_state_and_res[ntest] = make_pair(test, res);
-                    while (global_idx_to_state_and_res.size() > max_nproc_) {
+                    while (global_idx_to_state_and_res.size() > checker.capacity()) {
                         vector<int> ids;
                         for (auto &p : global_idx_to_state_and_res) {
                             ids.push_back(p.first);
@@ -3327,7 +3501,7 @@ loop_end:
                 global_idx_to_range_and_idx[ntest] = make_tuple(end_idx, end_idx, 0);
                 shared_future<model_checker_code> res = checker.run_test(test);
                 global_idx_to_state_and_res[ntest] = make_pair(test, res);
-                while (global_idx_to_state_and_res.size() > max_nproc_) {
+                while (global_idx_to_state_and_res.size() > checker.capacity()) {
                     vector<int> ids;
                     for (auto &p : global_idx_to_state_and_res) {
                         ids.push_back(p.first);
@@ -3418,6 +3592,7 @@ loop_end:
     tout << "\nTotal time: " << (end_time - start_time) / 1s << " seconds" << endl;
 
     checker.join();
+    report_result_cache(tout);
     tout.flush();
     tout.close();
 
@@ -3436,9 +3611,7 @@ int engine::run_random_testing(
     // then, after testing each node, remove it from the vector
     vector<vertex> verts;
 
-    graph_type::vertex_iterator it, end;
-    for (boost::tie(it, end) = boost::vertices(graph.whole_program_graph()); it != end; ++it) {
-        const vertex &v = *it;
+    for (vertex v = 0; v < graph.csr().num_vertices(); ++v) {
         verts.push_back(v);
     }
 
@@ -3469,7 +3642,7 @@ int engine::run_random_testing(
         } else {
             id_to_test[total_tests] = test;
             id_to_res[total_tests] = res;
-            while (id_to_test.size() > max_nproc_) {
+            while (id_to_test.size() > checker.capacity()) {
                 list<int> finish_ids;
                 for (auto iter : id_to_res) {
                     shared_future<model_checker_code> old_res = iter.second;
@@ -3559,10 +3732,10 @@ void engine::output_groups(fs::path output_dir, const pm_graph &graph, const std
     // header
     f << "group_id,group_representative,group_members\n";
 
-    const_property_map pmap = boost::get(pnode_property_t(), graph.whole_program_graph());
+    const csr_graph &nodes = graph.csr();
 
     auto get_store_id = [&] (vertex v) {
-        const pm_node *p = dynamic_cast<const pm_node*>(boost::get(pmap, v));
+        const pm_node *p = dynamic_cast<const pm_node*>(nodes.node(v));
         assert(p && "Node is null!");
         return p->event()->store_id();
     };
@@ -25,6 +25,8 @@
 #include "../utils/common.hpp"
 #include "../utils/util.hpp"
 #include "../model_checker/model_checker.hpp"
+#include "../model_checker/result_cache.hpp"
+#include "../runtime/result_db.hpp"
 #include "../graph/persistence_graph.hpp"
 #include "../graph/pm_graph.hpp"
 #include "../graph/posix_graph.hpp"
@@ -89,6 +91,12 @@ class engine {
 
     int max_nproc_;
 
+    // Checker fork servers, kept across model checkers. Null unless test.forkserver
+    std::shared_ptr<forkserver_pool> forkservers_;
+
+    // Checker results by crash state, across model checkers. Null unless test.result_cache
+    std::shared_ptr<result_cache> cached_results_;
+
     int max_um_size_;
 
     pathfinder_mode mode_;
@@ -143,7 +151,7 @@ class engine {
      */
     std::vector<update_mechanism> split_by_epochs(
         const llvm::Type *instance_type,
-        const graph_type &g,
+        const pm_graph &pg,
         const std::vector<vertex> &iverts) const;
 
     /**
@@ -155,7 +163,7 @@ class engine {
      */
     std::vector<update_mechanism_group> group_by_representative_in_type(
         const llvm::Type *t,
-        const graph_type &g,
+        const pm_graph &pg,
         std::vector<update_mechanism> &mechanisms) const;
 
     /**
@@ -214,6 +222,24 @@ class engine {
      */
     void run_representative_testing_by_function(const trace &t, function_to_group_of_um_group &fmap);
 
+    /**
+     * @brief For POSIX. Feed the crash states of vertex_list to consume while they are still being generated.
+     *
+     * Generation runs on its own thread and is at most general.order_queue_size
+     * orders ahead of consume, so memory does not grow with the number of
+     * crash states. The first order is the whole subgraph, so its smallest
+     * event index (the setup point) is known before any test starts.
+     *
+     * @param timeout Stop after generating for this long, not counting time spent waiting on consume. Zero for no limit.
+     * @param consume Called with each event order (sorted) and the setup point
+     * @return false if generation timed out
+     */
+    bool stream_event_orders(
+        posix_graph &graph,
+        const update_mechanism &vertex_list,
+        std::chrono::seconds timeout,
+        const std::function<void(const std::vector<int>&, int)> &consume);
+
     /**
      * @brief For PM and MMIO. Create a test object using the templated configuration. 
      *
@@ -240,6 +266,34 @@ class engine {
         posix_graph &graph,
         std::vector<vertex> &vertex_vec);
 
+    /**
+     * @brief For POSIX. The prefix snapshot cache for a model checker, or nullptr if general.prefix_snapshots is 0.
+     *
+     * @param output_dir Where the snapshot images are kept
+     */
+    std::shared_ptr<prefix_cache> make_prefix_cache(const boost::filesystem::path &output_dir) const;
+
+    /**
+     * @brief Print the result cache statistics, if test.result_cache is on.
+     */
+    void report_result_cache(std::ostream &os) const;
+
+    /**
+     * @brief For general.result_db. Hash of the checker program and the
+     * checker and daemon command templates.
+     */
+    content_hasher::digest_t checker_fingerprint(void) const;
+
+    /**
+     * @brief For general.result_db. Identifies a representative across runs
+     * by the source locations and types of its events, the edges between
+     * them, and the checker.
+     */
+    result_db::fingerprint_t fingerprint(
+        const pm_graph &graph,
+        const update_mechanism &mechanism,
+        const content_hasher::digest_t &checker) const;
+
     /**
      * @brief For exhaustive testing, create a test object specified by index range.
      *
@@ -269,6 +323,11 @@ class engine {
     bool config_is_empty(const char *key) const { return !config_not_empty(key); }
     int config_int(const char *key) const { return config_[key].as<int>(); }
 
+    // fill in how the test daemon signals it is ready
+    void set_daemon_readiness(
+        const jinja2::ValuesMap &vals,
+        model_checker_state &state) const;
+
     void try_fill_args(
         const jinja2::ValuesMap &vals,
         std::list<std::string> &args,
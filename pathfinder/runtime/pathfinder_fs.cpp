@@ -608,5 +608,31 @@ void pathfinder_fs::reset_state() {
   open_managed_files_.clear();
   filesystem_active_ = true;
 }
+
+void pathfinder_fs::rebase(const std::string& from, const std::string& to) {
+  auto moved = [&](const std::string& f) {
+    if (f.compare(0, from.size(), from) != 0) return f;
+    return to + f.substr(from.size());
+  };
+
+  std::map<std::string, file_state> file_state;
+  for (auto& p : db_file_state_) {
+    p.second.filename_ = moved(p.second.filename_);
+    file_state[moved(p.first)] = p.second;
+  }
+  db_file_state_ = std::move(file_state);
+
+  std::set<std::string> open_files;
+  for (const auto& f : open_managed_files_) {
+    open_files.insert(moved(f));
+  }
+  open_managed_files_ = std::move(open_files);
+
+  std::unordered_map<std::string, std::set<std::string>> new_files;
+  for (auto& p : dir_to_new_files_since_last_sync_) {
+    new_files[moved(p.first)] = std::move(p.second);
+  }
+  dir_to_new_files_since_last_sync_ = std::move(new_files);
+}
   
 }  // namespace pathfinder
@@ -1,3 +1,5 @@
+#pragma once
+
 // Adapted from RocksDB's fault injection fs. The filesystem wrapper keeps track of the state of a filesystem as of
 // the last "sync". It then checks for data loss errors by purposely dropping
 // file data (or entire files) not protected by a "sync".
@@ -284,6 +286,10 @@ class pathfinder_fs {
 
   void reset_state();
 
+  // Replace the leading `from` of every tracked path with `to`, for moving
+  // the state to another directory.
+  void rebase(const std::string& from, const std::string& to);
+
  private:
   // port::Mutex mutex_;
   std::map<std::string, file_state> db_file_state_;
@@ -0,0 +1,92 @@
+#include "result_db.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+
+namespace fs = boost::filesystem;
+using namespace std;
+
+namespace pathfinder {
+
+static const char *outcome_str(result_db::outcome o) {
+    return o == result_db::CONSISTENT ? "consistent" : "inconsistent";
+}
+
+result_db::result_db(const fs::path &path) : path_(path) {
+    ifstream in(path.string());
+    string line;
+    while (std::getline(in, line)) {
+        // a run that died mid-write may leave a partial last line
+        uint64_t first, second;
+        char o[16];
+        if (sscanf(line.c_str(), "%16" SCNx64 "%16" SCNx64 " %15s", &first, &second, o) != 3) continue;
+        if (!strcmp(o, "consistent")) {
+            known_[{first, second}] = CONSISTENT;
+        } else if (!strcmp(o, "inconsistent")) {
+            known_[{first, second}] = INCONSISTENT;
+        } else {
+            continue;
+        }
+        loaded_++;
+    }
+
+    fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ == -1) {
+        cerr << "Could not open result database " << path.string() << ": " << strerror(errno) << "\n";
+        exit(EXIT_FAILURE);
+    }
+    // end a partial last line, so our first record does not run into it
+    int rfd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    off_t size = lseek(rfd, 0, SEEK_END);
+    char last = '\n';
+    if (size > 0 && pread(rfd, &last, 1, size - 1) == 1 && last != '\n') {
+        (void)!write(fd_, "\n", 1);
+    }
+    close(rfd);
+}
+
+result_db::~result_db() {
+    if (fd_ != -1) close(fd_);
+}
+
+result_db::outcome result_db::lookup(const fingerprint_t &fp) {
+    lock_guard<mutex> lock(mtx_);
+    auto it = known_.find(fp);
+    return it == known_.end() ? UNKNOWN : it->second;
+}
+
+void result_db::record(const fingerprint_t &fp, outcome o) {
+    char line[128];
+    int n = snprintf(line, sizeof(line), "%016" PRIx64 "%016" PRIx64 " %s %lld\n",
+        fp.first, fp.second, outcome_str(o), (long long)time(nullptr));
+
+    lock_guard<mutex> lock(mtx_);
+    known_[fp] = o;
+    recorded_++;
+    // one write per record, so concurrent runs sharing the file do not interleave
+    if (write(fd_, line, n) != n) {
+        cerr << "Could not write to result database " << path_.string() << ": " << strerror(errno) << "\n";
+    }
+}
+
+void result_db::count_skipped(void) {
+    lock_guard<mutex> lock(mtx_);
+    skipped_++;
+}
+
+void result_db::report(ostream &os) {
+    lock_guard<mutex> lock(mtx_);
+    os << "Result database " << path_.string() << ": " << loaded_ << " records loaded, "
+       << skipped_ << " representatives skipped as known consistent, "
+       << recorded_ << " outcomes recorded\n";
+}
+
+}
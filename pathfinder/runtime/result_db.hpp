@@ -0,0 +1,60 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "../utils/content_hash.hpp"
+
+namespace pathfinder {
+
+/**
+ * @brief Representative test outcomes kept across runs, so re-runs after a
+ * small change to the application only test what changed.
+ *
+ * The database is a text file with one "<fingerprint> <outcome> <time>"
+ * record per line, appended as tests finish. Later records win. It is loaded
+ * once when opened.
+ */
+class result_db {
+public:
+    typedef content_hasher::digest_t fingerprint_t;
+
+    enum outcome {
+        UNKNOWN, CONSISTENT, INCONSISTENT
+    };
+
+private:
+    std::mutex mtx_;
+    boost::filesystem::path path_;
+    int fd_ = -1;
+    std::map<fingerprint_t, outcome> known_;
+    uint64_t loaded_ = 0;
+    uint64_t skipped_ = 0;
+    uint64_t recorded_ = 0;
+
+public:
+    /**
+     * @brief Open (or create) the database at path. Exits on errors.
+     */
+    explicit result_db(const boost::filesystem::path &path);
+    ~result_db();
+
+    outcome lookup(const fingerprint_t &fp);
+
+    /**
+     * @brief Store the outcome of a test, on disk right away.
+     */
+    void record(const fingerprint_t &fp, outcome o);
+
+    /**
+     * @brief Count a test that was not run because of lookup.
+     */
+    void count_skipped(void);
+
+    void report(std::ostream &os);
+};
+
+}
@@ -24,7 +24,7 @@ namespace pathfinder
         if(!_tree.is_valid(it)) return;
         int rootdepth=_tree.depth(it);
         log_file << "-----" << endl;
-        const_property_map pmap = boost::get(pnode_property_t(), _pg.whole_program_graph());
+        const csr_graph &nodes = _pg.csr();
         while(it != end) {
             log_file << "D" << _tree.depth(it) - rootdepth << " ";
             for(int i = 0; i<_tree.depth(it) - rootdepth; ++i) 
@@ -39,7 +39,7 @@ namespace pathfinder
                     log_file << "#Update protocol " << i << endl;
                     for (int j = 0; j < umg[i].size(); ++j) {
                         // get source code line first
-                        const posix_node *node = dynamic_cast<const posix_node*>(boost::get(pmap, umg[i][j]));
+                        const posix_node *node = dynamic_cast<const posix_node*>(nodes.node(umg[i][j]));
                         shared_ptr<trace_event> event = node->event();
                         int line = -1;
                         string file;
@@ -0,0 +1,57 @@
+#include "../trace/binary_trace.hpp"
+#include "../trace/trace.hpp"
+#include "test_util.hpp"
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace fs = boost::filesystem;
+using namespace std;
+using namespace pathfinder;
+
+static vector<string> dump(const trace &t) {
+    vector<string> res;
+    for (const auto &te : t.events()) {
+        stringstream ss;
+        ss << te->timestamp << "," << te->store_num << "," << te->write_num
+            << "," << t.within_testing_range(te) << "," << te->str();
+        for (const stack_frame &sf : te->backtrace()) ss << "|" << sf.str();
+        res.push_back(ss.str());
+    }
+    return res;
+}
+
+// Saving a parsed trace in the binary format and loading it back must give
+// the same events, with the same payloads and stacks.
+int main(int argc, char *argv[]) {
+    CHECK(argc == 2);
+    fs::path text_path(argv[1]);
+    CHECK(!is_binary_trace(text_path));
+
+    trace text(false, POSIX);
+    text.read_offline_trace(text_path);
+    CHECK(!text.events().empty());
+
+    scratch_dir out;
+    fs::path bin_path = out.path() / ("tracer" BINARY_TRACE_EXT);
+    text.write_binary_trace(bin_path);
+    CHECK(is_binary_trace(bin_path));
+
+    trace bin(false, POSIX);
+    bin.read_offline_trace(bin_path);
+    CHECK_EQ(bin.events().size(), text.events().size());
+    CHECK_EQ(bin.stores().size(), text.stores().size());
+    CHECK(dump(bin) == dump(text));
+
+    // and once more, from the loaded copy
+    fs::path again_path = out.path() / ("again" BINARY_TRACE_EXT);
+    bin.write_binary_trace(again_path);
+    trace again(false, POSIX);
+    again.read_offline_trace(again_path);
+    CHECK(dump(again) == dump(text));
+
+    cout << text.events().size() << " events, " << fs::file_size(text_path)
+        << " -> " << fs::file_size(bin_path) << " bytes: ok" << endl;
+    return 0;
+}
@@ -0,0 +1,114 @@
+#include "../utils/content_hash.hpp"
+#include "test_util.hpp"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace fs = boost::filesystem;
+using namespace std;
+using namespace pathfinder;
+
+static uint64_t xxh64_of(const string &s, uint64_t seed=0) {
+    xxh64 h(seed);
+    h.update(s.data(), s.size());
+    return h.digest();
+}
+
+static void write_file(const fs::path &p, const string &contents) {
+    ofstream(p.string(), ios::binary) << contents;
+}
+
+static content_hasher::digest_t tree_digest(const fs::path &dir) {
+    content_hasher h;
+    CHECK(h.update_tree(dir));
+    return h.digest();
+}
+
+// a small tree like a pmdir: nested files, an empty file and a symlink
+static void make_tree(const fs::path &dir) {
+    fs::create_directories(dir / "sub");
+    write_file(dir / "CURRENT", "MANIFEST-000001\n");
+    write_file(dir / "sub" / "000003.log", string(5000, 'x'));
+    write_file(dir / "LOCK", "");
+    fs::create_symlink("CURRENT", dir / "link");
+}
+
+int main(void) {
+    // reference values of XXH64
+    CHECK_EQ(xxh64_of(""), 0xEF46DB3751D8E999ull);
+    CHECK_EQ(xxh64_of("a"), 0xD24EC4F1A98C6E5Bull);
+    CHECK_EQ(xxh64_of("abc"), 0x44BC2CF5AD770999ull);
+    CHECK_EQ(xxh64_of("Nobody inspects the spammish repetition"), 0xFBCEA83C8A378BF1ull);
+
+    // streaming in any chunks gives the one-shot digest
+    mt19937 rng(1);
+    string data(1000, '\0');
+    for (char &c : data) c = (char)rng();
+    for (uint64_t seed : {0ull, 1ull, 0x9e3779b97f4a7c15ull}) {
+        for (size_t len : {0u, 1u, 31u, 32u, 33u, 64u, 100u, 1000u}) {
+            string s = data.substr(0, len);
+            for (int i = 0; i < 20; i++) {
+                xxh64 h(seed);
+                for (size_t off = 0; off < len; ) {
+                    size_t n = std::min<size_t>(len - off, rng() % 40);
+                    h.update(s.data() + off, n);
+                    off += n;
+                }
+                CHECK_EQ(h.digest(), xxh64_of(s, seed));
+            }
+        }
+    }
+    CHECK(xxh64_of(data, 0) != xxh64_of(data, 1));
+
+    // strings are length-prefixed
+    content_hasher ab_c, a_bc;
+    ab_c.update(string("ab"));
+    ab_c.update(string("c"));
+    a_bc.update(string("a"));
+    a_bc.update(string("bc"));
+    CHECK(ab_c.digest() != a_bc.digest());
+
+    scratch_dir scratch;
+    fs::path a = scratch.path() / "a", b = scratch.path() / "b";
+    make_tree(a);
+    make_tree(b);
+    // equal trees, wherever they are and whenever they were written
+    CHECK(tree_digest(a) == tree_digest(b));
+
+    // file contents
+    auto base = tree_digest(a);
+    write_file(b / "sub" / "000003.log", string(4999, 'x') + "y");
+    CHECK(tree_digest(b) != base);
+    write_file(b / "sub" / "000003.log", string(5000, 'x'));
+    CHECK(tree_digest(b) == base);
+
+    // permissions
+    CHECK(!chmod((b / "LOCK").c_str(), 0600));
+    CHECK(!chmod((a / "LOCK").c_str(), 0644));
+    CHECK(tree_digest(b) != tree_digest(a));
+    CHECK(!chmod((b / "LOCK").c_str(), 0644));
+    CHECK(tree_digest(b) == base);
+
+    // names
+    fs::rename(b / "LOCK", b / "LOCK2");
+    CHECK(tree_digest(b) != base);
+    fs::rename(b / "LOCK2", b / "LOCK");
+    CHECK(tree_digest(b) == base);
+
+    // symlink targets
+    fs::remove(b / "link");
+    fs::create_symlink("LOCK", b / "link");
+    CHECK(tree_digest(b) != base);
+
+    // a file that cannot be read is not hashed
+    content_hasher missing;
+    CHECK(!missing.update_file(scratch.path() / "missing"));
+
+    cout << "xxh64 and content_hasher: ok" << endl;
+    return 0;
+}
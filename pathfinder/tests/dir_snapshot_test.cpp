@@ -0,0 +1,131 @@
+#include "../utils/dir_snapshot.hpp"
+#include "test_util.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+
+namespace fs = boost::filesystem;
+using namespace std;
+using namespace pathfinder;
+
+// path relative to dir -> file contents, or "<dir>"
+typedef map<string, string> tree_t;
+
+static tree_t read_tree(const fs::path &dir) {
+    tree_t tree;
+    for (fs::recursive_directory_iterator it(dir), end; it != end; ++it) {
+        string rel = it->path().lexically_relative(dir).string();
+        if (fs::is_directory(it->path())) {
+            tree[rel] = "<dir>";
+        } else {
+            ifstream f(it->path().string(), ios::binary);
+            stringstream ss;
+            ss << f.rdbuf();
+            tree[rel] = ss.str();
+        }
+    }
+    return tree;
+}
+
+static void write_file(const fs::path &path, const string &contents) {
+    ofstream f(path.string(), ios::binary | ios::trunc);
+    f << contents;
+}
+
+static void populate(const fs::path &dir) {
+    fs::create_directories(dir / "sub");
+    write_file(dir / "a", "aaaa");
+    write_file(dir / "b", "bbbb");
+    write_file(dir / "sub" / "c", "cccc");
+}
+
+// changes of every kind are undone by restore
+static void check_restore(const string &kind, const fs::path &root) {
+    fs::path dir = root / "pmdir", image = root / "image";
+    populate(dir);
+    auto backend = make_snapshot_backend(kind, root);
+    tree_t before = read_tree(dir);
+
+    CHECK(backend->take(dir, image));
+    // same size, right after take: must not be mistaken for unchanged
+    write_file(dir / "a", "AAAA");
+    fs::remove(dir / "b");
+    write_file(dir / "d", "dddd");
+    fs::rename(dir / "sub" / "c", dir / "e");
+    CHECK(backend->restore(image, dir));
+    CHECK(read_tree(dir) == before);
+
+    // and again, from the state restore left behind
+    write_file(dir / "sub" / "c", "CCCC");
+    CHECK(backend->restore(image, dir));
+    CHECK(read_tree(dir) == before);
+    backend->drop(image);
+}
+
+// a dropped image that no longer matches dir must not be reused by take
+static void check_stale_spare(const string &kind, const fs::path &root) {
+    fs::path dir = root / "pmdir";
+    populate(dir);
+    auto backend = make_snapshot_backend(kind, root);
+
+    CHECK(backend->take(dir, root / "image1"));
+    CHECK(backend->restore(root / "image1", dir));
+    backend->drop(root / "image1");
+    fs::remove(dir / "b");
+    tree_t before = read_tree(dir);
+
+    CHECK(backend->take(dir, root / "image2"));
+    write_file(dir / "a", "AAAA");
+    CHECK(backend->restore(root / "image2", dir));
+    CHECK(!fs::exists(dir / "b"));
+    CHECK(read_tree(dir) == before);
+    backend->drop(root / "image2");
+}
+
+// stores through a mapping that was live when the image was taken
+static void check_mapped_writes(const string &kind, const fs::path &root) {
+    fs::path dir = root / "pmdir", image = root / "image";
+    populate(dir);
+    auto backend = make_snapshot_backend(kind, root);
+    tree_t before = read_tree(dir);
+
+    int fd = open((dir / "a").c_str(), O_RDWR);
+    CHECK(fd != -1);
+    char *p = (char *)mmap(nullptr, 4, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    CHECK(p != MAP_FAILED);
+    p[0] = 'x';
+    CHECK(backend->take(dir, image));
+    p[1] = 'y';
+    munmap(p, 4);
+    close(fd);
+
+    CHECK(backend->restore(image, dir));
+    before["a"] = "xaaa";
+    CHECK(read_tree(dir) == before);
+    backend->drop(image);
+}
+
+int main(int argc, char *argv[]) {
+    for (string kind : {"copy", "reflink", "layered"}) {
+        {
+            scratch_dir root;
+            check_restore(kind, root.path());
+        }
+        {
+            scratch_dir root;
+            check_stale_spare(kind, root.path());
+        }
+        {
+            scratch_dir root;
+            check_mapped_writes(kind, root.path());
+        }
+        cout << kind << ": ok" << endl;
+    }
+    return 0;
+}
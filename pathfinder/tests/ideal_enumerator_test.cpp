@@ -0,0 +1,118 @@
+#include "../graph/persistence_graph.hpp"
+#include "test_util.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <numeric>
+#include <random>
+#include <set>
+#include <vector>
+
+using namespace std;
+using namespace pathfinder;
+
+typedef set<vector<vertex>> ideals_t;
+
+// A random DAG on n vertices, numbered so that edges go both ways.
+static graph_type random_dag(mt19937 &rng, size_t n, double density) {
+    vector<vertex> label(n);
+    iota(label.begin(), label.end(), 0);
+    shuffle(label.begin(), label.end(), rng);
+
+    graph_type g(n);
+    bernoulli_distribution edge(density);
+    for (size_t i = 0; i < n; i++) {
+        for (size_t j = i + 1; j < n; j++) {
+            if (edge(rng)) boost::add_edge(label[i], label[j], g);
+        }
+    }
+    return g;
+}
+
+static ideals_t enumerated(const graph_type &g, optional<vertex> root = nullopt) {
+    ideal_enumerator e(g, root);
+    ideals_t res;
+    size_t visits = 0;
+    atomic<bool> cancel(false);
+    CHECK(e.enumerate([&](const ideal_enumerator::ideal &ideal) {
+        vector<vertex> verts;
+        for (size_t i = ideal.find_first(); i != ideal.npos; i = ideal.find_next(i)) {
+            verts.push_back(e.vertices()[i]);
+        }
+        sort(verts.begin(), verts.end());
+        res.insert(verts);
+        visits++;
+        return true;
+    }, cancel));
+    // each ideal exactly once
+    CHECK_EQ(visits, res.size());
+    return res;
+}
+
+// Every subset of the vertices other than root that holds all the
+// predecessors (other than root) of its members.
+static ideals_t brute_force(const graph_type &g, optional<vertex> root = nullopt) {
+    size_t n = boost::num_vertices(g);
+    ideals_t res;
+    for (uint64_t mask = 0; mask < (1ULL << n); mask++) {
+        if (root && (mask >> *root & 1)) continue;
+        bool closed = true;
+        graph_type::edge_iterator ei, eend;
+        for (boost::tie(ei, eend) = boost::edges(g); ei != eend && closed; ++ei) {
+            vertex u = boost::source(*ei, g), v = boost::target(*ei, g);
+            if (root && u == *root) continue;
+            closed = !(mask >> v & 1) || (mask >> u & 1);
+        }
+        if (!closed) continue;
+        vector<vertex> verts;
+        for (vertex v = 0; v < n; v++) {
+            if (mask >> v & 1) verts.push_back(v);
+        }
+        res.insert(verts);
+    }
+    return res;
+}
+
+int main(void) {
+    mt19937 rng(1);
+
+    // no edges: every subset; a chain: every prefix
+    graph_type empty(5), chain(5);
+    for (vertex v = 0; v + 1 < 5; v++) boost::add_edge(v, v + 1, chain);
+    CHECK_EQ(enumerated(empty).size(), 32u);
+    CHECK_EQ(enumerated(chain).size(), 6u);
+    CHECK_EQ(enumerated(graph_type(0)).size(), 1u);
+
+    size_t total = 0;
+    for (int i = 0; i < 300; i++) {
+        size_t n = 1 + rng() % 12;
+        double density = (rng() % 100) / 100.0;
+        graph_type g = random_dag(rng, n, density);
+        ideals_t ideals = enumerated(g);
+        CHECK(ideals == brute_force(g));
+        total += ideals.size();
+    }
+
+    // a shadow root before every vertex is left out of the ideals
+    for (int i = 0; i < 50; i++) {
+        size_t n = 2 + rng() % 10;
+        graph_type g = random_dag(rng, n - 1, 0.3);
+        vertex root = boost::add_vertex(g);
+        for (vertex v = 0; v < root; v++) boost::add_edge(root, v, g);
+        CHECK(enumerated(g, root) == brute_force(g, root));
+    }
+
+    // stops when visit says so, and when cancelled
+    ideal_enumerator e(empty);
+    atomic<bool> cancel(false);
+    size_t visits = 0;
+    CHECK(!e.enumerate([&](const ideal_enumerator::ideal &) { return ++visits < 3; }, cancel));
+    CHECK_EQ(visits, 3u);
+    cancel = true;
+    visits = 0;
+    CHECK(!e.enumerate([&](const ideal_enumerator::ideal &) { visits++; return true; }, cancel));
+    CHECK_EQ(visits, 0u);
+
+    cout << total << " ideals over 300 random DAGs: ok" << endl;
+    return 0;
+}
@@ -0,0 +1,65 @@
+#include "../graph/posix_graph.hpp"
+#include "../trace/trace.hpp"
+#include "test_util.hpp"
+
+#include <atomic>
+#include <random>
+#include <set>
+#include <vector>
+
+namespace fs = boost::filesystem;
+using namespace std;
+using namespace pathfinder;
+
+typedef set<vector<vertex>> orderings_t;
+
+static orderings_t orderings(persistence_graph &g, const vector<vertex> &verts) {
+    orderings_t res;
+    atomic<bool> cancel(false);
+    CHECK(g.for_each_order(verts, cancel, [&](const vector<vertex> &order) {
+        res.insert(order);
+        return true;
+    }));
+    return res;
+}
+
+// The sweep construction keeps far fewer edges than the all-pairs one, but
+// every subgraph must still have the same orderings.
+int main(int argc, char *argv[]) {
+    CHECK(argc == 2);
+    scratch_dir out;
+    trace t(false, POSIX);
+    t.read_offline_trace(fs::path(argv[1]));
+    t.set_root_dir("/");
+    t.decompose_trace_events();
+
+    posix_graph pairwise(t, out.path(), true, false);
+    posix_graph sweep(t, out.path(), true, true);
+    size_t n = pairwise.csr().num_vertices();
+    CHECK(n > 0);
+    CHECK_EQ(sweep.csr().num_vertices(), n);
+
+    vector<vector<vertex>> lists;
+    // runs of neighbouring events, which are mostly ordered
+    for (vertex v = 0; v + 6 <= n; v += 3) {
+        vector<vertex> run;
+        for (vertex u = v; u < v + 6; u++) run.push_back(u);
+        lists.push_back(run);
+    }
+    // and events far apart, ordered through the ones in between
+    mt19937 rng(1);
+    for (int i = 0; i < 100; i++) {
+        set<vertex> pick;
+        while (pick.size() < 6) pick.insert(rng() % n);
+        lists.emplace_back(pick.begin(), pick.end());
+    }
+
+    size_t total = 0;
+    for (const auto &verts : lists) {
+        orderings_t a = orderings(pairwise, verts), b = orderings(sweep, verts);
+        CHECK(a == b);
+        total += a.size();
+    }
+    cout << lists.size() << " subgraphs, " << total << " orderings: ok" << endl;
+    return 0;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <cstdlib>
+#include <iostream>
+
+/**
+ * Small self-checks for pathfinder's building blocks. Each test is its own
+ * executable that exits with a failure status on the first failed CHECK.
+ */
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; \
+        std::exit(EXIT_FAILURE); \
+    } \
+} while (0)
+
+#define CHECK_EQ(a, b) do { \
+    if (!((a) == (b))) { \
+        std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK_EQ(" #a ", " #b ") failed: " \
+                  << (a) << " != " << (b) << std::endl; \
+        std::exit(EXIT_FAILURE); \
+    } \
+} while (0)
+
+namespace pathfinder {
+
+/**
+ * @brief A fresh directory under the system temp dir, removed when done.
+ */
+class scratch_dir {
+    boost::filesystem::path path_;
+
+public:
+    scratch_dir() {
+        path_ = boost::filesystem::temp_directory_path() /
+                boost::filesystem::unique_path("pathfinder-test-%%%%-%%%%-%%%%");
+        boost::filesystem::create_directories(path_);
+    }
+
+    ~scratch_dir() {
+        boost::system::error_code ec;
+        boost::filesystem::remove_all(path_, ec);
+    }
+
+    const boost::filesystem::path &path(void) const { return path_; }
+};
+
+}
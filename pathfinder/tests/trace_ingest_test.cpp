@@ -0,0 +1,42 @@
+#include "../trace/trace.hpp"
+#include "test_util.hpp"
+
+#include <algorithm>
+#include <string>
+#include <thread>
+
+namespace fs = boost::filesystem;
+using namespace std;
+using namespace pathfinder;
+
+/**
+ * Load each trace with one parser thread and with a pool, report events/s
+ * for both and check that they produce the same events. Also usable as a
+ * benchmark on larger traces:
+ *
+ *   trace_ingest_test [-j <threads>] [-m pm|mmio|posix] <trace>...
+ */
+int main(int argc, char *argv[]) {
+    size_t nthreads = max(2u, thread::hardware_concurrency());
+    pathfinder_mode mode = POSIX;
+    int i = 1;
+    for (; i + 1 < argc && argv[i][0] == '-'; i += 2) {
+        string opt = argv[i], val = argv[i + 1];
+        if (opt == "-j") {
+            nthreads = stoul(val);
+        } else if (opt == "-m") {
+            CHECK(val == "pm" || val == "mmio" || val == "posix");
+            mode = val == "pm" ? PM : val == "mmio" ? MMIO : POSIX;
+        } else {
+            CHECK(!"unknown option");
+        }
+    }
+    CHECK(i < argc);
+
+    for (; i < argc; i++) {
+        fs::path trace_path(argv[i]);
+        CHECK(fs::exists(trace_path));
+        CHECK(benchmark_trace_ingest(trace_path, false, mode, nthreads, cout));
+    }
+    return 0;
+}
@@ -0,0 +1,416 @@
+#include "binary_trace.hpp"
+#include "trace.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <tuple>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+namespace fs = boost::filesystem;
+
+namespace pathfinder
+{
+
+bool is_binary_trace(const fs::path &path) {
+    char magic[sizeof(binary_trace_header::magic)] = {0};
+    fs::ifstream f(path, ios::binary);
+    if (!f.read(magic, sizeof(magic))) return false;
+    return !memcmp(magic, BINARY_TRACE_MAGIC, sizeof(BINARY_TRACE_MAGIC));
+}
+
+namespace
+{
+
+// Builds the interned sections of a binary trace while it is written.
+class binary_trace_builder {
+    unordered_map<string, uint32_t> string_ids_;
+    map<tuple<uint32_t, uint32_t, int, uint64_t>, uint32_t> frame_ids_;
+    // Interned stacks are already unique, so only their frames need mapping.
+    unordered_map<uint32_t, uint32_t> stack_by_intern_id_;
+
+public:
+    vector<binary_trace_string> strings;
+    string string_data;
+    vector<binary_trace_frame> frames;
+    vector<binary_trace_stack> stacks;
+    vector<uint32_t> stack_frames;
+    vector<char> blobs;
+
+    uint32_t intern(const string &s) {
+        auto it = string_ids_.find(s);
+        if (it != string_ids_.end()) return it->second;
+
+        uint32_t id = strings.size();
+        strings.push_back({string_data.size(), s.size()});
+        string_data += s;
+        string_ids_[s] = id;
+        return id;
+    }
+
+    uint32_t intern_optional(const string &s) {
+        return s.empty() ? BINARY_TRACE_NO_STRING : intern(s);
+    }
+
+    uint32_t intern(const interned_stack &stack) {
+        auto known = stack_by_intern_id_.find(stack.id());
+        if (known != stack_by_intern_id_.end()) return known->second;
+
+        vector<uint32_t> ids;
+        ids.reserve(stack.size());
+        for (const stack_frame &sf : stack) {
+            auto key = make_tuple(intern(sf.function), intern(sf.file), sf.line, sf.binary_address);
+            auto it = frame_ids_.find(key);
+            if (it == frame_ids_.end()) {
+                binary_trace_frame f = {get<0>(key), get<1>(key), sf.line, 0, sf.binary_address};
+                it = frame_ids_.emplace(key, frames.size()).first;
+                frames.push_back(f);
+            }
+            ids.push_back(it->second);
+        }
+
+        uint32_t id = stacks.size();
+        stacks.push_back({(uint32_t)stack_frames.size(), (uint32_t)ids.size()});
+        stack_frames.insert(stack_frames.end(), ids.begin(), ids.end());
+        stack_by_intern_id_[stack.id()] = id;
+        return id;
+    }
+
+    // Returns the blob offset. Payloads stay NUL-terminated, like the decoded
+    // base64 buffers they replace.
+    uint64_t add_blob(const char *data, uint64_t size, int64_t aux = 0) {
+        uint64_t offset = blobs.size();
+        binary_trace_blob b = {size, aux};
+        const char *hdr = reinterpret_cast<const char*>(&b);
+        blobs.insert(blobs.end(), hdr, hdr + sizeof(b));
+        if (size) blobs.insert(blobs.end(), data, data + size);
+        blobs.push_back('\0');
+        blobs.resize((blobs.size() + 7) & ~7ull, '\0');
+        return offset;
+    }
+};
+
+uint64_t align8(uint64_t off) {
+    return (off + 7) & ~7ull;
+}
+
+}  // namespace
+
+void trace::write_binary_trace(fs::path trace_path) const {
+    binary_trace_builder b;
+    vector<binary_trace_event> records;
+    records.reserve(events_.size());
+
+    for (const auto &te : events_) {
+        binary_trace_event r;
+        memset(&r, 0, sizeof(r));
+        r.tid = te->tid;
+        r.store_num = te->store_num;
+        r.address = te->address;
+        r.size = te->size;
+        r.value = te->value;
+        r.wfile_offset = te->wfile_offset;
+        r.file_offset = te->file_offset;
+        r.len = te->len;
+        r.file_size = te->file_size;
+        r.type = te->type;
+        r.file_path = b.intern_optional(te->file_path);
+        r.new_path = b.intern_optional(te->new_path);
+        r.stack = b.intern(te->stack);
+        r.mode = te->mode;
+        r.fd = te->fd;
+        r.flags = te->flags;
+        r.prot = te->prot;
+        r.iovcnt = te->iovcnt;
+        if (te->workload_thread_id) {
+            r.present |= BINARY_TRACE_HAS_WORKLOAD_TID;
+            r.workload_thread_id = *te->workload_thread_id;
+        }
+        if (te->thread_op_id) {
+            r.present |= BINARY_TRACE_HAS_THREAD_OP_ID;
+            r.thread_op_id = *te->thread_op_id;
+        }
+
+        r.payload = b.blobs.size();
+        if (te->char_buf) {
+            b.add_blob(te->char_buf.get(), te->char_buf_size);
+            r.npayloads = 1;
+        } else if (!te->iov.empty()) {
+            assert(te->iov.size() == te->iov_sizes.size());
+            for (size_t i = 0; i < te->iov.size(); ++i) {
+                b.add_blob(get<1>(te->iov[i]).get(), te->iov_sizes[i], get<0>(te->iov[i]));
+            }
+            r.npayloads = te->iov.size();
+        } else if (te->is_write()) {
+            b.add_blob(te->buf.data(), te->buf.size());
+            r.npayloads = 1;
+        } else if (te->is_pwritev()) {
+            for (const string &buf : te->buf_vec) {
+                b.add_blob(buf.data(), buf.size());
+            }
+            r.npayloads = te->buf_vec.size();
+        }
+
+        records.push_back(r);
+    }
+
+    vector<uint32_t> intrinsics;
+    for (const string &func : intrinsic_functions) {
+        intrinsics.push_back(b.intern(func));
+    }
+
+    binary_trace_header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, BINARY_TRACE_MAGIC, sizeof(BINARY_TRACE_MAGIC));
+    h.version = BINARY_TRACE_VERSION;
+    h.mode = mode_;
+    if (mode_ == PM && !selective_) h.flags |= BINARY_TRACE_MARKERS_DROPPED;
+    h.nevents = records.size();
+    h.nstrings = b.strings.size();
+    h.nframes = b.frames.size();
+    h.nstacks = b.stacks.size();
+    h.nstack_frames = b.stack_frames.size();
+    h.nintrinsics = intrinsics.size();
+    h.blobs_size = b.blobs.size();
+
+    h.events_off = sizeof(h);
+    h.strings_off = align8(h.events_off + records.size() * sizeof(binary_trace_event));
+    h.string_data_off = align8(h.strings_off + b.strings.size() * sizeof(binary_trace_string));
+    h.frames_off = align8(h.string_data_off + b.string_data.size());
+    h.stacks_off = align8(h.frames_off + b.frames.size() * sizeof(binary_trace_frame));
+    h.stack_frames_off = align8(h.stacks_off + b.stacks.size() * sizeof(binary_trace_stack));
+    h.intrinsics_off = align8(h.stack_frames_off + b.stack_frames.size() * sizeof(uint32_t));
+    h.blobs_off = align8(h.intrinsics_off + intrinsics.size() * sizeof(uint32_t));
+
+    fs::ofstream f(trace_path, ios::binary | ios::trunc);
+    if (!f) {
+        cerr << "write_binary_trace: could not open " << trace_path << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    auto write_at = [&] (uint64_t off, const void *data, uint64_t size) {
+        static const char zeros[8] = {0};
+        uint64_t pos = f.tellp();
+        assert(pos <= off && off - pos < 8);
+        f.write(zeros, off - pos);
+        if (size) f.write(reinterpret_cast<const char*>(data), size);
+    };
+
+    write_at(0, &h, sizeof(h));
+    write_at(h.events_off, records.data(), records.size() * sizeof(binary_trace_event));
+    write_at(h.strings_off, b.strings.data(), b.strings.size() * sizeof(binary_trace_string));
+    write_at(h.string_data_off, b.string_data.data(), b.string_data.size());
+    write_at(h.frames_off, b.frames.data(), b.frames.size() * sizeof(binary_trace_frame));
+    write_at(h.stacks_off, b.stacks.data(), b.stacks.size() * sizeof(binary_trace_stack));
+    write_at(h.stack_frames_off, b.stack_frames.data(), b.stack_frames.size() * sizeof(uint32_t));
+    write_at(h.intrinsics_off, intrinsics.data(), intrinsics.size() * sizeof(uint32_t));
+    write_at(h.blobs_off, b.blobs.data(), b.blobs.size());
+
+    f.close();
+    if (!f) {
+        cerr << "write_binary_trace: failed writing " << trace_path << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    cout << "Wrote binary trace " << trace_path.string() << ": " << h.nevents
+        << " events, " << h.nstrings << " strings, " << h.nstacks << " stacks" << endl;
+}
+
+void trace::read_binary_trace(fs::path trace_path) {
+    auto start = chrono::steady_clock::now();
+
+    auto corrupt = [&] (const char *what) {
+        cerr << "read_binary_trace: " << trace_path << " is corrupt (" << what << ")" << endl;
+        exit(EXIT_FAILURE);
+    };
+
+    int fd = open(trace_path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        cerr << "read_binary_trace: could not open " << trace_path << endl;
+        exit(EXIT_FAILURE);
+    }
+    struct stat st;
+    if (fstat(fd, &st) || (uint64_t)st.st_size < sizeof(binary_trace_header)) {
+        close(fd);
+        corrupt("too small");
+    }
+    uint64_t file_size = st.st_size;
+    void *addr = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        cerr << "read_binary_trace: could not mmap " << trace_path << endl;
+        exit(EXIT_FAILURE);
+    }
+    // Payloads alias this mapping, so it lives as long as any event does.
+    shared_ptr<char> mapping((char*)addr, [file_size] (char *p) { munmap(p, file_size); });
+    const char *base = mapping.get();
+
+    const binary_trace_header &h = *reinterpret_cast<const binary_trace_header*>(base);
+    if (memcmp(h.magic, BINARY_TRACE_MAGIC, sizeof(BINARY_TRACE_MAGIC))) corrupt("bad magic");
+    if (h.version != BINARY_TRACE_VERSION) {
+        cerr << "read_binary_trace: unsupported version " << h.version
+            << " (expected " << BINARY_TRACE_VERSION << ")" << endl;
+        exit(EXIT_FAILURE);
+    }
+    if (h.mode != (uint32_t)mode_) {
+        cerr << "read_binary_trace: trace was recorded in a different mode ("
+            << h.mode << " vs " << mode_ << ")" << endl;
+        exit(EXIT_FAILURE);
+    }
+    if ((h.flags & BINARY_TRACE_MARKERS_DROPPED) && selective_) {
+        cerr << "Warning: binary trace was saved without selective testing markers.\n";
+    }
+
+    auto check_section = [&] (uint64_t off, uint64_t count, uint64_t elem_size) {
+        if (off % 8 || off > file_size || count > (file_size - off) / elem_size) corrupt("bad section");
+    };
+    check_section(h.events_off, h.nevents, sizeof(binary_trace_event));
+    check_section(h.strings_off, h.nstrings, sizeof(binary_trace_string));
+    check_section(h.frames_off, h.nframes, sizeof(binary_trace_frame));
+    check_section(h.stacks_off, h.nstacks, sizeof(binary_trace_stack));
+    check_section(h.stack_frames_off, h.nstack_frames, sizeof(uint32_t));
+    check_section(h.intrinsics_off, h.nintrinsics, sizeof(uint32_t));
+    check_section(h.blobs_off, h.blobs_size, 1);
+
+    const binary_trace_event *records = reinterpret_cast<const binary_trace_event*>(base + h.events_off);
+    const binary_trace_string *strings = reinterpret_cast<const binary_trace_string*>(base + h.strings_off);
+    const binary_trace_frame *frames = reinterpret_cast<const binary_trace_frame*>(base + h.frames_off);
+    const binary_trace_stack *stacks = reinterpret_cast<const binary_trace_stack*>(base + h.stacks_off);
+    const uint32_t *stack_frames = reinterpret_cast<const uint32_t*>(base + h.stack_frames_off);
+    const uint32_t *intrinsics = reinterpret_cast<const uint32_t*>(base + h.intrinsics_off);
+    const char *blobs = base + h.blobs_off;
+
+    auto get_string = [&] (uint32_t id) -> string {
+        if (id == BINARY_TRACE_NO_STRING) return string();
+        if (id >= h.nstrings) corrupt("bad string id");
+        const binary_trace_string &s = strings[id];
+        if (s.offset > file_size - h.string_data_off ||
+            s.size > file_size - h.string_data_off - s.offset) corrupt("bad string");
+        return string(base + h.string_data_off + s.offset, s.size);
+    };
+
+    // Decode and intern every stack once; events then share it by ID.
+    vector<interned_stack> decoded_stacks(h.nstacks);
+    for (uint64_t i = 0; i < h.nstacks; ++i) {
+        if (stacks[i].first > h.nstack_frames ||
+            stacks[i].count > h.nstack_frames - stacks[i].first) corrupt("bad stack");
+        vector<stack_frame> stack;
+        for (uint32_t j = 0; j < stacks[i].count; ++j) {
+            uint32_t fid = stack_frames[stacks[i].first + j];
+            if (fid >= h.nframes) corrupt("bad frame id");
+            stack_frame sf;
+            sf.function = get_string(frames[fid].function);
+            sf.file = get_string(frames[fid].file);
+            sf.line = frames[fid].line;
+            sf.binary_address = frames[fid].binary_address;
+            stack.push_back(sf);
+        }
+        decoded_stacks[i] = interned_stack(std::move(stack));
+    }
+
+    // Walk a run of payloads; each is a header, the bytes, a NUL and padding.
+    auto next_blob = [&] (uint64_t &off, const char *&data) -> const binary_trace_blob& {
+        if (off > h.blobs_size || h.blobs_size - off < sizeof(binary_trace_blob)) corrupt("bad payload");
+        const binary_trace_blob &blob = *reinterpret_cast<const binary_trace_blob*>(blobs + off);
+        off += sizeof(binary_trace_blob);
+        if (blob.size >= h.blobs_size - off) corrupt("bad payload size");
+        data = blobs + off;
+        off = align8(off + blob.size + 1);
+        return blob;
+    };
+
+    // Feed the events through the same merge step as the text parser, so the
+    // counters, file sets, op tracing and testing ranges come out identical.
+    const uint64_t chunk = 4096;
+    for (uint64_t first = 0; first < h.nevents; first += chunk) {
+        parsed_line parsed;
+        if (first == 0) {
+            for (uint64_t i = 0; i < h.nintrinsics; ++i) {
+                parsed.intrinsic_functions.push_back(get_string(intrinsics[i]));
+            }
+        }
+
+        uint64_t last = std::min(h.nevents, first + chunk);
+        parsed.events.reserve(last - first);
+        for (uint64_t i = first; i < last; ++i) {
+            const binary_trace_event &r = records[i];
+            trace_event te;
+            te.tid = r.tid;
+            te.store_num = r.store_num;
+            te.address = r.address;
+            te.size = r.size;
+            te.value = r.value;
+            te.wfile_offset = r.wfile_offset;
+            te.file_offset = r.file_offset;
+            te.len = r.len;
+            te.file_size = r.file_size;
+            te.type = (event_type)r.type;
+            te.file_path = get_string(r.file_path);
+            te.new_path = get_string(r.new_path);
+            if (r.stack >= h.nstacks) corrupt("bad stack id");
+            te.stack = decoded_stacks[r.stack];
+            te.mode = r.mode;
+            te.fd = r.fd;
+            te.flags = r.flags;
+            te.prot = r.prot;
+            te.iovcnt = r.iovcnt;
+            if (r.present & BINARY_TRACE_HAS_WORKLOAD_TID) te.workload_thread_id = r.workload_thread_id;
+            if (r.present & BINARY_TRACE_HAS_THREAD_OP_ID) te.thread_op_id = r.thread_op_id;
+
+            uint64_t off = r.payload;
+            const char *data = nullptr;
+            if (r.npayloads) {
+                if (mode_ == PM && te.is_write()) {
+                    const binary_trace_blob &blob = next_blob(off, data);
+                    te.buf = string(data, blob.size);
+                } else if (mode_ == PM && te.is_pwritev()) {
+                    for (uint32_t p = 0; p < r.npayloads; ++p) {
+                        const binary_trace_blob &blob = next_blob(off, data);
+                        te.buf_vec.push_back(string(data, blob.size));
+                    }
+                } else if (te.is_writev()) {
+                    for (uint32_t p = 0; p < r.npayloads; ++p) {
+                        const binary_trace_blob &blob = next_blob(off, data);
+                        te.iov.push_back(make_tuple((int)blob.aux, shared_ptr<char>(mapping, (char*)data)));
+                        te.iov_sizes.push_back(blob.size);
+                    }
+                } else {
+                    const binary_trace_blob &blob = next_blob(off, data);
+                    te.char_buf = shared_ptr<char>(mapping, (char*)data);
+                    te.char_buf_size = blob.size;
+                }
+            }
+
+            if (te.is_store()) {
+                const char *bytes = te.char_buf ? te.char_buf.get() : (const char*)&te.value;
+                te.value_bytes.assign(bytes, bytes + te.size);
+            }
+
+            parsed.events.push_back(std::move(te));
+        }
+
+        append_events(std::move(parsed));
+    }
+
+    auto end = chrono::steady_clock::now();
+    ingest_stats_.lines = h.nevents;
+    ingest_stats_.bytes = file_size;
+    ingest_stats_.seconds = chrono::duration<double>(end - start).count();
+    ingest_stats_.nthreads = 1;
+
+    cout << "Binary trace: " << h.nevents << " records (" << (file_size >> 20) << " MiB), "
+        << events_.size() << " events in " << ingest_stats_.seconds << " s" << endl;
+
+    for (const auto & func : intrinsic_functions) {
+        cout << "intrinsic function: " << func << endl;
+    }
+
+    construct_testing_ranges();
+}
+
+}  // namespace pathfinder
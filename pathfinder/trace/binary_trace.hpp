@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+
+#include <boost/filesystem.hpp>
+
+/**
+ * On-disk layout of the compact binary trace (see trace::write_binary_trace).
+ *
+ * The file is a header followed by 8-byte aligned sections:
+ *
+ *   events        nevents fixed-size binary_trace_event records
+ *   strings       nstrings {offset, size} entries into string_data
+ *   string_data   the interned paths and function/file names
+ *   frames        nframes binary_trace_frame records
+ *   stacks        nstacks {first, count} ranges into stack_frames
+ *   stack_frames  frame IDs, shared by all deduplicated stacks
+ *   intrinsics    string IDs of the intrinsic functions seen while parsing
+ *   blobs         raw (decoded) payloads, each a binary_trace_blob header
+ *                 followed by the bytes, a NUL, and padding
+ *
+ * Loading mmaps the file and points char_buf/iov straight into the mapping.
+ */
+
+namespace pathfinder
+{
+
+#define BINARY_TRACE_MAGIC "PFTRACE"
+#define BINARY_TRACE_VERSION 1
+// Conventional extension for binary traces.
+#define BINARY_TRACE_EXT ".ptrace"
+
+// No string (e.g., an event without a file path).
+#define BINARY_TRACE_NO_STRING UINT32_MAX
+
+struct binary_trace_header {
+    char magic[8];
+    uint32_t version;
+    // pathfinder_mode the trace was parsed in
+    uint32_t mode;
+    uint32_t flags;
+    uint32_t reserved;
+
+    uint64_t nevents;
+    uint64_t nstrings;
+    uint64_t nframes;
+    uint64_t nstacks;
+    uint64_t nstack_frames;
+    uint64_t nintrinsics;
+    uint64_t blobs_size;
+
+    uint64_t events_off;
+    uint64_t strings_off;
+    uint64_t string_data_off;
+    uint64_t frames_off;
+    uint64_t stacks_off;
+    uint64_t stack_frames_off;
+    uint64_t intrinsics_off;
+    uint64_t blobs_off;
+};
+
+// The PM trace was loaded without selective testing, so markers were dropped.
+#define BINARY_TRACE_MARKERS_DROPPED 0x1
+
+struct binary_trace_string {
+    uint64_t offset;
+    uint64_t size;
+};
+
+struct binary_trace_frame {
+    uint32_t function;
+    uint32_t file;
+    int32_t line;
+    uint32_t reserved;
+    uint64_t binary_address;
+};
+
+struct binary_trace_stack {
+    uint32_t first;
+    uint32_t count;
+};
+
+// Set in binary_trace_event::present for the optional fields.
+#define BINARY_TRACE_HAS_WORKLOAD_TID 0x1
+#define BINARY_TRACE_HAS_THREAD_OP_ID 0x2
+
+struct binary_trace_event {
+    uint64_t tid;
+    uint64_t store_num;
+    uint64_t address;
+    uint64_t size;
+    uint64_t value;
+    uint64_t wfile_offset;
+    int64_t file_offset;
+    int64_t len;
+    int64_t file_size;
+    // offset into the blob section of this event's first payload
+    uint64_t payload;
+
+    uint32_t type;
+    uint32_t file_path;
+    uint32_t new_path;
+    uint32_t stack;
+    uint32_t npayloads;
+    uint32_t present;
+
+    int32_t mode;
+    int32_t fd;
+    int32_t flags;
+    int32_t prot;
+    int32_t iovcnt;
+    int32_t workload_thread_id;
+    int32_t thread_op_id;
+    int32_t reserved;
+};
+
+struct binary_trace_blob {
+    uint64_t size;
+    // the iov length for WRITEV buffers, otherwise unused
+    int64_t aux;
+};
+
+static_assert(sizeof(binary_trace_header) % 8 == 0, "header must keep sections aligned");
+static_assert(sizeof(binary_trace_event) % 8 == 0, "event records must stay aligned");
+static_assert(sizeof(binary_trace_blob) % 8 == 0, "blobs must stay aligned");
+
+/**
+ * @brief Check whether a file starts with the binary trace magic.
+ */
+bool is_binary_trace(const boost::filesystem::path &path);
+
+}  // namespace pathfinder
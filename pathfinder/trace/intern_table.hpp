@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include <boost/assert.hpp>
+
+namespace pathfinder
+{
+
+/**
+ * @brief Maps equal values to one dense 32-bit ID, and IDs back to a single
+ * shared copy of the value.
+ *
+ * Interning is thread-safe, since the trace parser workers intern
+ * concurrently. Looking up an ID never locks: entries live in buckets of
+ * doubling size that are never moved once allocated, so a reference returned
+ * by get() stays valid for the life of the table.
+ */
+template <typename T, typename Hash = std::hash<T>, typename Equal = std::equal_to<T>>
+class intern_table {
+public:
+    typedef uint32_t id_type;
+
+    intern_table() {
+        for (auto &b : buckets_) b.store(nullptr, std::memory_order_relaxed);
+    }
+
+    ~intern_table() {
+        for (auto &b : buckets_) delete[] b.load(std::memory_order_relaxed);
+    }
+
+    intern_table(const intern_table&) = delete;
+    intern_table &operator=(const intern_table&) = delete;
+
+    // Only copies the value if it is not interned yet.
+    id_type intern(const T &value) { return intern_impl(value); }
+    id_type intern(T &&value) { return intern_impl(std::move(value)); }
+
+    const T &get(id_type id) const {
+        BOOST_ASSERT(id < size_.load(std::memory_order_acquire));
+        return const_cast<intern_table*>(this)->locate(id, false);
+    }
+
+    size_t size(void) const { return size_.load(std::memory_order_acquire); }
+
+private:
+    // Bucket b holds (1 << (FIRST_BUCKET_BITS + b)) entries.
+    static constexpr unsigned FIRST_BUCKET_BITS = 6;
+    static constexpr unsigned NUM_BUCKETS = 32 - FIRST_BUCKET_BITS;
+    static constexpr uint64_t MAX_SIZE = (1ull << 32) - (1ull << FIRST_BUCKET_BITS);
+
+    struct ref_hash {
+        size_t operator()(std::reference_wrapper<const T> v) const { return Hash()(v.get()); }
+    };
+    struct ref_equal {
+        bool operator()(std::reference_wrapper<const T> a, std::reference_wrapper<const T> b) const {
+            return Equal()(a.get(), b.get());
+        }
+    };
+
+    template <typename U>
+    id_type intern_impl(U &&value) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = ids_.find(std::cref(value));
+        if (it != ids_.end()) return it->second;
+
+        id_type id = size_.load(std::memory_order_relaxed);
+        BOOST_ASSERT(id < MAX_SIZE && "intern_table is full");
+        T &slot = locate(id, true);
+        slot = std::forward<U>(value);
+        ids_.emplace(std::cref(slot), id);
+        size_.store(id + 1, std::memory_order_release);
+        return id;
+    }
+
+    T &locate(id_type id, bool allocate) {
+        uint64_t i = (uint64_t)id + (1ull << FIRST_BUCKET_BITS);
+        unsigned msb = 63 - __builtin_clzll(i);
+        unsigned b = msb - FIRST_BUCKET_BITS;
+        T *bucket = buckets_[b].load(std::memory_order_acquire);
+        if (!bucket) {
+            BOOST_ASSERT(allocate);
+            bucket = new T[1ull << msb];
+            buckets_[b].store(bucket, std::memory_order_release);
+        }
+        return bucket[i - (1ull << msb)];
+    }
+
+    std::mutex mutex_;
+    std::unordered_map<std::reference_wrapper<const T>, id_type, ref_hash, ref_equal> ids_;
+    std::atomic<T*> buckets_[NUM_BUCKETS];
+    std::atomic<id_type> size_{0};
+};
+
+inline size_t hash_combine(size_t seed, size_t v) {
+    return seed ^ (v + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2));
+}
+
+}  // namespace pathfinder
@@ -1,4 +1,5 @@
 #include "stack_frame.hpp"
+#include "intern_table.hpp"
 
 #include <iostream>
 #include <sstream>
@@ -24,6 +25,13 @@ bool stack_frame::operator<(const stack_frame &other) const {
     return binary_address < other.binary_address;
 }
 
+size_t stack_frame_hash::operator()(const stack_frame &sf) const {
+    size_t h = std::hash<string>()(sf.function);
+    h = hash_combine(h, std::hash<string>()(sf.file));
+    h = hash_combine(h, std::hash<int>()(sf.line));
+    return hash_combine(h, std::hash<uint64_t>()(sf.binary_address));
+}
+
 string stack_frame::str(void) const {
     stringstream ss;
     ios::fmtflags f(ss.flags());
@@ -35,4 +43,77 @@ string stack_frame::str(void) const {
     return ss.str();
 }
 
+/* interned_stack */
+
+namespace
+{
+
+// Stacks are keyed by their frame IDs; frames keeps the materialized copy
+// that interned_stack hands out.
+struct stack_entry {
+    vector<uint32_t> frame_ids;
+    vector<stack_frame> frames;
+};
+
+struct stack_entry_hash {
+    size_t operator()(const stack_entry &e) const {
+        size_t h = e.frame_ids.size();
+        for (uint32_t id : e.frame_ids) h = hash_combine(h, id);
+        return h;
+    }
+};
+
+struct stack_entry_equal {
+    bool operator()(const stack_entry &a, const stack_entry &b) const {
+        return a.frame_ids == b.frame_ids;
+    }
+};
+
+typedef intern_table<stack_frame, stack_frame_hash> frame_table_type;
+typedef intern_table<stack_entry, stack_entry_hash, stack_entry_equal> stack_table_type;
+
+frame_table_type &frame_table(void) {
+    static frame_table_type *table = new frame_table_type();
+    return *table;
+}
+
+stack_table_type &stack_table(void) {
+    static stack_table_type *table = [] {
+        stack_table_type *t = new stack_table_type();
+        // ID 0 is always the empty stack.
+        t->intern(stack_entry());
+        return t;
+    }();
+    return *table;
+}
+
+}  // namespace
+
+interned_stack::interned_stack(vector<stack_frame> &&frames) {
+    stack_entry e;
+    e.frame_ids.reserve(frames.size());
+    for (const stack_frame &sf : frames) {
+        e.frame_ids.push_back(frame_table().intern(sf));
+    }
+    e.frames = std::move(frames);
+    id_ = stack_table().intern(std::move(e));
+}
+
+interned_stack interned_stack::from_id(uint32_t id) {
+    BOOST_ASSERT(id < stack_table().size());
+    return interned_stack(id);
+}
+
+const vector<stack_frame> &interned_stack::frames(void) const {
+    return stack_table().get(id_).frames;
+}
+
+size_t interned_stack::num_stacks(void) {
+    return stack_table().size();
+}
+
+size_t interned_stack::num_frames(void) {
+    return frame_table().size();
+}
+
 }  // namespace pathfinder
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include <cstdint>
 #include <string>
+#include <vector>
 
 namespace pathfinder
 {
@@ -19,5 +20,56 @@ struct stack_frame {
     bool operator<(const stack_frame &other) const;
 };
 
+struct stack_frame_hash {
+    size_t operator()(const stack_frame &sf) const;
+};
+
+/**
+ * @brief A call stack, stored once in a process-wide table.
+ *
+ * Frames and whole stacks are interned, so an event only carries a 32-bit
+ * stack ID and equal stacks compare as integers. The const vector-like
+ * accessors read the shared frames.
+ */
+class interned_stack {
+    uint32_t id_;
+
+    explicit interned_stack(uint32_t id) : id_(id) {}
+
+public:
+    typedef std::vector<stack_frame>::const_iterator const_iterator;
+
+    // The empty stack.
+    interned_stack() : id_(0) {}
+    explicit interned_stack(std::vector<stack_frame> &&frames);
+
+    static interned_stack from_id(uint32_t id);
+
+    uint32_t id(void) const { return id_; }
+    const std::vector<stack_frame> &frames(void) const;
+    operator const std::vector<stack_frame>&() const { return frames(); }
+
+    size_t size(void) const { return frames().size(); }
+    bool empty(void) const { return id_ == 0; }
+    const stack_frame &at(size_t i) const { return frames().at(i); }
+    const stack_frame &operator[](size_t i) const { return frames()[i]; }
+    const stack_frame &front(void) const { return frames().front(); }
+    const stack_frame &back(void) const { return frames().back(); }
+    const_iterator begin(void) const { return frames().begin(); }
+    const_iterator end(void) const { return frames().end(); }
+
+    bool operator==(const interned_stack &other) const { return id_ == other.id_; }
+    bool operator!=(const interned_stack &other) const { return id_ != other.id_; }
+    bool operator<(const interned_stack &other) const { return id_ < other.id_; }
+
+    // Number of distinct stacks and frames interned so far.
+    static size_t num_stacks(void);
+    static size_t num_frames(void);
+};
+
+struct interned_stack_hash {
+    size_t operator()(const interned_stack &s) const { return s.id(); }
+};
+
 
 }  // namespace pathfinder
\ No newline at end of file
@@ -1,15 +1,24 @@
 #include "trace.hpp"
+#include "binary_trace.hpp"
 
 #include <algorithm>
 #include <cassert>
+#include <cctype>
+#include <charconv>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
 #include <ios>
+#include <limits>
+#include <map>
+#include <queue>
+#include <sstream>
+#include <type_traits>
 #include <vector>
 
 #include <fcntl.h>
 
 #include <boost/icl/right_open_interval.hpp>
-#include <boost/algorithm/string/regex.hpp>
 
 using namespace std;
 namespace bp = boost::process;
@@ -19,183 +28,341 @@ namespace fs = boost::filesystem;
 namespace pathfinder
 {
 
-vector<stack_frame> trace::parse_pm_stack(
-    vector<string>::iterator &start,
-    vector<string>::iterator &end) {
+/**
+ * Splits a string_view on a single delimiter without copying, with the same
+ * semantics as boost::split (a trailing delimiter yields a final empty field).
+ */
+class field_tokenizer {
+    string_view rest_;
+    char delim_;
+    bool done_ = false;
 
-    static regex frame_re(R"((\w+): (.+) \((.+):(\d+)\))");
-    // static regex frame_imprecise_re(R"((\w+): (.+) \(in (.+)\))");
-    vector<stack_frame> stack;
+public:
+    field_tokenizer(string_view s, char delim) : rest_(s), delim_(delim) {}
 
-    for (auto it = start; it != end; ++it) {
-        cmatch cm;
-        stack_frame sf;
+    bool done(void) const { return done_; }
+
+    // Everything not yet consumed, i.e., the remaining fields.
+    string_view remaining(void) const { return rest_; }
 
-        if (std::regex_match(it->c_str(), cm, frame_re)) {
-            sf.binary_address = stoi(cm[1], nullptr, 16);
-            sf.function = cm[2];
-            sf.file = cm[3];
-            sf.line = stoi(cm[4]);
-            stack.push_back(sf);
+    string_view next(void) {
+        if (done_) return string_view();
+
+        size_t pos = rest_.find(delim_);
+        string_view field = rest_.substr(0, pos);
+        if (pos == string_view::npos) {
+            rest_ = string_view();
+            done_ = true;
         } else {
+            rest_.remove_prefix(pos + 1);
+        }
+        return field;
+    }
+};
+
+/**
+ * Parse a number with std::from_chars, accepting what stoi/stoull accepted in
+ * our traces: a "0x" prefix for hex fields, and negative values for unsigned
+ * fields (which wrap, as with stoull).
+ */
+template <typename T>
+static T parse_number(string_view sv, int base, string_view context) {
+    while (!sv.empty() && isspace((unsigned char)sv.front())) sv.remove_prefix(1);
+
+    bool negative = !sv.empty() && sv.front() == '-';
+    string_view digits = negative ? sv.substr(1) : sv;
+    if (base == 16 && digits.size() > 1 && digits[0] == '0' &&
+        (digits[1] == 'x' || digits[1] == 'X')) {
+        digits.remove_prefix(2);
+    }
+
+    typedef make_unsigned_t<T> unsigned_t;
+    unsigned_t magnitude = 0;
+    from_chars_result res = from_chars(digits.data(), digits.data() + digits.size(), magnitude, base);
+    bool in_range = res.ec == std::errc();
+    if (in_range && is_signed<T>::value) {
+        unsigned_t limit = (unsigned_t)numeric_limits<T>::max() + (negative ? 1 : 0);
+        in_range = magnitude <= limit;
+    }
+
+    if (!in_range) {
+        cerr << "Malformed number '" << sv << "' in trace event:" << endl;
+        cerr << "\t" << context << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    return negative ? (T)((unsigned_t)0 - magnitude) : (T)magnitude;
+}
+
+[[noreturn]] static void unrecognized_event(string_view kw, string_view raw_event) {
+    cerr << "Unrecognized event: " << kw << endl;
+    cerr << "\t" << raw_event << endl;
+    exit(EXIT_FAILURE);
+}
+
+/**
+ * Map an event keyword from the trace to its event type. Dispatches on the
+ * first character so each keyword costs at most a handful of compares.
+ */
+static bool lookup_event_keyword(string_view kw, event_type &type) {
+    if (kw.empty()) return false;
+
+    switch (kw[0]) {
+        case 'C':
+            if (kw == "CREAT") { type = CREAT; return true; }
+            if (kw == "CLOSE") { type = CLOSE; return true; }
             break;
+        case 'F':
+            if (kw == "FLUSH") { type = FLUSH; return true; }
+            if (kw == "FENCE") { type = FENCE; return true; }
+            if (kw == "FSYNC") { type = FSYNC; return true; }
+            if (kw == "FDATASYNC") { type = FDATASYNC; return true; }
+            if (kw == "FTRUNCATE") { type = FTRUNCATE; return true; }
+            if (kw == "FALLOCATE") { type = FALLOCATE; return true; }
+            break;
+        case 'L':
+            if (kw == "LSEEK") { type = LSEEK; return true; }
+            break;
+        case 'M':
+            if (kw == "MSYNC") { type = MSYNC; return true; }
+            if (kw == "MKDIR") { type = MKDIR; return true; }
+            break;
+        case 'O':
+            if (kw == "OPEN") { type = OPEN; return true; }
+            break;
+        case 'P':
+            if (kw == "PWRITE64") { type = PWRITE64; return true; }
+            if (kw == "PWRITEV") { type = PWRITEV; return true; }
+            if (kw == "PREAD") { type = PREAD; return true; }
+            break;
+        case 'R':
+            if (kw == "REGISTER_FILE") { type = REGISTER_FILE; return true; }
+            if (kw == "REGISTER_WRITE_FILE") { type = REGISTER_WRITE_FILE; return true; }
+            if (kw == "RENAME") { type = RENAME; return true; }
+            if (kw == "RMDIR") { type = RMDIR; return true; }
+            if (kw == "READ") { type = READ; return true; }
+            break;
+        case 'S':
+            if (kw == "STORE") { type = STORE; return true; }
+            if (kw == "SYNC") { type = SYNC; return true; }
+            if (kw == "SYNCFS") { type = SYNCFS; return true; }
+            if (kw == "SYNC_FILE_RANGE") { type = SYNC_FILE_RANGE; return true; }
+            break;
+        case 'U':
+            if (kw == "UNREGISTER_FILE") { type = UNREGISTER_FILE; return true; }
+            if (kw == "UNLINK") { type = UNLINK; return true; }
+            break;
+        case 'W':
+            if (kw == "WRITE") { type = WRITE; return true; }
+            if (kw == "WRITEV") { type = WRITEV; return true; }
+            break;
+        default:
+            break;
+    }
+
+    // The marker tokens are configurable, so they can't be bucketed above.
+    if (kw == PATHFINDER_BEGIN_TOKEN) { type = PATHFINDER_BEGIN; return true; }
+    if (kw == PATHFINDER_END_TOKEN) { type = PATHFINDER_END; return true; }
+    if (kw == PATHFINDER_OP_BEGIN_TOKEN) { type = PATHFINDER_OP_BEGIN; return true; }
+    if (kw == PATHFINDER_OP_END_TOKEN) { type = PATHFINDER_OP_END; return true; }
+
+    return false;
+}
+
+static bool is_word_char(char c) {
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+static bool is_digit_char(char c) {
+    return isdigit((unsigned char)c);
+}
+
+// Translate the NEWLINE & SEMICOMMA tokens pmemcheck uses to escape buffers.
+static string unescape_pm_buffer(string_view sv) {
+    static constexpr string_view newline_tok = "NEWLINE";
+    static constexpr string_view semicomma_tok = "SEMICOMMA";
+
+    string out;
+    out.reserve(sv.size());
+    size_t i = 0;
+    while (i < sv.size()) {
+        if (sv.compare(i, newline_tok.size(), newline_tok) == 0) {
+            out.push_back('\n');
+            i += newline_tok.size();
+        } else if (sv.compare(i, semicomma_tok.size(), semicomma_tok) == 0) {
+            out.push_back(';');
+            i += semicomma_tok.size();
+        } else {
+            out.push_back(sv[i]);
+            i++;
         }
     }
+    return out;
+}
+
+/**
+ * Frames look like "ADDR: function (file:line)". Mirrors the old regex
+ * (\w+): (.+) \((.+):(\d+)\), including its greedy matching.
+ */
+static bool parse_pm_frame(string_view frame, stack_frame &sf) {
+    if (frame.size() < 2 || frame.back() != ')') return false;
+
+    size_t colon = frame.find(": ");
+    if (colon == string_view::npos || colon == 0) return false;
+    string_view addr = frame.substr(0, colon);
+    if (!all_of(addr.begin(), addr.end(), is_word_char)) return false;
+
+    // Strip the trailing ')'
+    string_view rest = frame.substr(colon + 2, frame.size() - colon - 3);
+    size_t line_sep = rest.rfind(':');
+    if (line_sep == string_view::npos) return false;
+    string_view line = rest.substr(line_sep + 1);
+    if (line.empty() || !all_of(line.begin(), line.end(), is_digit_char)) return false;
+
+    // The function name is greedy, so take the last " (" that leaves a
+    // non-empty file name.
+    string_view head = rest.substr(0, line_sep);
+    size_t paren = head.rfind(" (");
+    while (paren != string_view::npos && paren + 2 >= head.size()) {
+        paren = paren ? head.rfind(" (", paren - 1) : string_view::npos;
+    }
+    if (paren == string_view::npos || paren == 0) return false;
 
-    return stack;
+    sf.binary_address = parse_number<uint64_t>(addr, 16, frame);
+    sf.function = string(head.substr(0, paren));
+    sf.file = string(head.substr(paren + 2));
+    sf.line = parse_number<int>(line, 10, frame);
+    return true;
 }
 
-vector<stack_frame> trace::parse_posix_stack(vector<string> &raw_pieces) {
+interned_stack trace::parse_pm_stack(string_view frames) const {
     vector<stack_frame> stack;
-    if (raw_pieces.size() <= 1) return stack;
-    for (size_t i = 1; i < raw_pieces.size(); i++) {
+
+    field_tokenizer tok(frames, ';');
+    while (!tok.done()) {
         stack_frame sf;
-        // split by ","
-        vector<string> pieces;
-        // boost::split(pieces, raw_pieces[i], boost::is_any_of(","));
-        // split by "," but only split by last 3 commas
-        boost::split(pieces, raw_pieces[i], boost::is_any_of(","));
-        if (pieces.size() < 4) break;
-        if (pieces.size() > 4) {
-            vector<string> processed_pieces;
-            // keep last 3 pieces, and combine the rest with ","
-            string combined;
-            for (size_t j = 0; j < pieces.size() - 3; j++) {
-                combined += pieces[j];
-                if (j != pieces.size() - 4) {
-                    combined += ",";
-                }
-            }
-            processed_pieces.push_back(combined);
-            for (size_t j = pieces.size() - 3; j < pieces.size(); j++) {
-                processed_pieces.push_back(pieces[j]);
-            }
-            pieces = processed_pieces;
-        }
-        sf.function = pieces[0];
-        if (pieces[1] == "") {
+        if (!parse_pm_frame(tok.next(), sf)) break;
+        stack.push_back(sf);
+    }
+
+    return interned_stack(std::move(stack));
+}
+
+interned_stack trace::parse_posix_stack(
+    string_view frames,
+    vector<string> &intrinsics) const {
+    vector<stack_frame> stack;
+
+    field_tokenizer tok(frames, ';');
+    bool first = true;
+    while (!tok.done()) {
+        string_view frame = tok.next();
+        // "function,file,line,addr", where function names may contain
+        // commas, so split on the last three.
+        size_t addr_sep = frame.rfind(',');
+        if (addr_sep == string_view::npos || addr_sep == 0) break;
+        size_t line_sep = frame.rfind(',', addr_sep - 1);
+        if (line_sep == string_view::npos || line_sep == 0) break;
+        size_t file_sep = frame.rfind(',', line_sep - 1);
+        if (file_sep == string_view::npos) break;
+
+        stack_frame sf;
+        sf.function = string(frame.substr(0, file_sep));
+        string_view file = frame.substr(file_sep + 1, line_sep - file_sep - 1);
+        if (file.empty()) {
             sf.file = "unknown";
             sf.line = -1;
-            if (i == 1 && find(intrinsic_functions.begin(), intrinsic_functions.end(), sf.function) == intrinsic_functions.end())
-            intrinsic_functions.push_back(sf.function);
-            // continue;
-        } 
+            if (first) intrinsics.push_back(sf.function);
+        }
         else {
-            sf.file = pieces[1];
-            sf.line = stoi(pieces[2]);
+            sf.file = string(file);
+            sf.line = parse_number<int>(frame.substr(line_sep + 1, addr_sep - line_sep - 1), 10, frame);
         }
-        sf.binary_address = stoi(pieces[3], nullptr, 16);
+        sf.binary_address = parse_number<uint64_t>(frame.substr(addr_sep + 1), 16, frame);
         stack.push_back(sf);
+        first = false;
     }
-    return stack;
-
+    return interned_stack(std::move(stack));
 }
 
-trace_event trace::parse_pm_op(const string &raw_event) {
+trace_event trace::parse_pm_op(string_view raw_event) const {
     trace_event te;
-    vector<string> pieces;
 
     BOOST_ASSERT(!raw_event.empty());
 
-    boost::split(pieces, raw_event, boost::is_any_of(";"));
+    field_tokenizer tok(raw_event, ';');
+    string_view kw = tok.next();
+    auto hex = [&] (string_view sv) { return parse_number<uint64_t>(sv, 16, raw_event); };
 
-    auto it_start = pieces.begin();
-    auto it_end = pieces.end();
+    if (!lookup_event_keyword(kw, te.type)) unrecognized_event(kw, raw_event);
 
-    if (pieces[0] == "STORE") {
-        te.type = STORE;
-        te.address = stoull(pieces[1], nullptr, 16);
-        te.value = stoull(pieces[2], nullptr, 16);
-        te.size = stoull(pieces[3], nullptr, 16);
-        assert(te.size <= sizeof(te.value));
-        for (int i = 0; i < te.size; i++) {
-            te.value_bytes.push_back( ((char*)&te.value)[i] );
-        }
-        assert(te.size == te.value_bytes.size());
-
-        it_start = pieces.begin() + 4;
-        te.stack = parse_pm_stack(it_start, it_end);
-    } else if (pieces[0] == "FLUSH") {
-        te.type = FLUSH;
-        te.address = stoull(pieces[1], nullptr, 16);
-        te.size = stoull(pieces[2], nullptr, 16);
-        it_start = pieces.begin() + 3;
-        // iangneal: don't need this for now
-        te.stack = parse_pm_stack(it_start, it_end);
-    } else if (pieces[0] == "FENCE") {
-        te.type = FENCE;
-        it_start = pieces.begin() + 1;
-        // iangneal: don't need this for now.
-        te.stack = parse_pm_stack(it_start, it_end);
-    } else if (pieces[0] == "REGISTER_FILE") {
-        te.type = REGISTER_FILE;
-        te.file_path = pieces[1];
-        te.address = stoull(pieces[2], nullptr, 16);
-        te.size = stoull(pieces[3], nullptr, 16);
-        te.file_offset = stol(pieces[4], nullptr, 16);
-        // Also add to the set of known PM files
-        pm_files_.insert(te.file_path);
-    } else if (pieces[0] == "WRITE") {
-        te.type = WRITE;
-        te.file_path = pieces[1];
-
-        // translate NEWLINE & SEMICOMMA tokens
-        std::regex r_newline("NEWLINE");
-        std::regex r_semicomma("SEMICOMMA");
-        string processed = std::regex_replace(pieces[2], r_newline, "\n");
-        processed = std::regex_replace(processed, r_semicomma, ";");
-
-        te.buf = processed;
-        it_start = pieces.begin() + 3;
-        te.stack = parse_pm_stack(it_start, it_end);
-        // for now I don't want to pollute pm_files_ with files for WRITE
-        // if (pm_files_.find(te.file_path) != pm_files_.end()) {
-        //     pm_files_.erase(te.file_path);
-        // }
-        // write_files_.insert(te.file_path);
-
-        // WRITE event should be after REGISTER_WRITE_FILE event
-        assert(write_files_.find(te.file_path) != write_files_.end());
-    } else if (pieces[0] == "REGISTER_WRITE_FILE") {
-        te.type = REGISTER_WRITE_FILE;
-        te.file_path = pieces[1];
-        write_files_.insert(te.file_path);
-    } else if (pieces[0] == "PWRITEV") {
-        te.type = PWRITEV;
-        te.file_path = pieces[1];
-        te.wfile_offset = stoull(pieces[2]);
-        int buf_count = stoi(pieces[3]);
-        for (int i = 0; i < buf_count; i++) {
-            // translate NEWLINE & SEMICOMMA tokens
-            std::regex r_newline("NEWLINE");
-            std::regex r_semicomma("SEMICOMMA");
-            string processed = std::regex_replace(pieces[4+i], r_newline, "\n");
-            processed = std::regex_replace(processed, r_semicomma, ";");
-
-            te.buf_vec.push_back(processed);
+    switch (te.type) {
+        case STORE:
+            te.address = hex(tok.next());
+            te.value = hex(tok.next());
+            te.size = hex(tok.next());
+            assert(te.size <= sizeof(te.value));
+            for (int i = 0; i < te.size; i++) {
+                te.value_bytes.push_back( ((char*)&te.value)[i] );
+            }
+            assert(te.size == te.value_bytes.size());
+
+            te.stack = parse_pm_stack(tok.remaining());
+            break;
+        case FLUSH:
+            te.address = hex(tok.next());
+            te.size = hex(tok.next());
+            // iangneal: don't need this for now
+            te.stack = parse_pm_stack(tok.remaining());
+            break;
+        case FENCE:
+            // iangneal: don't need this for now.
+            te.stack = parse_pm_stack(tok.remaining());
+            break;
+        case REGISTER_FILE:
+            te.file_path = string(tok.next());
+            te.address = hex(tok.next());
+            te.size = hex(tok.next());
+            te.file_offset = parse_number<off_t>(tok.next(), 16, raw_event);
+            break;
+        case WRITE:
+            te.file_path = string(tok.next());
+            te.buf = unescape_pm_buffer(tok.next());
+            te.stack = parse_pm_stack(tok.remaining());
+            // for now I don't want to pollute pm_files_ with files for WRITE
+            // if (pm_files_.find(te.file_path) != pm_files_.end()) {
+            //     pm_files_.erase(te.file_path);
+            // }
+            // write_files_.insert(te.file_path);
+            break;
+        case REGISTER_WRITE_FILE:
+            te.file_path = string(tok.next());
+            break;
+        case PWRITEV: {
+            te.file_path = string(tok.next());
+            te.wfile_offset = parse_number<uint64_t>(tok.next(), 10, raw_event);
+            int buf_count = parse_number<int>(tok.next(), 10, raw_event);
+            for (int i = 0; i < buf_count; i++) {
+                te.buf_vec.push_back(unescape_pm_buffer(tok.next()));
+            }
+            te.stack = parse_pm_stack(tok.remaining());
+            break;
         }
-        it_start = pieces.begin() + 4 + buf_count;
-        te.stack = parse_pm_stack(it_start, it_end);
-        // WRITE event should be after REGISTER_WRITE_FILE event
-        assert(write_files_.find(te.file_path) != write_files_.end());
-    } else if (pieces[0] == "FTRUNCATE") {
-        te.type = FTRUNCATE;
-        te.file_path = pieces[1];
-        te.len = stol(pieces[2]);
-    } else if (pieces[0] == "FALLOCATE") {
-        te.type = FALLOCATE;
-        te.file_path = pieces[1];
-        te.mode = stoi(pieces[2]);
-        te.file_offset = stol(pieces[3]);
-        te.len = stol(pieces[4]);
-    } else if (pieces[0] == PATHFINDER_BEGIN_TOKEN) {
-        te.type = PATHFINDER_BEGIN;
-    } else if (pieces[0] == PATHFINDER_END_TOKEN) {
-        te.type = PATHFINDER_END;
-    } else {
-        cerr << "Unrecognized event: " << pieces[0] << endl;
-        cerr << "\t" << raw_event << endl;
-        exit(EXIT_FAILURE);
+        case FTRUNCATE:
+            te.file_path = string(tok.next());
+            te.len = parse_number<off_t>(tok.next(), 10, raw_event);
+            break;
+        case FALLOCATE:
+            te.file_path = string(tok.next());
+            te.mode = parse_number<int>(tok.next(), 10, raw_event);
+            te.file_offset = parse_number<off_t>(tok.next(), 10, raw_event);
+            te.len = parse_number<off_t>(tok.next(), 10, raw_event);
+            break;
+        case PATHFINDER_BEGIN:
+        case PATHFINDER_END:
+            break;
+        default:
+            unrecognized_event(kw, raw_event);
     }
 
     // This won't be equal because we discard "???" entries.
@@ -208,397 +375,341 @@ trace_event trace::parse_pm_op(const string &raw_event) {
     return te;
 }
 
-shared_ptr<char> trace::base64_decode(const char* input, uint32_t size)
+shared_ptr<char> trace::base64_decode(const char* input, uint32_t size, uint64_t &decoded_size) const
 {
-	/* set up a destination buffer large enough to hold the encoded data */
-	char* output = (char*)malloc(BUFFER_SIZE);
-	/* keep track of our decoded position */
-	char* c = output;
-	/* store the number of bytes decoded by a single call */
-	int cnt = 0;
+	/* every 4 input characters decode to at most 3 bytes, plus the terminator */
+	shared_ptr<char> output = shared_ptr<char>(new char[(size / 4 + 1) * 3 + 1], std::default_delete<char[]>());
 	/* we need a decoder state */
 	base64_decodestate s;
-	
+
 	/*---------- START DECODING ----------*/
 	/* initialise the decoder state */
 	base64_init_decodestate(&s);
 	/* decode the input data */
-	cnt = base64_decode_block(input, size, c, &s);
-	c += cnt;
+	int cnt = base64_decode_block(input, size, output.get(), &s);
 	/* note: there is no base64_decode_blockend! */
 	/*---------- STOP DECODING  ----------*/
-	
-	/* we want to print the decoded data, so null-terminate it: */
-	*c = 0;
-
-    // now we know the actual size of the decoded data, allocate another char array and copy the data
-    // char* final_output = (char*)malloc(c - output + 1);
-    shared_ptr<char> final_output = shared_ptr<char>(new char[c - output + 1], std::default_delete<char[]>());
-    memcpy(final_output.get(), output, c - output + 1);
-    free(output);
-	
-	return final_output;
+
+	/* null-terminate, like the decoded buffers always have been */
+	output.get()[cnt] = 0;
+	decoded_size = cnt;
+
+	return output;
 }
 
-trace_event trace::parse_posix_op(const string &line) {
+trace_event trace::parse_posix_op(string_view line, vector<string> &intrinsics) const {
     trace_event te;
-    vector<string> pieces;
-
-    // split line by ";"
-    vector<string> raw_pieces;
-    boost::algorithm::split_regex(raw_pieces, line, boost::regex(";"));
-    BOOST_ASSERT(raw_pieces.size());
-    string posix_event = raw_pieces[0];
-
-    // split posix_event by ","
-    boost::split(pieces, posix_event, boost::is_any_of(","));
-    auto it_start = pieces.begin();
-    auto it_end = pieces.end();
-    // cout << "posix_event: " << posix_event << endl;
-    if (pieces[2] == "STORE") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10);
-        te.type = STORE;
-        te.store_num = stoull(pieces[3], nullptr, 10);
-        te.file_path = pieces[4];
-        te.address = stoull(pieces[5], nullptr, 16);
-        te.size = stoull(pieces[6], nullptr, 10);
-        string encoded_value = pieces[7];
-        te.char_buf = base64_decode(encoded_value.c_str(), encoded_value.size());
-        // I cannot use strlen here because it will stop at the first '\0'
-        // assert(te.size <= strlen(te.char_buf));
-        for (int i = 0; i < te.size; i++) {
-            te.value_bytes.push_back(*(te.char_buf.get() + i));
-        }
-        assert(te.size == te.value_bytes.size());
-        // parse stack
 
+    // The event is everything up to the first ";", the stack follows.
+    field_tokenizer segments(line, ';');
+    field_tokenizer tok(segments.next(), ',');
+
+    auto dec = [&] (string_view sv) { return parse_number<uint64_t>(sv, 10, line); };
+    auto num = [&] (string_view sv) { return parse_number<int>(sv, 10, line); };
+    auto off = [&] (string_view sv) { return parse_number<off_t>(sv, 10, line); };
+    auto decode = [&] (string_view sv, uint64_t &decoded_size) {
+        return base64_decode(sv.data(), sv.size(), decoded_size);
+    };
+
+    te.timestamp = dec(tok.next());
+    te.tid = dec(tok.next());
+    string_view kw = tok.next();
+    // cout << "posix_event: " << line << endl;
+
+    if (!lookup_event_keyword(kw, te.type)) unrecognized_event(kw, line);
+
+    switch (te.type) {
+        case STORE:
+            te.store_num = dec(tok.next());
+            te.file_path = string(tok.next());
+            te.address = parse_number<uint64_t>(tok.next(), 16, line);
+            te.size = dec(tok.next());
+            te.char_buf = decode(tok.next(), te.char_buf_size);
+            // I cannot use strlen here because it will stop at the first '\0'
+            // assert(te.size <= strlen(te.char_buf));
+            for (int i = 0; i < te.size; i++) {
+                te.value_bytes.push_back(*(te.char_buf.get() + i));
+            }
+            assert(te.size == te.value_bytes.size());
+            break;
+        case REGISTER_FILE:
+            te.file_path = string(tok.next());
+            te.address = parse_number<uint64_t>(tok.next(), 16, line);
+            te.size = dec(tok.next());
+            te.file_offset = off(tok.next());
+            te.prot = num(tok.next());
+            te.flags = num(tok.next());
+            break;
+        case UNREGISTER_FILE:
+            te.file_path = string(tok.next());
+            te.address = parse_number<uint64_t>(tok.next(), 16, line);
+            te.size = dec(tok.next());
+            break;
+        case MSYNC:
+            te.file_path = string(tok.next());
+            te.address = parse_number<uint64_t>(tok.next(), 16, line);
+            te.size = dec(tok.next());
+            te.flags = num(tok.next());
+            break;
+        case FTRUNCATE:
+            te.fd = num(tok.next());
+            te.file_path = string(tok.next());
+            te.len = off(tok.next());
+            break;
+        case PWRITE64:
+            te.fd = num(tok.next());
+            te.file_path = string(tok.next());
+            te.file_offset = off(tok.next());
+            te.size = dec(tok.next());
+            te.char_buf = decode(tok.next(), te.char_buf_size);
+            break;
+        case WRITE:
+            te.fd = num(tok.next());
+            te.file_path = string(tok.next());
+            te.size = dec(tok.next());
+            te.char_buf = decode(tok.next(), te.char_buf_size);
+            break;
+        case WRITEV:
+            te.fd = num(tok.next());
+            te.file_path = string(tok.next());
+            te.iovcnt = num(tok.next());
+            for (int i = 0; i < te.iovcnt; i++) {
+                int iov_len = num(tok.next());
+                uint64_t iov_size = 0;
+                shared_ptr<char> iov_base = decode(tok.next(), iov_size);
+                te.iov.push_back(make_tuple(iov_len, iov_base));
+                te.iov_sizes.push_back(iov_size);
+            }
+            break;
+        case LSEEK:
+            te.fd = num(tok.next());
+            te.file_path = string(tok.next());
+            te.file_offset = off(tok.next());
+            te.flags = num(tok.next());
+            break;
+        case RENAME:
+            te.file_path = string(tok.next());
+            te.new_path = string(tok.next());
+            break;
+        case UNLINK:
+        case RMDIR:
+            te.file_path = string(tok.next());
+            break;
+        case FSYNC:
+        case FDATASYNC:
+        case CLOSE:
+        case SYNCFS:
+            te.fd = num(tok.next());
+            te.file_path = string(tok.next());
+            break;
+        case FALLOCATE:
+            te.fd = num(tok.next());
+            te.file_path = string(tok.next());
+            te.mode = num(tok.next());
+            te.file_offset = off(tok.next());
+            te.len = off(tok.next());
+            break;
+        case OPEN:
+            te.file_path = string(tok.next());
+            te.flags = num(tok.next());
+            te.mode = num(tok.next());
+            te.fd = num(tok.next());
+            break;
+        case CREAT:
+            te.file_path = string(tok.next());
+            te.mode = num(tok.next());
+            te.fd = num(tok.next());
+            break;
+        case MKDIR:
+            te.file_path = string(tok.next());
+            te.mode = num(tok.next());
+            break;
+        case SYNC_FILE_RANGE:
+            te.fd = num(tok.next());
+            te.file_path = string(tok.next());
+            te.file_offset = off(tok.next());
+            te.len = off(tok.next());
+            te.flags = num(tok.next());
+            break;
+        case READ:
+            te.fd = num(tok.next());
+            te.file_path = string(tok.next());
+            te.size = dec(tok.next());
+            break;
+        case PREAD:
+            te.fd = num(tok.next());
+            te.file_path = string(tok.next());
+            te.file_offset = off(tok.next());
+            te.size = dec(tok.next());
+            break;
+        case SYNC:
+        case FENCE:
+        case PATHFINDER_BEGIN:
+        case PATHFINDER_END:
+            break;
+        case PATHFINDER_OP_BEGIN:
+        case PATHFINDER_OP_END:
+            te.workload_thread_id = num(tok.next());
+            te.thread_op_id = num(tok.next());
+            break;
+        default:
+            unrecognized_event(kw, line);
     }
-    else if (pieces[2] == "REGISTER_FILE") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10);
-        te.type = REGISTER_FILE;
-        te.file_path = pieces[3];
-        te.address = stoull(pieces[4], nullptr, 16);
-        te.size = stoull(pieces[5], nullptr, 10);
-        te.file_offset = stol(pieces[6], nullptr, 10);
-        te.prot = stoi(pieces[7], nullptr, 10);
-        te.flags = stoi(pieces[8], nullptr, 10);
-        write_files_.insert(te.file_path);
-        pm_files_.insert(te.file_path);
-    }
-    else if (pieces[2] == "UNREGISTER_FILE") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10);
-        te.type = UNREGISTER_FILE;
-        te.file_path = pieces[3];
-        te.address = stoull(pieces[4], nullptr, 16);
-        te.size = stoull(pieces[5], nullptr, 10);
-    }
-    else if (pieces[2] == "MSYNC") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10);
-        te.type = MSYNC;
-        te.file_path = pieces[3];
-        te.address = stoull(pieces[4], nullptr, 16);
-        te.size = stoull(pieces[5], nullptr, 10);
-        te.flags = stoi(pieces[6], nullptr, 10);
-    }
-    else if (pieces[2] == "FTRUNCATE") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10);
-        te.type = FTRUNCATE;
-        te.fd = stoi(pieces[3], nullptr, 10);
-        te.file_path = pieces[4];
-        te.len = stol(pieces[5]);
-        write_files_.insert(te.file_path);
-    }
-    else if (pieces[2] == "PWRITE64") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10);
-        te.type = PWRITE64;
-        te.fd = stoi(pieces[3], nullptr, 10);
-        te.file_path = pieces[4];
-        te.file_offset = stol(pieces[5]);
-        te.size = stoull(pieces[6]);
-        string encoded_value = pieces[7];
-        te.char_buf = base64_decode(encoded_value.c_str(), encoded_value.size());
-        write_files_.insert(te.file_path);
-    }
-    else if (pieces[2] == "WRITE") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10);
-        te.type = WRITE;
-        te.fd = stoi(pieces[3], nullptr, 10);
-        te.file_path = pieces[4];
-        te.size = stoull(pieces[5]);
-        string encoded_value = pieces[6];
-        te.char_buf = base64_decode(encoded_value.c_str(), encoded_value.size());
-        // cout << "te.buf: " << te.buf << endl;
-        write_files_.insert(te.file_path);
-    }
-    else if (pieces[2] == "WRITEV") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10); 
-        te.type = WRITEV;
-        te.fd = stoi(pieces[3], nullptr, 10);
-        te.file_path = pieces[4];
-        te.iovcnt = stoi(pieces[5]);
-        for (int i = 0; i < te.iovcnt; i++) {
-            int iov_len = stoi(pieces[6+i*2]);
-            string encoded_value = pieces[6+i*2+1];
-            shared_ptr<char> iov_base = base64_decode(encoded_value.c_str(), encoded_value.size());
-            te.iov.push_back(make_tuple(iov_len, iov_base));
-            // cout << "te.buf: " << te.buf << endl;
-        }
-        write_files_.insert(te.file_path);
-    }
-    else if (pieces[2] == "LSEEK") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10); 
-        te.type = LSEEK;
-        te.fd = stoi(pieces[3], nullptr, 10);
-        te.file_path = pieces[4];
-        te.file_offset = stol(pieces[5]);
-        te.flags = stoi(pieces[6]);
-        write_files_.insert(te.file_path);
-    }
-    else if (pieces[2] == "RENAME") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10); 
-        te.type = RENAME;
-        te.file_path = pieces[3];
-        te.new_path = pieces[4];
-        write_files_.insert(te.file_path);
-        write_files_.insert(te.new_path);
-    }
-    else if (pieces[2] == "UNLINK") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10); 
-        te.type = UNLINK;
-        te.file_path = pieces[3];
-        write_files_.insert(te.file_path);
-    }
-    else if (pieces[2] == "FSYNC") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10); 
-        te.type = FSYNC;
-        te.fd = stoi(pieces[3], nullptr, 10);
-        te.file_path = pieces[4];
-        write_files_.insert(te.file_path);
-    }
-    else if (pieces[2] == "FDATASYNC") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10);
-        te.type = FDATASYNC;
-        te.fd = stoi(pieces[3], nullptr, 10);
-        te.file_path = pieces[4];
-        write_files_.insert(te.file_path);
-    }
-    else if (pieces[2] == "FALLOCATE") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10);
-        te.type = FALLOCATE;
-        te.fd = stoi(pieces[3], nullptr, 10);
-        te.file_path = pieces[4];
-        te.mode = stoi(pieces[5], nullptr, 10);
-        te.file_offset = stol(pieces[6], nullptr, 10);
-        te.len = stol(pieces[7], nullptr, 10);
-        write_files_.insert(te.file_path);
-    }
-    else if (pieces[2] == "OPEN") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10);
-        te.type = OPEN;
-        te.file_path = pieces[3];
-        te.flags = stoi(pieces[4], nullptr, 10);
-        te.mode = stoi(pieces[5], nullptr, 10);
-        te.fd = stoi(pieces[6], nullptr, 10);
-        write_files_.insert(te.file_path);
-    }
-    else if (pieces[2] == "CREAT") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10);
-        te.type = CREAT;
-        te.file_path = pieces[3];
-        te.mode = stoi(pieces[4], nullptr, 10);
-        te.fd = stoi(pieces[5], nullptr, 10);
-        write_files_.insert(te.file_path);
-    }
-    else if (pieces[2] == "CLOSE") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10);
-        te.type = CLOSE;
-        te.fd = stoi(pieces[3], nullptr, 10);
-        te.file_path = pieces[4];
-    }
-    else if (pieces[2] == "MKDIR") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10);
-        te.type = MKDIR;
-        te.file_path = pieces[3];
-        te.mode = stoi(pieces[4], nullptr, 10);
-        write_files_.insert(te.file_path);
-    }
-    else if (pieces[2] == "RMDIR") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10);
-        te.type = RMDIR;
-        te.file_path = pieces[3];
-        write_files_.insert(te.file_path);
-    }
-    else if (pieces[2] == "SYNC") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10);
-        te.type = SYNC;
-    }
-    else if (pieces[2] == "SYNCFS") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10);
-        te.type = SYNCFS;
-        te.fd = stoi(pieces[3], nullptr, 10);
-        te.file_path = pieces[4];
-    }
-    else if (pieces[2] == "SYNC_FILE_RANGE") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10);
-        te.type = SYNC_FILE_RANGE;
-        te.fd = stoi(pieces[3], nullptr, 10);
-        te.file_path = pieces[4];
-        te.file_offset = stol(pieces[5], nullptr, 10);
-        te.len = stol(pieces[6], nullptr, 10);
-        te.flags = stoi(pieces[7], nullptr, 10);
-    }
-    else if (pieces[2] == "FENCE") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10); 
-        te.type = FENCE;
-    }
-    else if (pieces[2] == "READ") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10);
-        te.type = READ;
-        te.fd = stoi(pieces[3], nullptr, 10);
-        te.file_path = pieces[4];
-        te.size = stoull(pieces[5]);
-    }
-    else if (pieces[2] == "PREAD") {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10);
-        te.type = PREAD;
-        te.fd = stoi(pieces[3], nullptr, 10);
-        te.file_path = pieces[4];
-        te.file_offset = stol(pieces[5]);
-        te.size = stoull(pieces[6]);
-    }
-    else if (pieces[2] == PATHFINDER_BEGIN_TOKEN) {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10); 
-        te.type = PATHFINDER_BEGIN;
-    }
-    else if (pieces[2] == PATHFINDER_END_TOKEN) {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10); 
-        te.type = PATHFINDER_END;
-    }
-    else if (pieces[2] == PATHFINDER_OP_BEGIN_TOKEN) {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10); 
-        te.type = PATHFINDER_OP_BEGIN;
-        te.workload_thread_id = stoi(pieces[3], nullptr, 10);
-        te.thread_op_id = stoi(pieces[4], nullptr, 10);
-        current_thread_op_ = make_pair(te.tid, *te.thread_op_id);
-        current_tid_to_workload_tid_ = make_pair(te.tid, *te.workload_thread_id);
-    }
-    else if (pieces[2] == PATHFINDER_OP_END_TOKEN) {
-        te.timestamp = stoull(pieces[0], nullptr, 10);
-        te.tid = stoull(pieces[1], nullptr, 10); 
-        te.type = PATHFINDER_OP_END;
-        te.workload_thread_id = stoi(pieces[3], nullptr, 10);
-        te.thread_op_id = stoi(pieces[4], nullptr, 10);
-        current_thread_op_ = nullopt;
-        current_tid_to_workload_tid_ = nullopt;
-    }
-    else {
-        cerr << "Unrecognized event: " << pieces[2] << endl;
-        cerr << "\t" << line << endl;
-        exit(EXIT_FAILURE);
-    }
-    te.stack = parse_posix_stack(raw_pieces);
-    // TODO: current Pin tool has some problem handling multi-processing with -follow-execv
-    // this is a temporary fix to ensure timestamp is always increasing...
-    te.timestamp = timestamp_;
-    timestamp_++;
-
-    if (current_thread_op_ && te.type != PATHFINDER_OP_BEGIN && current_thread_op_->first == te.tid) {
-        thread_ops_[current_thread_op_->first][current_thread_op_->second].push_back(te.timestamp);
-        te.workload_thread_id = current_tid_to_workload_tid_->second;
-    }
+    te.stack = parse_posix_stack(segments.remaining(), intrinsics);
+    // The timestamp and op-tracing state are assigned in append_events.
 
     return te;
 }
 
-size_t trace::get_next_events(string line) {
+trace::parsed_line trace::parse_line(const string &line) const {
+    parsed_line parsed;
     if (line.empty()) {
-        return 0;
+        return parsed;
     }
-    size_t nadded = 0;
 
     if (mode_ == PM) {
         // See if this line has a trace in it.
         if (line.find("START||") != string::npos ||
             line.find("||STOP") != string::npos) {
-            // Split the trace
-            vector<string> raw_events;
-            boost::algorithm::split_regex(raw_events, line, boost::regex("\\|\\|"));
-            // cerr << "\n\nnew line!\n>>> " << line << endl << endl;
-            for (const auto &event : raw_events) {
-                if (event.empty() ||
-                    event.find("START") != string::npos ||
-                    event.find("STOP") != string::npos ||
-                    event.find("==") != string::npos
-                    ) continue;
-
-                // cerr << "event: " << event << endl;
-
-                std::shared_ptr<trace_event> te = make_shared<trace_event>(parse_pm_op(event));
-                if (te->is_marker_event() && !selective_) {
-                    cerr << "Warning: ignoring selective testing trace events (testing full trace anyways).\n";
-                    continue;
+            // Split the trace on "||"
+            string_view rest(line);
+            while (true) {
+                size_t pos = rest.find("||");
+                string_view event = rest.substr(0, pos);
+
+                if (!(event.empty() ||
+                      event.find("START") != string_view::npos ||
+                      event.find("STOP") != string_view::npos ||
+                      event.find("==") != string_view::npos)) {
+                    parsed.events.push_back(parse_pm_op(event));
                 }
 
-                te->timestamp = timestamp_;
-                timestamp_++;
-                if (te->is_store()) {
-                    te->store_num = store_num_;
-                    store_num_++;
-                }
+                if (pos == string_view::npos) break;
+                rest.remove_prefix(pos + 2);
+            }
+        }
+    }
+    else {
+        parsed.events.push_back(parse_posix_op(line, parsed.intrinsic_functions));
+    }
 
-                if (te->is_write() || te->is_pwritev()) {
-                    te->write_num = write_num_;
-                    write_num_++;
-                }
+    // Otherwise, see if it's a summary
+    // TODO: We really don't need this right now, we don't use it anyways.
 
-                if (te->is_pathfinder_begin()) {
-                    testing_starts_.push_back(te->timestamp);
-                }
+    return parsed;
+}
 
-                if (te->is_pathfinder_end()) {
-                    testing_stops_.push_back(te->timestamp);
-                }
+void trace::register_event_files(const trace_event &te) {
+    if (mode_ == PM) {
+        switch (te.type) {
+            case REGISTER_FILE:
+                // Also add to the set of known PM files
+                pm_files_.insert(te.file_path);
+                break;
+            case REGISTER_WRITE_FILE:
+                write_files_.insert(te.file_path);
+                break;
+            case WRITE:
+            case PWRITEV:
+                // WRITE event should be after REGISTER_WRITE_FILE event
+                assert(write_files_.find(te.file_path) != write_files_.end());
+                break;
+            default:
+                break;
+        }
+        return;
+    }
 
-                events_.push_back(te);
-                assert(te->event_idx() == events_.size() - 1);
-                if (events_.back()->is_store()) {
-                    stores_.push_back(events_.back());
-                    // cerr << stores_.back() << "\n" << stores_.back()->str() << "\n";
-                }
-                nadded++;
-            }
+    switch (te.type) {
+        case REGISTER_FILE:
+            write_files_.insert(te.file_path);
+            pm_files_.insert(te.file_path);
+            break;
+        case RENAME:
+            write_files_.insert(te.file_path);
+            write_files_.insert(te.new_path);
+            break;
+        case FTRUNCATE:
+        case PWRITE64:
+        case WRITE:
+        case WRITEV:
+        case LSEEK:
+        case UNLINK:
+        case FSYNC:
+        case FDATASYNC:
+        case FALLOCATE:
+        case OPEN:
+        case CREAT:
+        case MKDIR:
+        case RMDIR:
+            write_files_.insert(te.file_path);
+            break;
+        default:
+            break;
+    }
+}
+
+size_t trace::append_events(parsed_line &&parsed) {
+    size_t nadded = 0;
+
+    for (const string &func : parsed.intrinsic_functions) {
+        if (find(intrinsic_functions.begin(), intrinsic_functions.end(), func) == intrinsic_functions.end()) {
+            intrinsic_functions.push_back(func);
         }
     }
-    else {
-        std::shared_ptr<trace_event> te = make_shared<trace_event>(parse_posix_op(line));
+
+    for (trace_event &parsed_te : parsed.events) {
+        register_event_files(parsed_te);
+        parsed_te.file_path_id = intern_path(parsed_te.file_path);
+        parsed_te.new_path_id = intern_path(parsed_te.new_path);
+
+        std::shared_ptr<trace_event> te = make_shared<trace_event>(std::move(parsed_te));
+
+        if (mode_ == PM) {
+            if (te->is_marker_event() && !selective_) {
+                cerr << "Warning: ignoring selective testing trace events (testing full trace anyways).\n";
+                continue;
+            }
+
+            te->timestamp = timestamp_;
+            timestamp_++;
+            if (te->is_store()) {
+                te->store_num = store_num_;
+                store_num_++;
+            }
+
+            if (te->is_write() || te->is_pwritev()) {
+                te->write_num = write_num_;
+                write_num_++;
+            }
+
+            if (te->is_pathfinder_begin()) {
+                testing_starts_.push_back(te->timestamp);
+            }
+
+            if (te->is_pathfinder_end()) {
+                testing_stops_.push_back(te->timestamp);
+            }
+        } else {
+            // TODO: current Pin tool has some problem handling multi-processing with -follow-execv
+            // this is a temporary fix to ensure timestamp is always increasing...
+            te->timestamp = timestamp_;
+            timestamp_++;
+
+            if (te->type == PATHFINDER_OP_BEGIN) {
+                current_thread_op_ = make_pair(te->tid, *te->thread_op_id);
+                current_tid_to_workload_tid_ = make_pair(te->tid, *te->workload_thread_id);
+            } else if (te->type == PATHFINDER_OP_END) {
+                current_thread_op_ = nullopt;
+                current_tid_to_workload_tid_ = nullopt;
+            }
+
+            if (current_thread_op_ && te->type != PATHFINDER_OP_BEGIN && current_thread_op_->first == te->tid) {
+                thread_ops_[current_thread_op_->first][current_thread_op_->second].push_back(te->timestamp);
+                te->workload_thread_id = current_tid_to_workload_tid_->second;
+            }
+        }
+
         events_.push_back(te);
         assert(te->event_idx() == events_.size() - 1);
         if (events_.back()->is_store()) {
@@ -608,9 +719,6 @@ size_t trace::get_next_events(string line) {
         nadded++;
     }
 
-    // Otherwise, see if it's a summary
-    // TODO: We really don't need this right now, we don't use it anyways.
-
     return nadded;
 }
 
@@ -650,22 +758,192 @@ void trace::construct_testing_ranges(void) {
     }
 }
 
-void trace::read(bp::child &child, std::istream &stream) {
-    stringstream ss;
-    thread t;
+void trace::ingest(std::istream &stream, const function<bool(void)> &keep_reading) {
+    // Lines per batch handed to a parser worker. Large enough to amortize the
+    // hand-off, small enough to keep all workers busy on short traces.
+    const size_t batch_lines = 1024;
+    const size_t nworkers = parse_threads_;
+    // Bound the number of batches that are read but not yet merged.
+    const uint64_t max_inflight = 4 * nworkers;
+
+    typedef vector<string> line_batch;
+    typedef vector<parsed_line> parsed_batch;
+
+    mutex mtx;
+    condition_variable work_cv, merge_cv, space_cv;
+    deque<pair<uint64_t, line_batch>> work;
+    map<uint64_t, parsed_batch> parsed;
+    uint64_t nsubmitted = 0;
+    uint64_t nmerged = 0;
+    bool reading_done = false;
+
+    auto parse_worker = [&] {
+        while (true) {
+            pair<uint64_t, line_batch> batch;
+            {
+                unique_lock<mutex> lock(mtx);
+                work_cv.wait(lock, [&] { return !work.empty() || reading_done; });
+                if (work.empty()) return;
+                batch = std::move(work.front());
+                work.pop_front();
+            }
+
+            parsed_batch result;
+            result.reserve(batch.second.size());
+            for (const string &line : batch.second) {
+                result.push_back(parse_line(line));
+            }
+
+            {
+                lock_guard<mutex> lock(mtx);
+                parsed[batch.first] = std::move(result);
+            }
+            merge_cv.notify_one();
+        }
+    };
+
+    // The merge stage is the only place that touches trace state, and it
+    // consumes batches strictly in read order.
+    auto merge_worker = [&] {
+        while (true) {
+            parsed_batch batch;
+            {
+                unique_lock<mutex> lock(mtx);
+                merge_cv.wait(lock, [&] {
+                    return parsed.count(nmerged) || (reading_done && nmerged == nsubmitted);
+                });
+                auto it = parsed.find(nmerged);
+                if (it == parsed.end()) return;
+                batch = std::move(it->second);
+                parsed.erase(it);
+            }
+
+            for (parsed_line &pl : batch) {
+                append_events(std::move(pl));
+            }
+
+            {
+                lock_guard<mutex> lock(mtx);
+                nmerged++;
+            }
+            space_cv.notify_one();
+        }
+    };
+
+    auto start = chrono::steady_clock::now();
+    uint64_t nlines = 0, nbytes = 0;
+
+    vector<thread> workers;
+    for (size_t i = 0; i < nworkers; ++i) {
+        workers.emplace_back(parse_worker);
+    }
+    thread merger(merge_worker);
+
+    auto submit = [&] (line_batch &&batch) {
+        {
+            unique_lock<mutex> lock(mtx);
+            space_cv.wait(lock, [&] { return nsubmitted - nmerged < max_inflight; });
+            work.emplace_back(nsubmitted++, std::move(batch));
+        }
+        work_cv.notify_one();
+    };
+
+    line_batch batch;
+    batch.reserve(batch_lines);
+    auto take = [&] (string &&line) {
+        nlines++;
+        nbytes += line.size() + 1;
+        if (raw_copy_) *raw_copy_ << line << '\n';
+        batch.push_back(std::move(line));
+        if (batch.size() == batch_lines) {
+            submit(std::move(batch));
+            batch = line_batch();
+            batch.reserve(batch_lines);
+        }
+    };
+
+    // With a reorder window, a record is taken once every smaller timestamp
+    // was, or once the window is full, in which case the timestamps it skips
+    // never came. Lines without a timestamp are taken as they come.
+    multimap<uint64_t, string> held;
+    uint64_t next_ts = 0, nmissing = 0;
+    auto take_held = [&] (bool all) {
+        while (!held.empty() &&
+               (all || held.begin()->first <= next_ts || held.size() > reorder_window_)) {
+            auto it = held.begin();
+            if (it->first > next_ts) nmissing += it->first - next_ts;
+            next_ts = max(next_ts, it->first + 1);
+            take(std::move(it->second));
+            held.erase(it);
+        }
+    };
+
     do {
         string line;
         std::getline(stream, line);
-        if (!line.empty()) {
-            // Join so we get serializable time stamps.
-            if (t.joinable()) t.join();
-            // Do this asynchronously to allow for reading and parsing.
-            auto tfn = [&, this] (string s) { this->get_next_events(s); };
-            t = thread(tfn, line);
+        if (line.empty()) continue;
+        if (reorder_window_ == 0) {
+            take(std::move(line));
+            continue;
         }
-    } while (!stream.eof());
+        const char *first = line.data(), *last = line.data() + line.size();
+        uint64_t ts;
+        auto res = from_chars(first, last, ts);
+        if (res.ec != errc() || res.ptr == first || res.ptr == last || *res.ptr != ',') {
+            take(std::move(line));
+            continue;
+        }
+        held.emplace(ts, std::move(line));
+        take_held(false);
+    } while (!stream.eof() || keep_reading());
+    take_held(true);
+    if (nmissing) {
+        cerr << "Trace ingestion: " << nmissing << " timestamps never arrived within the reorder window of "
+             << reorder_window_ << " records" << endl;
+    }
+
+    if (!batch.empty()) {
+        submit(std::move(batch));
+    }
+    // closes the file
+    raw_copy_.reset();
+
+    {
+        lock_guard<mutex> lock(mtx);
+        reading_done = true;
+    }
+    work_cv.notify_all();
+    merge_cv.notify_all();
+
+    for (thread &t : workers) {
+        t.join();
+    }
+    merger.join();
+
+    auto end = chrono::steady_clock::now();
+    ingest_stats_.lines = nlines;
+    ingest_stats_.bytes = nbytes;
+    ingest_stats_.seconds = chrono::duration<double>(end - start).count();
+    ingest_stats_.nthreads = nworkers;
+
+    cout << "Trace ingestion: " << nlines << " lines (" << (nbytes >> 20) << " MiB), "
+        << events_.size() << " events in " << ingest_stats_.seconds << " s with "
+        << nworkers << " parser thread(s); " << interned_stack::num_stacks() << " distinct stacks of "
+        << interned_stack::num_frames() << " distinct frames" << endl;
+}
+
+void trace::copy_raw_trace(const fs::path &path) {
+    auto os = make_shared<fs::ofstream>(path);
+    if (!*os) {
+        cerr << "Could not create " << path.string() << "\n";
+        exit(EXIT_FAILURE);
+    }
+    raw_copy_ = os;
+}
+
+void trace::read(bp::child &child, std::istream &stream) {
+    ingest(stream, [] { return false; });
     child.wait();
-    if (t.joinable()) t.join();
 
     for (const auto & func : intrinsic_functions) {
         cout << "intrinsic function: " << func << endl;
@@ -676,22 +954,8 @@ void trace::read(bp::child &child, std::istream &stream) {
 }
 
 void trace::read(bp::child &child, bp::child &test, std::istream &stream) {
-    stringstream ss;
-    thread t;
-
-    do {
-        string line;
-        std::getline(stream, line);
-        if (!line.empty()) {
-            // Join so we get serializable time stamps.
-            if (t.joinable()) t.join();
-            // Do this asynchronously to allow for reading and parsing.
-            auto tfn = [&, this] (string s) { this->get_next_events(s); };
-            t = thread(tfn, line);
-        }
-    } while (!stream.eof() || test.running());
+    ingest(stream, [&] { return test.running(); });
     child.wait();
-    if (t.joinable()) t.join();
 
     for (const auto & func : intrinsic_functions) {
         cout << "intrinsic function: " << func << endl;
@@ -700,26 +964,120 @@ void trace::read(bp::child &child, bp::child &test, std::istream &stream) {
     construct_testing_ranges();
 }
 
+/**
+ * The tool writes each thread's records to a file of its own, in timestamp
+ * order, with frames as raw "@<address>;" that its <pid>.sym file maps to
+ * symbolized frames. A file can end in a partial record and the zeros of the
+ * unused part of its last window.
+ */
+size_t trace::merge_thread_traces(const fs::path &trace_path) {
+    typedef pair<uint64_t, size_t> head;
+    string prefix = trace_path.filename().string() + ".";
+    fs::path dir = trace_path.parent_path().empty() ? fs::path(".") : trace_path.parent_path();
+    vector<pair<string, fs::path>> thread_files, sym_files;
+
+    for (fs::directory_iterator it(dir), end; it != end; ++it) {
+        string name = it->path().filename().string();
+        if (name.compare(0, prefix.size(), prefix) != 0) continue;
+        string rest = name.substr(prefix.size());
+        size_t dot = rest.find('.');
+        if (dot == string::npos || dot == 0) continue;
+        string pid = rest.substr(0, dot), tid = rest.substr(dot + 1);
+        auto is_number = [](const string &s) {
+            return !s.empty() && all_of(s.begin(), s.end(), ::isdigit);
+        };
+        if (!is_number(pid)) continue;
+        if (tid == "sym") {
+            sym_files.emplace_back(pid, it->path());
+        } else if (is_number(tid)) {
+            thread_files.emplace_back(pid, it->path());
+        }
+    }
+    if (thread_files.empty()) return 0;
+
+    // (pid, address) -> frame. A forked child inherits the parent's
+    // addresses, so fall back to any process that symbolized the address.
+    map<pair<string, uint64_t>, string> frames;
+    unordered_map<uint64_t, string> any_frames;
+    for (const auto &[pid, path] : sym_files) {
+        fs::ifstream f(path);
+        string line;
+        while (getline(f, line)) {
+            size_t tab = line.find('\t');
+            if (tab == string::npos || f.eof()) continue;
+            uint64_t addr = strtoull(line.c_str(), nullptr, 16);
+            frames[{pid, addr}] = line.substr(tab + 1);
+            any_frames[addr] = line.substr(tab + 1);
+        }
+    }
+
+    vector<unique_ptr<fs::ifstream>> files;
+    vector<string> lines(thread_files.size());
+    priority_queue<head, vector<head>, greater<head>> heads;
+    // a record only counts once its newline is written
+    auto next = [&](size_t i) {
+        if (getline(*files[i], lines[i]) && !files[i]->eof()) {
+            heads.push(head(strtoull(lines[i].c_str(), nullptr, 10), i));
+        }
+    };
+    for (size_t i = 0; i < thread_files.size(); i++) {
+        files.emplace_back(new fs::ifstream(thread_files[i].second));
+        next(i);
+    }
+
+    fs::ofstream os(trace_path, ios::app);
+    if (!os) {
+        cerr << "Could not open " << trace_path.string() << "\n";
+        exit(EXIT_FAILURE);
+    }
+    size_t nrecords = 0;
+    string record;
+    while (!heads.empty()) {
+        size_t i = heads.top().second;
+        heads.pop();
+        const string &line = lines[i];
+        record.clear();
+        size_t pos = 0;
+        while (pos < line.size()) {
+            size_t end = min(line.find(';', pos), line.size());
+            if (line[pos] == '@') {
+                // frames the tool never got to symbolize are dropped
+                uint64_t addr = strtoull(line.c_str() + pos + 1, nullptr, 16);
+                auto it = frames.find({thread_files[i].first, addr});
+                if (it != frames.end()) {
+                    record += it->second;
+                } else if (any_frames.count(addr)) {
+                    record += any_frames[addr];
+                }
+            } else {
+                record.append(line, pos, end - pos);
+                if (end < line.size()) record += ';';
+            }
+            pos = end + 1;
+        }
+        os << record << '\n';
+        nrecords++;
+        next(i);
+    }
+    os.close();
+
+    files.clear();
+    for (const auto &[pid, path] : thread_files) fs::remove(path);
+    for (const auto &[pid, path] : sym_files) fs::remove(path);
+    return nrecords;
+}
+
 void trace::read_offline_trace(fs::path trace_path) {
     if (!fs::exists(trace_path)) {
         cerr << "read_offline_trace: offline log doesn't exist!" << endl;
         exit(EXIT_FAILURE);
     }
-    stringstream ss;
-    thread t;
+    if (is_binary_trace(trace_path)) {
+        read_binary_trace(trace_path);
+        return;
+    }
     fs::ifstream stream(trace_path);
-    do {
-        string line;
-        std::getline(stream, line);
-        if (!line.empty()) {
-            // Join so we get serializable time stamps.
-            if (t.joinable()) t.join();
-            // Do this asynchronously to allow for reading and parsing.
-            auto tfn = [&, this] (string s) { this->get_next_events(s); };
-            t = thread(tfn, line);
-        }
-    } while (!stream.eof());
-    if (t.joinable()) t.join();
+    ingest(stream, [] { return false; });
 
     for (const auto & func : intrinsic_functions) {
         cout << "intrinsic function: " << func << endl;
@@ -1126,4 +1484,50 @@ trace::~trace() {
     // }
 }
 
+
+bool benchmark_trace_ingest(const fs::path &trace_path,
+                            bool selective,
+                            pathfinder_mode mode,
+                            size_t nthreads,
+                            std::ostream &out) {
+    vector<size_t> configs = {1};
+    if (nthreads > 1) configs.push_back(nthreads);
+
+    vector<string> baseline;
+    for (size_t n : configs) {
+        trace t(selective, mode);
+        t.set_parse_threads(n);
+        t.read_offline_trace(trace_path);
+
+        const trace_ingest_stats &stats = t.last_ingest_stats();
+        double secs = std::max(stats.seconds, 1e-9);
+        out << "[ingest benchmark] " << trace_path.string()
+            << ": threads=" << stats.nthreads
+            << " lines=" << stats.lines
+            << " events=" << t.events().size()
+            << " stores=" << t.stores().size()
+            << " time=" << stats.seconds << "s"
+            << " events/s=" << (uint64_t)(t.events().size() / secs)
+            << " lines/s=" << (uint64_t)(stats.lines / secs)
+            << " MiB/s=" << (stats.bytes / secs) / (1 << 20) << endl;
+
+        vector<string> dump;
+        for (const auto &te : t.events()) {
+            stringstream ss;
+            ss << te->timestamp << "," << te->store_num << "," << te->write_num
+                << "," << t.within_testing_range(te) << "," << te->str();
+            dump.push_back(ss.str());
+        }
+
+        if (baseline.empty()) {
+            baseline = std::move(dump);
+        } else if (dump != baseline) {
+            cerr << "[ingest benchmark] trace loaded with " << n
+                << " threads differs from the single-threaded load!" << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
 }
\ No newline at end of file
@@ -1,12 +1,14 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
 #include <iostream>
 #include <list>
 #include <memory>
 #include <mutex>
 #include <regex>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <unordered_map>
 #include <unordered_set>
@@ -30,9 +32,6 @@ extern "C" {
 #include "trace_event.hpp"
 #include "trace.hpp"
 
-
-#define BUFFER_SIZE 1000000
-
 namespace pathfinder
 {
 
@@ -44,6 +43,16 @@ typedef enum {
     PM, MMIO, POSIX
 } pathfinder_mode;
 
+/**
+ * @brief Throughput numbers for the last read of a trace.
+ */
+struct trace_ingest_stats {
+    uint64_t lines = 0;
+    uint64_t bytes = 0;
+    double seconds = 0;
+    size_t nthreads = 0;
+};
+
 class trace {
     /**
      * Private vars
@@ -78,27 +87,104 @@ class trace {
     std::optional<std::pair<uint64_t, int>> current_thread_op_;
     std::optional<std::pair<uint64_t, int>> current_tid_to_workload_tid_;
 
-    std::vector<stack_frame> parse_pm_stack(std::vector<std::string>::iterator &start,
-                                            std::vector<std::string>::iterator &end);
+    trace_ingest_stats ingest_stats_;
+
+    // Where ingest copies the lines it reads, if set.
+    std::shared_ptr<std::ostream> raw_copy_;
+
+    // Number of parser workers used by the ingestion pipeline.
+    size_t parse_threads_;
+
+    // Records held back to put them in timestamp order, 0 to take lines as
+    // they come.
+    size_t reorder_window_ = 0;
 
-    std::vector<stack_frame> parse_posix_stack(std::vector<std::string> &raw_pieces);
+    /**
+     * The events parsed from a single line of the trace, before the ordered
+     * merge assigns them timestamps. Parsing is side-effect free so that lines
+     * can be parsed out of order; anything that touches trace state is
+     * deferred to append_events.
+     */
+    struct parsed_line {
+        std::vector<trace_event> events;
+        std::vector<std::string> intrinsic_functions;
+    };
+
+    interned_stack parse_pm_stack(std::string_view frames) const;
+
+    interned_stack parse_posix_stack(std::string_view frames,
+                                     std::vector<std::string> &intrinsics) const;
+
+    trace_event parse_pm_op(std::string_view raw_event) const;
+    std::shared_ptr<char> base64_decode(const char* input, uint32_t size, uint64_t &decoded_size) const;
+    trace_event parse_posix_op(std::string_view posix_event,
+                               std::vector<std::string> &intrinsics) const;
 
-    trace_event parse_pm_op(const std::string &raw_event);
-    std::shared_ptr<char> base64_decode(const char* input, uint32_t size);
-    trace_event parse_posix_op(const std::string &posix_event);
+    // Parser stage: turn one raw line into events. Safe to call concurrently.
+    parsed_line parse_line(const std::string &line) const;
 
-    size_t get_next_events(std::string line);
+    // Merge stage: sequence the parsed events into the trace. Must be called
+    // in line order.
+    size_t append_events(parsed_line &&parsed);
+
+    // Record the files an event refers to in pm_files_/write_files_.
+    void register_event_files(const trace_event &te);
+
+    /**
+     * Reader -> parser pool -> ordered merge. Lines are read in batches and
+     * handed to parse_threads_ workers; batches are merged strictly in the
+     * order they were read, so the result is identical to a serial parse.
+     */
+    void ingest(std::istream &stream, const std::function<bool(void)> &keep_reading);
 
     void construct_testing_ranges(void);
 
+    // Load a trace saved by write_binary_trace (see binary_trace.hpp).
+    void read_binary_trace(boost::filesystem::path trace_path);
+
 public:
-    trace(bool selective_testing, pathfinder_mode mode) : selective_(selective_testing), mode_(mode) {}
+    trace(bool selective_testing, pathfinder_mode mode)
+        : selective_(selective_testing), mode_(mode),
+          parse_threads_(std::max(1u, std::thread::hardware_concurrency())) {}
+
+    // set the number of parser workers used when reading the trace
+    void set_parse_threads(size_t n) { parse_threads_ = std::max<size_t>(1, n); }
+
+    const trace_ingest_stats &last_ingest_stats(void) const { return ingest_stats_; }
+
+    /**
+     * @brief Put the records of the next read in order of their leading
+     * timestamp, holding back up to window records. A streamed trace has its
+     * records in the order they were finished, which is only roughly the
+     * order of their timestamps.
+     */
+    void set_reorder_window(size_t window) { reorder_window_ = window; }
+
+    /**
+     * @brief Also write the lines of the next read to path, for traces that
+     * are parsed straight from a pipe and never land in a file.
+     */
+    void copy_raw_trace(const boost::filesystem::path &path);
 
     void read(boost::process::child &child, std::istream &stream);
     void read(boost::process::child &child, boost::process::child &test, std::istream &stream);
+
+    /**
+     * @brief Append to trace_path the records the Pin tool left in its
+     * per-thread files (trace_path.<pid>.<tid>), which happens when the tool
+     * is killed before it merges them itself. Returns the number of records
+     * recovered; the per-thread files are removed.
+     */
+    static size_t merge_thread_traces(const boost::filesystem::path &trace_path);
     // for hse, I am just going to cheat and read trace offline
     void read_offline_trace(boost::filesystem::path trace_path);
 
+    /**
+     * @brief Save the parsed trace in the compact binary format, which
+     * read_offline_trace loads much faster than the text log.
+     */
+    void write_binary_trace(boost::filesystem::path trace_path) const;
+
     // setup root_dir
     void set_root_dir(boost::filesystem::path path) { root_dir = path; }
 
@@ -143,4 +229,16 @@ public:
     ~trace();
 };
 
+/**
+ * @brief Load an offline trace once with a single parser thread and once
+ * with nthreads, and report the throughput of both to out.
+ *
+ * @return true if both loads produced exactly the same events.
+ */
+bool benchmark_trace_ingest(const boost::filesystem::path &trace_path,
+                            bool selective,
+                            pathfinder_mode mode,
+                            size_t nthreads,
+                            std::ostream &out);
+
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #include "trace_event.hpp"
+#include "intern_table.hpp"
 
 #include <iostream>
 
@@ -18,6 +19,23 @@ static const char *event_type_strs[] = {
     PATHFINDER_OP_BEGIN_TOKEN, PATHFINDER_OP_END_TOKEN
 };
 
+static intern_table<string> &path_table(void) {
+    static intern_table<string> *table = [] {
+        intern_table<string> *t = new intern_table<string>();
+        t->intern(string());
+        return t;
+    }();
+    return *table;
+}
+
+path_id intern_path(const string &path) {
+    return path.empty() ? 0 : path_table().intern(path);
+}
+
+const string &interned_path(path_id id) {
+    return path_table().get(id);
+}
+
 const char *event_type_to_str(event_type t) {
     return event_type_strs[t];
 }
@@ -130,7 +148,6 @@ string trace_event::str(void) const {
     case PATHFINDER_END:
     case PATHFINDER_OP_BEGIN:
     case PATHFINDER_OP_END:
-        ss << raw;
         break;
     case CREAT:
     case MKDIR:
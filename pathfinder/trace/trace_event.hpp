@@ -72,47 +72,61 @@ enum event_type {
 
 const char *event_type_to_str(event_type t);
 
+/**
+ * Process-wide path table, so events can compare paths as integers. ID 0 is
+ * always the empty path.
+ */
+typedef uint32_t path_id;
+path_id intern_path(const std::string &path);
+const std::string &interned_path(path_id id);
+
 /**
  *
  */
 struct trace_event {
-    std::string raw;
-    uint64_t timestamp;
+    uint64_t timestamp = 0;
     uint64_t store_num = UINT64_MAX;
     uint64_t write_num = UINT64_MAX;
 
-    event_type type;
-    uint64_t address;
-    uint64_t size;
+    event_type type = STOP;
+    uint64_t address = 0;
+    uint64_t size = 0;
     // We don't need this for update mechanisms, but we do need it for testing.
     std::vector<char> value_bytes;
-    uint64_t value;
+    uint64_t value = 0;
     // For REGISTER FILE
     std::string file_path;
-    off_t file_offset;
+    // Interned file_path/new_path, assigned when the event joins the trace.
+    path_id file_path_id = 0;
+    path_id new_path_id = 0;
+    off_t file_offset = 0;
 
     // For syscall file WRITEs
     std::string buf;
 
     // For syscall file PWRITEVs
     std::vector<std::string> buf_vec;
-    uint64_t wfile_offset;
+    uint64_t wfile_offset = 0;
 
     // For syscall file FTRUNCATEs & FALLOCATEs
-    off_t len;
-    int mode;
+    off_t len = 0;
+    int mode = 0;
 
     // For POSIX store
-    uint64_t tid;
+    uint64_t tid = 0;
     std::shared_ptr<char> char_buf;
+    // Decoded size of char_buf, which may contain NULs.
+    uint64_t char_buf_size = 0;
 
     // For POSIX mmap & msync & lseek
-    int flags;
-    int prot;
+    int flags = 0;
+    int prot = 0;
 
     // For POSIX writev
     std::vector<std::tuple<int, std::shared_ptr<char>>> iov;
-    int iovcnt;
+    // Decoded size of each iov buffer.
+    std::vector<uint64_t> iov_sizes;
+    int iovcnt = 0;
 
     // For RENAME
     std::string new_path;
@@ -135,7 +149,7 @@ struct trace_event {
     // For Pathfinder syscall decomposition
     std::optional<std::vector<micro_event>> micro_events;
 
-    std::vector<stack_frame> stack;
+    interned_stack stack;
 
     trace_event() {}
 
@@ -209,8 +223,8 @@ struct trace_event {
         return workload_thread_id.value();
     }
 
-    std::vector<stack_frame> backtrace(void) const {
-        return stack;
+    const std::vector<stack_frame> &backtrace(void) const {
+        return stack.frames();
     }
 };
 
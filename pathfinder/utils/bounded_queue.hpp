@@ -0,0 +1,67 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace pathfinder {
+
+/**
+ * @brief A fixed-capacity FIFO handing items from producer to consumer threads.
+ *
+ * push() blocks while the queue is full and pop() blocks while it is empty,
+ * so a fast producer can never run more than capacity items ahead.
+ * close() wakes everyone up: later pushes are refused and pop() drains what
+ * is left, then returns std::nullopt.
+ */
+template <typename T>
+class bounded_queue {
+    std::mutex mtx_;
+    std::condition_variable not_empty_, not_full_;
+    std::deque<T> items_;
+    size_t capacity_;
+    bool closed_ = false;
+
+public:
+    explicit bounded_queue(size_t capacity) : capacity_(capacity ? capacity : 1) {}
+
+    /**
+     * @brief Returns false (and drops item) if the queue was closed.
+     */
+    bool push(T item) {
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            not_full_.wait(lock, [&] { return closed_ || items_.size() < capacity_; });
+            if (closed_) return false;
+            items_.push_back(std::move(item));
+        }
+        not_empty_.notify_one();
+        return true;
+    }
+
+    std::optional<T> pop() {
+        std::optional<T> item;
+        {
+            std::unique_lock<std::mutex> lock(mtx_);
+            not_empty_.wait(lock, [&] { return closed_ || !items_.empty(); });
+            if (items_.empty()) return std::nullopt;
+            item = std::move(items_.front());
+            items_.pop_front();
+        }
+        not_full_.notify_one();
+        return item;
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            closed_ = true;
+        }
+        not_empty_.notify_all();
+        not_full_.notify_all();
+    }
+};
+
+}
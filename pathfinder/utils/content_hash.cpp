@@ -0,0 +1,182 @@
+#include "content_hash.hpp"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+
+namespace fs = boost::filesystem;
+using namespace std;
+
+namespace pathfinder {
+
+static const uint64_t PRIME64_1 = 0x9E3779B185EBCA87ull;
+static const uint64_t PRIME64_2 = 0xC2B2AE3D27D4EB4Full;
+static const uint64_t PRIME64_3 = 0x165667B19E3779F9ull;
+static const uint64_t PRIME64_4 = 0x85EBCA77C2B2AE63ull;
+static const uint64_t PRIME64_5 = 0x27D4EB2F165667C5ull;
+
+static inline uint64_t rotl64(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static inline uint64_t read64(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t input) {
+    acc += input * PRIME64_2;
+    acc = rotl64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+static inline uint64_t merge_round(uint64_t acc, uint64_t val) {
+    acc ^= round64(0, val);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+xxh64::xxh64(uint64_t seed) : seed_(seed) {
+    acc_[0] = seed + PRIME64_1 + PRIME64_2;
+    acc_[1] = seed + PRIME64_2;
+    acc_[2] = seed;
+    acc_[3] = seed - PRIME64_1;
+}
+
+void xxh64::update(const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char*)data;
+    const unsigned char *end = p + len;
+    total_ += len;
+
+    if (buffered_ + len < sizeof(buf_)) {
+        memcpy(buf_ + buffered_, p, len);
+        buffered_ += len;
+        return;
+    }
+
+    if (buffered_) {
+        size_t fill = sizeof(buf_) - buffered_;
+        memcpy(buf_ + buffered_, p, fill);
+        p += fill;
+        for (int i = 0; i < 4; ++i) acc_[i] = round64(acc_[i], read64(buf_ + 8 * i));
+        buffered_ = 0;
+    }
+
+    uint64_t v0 = acc_[0], v1 = acc_[1], v2 = acc_[2], v3 = acc_[3];
+    for (; p + 32 <= end; p += 32) {
+        v0 = round64(v0, read64(p));
+        v1 = round64(v1, read64(p + 8));
+        v2 = round64(v2, read64(p + 16));
+        v3 = round64(v3, read64(p + 24));
+    }
+    acc_[0] = v0; acc_[1] = v1; acc_[2] = v2; acc_[3] = v3;
+
+    buffered_ = end - p;
+    memcpy(buf_, p, buffered_);
+}
+
+uint64_t xxh64::digest(void) const {
+    uint64_t h;
+    if (total_ >= 32) {
+        h = rotl64(acc_[0], 1) + rotl64(acc_[1], 7) + rotl64(acc_[2], 12) + rotl64(acc_[3], 18);
+        for (int i = 0; i < 4; ++i) h = merge_round(h, acc_[i]);
+    } else {
+        h = seed_ + PRIME64_5;
+    }
+    h += total_;
+
+    const unsigned char *p = buf_;
+    const unsigned char *end = buf_ + buffered_;
+    for (; p + 8 <= end; p += 8) {
+        h ^= round64(0, read64(p));
+        h = rotl64(h, 27) * PRIME64_1 + PRIME64_4;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)read32(p) * PRIME64_1;
+        h = rotl64(h, 23) * PRIME64_2 + PRIME64_3;
+        p += 4;
+    }
+    for (; p < end; ++p) {
+        h ^= (*p) * PRIME64_5;
+        h = rotl64(h, 11) * PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+bool content_hasher::update_file(const fs::path &file) {
+    int fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1) return false;
+
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        return false;
+    }
+    update((uint64_t)st.st_size);
+
+    // Only the data extents and where they are; holes read as zeroes anyway,
+    // so a file written with zeroes hashes differently from a sparse one.
+    // Both are the same to the checker, but this is only a cache.
+    static thread_local vector<char> buf(1 << 20);
+    off_t off = 0;
+    while (off < st.st_size) {
+        off_t data = lseek(fd, off, SEEK_DATA);
+        if (data < 0) break;
+        off_t hole = lseek(fd, data, SEEK_HOLE);
+        if (hole < 0) hole = st.st_size;
+        update((uint64_t)data);
+        update((uint64_t)(hole - data));
+        for (off = data; off < hole; ) {
+            ssize_t n = pread(fd, buf.data(), std::min<off_t>(buf.size(), hole - off), off);
+            if (n <= 0) {
+                close(fd);
+                return false;
+            }
+            update(buf.data(), n);
+            off += n;
+        }
+    }
+
+    close(fd);
+    return true;
+}
+
+bool content_hasher::update_tree(const fs::path &dir) {
+    boost::system::error_code ec;
+    vector<fs::path> entries;
+    for (fs::recursive_directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec)) {
+        entries.push_back(it->path());
+    }
+    if (ec) return false;
+    sort(entries.begin(), entries.end());
+
+    for (const auto &p : entries) {
+        struct stat st;
+        if (lstat(p.c_str(), &st)) return false;
+        update(p.lexically_relative(dir).string());
+        update((uint64_t)st.st_mode);
+        if (S_ISREG(st.st_mode)) {
+            if (!update_file(p)) return false;
+        } else if (S_ISLNK(st.st_mode)) {
+            update(fs::read_symlink(p, ec).string());
+            if (ec) return false;
+        }
+    }
+    return true;
+}
+
+}
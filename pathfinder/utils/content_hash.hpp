@@ -0,0 +1,68 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+namespace pathfinder {
+
+/**
+ * @brief Streaming XXH64, for telling byte-identical crash states apart
+ * without keeping copies of them.
+ */
+class xxh64 {
+    uint64_t acc_[4];
+    uint64_t seed_;
+    uint64_t total_ = 0;
+    unsigned char buf_[32];
+    size_t buffered_ = 0;
+
+public:
+    explicit xxh64(uint64_t seed=0);
+
+    void update(const void *data, size_t len);
+
+    uint64_t digest(void) const;
+};
+
+/**
+ * @brief A 128-bit content hash, made of two XXH64 streams with different
+ * seeds over the same input.
+ */
+class content_hasher {
+    xxh64 lo_{0}, hi_{0x9e3779b97f4a7c15ull};
+
+public:
+    typedef std::pair<uint64_t, uint64_t> digest_t;
+
+    void update(const void *data, size_t len) {
+        lo_.update(data, len);
+        hi_.update(data, len);
+    }
+
+    void update(uint64_t v) { update(&v, sizeof(v)); }
+
+    // length-prefixed, so consecutive strings cannot run together
+    void update(const std::string &s) {
+        update((uint64_t)s.size());
+        update(s.data(), s.size());
+    }
+
+    digest_t digest(void) const { return {lo_.digest(), hi_.digest()}; }
+
+    /**
+     * @brief Add the contents of a file, skipping its holes.
+     */
+    bool update_file(const boost::filesystem::path &file);
+
+    /**
+     * @brief Add everything under dir: names relative to dir, file types and
+     * permissions, symlink targets and file contents, in sorted order.
+     * Timestamps and inode numbers are left out.
+     */
+    bool update_tree(const boost::filesystem::path &dir);
+};
+
+}
@@ -0,0 +1,361 @@
+#include "dir_snapshot.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/fs.h>
+#include <linux/magic.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/vfs.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
+
+namespace fs = boost::filesystem;
+using namespace std;
+
+namespace pathfinder {
+
+static bool operator==(const timespec &a, const timespec &b) {
+    return a.tv_sec == b.tv_sec && a.tv_nsec == b.tv_nsec;
+}
+
+static bool operator<(const timespec &a, const timespec &b) {
+    return a.tv_sec < b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_nsec < b.tv_nsec);
+}
+
+/**
+ * @brief (device, inode) of the files with a writable shared mapping in this
+ * process. Stores through those do not always update the ctime.
+ */
+static set<pair<dev_t, ino_t>> shared_writable_mappings(void) {
+    set<pair<dev_t, ino_t>> mapped;
+    ifstream maps("/proc/self/maps");
+    string line;
+    while (getline(maps, line)) {
+        char perms[8];
+        unsigned int major, minor;
+        unsigned long inode;
+        if (sscanf(line.c_str(), "%*lx-%*lx %7s %*lx %x:%x %lu", perms, &major, &minor, &inode) != 4) continue;
+        if (inode == 0 || perms[1] != 'w' || perms[3] != 's') continue;
+        mapped.insert(make_pair(makedev(major, minor), (ino_t)inode));
+    }
+    return mapped;
+}
+
+static vector<fs::path> list_directory(const fs::path &dir) {
+    vector<fs::path> entries;
+    for (const auto &entry : fs::directory_iterator(dir)) {
+        entries.push_back(entry.path());
+    }
+    return entries;
+}
+
+void snapshot_backend::drop(const fs::path &image) {
+    boost::system::error_code ec;
+    fs::remove_all(image, ec);
+}
+
+bool copy_snapshot_backend::copy_file(int src_fd, int dst_fd, off_t size) {
+    off_t pos = 0;
+    while (pos < size) {
+        // skip holes, so sparse files stay sparse
+        off_t data = lseek(src_fd, pos, SEEK_DATA);
+        if (data == -1 && errno == ENXIO) break;
+        if (data == -1) data = pos;
+        off_t hole = lseek(src_fd, data, SEEK_HOLE);
+        if (hole == -1 || hole > size) hole = size;
+
+        loff_t in = data, out = data;
+        while (in < hole) {
+            ssize_t n = copy_file_range(src_fd, &in, dst_fd, &out, hole - in, 0);
+            if (n > 0) continue;
+            if (n == 0) break;
+            // e.g. across file systems on older kernels
+            if (errno != EXDEV && errno != ENOSYS && errno != EINVAL && errno != EOPNOTSUPP) {
+                return false;
+            }
+            vector<char> buf(1 << 20);
+            while (in < hole) {
+                ssize_t r = pread(src_fd, buf.data(), min((off_t)buf.size(), hole - in), in);
+                if (r <= 0) return false;
+                for (ssize_t done = 0; done < r; ) {
+                    ssize_t w = pwrite(dst_fd, buf.data() + done, r - done, in + done);
+                    if (w <= 0) return false;
+                    done += w;
+                }
+                in += r;
+            }
+        }
+        pos = hole;
+    }
+    return ftruncate(dst_fd, size) == 0;
+}
+
+bool copy_snapshot_backend::copy_entry(const fs::path &src, const fs::path &dst, bool recursive) {
+    struct stat st;
+    if (lstat(src.c_str(), &st)) {
+        cerr << "snapshot: cannot stat " << src << ": " << strerror(errno) << endl;
+        return false;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        if (mkdir(dst.c_str(), st.st_mode & 07777)) {
+            cerr << "snapshot: cannot create " << dst << ": " << strerror(errno) << endl;
+            return false;
+        }
+        if (recursive) {
+            for (const auto &child : list_directory(src)) {
+                if (!copy_entry(child, dst / child.filename(), true)) return false;
+            }
+        }
+    } else if (S_ISREG(st.st_mode)) {
+        int src_fd = open(src.c_str(), O_RDONLY);
+        int dst_fd = open(dst.c_str(), O_WRONLY | O_CREAT | O_EXCL, st.st_mode & 07777);
+        bool ok = src_fd != -1 && dst_fd != -1 && copy_file(src_fd, dst_fd, st.st_size);
+        if (!ok) {
+            cerr << "snapshot: cannot copy " << src << " to " << dst << ": " << strerror(errno) << endl;
+        }
+        if (src_fd != -1) close(src_fd);
+        if (dst_fd != -1) close(dst_fd);
+        return ok;
+    } else if (S_ISLNK(st.st_mode)) {
+        boost::system::error_code ec;
+        fs::copy_symlink(src, dst, ec);
+        if (ec) {
+            cerr << "snapshot: cannot copy " << src << ": " << ec.message() << endl;
+            return false;
+        }
+    } else {
+        cerr << "snapshot: skipping special file " << src << endl;
+    }
+    return true;
+}
+
+bool copy_snapshot_backend::take(const fs::path &dir, const fs::path &image) {
+    return copy_entry(dir, image, true);
+}
+
+bool copy_snapshot_backend::restore(const fs::path &image, const fs::path &dir) {
+    for (const auto &path : list_directory(dir)) {
+        fs::remove_all(path);
+    }
+    for (const auto &child : list_directory(image)) {
+        if (!copy_entry(child, dir / child.filename(), true)) return false;
+    }
+    return true;
+}
+
+bool reflink_snapshot_backend::copy_file(int src_fd, int dst_fd, off_t size) {
+    if (!ioctl(dst_fd, FICLONE, src_fd)) return true;
+    // e.g. the image is on another file system
+    return copy_snapshot_backend::copy_file(src_fd, dst_fd, size);
+}
+
+layered_snapshot_backend::~layered_snapshot_backend() {
+    if (!spare_.first.empty()) snapshot_backend::drop(spare_.first);
+}
+
+void layered_snapshot_backend::describe(const struct stat &st, const set<pair<dev_t, ino_t>> &mapped,
+                                        entry &e) {
+    e.ino = st.st_ino;
+    e.size = S_ISREG(st.st_mode) ? st.st_size : 0;
+    e.ctime = st.st_ctim;
+    e.mapped = S_ISREG(st.st_mode) && mapped.count(make_pair(st.st_dev, st.st_ino));
+}
+
+bool layered_snapshot_backend::unchanged(const struct stat &st, const entry &e) {
+    if (st.st_ino != e.ino) return false;
+    if (!S_ISREG(st.st_mode)) return true;
+    return !e.mapped && st.st_size == e.size && st.st_ctim == e.ctime;
+}
+
+void layered_snapshot_backend::settle(const manifest &m) {
+    timespec newest = {0, 0};
+    for (const auto &p : m.files) {
+        if (newest < p.second.ctime) newest = p.second.ctime;
+    }
+    // A change in the same clock tick as the ctime we recorded could leave
+    // it as is. Once the coarse clock is past it, every change moves it.
+    timespec now;
+    while (!clock_gettime(CLOCK_REALTIME_COARSE, &now) && !(newest < now)) {
+        const timespec pause = {0, 500000};
+        nanosleep(&pause, nullptr);
+    }
+}
+
+bool layered_snapshot_backend::record(const fs::path &dir, const fs::path &rel,
+                                      const set<pair<dev_t, ino_t>> &mapped, manifest &m) {
+    for (const auto &path : list_directory(dir / rel)) {
+        fs::path child = rel / path.filename();
+        struct stat st;
+        if (lstat(path.c_str(), &st)) return false;
+        describe(st, mapped, m.files[child]);
+        if (S_ISDIR(st.st_mode) && !record(dir, child, mapped, m)) return false;
+    }
+    return true;
+}
+
+bool layered_snapshot_backend::complete(const fs::path &dir, const manifest &m) {
+    struct stat st;
+    for (const auto &p : m.files) {
+        if (lstat((dir / p.first).c_str(), &st)) return false;
+    }
+    return true;
+}
+
+bool layered_snapshot_backend::discard_upper(const fs::path &dir, const fs::path &rel,
+                                             const manifest &m, bool fix) {
+    bool clean = true;
+    for (const auto &path : list_directory(dir / rel)) {
+        fs::path child = rel / path.filename();
+        struct stat st;
+        auto it = m.files.find(child);
+        bool same = it != m.files.end() && !lstat(path.c_str(), &st) && unchanged(st, it->second);
+        if (same && S_ISDIR(st.st_mode)) {
+            if (!discard_upper(dir, child, m, fix)) {
+                clean = false;
+                if (!fix) return false;
+            }
+            continue;
+        }
+        if (same) continue;
+        clean = false;
+        if (!fix) return false;
+        fs::remove_all(path);
+    }
+    return clean;
+}
+
+bool layered_snapshot_backend::copy_up(const fs::path &image, const fs::path &dir, manifest &m) {
+    auto mapped = shared_writable_mappings();
+    // parents sort before their children
+    for (auto &p : m.files) {
+        fs::path path = dir / p.first;
+        struct stat st;
+        if (!lstat(path.c_str(), &st)) {
+            // may have been mapped when the image was taken, and not any more
+            describe(st, mapped, p.second);
+            continue;
+        }
+        if (!copy_entry(image / p.first, path, false)) return false;
+        if (lstat(path.c_str(), &st)) return false;
+        describe(st, mapped, p.second);
+    }
+    settle(m);
+    return true;
+}
+
+bool layered_snapshot_backend::take(const fs::path &dir, const fs::path &image) {
+    // Restored and not touched since: the last image is still a copy of dir
+    if (!spare_.first.empty()) {
+        auto spare = std::move(spare_);
+        spare_ = {};
+        if (spare.second.dir == dir && discard_upper(dir, "", spare.second, false) &&
+            complete(dir, spare.second)) {
+            // same files, but which of them are mapped now may differ
+            manifest m;
+            m.dir = dir;
+            if (record(dir, "", shared_writable_mappings(), m)) {
+                boost::system::error_code ec;
+                fs::rename(spare.first, image, ec);
+                if (!ec) {
+                    manifests_[image] = std::move(m);
+                    return true;
+                }
+            }
+        }
+        snapshot_backend::drop(spare.first);
+    }
+
+    if (!copy_snapshot_backend::take(dir, image)) return false;
+
+    manifest m;
+    m.dir = dir;
+    if (!record(dir, "", shared_writable_mappings(), m)) {
+        cerr << "snapshot: cannot record " << dir << ": " << strerror(errno) << endl;
+        return false;
+    }
+    settle(m);
+    manifests_[image] = std::move(m);
+    return true;
+}
+
+bool layered_snapshot_backend::restore(const fs::path &image, const fs::path &dir) {
+    auto it = manifests_.find(image);
+    if (it == manifests_.end() || it->second.dir != dir) {
+        return copy_snapshot_backend::restore(image, dir);
+    }
+    discard_upper(dir, "", it->second, true);
+    return copy_up(image, dir, it->second);
+}
+
+void layered_snapshot_backend::drop(const fs::path &image) {
+    auto it = manifests_.find(image);
+    if (it == manifests_.end()) {
+        snapshot_backend::drop(image);
+        return;
+    }
+    // keep the latest one around, the next take can probably reuse it
+    if (!spare_.first.empty()) snapshot_backend::drop(spare_.first);
+    spare_ = make_pair(image, std::move(it->second));
+    manifests_.erase(it);
+}
+
+/**
+ * @brief The best backend for the file system of dir: reflink if it can
+ * clone files, layered if it tracks ctime on mapped writes, copy otherwise.
+ */
+static string probe_snapshot_backend(const fs::path &dir) {
+    static mutex mtx;
+    static unordered_map<dev_t, string> probed;
+
+    struct stat st;
+    if (stat(dir.c_str(), &st)) return "copy";
+
+    lock_guard<mutex> lock(mtx);
+    auto it = probed.find(st.st_dev);
+    if (it != probed.end()) return it->second;
+
+    string kind = "copy";
+    fs::path a = dir / fs::unique_path(".snapshot-probe-%%%%-%%%%");
+    fs::path b = dir / fs::unique_path(".snapshot-probe-%%%%-%%%%");
+    int fd_a = open(a.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    int fd_b = open(b.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd_a != -1 && fd_b != -1 && write(fd_a, "x", 1) == 1 && !ioctl(fd_b, FICLONE, fd_a)) {
+        kind = "reflink";
+    }
+    if (fd_a != -1) close(fd_a);
+    if (fd_b != -1) close(fd_b);
+    boost::system::error_code ec;
+    fs::remove(a, ec);
+    fs::remove(b, ec);
+
+    struct statfs sfs;
+    if (kind == "copy" && !statfs(dir.c_str(), &sfs) && sfs.f_type == EXT4_SUPER_MAGIC) {
+        kind = "layered";
+    }
+
+    probed[st.st_dev] = kind;
+    return kind;
+}
+
+unique_ptr<snapshot_backend> make_snapshot_backend(const string &kind, const fs::path &dir) {
+    string k = (kind == "auto") ? probe_snapshot_backend(dir) : kind;
+    if (k == "reflink") return make_unique<reflink_snapshot_backend>();
+    if (k == "layered") return make_unique<layered_snapshot_backend>();
+    if (k == "copy") return make_unique<copy_snapshot_backend>();
+
+    cerr << "Unknown pmdir snapshot backend '" << kind << "'\n";
+    exit(EXIT_FAILURE);
+}
+
+}
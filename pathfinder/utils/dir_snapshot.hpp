@@ -0,0 +1,133 @@
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+#include <utility>
+
+namespace pathfinder {
+
+/**
+ * @brief Saves and restores the contents of a directory, for backing up the
+ * pmdir around each test without forking cp.
+ *
+ * All backends keep sparse files sparse and fall back to copying a file's
+ * data when they cannot do better for it.
+ */
+class snapshot_backend {
+public:
+    virtual ~snapshot_backend() {}
+
+    virtual const char *name(void) const = 0;
+
+    /**
+     * @brief Save the contents of dir into image, which must not exist yet.
+     */
+    virtual bool take(const boost::filesystem::path &dir, const boost::filesystem::path &image) = 0;
+
+    /**
+     * @brief Replace the contents of dir with those of image.
+     */
+    virtual bool restore(const boost::filesystem::path &image, const boost::filesystem::path &dir) = 0;
+
+    /**
+     * @brief Delete an image.
+     */
+    virtual void drop(const boost::filesystem::path &image);
+};
+
+/**
+ * @brief Copies file data in process with copy_file_range, data segment by
+ * data segment.
+ */
+class copy_snapshot_backend : public snapshot_backend {
+protected:
+    // copy src to dst, which must not exist yet, with its children if recursive
+    bool copy_entry(const boost::filesystem::path &src, const boost::filesystem::path &dst, bool recursive);
+
+    virtual bool copy_file(int src_fd, int dst_fd, off_t size);
+
+public:
+    const char *name(void) const override { return "copy"; }
+    bool take(const boost::filesystem::path &dir, const boost::filesystem::path &image) override;
+    bool restore(const boost::filesystem::path &image, const boost::filesystem::path &dir) override;
+};
+
+/**
+ * @brief Shares file extents with FICLONE, so saving and restoring only
+ * costs metadata. Needs btrfs, XFS with reflink, or similar.
+ */
+class reflink_snapshot_backend : public copy_snapshot_backend {
+protected:
+    bool copy_file(int src_fd, int dst_fd, off_t size) override;
+
+public:
+    const char *name(void) const override { return "reflink"; }
+};
+
+/**
+ * @brief Treats the image as a read-only lower layer and dir as the upper
+ * layer on top of it: restore only copies up again the files that were
+ * changed, created, renamed or deleted since the image was taken.
+ *
+ * Changes are detected by inode, size and ctime, so this needs a file system
+ * that updates ctime on writes through shared mappings. Files that this
+ * process has a writable shared mapping of when the image is taken are always
+ * treated as changed, as stores through existing mappings may not update the
+ * ctime. Images restored into another directory are copied in full.
+ */
+class layered_snapshot_backend : public copy_snapshot_backend {
+    struct entry {
+        ino_t ino;
+        off_t size;
+        timespec ctime;
+        bool mapped;
+    };
+    struct manifest {
+        boost::filesystem::path dir;
+        // path relative to dir -> what it was right after take
+        std::map<boost::filesystem::path, entry> files;
+    };
+    std::map<boost::filesystem::path, manifest> manifests_;
+    // the last dropped image, which take() reuses if dir did not change since
+    std::pair<boost::filesystem::path, manifest> spare_;
+
+    static void describe(const struct stat &st, const std::set<std::pair<dev_t, ino_t>> &mapped, entry &e);
+    static bool unchanged(const struct stat &st, const entry &e);
+    // wait until any change to the files of m moves their ctime
+    static void settle(const manifest &m);
+    // describe everything under dir / rel into m
+    bool record(const boost::filesystem::path &dir, const boost::filesystem::path &rel,
+                const std::set<std::pair<dev_t, ino_t>> &mapped, manifest &m);
+    // whether everything in m is still in dir
+    bool complete(const boost::filesystem::path &dir, const manifest &m);
+    // whether dir / rel matches m; if fix, removes whatever does not
+    bool discard_upper(const boost::filesystem::path &dir, const boost::filesystem::path &rel,
+                       const manifest &m, bool fix);
+    // recreate from image what discard_upper removed
+    bool copy_up(const boost::filesystem::path &image, const boost::filesystem::path &dir, manifest &m);
+
+public:
+    ~layered_snapshot_backend();
+
+    const char *name(void) const override { return "layered"; }
+    bool take(const boost::filesystem::path &dir, const boost::filesystem::path &image) override;
+    bool restore(const boost::filesystem::path &image, const boost::filesystem::path &dir) override;
+    void drop(const boost::filesystem::path &image) override;
+};
+
+/**
+ * @brief Create a snapshot backend for directories on the file system of dir.
+ *
+ * @param kind reflink, layered, copy, or auto to pick the best one the file
+ * system supports
+ */
+std::unique_ptr<snapshot_backend> make_snapshot_backend(
+    const std::string &kind, const boost::filesystem::path &dir);
+
+}
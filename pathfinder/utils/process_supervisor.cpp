@@ -0,0 +1,263 @@
+#include "process_supervisor.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <future>
+#include <iostream>
+
+using namespace std;
+using namespace std::chrono;
+
+namespace pathfinder {
+
+// how long to keep reading after the process exits, in case something it
+// started still holds the pipes open
+#define SUPERVISOR_DRAIN_TIME milliseconds(1000)
+// how often to check processes we could not get a pidfd for
+#define SUPERVISOR_POLL_TIME 10
+
+struct process_supervisor::watch {
+    struct source {
+        watch *w = nullptr;
+        // our dup of the caller's fd, -1 once closed
+        int fd = -1;
+        string buf;
+        bool truncated = false;
+    };
+
+    pid_t pid;
+    int pidfd = -1;
+    source srcs[2];
+    // epoll tag for pidfd
+    source exit_tag;
+
+    bool has_deadline = false;
+    steady_clock::time_point deadline;
+    bool killed = false;
+
+    bool exited = false;
+    steady_clock::time_point drain_deadline;
+
+    promise<void> done;
+};
+
+typedef process_supervisor::watch watch;
+
+static int pidfd_open(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static void kill_process(watch &w) {
+#ifdef SYS_pidfd_send_signal
+    if (w.pidfd != -1) {
+        // unlike kill, cannot hit another process if the pid was reused
+        syscall(SYS_pidfd_send_signal, w.pidfd, SIGKILL, nullptr, 0);
+        return;
+    }
+#endif
+    kill(w.pid, SIGKILL);
+}
+
+// Whether a process without a pidfd has exited, leaving it unreaped
+static bool check_exited(pid_t pid) {
+    siginfo_t info = {};
+    if (waitid(P_PID, pid, &info, WEXITED | WNOHANG | WNOWAIT)) {
+        // already reaped by someone else
+        return errno == ECHILD;
+    }
+    return info.si_pid != 0;
+}
+
+static void read_source(int epfd, watch::source &s) {
+    char buf[1 << 16];
+    while (s.fd != -1) {
+        ssize_t n = read(s.fd, buf, sizeof(buf));
+        if (n > 0) {
+            size_t room = SUPERVISOR_MAX_OUTPUT - min(s.buf.size(), (size_t)SUPERVISOR_MAX_OUTPUT);
+            s.buf.append(buf, min((size_t)n, room));
+            s.truncated |= (size_t)n > room;
+        } else if (n < 0 && errno == EINTR) {
+            continue;
+        } else if (n < 0 && errno == EAGAIN) {
+            return;
+        } else {
+            epoll_ctl(epfd, EPOLL_CTL_DEL, s.fd, nullptr);
+            close(s.fd);
+            s.fd = -1;
+        }
+    }
+}
+
+process_supervisor::process_supervisor() {
+    epfd_ = epoll_create1(EPOLL_CLOEXEC);
+    wakefd_ = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epfd_ == -1 || wakefd_ == -1) {
+        cerr << "Could not set up the process supervisor: " << strerror(errno) << "\n";
+        exit(EXIT_FAILURE);
+    }
+    epoll_event ev = {};
+    ev.events = EPOLLIN;
+    ev.data.ptr = nullptr;
+    epoll_ctl(epfd_, EPOLL_CTL_ADD, wakefd_, &ev);
+    thread_ = std::thread(&process_supervisor::loop, this);
+}
+
+process_supervisor::~process_supervisor() {
+    {
+        lock_guard<mutex> lock(mtx_);
+        stopping_ = true;
+    }
+    uint64_t one = 1;
+    (void)!write(wakefd_, &one, sizeof(one));
+    if (thread_.joinable()) thread_.join();
+    close(wakefd_);
+    close(epfd_);
+}
+
+process_supervisor &process_supervisor::get(void) {
+    static process_supervisor supervisor;
+    return supervisor;
+}
+
+void process_supervisor::loop(void) {
+    list<shared_ptr<watch>> active;
+    epoll_event events[64];
+
+    while (true) {
+        // sleep until the next deadline, if any
+        auto now = steady_clock::now();
+        int wait_ms = -1;
+        auto until = [&](steady_clock::time_point t) {
+            int ms = (int)max<int64_t>(0, duration_cast<milliseconds>(t - now).count() + 1);
+            wait_ms = wait_ms == -1 ? ms : min(wait_ms, ms);
+        };
+        for (const auto &w : active) {
+            if (w->has_deadline && !w->killed) until(w->deadline);
+            if (w->exited) until(w->drain_deadline);
+            if (w->pidfd == -1 && !w->exited) until(now + milliseconds(SUPERVISOR_POLL_TIME));
+        }
+
+        int n = epoll_wait(epfd_, events, 64, wait_ms);
+        if (n < 0 && errno != EINTR) {
+            cerr << "epoll_wait: " << strerror(errno) << "\n";
+            exit(EXIT_FAILURE);
+        }
+        now = steady_clock::now();
+
+        for (int i = 0; i < n; ++i) {
+            auto *s = (watch::source*)events[i].data.ptr;
+            if (!s) {
+                uint64_t v;
+                (void)!read(wakefd_, &v, sizeof(v));
+                continue;
+            }
+            if (s == &s->w->exit_tag) {
+                watch &w = *s->w;
+                epoll_ctl(epfd_, EPOLL_CTL_DEL, w.pidfd, nullptr);
+                w.exited = true;
+                w.drain_deadline = now + SUPERVISOR_DRAIN_TIME;
+            } else {
+                read_source(epfd_, *s);
+            }
+        }
+
+        {
+            lock_guard<mutex> lock(mtx_);
+            if (stopping_) return;
+            for (auto &w : added_) {
+                epoll_event ev = {};
+                ev.events = EPOLLIN;
+                for (auto &s : w->srcs) {
+                    if (s.fd == -1) continue;
+                    ev.data.ptr = &s;
+                    epoll_ctl(epfd_, EPOLL_CTL_ADD, s.fd, &ev);
+                }
+                if (w->pidfd != -1) {
+                    ev.data.ptr = &w->exit_tag;
+                    epoll_ctl(epfd_, EPOLL_CTL_ADD, w->pidfd, &ev);
+                }
+            }
+            active.splice(active.end(), added_);
+        }
+
+        for (auto it = active.begin(); it != active.end(); ) {
+            watch &w = **it;
+            if (!w.exited && w.pidfd == -1 && check_exited(w.pid)) {
+                w.exited = true;
+                w.drain_deadline = now + SUPERVISOR_DRAIN_TIME;
+            }
+            if (!w.exited && w.has_deadline && !w.killed && now >= w.deadline) {
+                kill_process(w);
+                w.killed = true;
+            }
+
+            bool drained = w.srcs[0].fd == -1 && w.srcs[1].fd == -1;
+            if (!w.exited || (!drained && now < w.drain_deadline)) {
+                ++it;
+                continue;
+            }
+
+            for (auto &s : w.srcs) {
+                read_source(epfd_, s);
+                if (s.fd != -1) {
+                    epoll_ctl(epfd_, EPOLL_CTL_DEL, s.fd, nullptr);
+                    close(s.fd);
+                    s.fd = -1;
+                }
+            }
+            if (w.pidfd != -1) close(w.pidfd);
+            w.done.set_value();
+            it = active.erase(it);
+        }
+    }
+}
+
+bool process_supervisor::supervise(pid_t pid, int out_fd, int err_fd, milliseconds timeout,
+                                   string &out, string &err) {
+    auto w = make_shared<watch>();
+    w->pid = pid;
+    w->pidfd = pidfd_open(pid);
+    w->exit_tag.w = w.get();
+    int fds[2] = {out_fd, err_fd};
+    for (int i = 0; i < 2; ++i) {
+        w->srcs[i].w = w.get();
+        if (fds[i] == -1) continue;
+        // our own fd, so the caller closing theirs cannot confuse epoll
+        w->srcs[i].fd = fcntl(fds[i], F_DUPFD_CLOEXEC, 0);
+        fcntl(w->srcs[i].fd, F_SETFL, fcntl(w->srcs[i].fd, F_GETFL) | O_NONBLOCK);
+    }
+    if (timeout != milliseconds::max()) {
+        w->has_deadline = true;
+        w->deadline = steady_clock::now() + timeout;
+    }
+
+    auto done = w->done.get_future();
+    {
+        lock_guard<mutex> lock(mtx_);
+        added_.push_back(w);
+    }
+    uint64_t one = 1;
+    (void)!write(wakefd_, &one, sizeof(one));
+    done.wait();
+
+    out = std::move(w->srcs[0].buf);
+    err = std::move(w->srcs[1].buf);
+    if (w->srcs[0].truncated) out += "\n[PATHFINDER] output truncated\n";
+    if (w->srcs[1].truncated) err += "\n[PATHFINDER] output truncated\n";
+    return w->killed;
+}
+
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+
+namespace pathfinder {
+
+// Output kept per stream of a supervised command, the rest is read and dropped
+#define SUPERVISOR_MAX_OUTPUT (8ul << 20)
+
+/**
+ * @brief Waits for child processes to exit and collects their output, for
+ * all commands at once from a single epoll thread.
+ *
+ * Exits are seen through pidfds, so no one polls. The children are not
+ * reaped, callers still wait() on them to get their exit codes.
+ */
+class process_supervisor {
+public:
+    struct watch;
+
+private:
+    int epfd_ = -1;
+    // wakes the thread up when a watch is added
+    int wakefd_ = -1;
+    std::thread thread_;
+
+    std::mutex mtx_;
+    std::list<std::shared_ptr<watch>> added_;
+    bool stopping_ = false;
+
+    process_supervisor();
+
+    void loop(void);
+
+public:
+    ~process_supervisor();
+
+    static process_supervisor &get(void);
+
+    /**
+     * @brief Block until pid exits, killing it with SIGKILL after timeout
+     * (milliseconds::max() for none), while reading out_fd and err_fd (-1 for
+     * none) until they are closed. The fds stay open.
+     *
+     * @return bool Whether the process had to be killed.
+     */
+    bool supervise(pid_t pid, int out_fd, int err_fd, std::chrono::milliseconds timeout,
+                   std::string &out, std::string &err);
+};
+
+}
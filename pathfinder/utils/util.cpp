@@ -1,4 +1,5 @@
 #include "util.hpp"
+#include "process_supervisor.hpp"
 
 #include <boost/asio.hpp>
 #include <boost/filesystem/fstream.hpp>
@@ -8,10 +9,17 @@
 #include <boost/iostreams/filtering_streambuf.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <cstdlib>
+#include <cstring>
 #include <execinfo.h>
+#include <fcntl.h>
 #include <iostream>
+#include <netdb.h>
+#include <poll.h>
 #include <sstream>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <thread>
+#include <unistd.h>
 
 namespace aio = boost::asio;
 namespace bio = boost::iostreams;
@@ -89,96 +97,157 @@ bp::child start_command(const list<string> &args) {
     return c;
 }
 
-int finish_command(bp::child &c, bp::ipstream &outs, bp::ipstream &errs, string &output) {
+string format_command_output(const string &out, const string &err) {
     stringstream ss;
-
-    c.wait();
-
     string line;
-    while (std::getline(outs, line) && !line.empty()) {
+    for (istringstream is(out); std::getline(is, line); ) {
         ss << "[STDOUT] " << line << "\n";
-        // cerr << "[STDOUT] " << line << "\n";
-        line.clear();
     }
-    while (std::getline(errs, line) && !line.empty()) {
+    for (istringstream is(err); std::getline(is, line); ) {
         ss << "[STDERR] " << line << "\n";
-        // cerr << "[STDERR] " << line << "\n";
-        line.clear();
     }
+    return ss.str();
+}
 
-    ss.flush();
-    output = ss.str();
-
+// Both pipes are read while the command runs, so it cannot block on a full one
+static int supervise_command(bp::child &c, bp::ipstream *outs, bp::ipstream *errs,
+    string *output, milliseconds timeout) {
+    string out, err;
+    process_supervisor::get().supervise(c.id(),
+        outs ? outs->pipe().native_source() : -1,
+        errs ? errs->pipe().native_source() : -1,
+        timeout, out, err);
+    c.wait();
+    if (output) *output = format_command_output(out, err);
     return c.exit_code();
 }
 
+int finish_command(bp::child &c, bp::ipstream &outs, bp::ipstream &errs, string &output) {
+    return supervise_command(c, &outs, &errs, &output, milliseconds::max());
+}
+
 int finish_command(bp::child &c, bp::ipstream &outs,
     bp::ipstream &errs, string &output, std::chrono::seconds timeout) {
-    stringstream ss;
+    return supervise_command(c, &outs, &errs, &output, duration_cast<milliseconds>(timeout));
+}
 
-    auto start = steady_clock::now();
+int finish_command(bp::child &c, std::chrono::seconds timeout) {
+    return supervise_command(c, nullptr, nullptr, nullptr, duration_cast<milliseconds>(timeout));
+}
 
-    while (c.running()) {
-        std::this_thread::sleep_for(chrono::milliseconds(10));
-        auto now = steady_clock::now();
-        auto time_diff = duration_cast<milliseconds>(now - start);
-        auto timeout_ms = duration_cast<milliseconds>(timeout);
-        if (time_diff >= timeout_ms) {
-            break;
-        }
+daemon_readiness daemon_readiness::parse(const string &spec, milliseconds timeout) {
+    daemon_readiness r;
+    r.timeout = timeout;
+    if (spec.empty()) return r;
+
+    size_t colon = spec.find(':');
+    string kind = spec.substr(0, colon);
+    r.target = (colon == string::npos) ? "" : spec.substr(colon + 1);
+    if (kind == "tcp") r.kind = TCP;
+    else if (kind == "unix") r.kind = UNIX_SOCKET;
+    else if (kind == "file") r.kind = FILE_EXISTS;
+    else if (kind == "stdout") r.kind = STDOUT_MARKER;
+    else if (kind == "probe") r.kind = PROBE;
+
+    if (r.kind == NONE || r.target.empty() ||
+        (r.kind == TCP && r.target.rfind(':') == string::npos)) {
+        cerr << "Error: bad daemon readiness check '" << spec
+            << "', expected tcp:HOST:PORT, unix:PATH, file:PATH, stdout:MARKER or probe:COMMAND\n";
+        exit(EXIT_FAILURE);
     }
+    return r;
+}
 
-    if (c.running()) {
-        c.terminate();
-        c.wait();
+// Whether something accepts connections at addr, waiting at most wait
+static bool try_connect(const sockaddr *addr, socklen_t len, int family, milliseconds wait) {
+    int fd = socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) return false;
+    bool ok = !connect(fd, addr, len);
+    if (!ok && errno == EINPROGRESS) {
+        pollfd pfd = {fd, POLLOUT, 0};
+        int err = 0;
+        socklen_t err_len = sizeof(err);
+        ok = poll(&pfd, 1, wait.count()) == 1 &&
+             !getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &err_len) && err == 0;
     }
+    close(fd);
+    return ok;
+}
 
-    string line;
-    while (std::getline(outs, line) && !line.empty()) {
-        ss << "[STDOUT] " << line << "\n";
-        // cerr << "[STDOUT] " << line << "\n";
-        line.clear();
-    }
-    while (std::getline(errs, line) && !line.empty()) {
-        ss << "[STDERR] " << line << "\n";
-        // cerr << "[STDERR] " << line << "\n";
-        line.clear();
+// wait bounds a connect or read, left (the time to the deadline) a probe
+static bool daemon_is_ready(const daemon_readiness &ready, int out_fd,
+                            string &consumed, milliseconds wait, milliseconds left) {
+    switch (ready.kind) {
+        case daemon_readiness::TCP: {
+            size_t colon = ready.target.rfind(':');
+            string host = ready.target.substr(0, colon);
+            string port = ready.target.substr(colon + 1);
+            addrinfo hints = {}, *addrs = nullptr;
+            hints.ai_socktype = SOCK_STREAM;
+            if (getaddrinfo(host.empty() ? "localhost" : host.c_str(), port.c_str(), &hints, &addrs)) {
+                return false;
+            }
+            bool ok = false;
+            for (addrinfo *a = addrs; a && !ok; a = a->ai_next) {
+                ok = try_connect(a->ai_addr, a->ai_addrlen, a->ai_family, wait);
+            }
+            freeaddrinfo(addrs);
+            return ok;
+        }
+        case daemon_readiness::UNIX_SOCKET: {
+            sockaddr_un addr = {};
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, ready.target.c_str(), sizeof(addr.sun_path) - 1);
+            return try_connect((const sockaddr*)&addr, sizeof(addr), AF_UNIX, wait);
+        }
+        case daemon_readiness::FILE_EXISTS:
+            return fs::exists(ready.target);
+        case daemon_readiness::STDOUT_MARKER: {
+            // Read whatever is there, waiting for more at most `wait`
+            pollfd pfd = {out_fd, POLLIN, 0};
+            if (poll(&pfd, 1, wait.count()) == 1) {
+                char buf[4096];
+                ssize_t n = read(out_fd, buf, sizeof(buf));
+                if (n > 0) consumed.append(buf, n);
+                // closed, so poll no longer waits
+                else std::this_thread::sleep_for(wait);
+            }
+            return consumed.find(ready.target) != string::npos;
+        }
+        case daemon_readiness::PROBE: {
+            list<string> args;
+            boost::split(args, ready.target, boost::is_space(), boost::token_compress_on);
+            bp::child c = start_command(args);
+            return supervise_command(c, nullptr, nullptr, nullptr, left) == 0;
+        }
+        default:
+            return true;
     }
-
-    ss.flush();
-    output = ss.str();
-
-    return c.exit_code();
 }
 
-int finish_command(bp::child &c, std::chrono::seconds timeout) {
-    // while (c.running()) {
-    //     bool finished = c.wait_for(chrono::milliseconds(10));
-    //     if (system_clock::now() - start >= timeout) break;
-    // }
-
-    // if (c.running()) {
-    //     c.terminate();
-    //     c.wait();
-    // }
-    // iangneal: It seems this may have uncovered a boost bug. So just wait.
-    // if (c.running()) {
-    //     c.wait();
-    // }
-
-    time_point<system_clock> start = system_clock::now();
-
-    while (c.running()) {
-        std::this_thread::sleep_for(chrono::milliseconds(10));
-        if (system_clock::now() - start >= timeout) break;
+bool wait_for_daemon(const daemon_readiness &ready, bp::child &daemon,
+                     int out_fd, string &consumed) {
+    if (ready.kind == daemon_readiness::STDOUT_MARKER && out_fd < 0) {
+        cerr << "Error: stdout readiness check needs the daemon's output\n";
+        exit(EXIT_FAILURE);
     }
 
-    if (c.running()) {
-        c.terminate();
-        c.wait();
+    const auto deadline = steady_clock::now() + ready.timeout;
+    milliseconds delay(1);
+    while (true) {
+        auto left = duration_cast<milliseconds>(deadline - steady_clock::now());
+        milliseconds wait = std::max(milliseconds(1), std::min(delay, left));
+        if (daemon_is_ready(ready, out_fd, consumed, wait, std::max(milliseconds(1), left))) return true;
+        // a daemon that forks into the background exits with 0, keep polling
+        if (!daemon.running() && daemon.exit_code() != 0) return false;
+        left = duration_cast<milliseconds>(deadline - steady_clock::now());
+        if (left <= milliseconds(0)) return false;
+        // the stdout check already waited for output
+        if (ready.kind != daemon_readiness::STDOUT_MARKER) {
+            std::this_thread::sleep_for(std::min(delay, left));
+        }
+        delay = std::min(delay * 2, milliseconds(500));
     }
-
-    return c.exit_code();
 }
 
 int run_command(string cmd) {
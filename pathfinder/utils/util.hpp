@@ -36,6 +36,12 @@ boost::process::child start_command(
 	const std::list<std::string> &args
 );
 
+/**
+ * @brief Prefix each line of a command's output with [STDOUT] or [STDERR],
+ * stdout first, as the finish_command functions return it.
+ */
+std::string format_command_output(const std::string &out, const std::string &err);
+
 int finish_command(
 	boost::process::child &process,
 	std::chrono::seconds timeout
@@ -56,6 +62,36 @@ int finish_command(
 	std::chrono::seconds timeout
 );
 
+/**
+ * @brief How to tell that a daemon is ready to take requests.
+ *
+ * Parsed from a spec of the form tcp:HOST:PORT, unix:PATH, file:PATH,
+ * stdout:MARKER or probe:COMMAND. An empty spec means no check.
+ */
+struct daemon_readiness {
+	enum kind_t { NONE, TCP, UNIX_SOCKET, FILE_EXISTS, STDOUT_MARKER, PROBE };
+	kind_t kind = NONE;
+	std::string target;
+	std::chrono::milliseconds timeout = std::chrono::seconds(30);
+
+	static daemon_readiness parse(const std::string &spec, std::chrono::milliseconds timeout);
+};
+
+/**
+ * @brief Poll with exponential backoff until the daemon is ready, it exits or
+ * the timeout passes.
+ *
+ * @param out_fd the daemon's stdout, needed for STDOUT_MARKER
+ * @param consumed what was read from out_fd while waiting
+ * @return true if the daemon is ready
+ */
+bool wait_for_daemon(
+	const daemon_readiness &ready,
+	boost::process::child &daemon,
+	int out_fd,
+	std::string &consumed
+);
+
 // https://gist.github.com/yfnick/6ba33efa7ba12e93b148
 struct gzip {
 	static std::vector<char> compress(const std::vector<char>& data);
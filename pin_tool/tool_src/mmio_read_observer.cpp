@@ -4,9 +4,9 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/syscall.h>
+#include <algorithm>
 #include <fstream>
 #include <iostream>
-#include <set>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -18,16 +18,26 @@ KNOB< std::string > of_knob(
 
 class store_id{
 public:
+    size_t id;
     ADDRINT addr;
     size_t size;
     size_t reads{0};
     size_t writes{0};
     store_id() {}
-    store_id(ADDRINT _addr, size_t _size) : addr{_addr}, size{_size} {}
+    store_id(size_t _id, ADDRINT _addr, size_t _size) : id{_id}, addr{_addr}, size{_size} {}
 };
 
-std::set<size_t> id_set;
-std::unordered_map<size_t, store_id> id_mapping;
+// Stores are indexed by 64-byte line, so an access only checks the few
+// stores that share its line(s) instead of every store in the input file.
+#define SHADOW_SHIFT 6
+
+// stores, sorted by id, one per id
+std::vector<store_id> stores;
+// line number -> indices into stores of the stores overlapping that line
+std::unordered_map<ADDRINT, std::vector<uint32_t>> shadow;
+// cheap reject for the (common) accesses outside every store
+ADDRINT shadow_lo = ~(ADDRINT)0;
+ADDRINT shadow_hi = 0;
 
 bool overlap(size_t A_start, size_t A_size, size_t B_start, size_t B_size) {
     size_t A_end = A_start + A_size;
@@ -35,22 +45,31 @@ bool overlap(size_t A_start, size_t A_size, size_t B_start, size_t B_size) {
     return ((A_start < B_end) && (B_start < A_end));
 }
 
-VOID AddressRead(ADDRINT addr, size_t sz) {
-    for (size_t id : id_set) {
-        store_id& store = id_mapping[id];
-        if (overlap(static_cast<size_t>(store.addr), store.size, static_cast<size_t>(addr), sz)) {
-            store.reads++;
+// Count the access on every store it overlaps. A store that spans several
+// lines is only counted once per access.
+static inline void count_access(ADDRINT addr, size_t sz, size_t store_id::*count) {
+    if (addr >= shadow_hi || addr + sz <= shadow_lo) return;
+    ADDRINT first = addr >> SHADOW_SHIFT, last = (addr + sz - 1) >> SHADOW_SHIFT;
+    for (ADDRINT line = first; line <= last; line++) {
+        auto it = shadow.find(line);
+        if (it == shadow.end()) continue;
+        for (uint32_t idx : it->second) {
+            store_id &store = stores[idx];
+            // already counted on an earlier line of this access
+            if (line > first && (store.addr >> SHADOW_SHIFT) < line) continue;
+            if (overlap(static_cast<size_t>(store.addr), store.size, static_cast<size_t>(addr), sz)) {
+                store.*count += 1;
+            }
         }
     }
 }
 
+VOID AddressRead(ADDRINT addr, size_t sz) {
+    count_access(addr, sz, &store_id::reads);
+}
+
 VOID AddressWrite(ADDRINT addr, size_t sz) {
-    for (size_t id : id_set) {
-        store_id& store = id_mapping[id];
-        if (overlap(static_cast<size_t>(store.addr), store.size, static_cast<size_t>(addr), sz)) {
-            store.writes++;
-        }
-    }
+    count_access(addr, sz, &store_id::writes);
 }
 
 VOID InstrumentTrace(TRACE trace, VOID *v) {
@@ -89,10 +108,12 @@ VOID Fini(INT32 code, VOID* v) {
     }
 
     std::cout << std::endl << "[PINTOOL STDOUT BEGIN]" << std::endl;
-    for (size_t id : id_set) {
-        store_id& store = id_mapping[id];
-        std::cout << "Store ID: " << id << ", reads: " << store.reads << ", (over)writes: " << store.writes << "\n";
-        outfile << "Store ID: " << id << ", reads: " << store.reads << ", (over)writes: " << store.writes << "\n";
+    for (const store_id &store : stores) {
+        std::cout << "Store ID: " << store.id << ", reads: " << store.reads << ", (over)writes: " << store.writes << "\n";
+        // "store_id,is_accessed", as read back by get_accessed_stores. Only
+        // reads count: what matters is whether recovery can observe the
+        // store, and overwriting it without reading it first does not.
+        outfile << store.id << "," << (store.reads > 0 ? 1 : 0) << "\n";
     }
     std::cout << std::endl << "[PINTOOL STDOUT END]" << std::endl;
 
@@ -104,6 +125,8 @@ void parse_input_file(std::ifstream &infile) {
     std::cout << "[PINTOOL STDOUT BEGIN]" << std::endl;
 
     std::string line;
+    // id -> index into stores; a later line for the same id replaces it
+    std::unordered_map<size_t, size_t> id_index;
     while (getline(infile, line)) {
         size_t id, size;
         ADDRINT address;
@@ -111,9 +134,26 @@ void parse_input_file(std::ifstream &infile) {
         sscanf(line.c_str(), "%ld, %ld, %ld", &id, &address, &size);
         // print out the data fields
         std::cout << "id: " << id << ", address: " << address << ", size: " << size << std::endl;
-        store_id store(address, size);
-        id_mapping[id] = store;
-        id_set.insert(id);
+        auto res = id_index.emplace(id, stores.size());
+        if (res.second) {
+            stores.emplace_back(id, address, size);
+        } else {
+            stores[res.first->second] = store_id(id, address, size);
+        }
+    }
+
+    std::sort(stores.begin(), stores.end(),
+        [](const store_id &a, const store_id &b) { return a.id < b.id; });
+
+    for (uint32_t idx = 0; idx < stores.size(); idx++) {
+        const store_id &store = stores[idx];
+        if (store.size == 0) continue;
+        ADDRINT end = store.addr + store.size;
+        for (ADDRINT line = store.addr >> SHADOW_SHIFT; line <= (end - 1) >> SHADOW_SHIFT; line++) {
+            shadow[line].push_back(idx);
+        }
+        shadow_lo = std::min(shadow_lo, store.addr);
+        shadow_hi = std::max(shadow_hi, end);
     }
 
     std::cout << "[PINTOOL STDOUT END]" << std::endl << std::endl;
@@ -45,6 +45,12 @@ END_LEGAL */
 #include <cxxabi.h>
 #include <cstdlib>
 #include <unordered_map>
+#include <atomic>
+#include <fstream>
+#include <queue>
+#include <unordered_set>
+#include <stdarg.h>
+#include <time.h>
 
 // #include <ucontext.h>
 // #include <libunwind.h>
@@ -67,6 +73,8 @@ extern "C" {
 
 #define FILENAME_SIZE 512
 #define BACKTRACE_SIZE 100
+#define MAX_THREADS 1024
+#define TRACE_BUFFER_SIZE (4UL << 20)
 
 #define MALLOC "malloc"
 #define FREE "free"
@@ -102,9 +110,26 @@ std::string target_filename;
 std::string at_fdcwd = "";
 bool record_value = false;
 
-// global counters
-unsigned long timestamp = 0;
+// global counters. Every trace record takes the next timestamp; storeLock
+// keeps store ids in timestamp order.
+std::atomic<unsigned long> timestamp(0);
 unsigned long store_id = 0;
+PIN_LOCK storeLock;
+
+// Backtraces are recorded as raw return addresses and symbolized once per
+// address, when an image is unloaded or the trace is written out.
+// return address -> "function,file,line,offset;", empty for filtered frames
+std::unordered_map<ADDRINT, std::string> symbolizedFrames;
+// recorded addresses not symbolized yet
+std::vector<ADDRINT> pendingFrames;
+// Symbolizing needs the client lock, and Pin holds it around ImageUnload, so
+// it is always taken before symLock.
+PIN_LOCK symLock;
+// symbolized frames are also appended to a file of their own, as
+// "<address>\t<frame>" lines, so pathfinder can still symbolize the records
+// of a tool that never got to Fini. The time of the last traceSyncFrames().
+int symFd = -1;
+std::atomic<time_t> symTime(0);
 
 // for recording op count if pathfinder markers are used
 // thread id -> op count
@@ -167,11 +192,23 @@ typedef struct threadNode {
 	struct threadNode *next;
 	void *mem_addr;
 	uint32_t mem_size;
+	// trace records of this thread go to a file of their own, through a
+	// shared mapping of part of it. traceBuf is where the mapping has room
+	// left, at file offset traceOff, and traceLen how much of it is used.
+	char *traceMap;
+	size_t traceMapLen;
+	char *traceBuf;
+	size_t traceCap;
+	size_t traceLen;
+	off_t traceOff;
+	int traceFd;
+	// return addresses this thread already added to pendingFrames
+	std::unordered_set<ADDRINT> *seenFrames;
 } ThreadNode;
 
 //ThreadNode *threadNodeHead = NULL;
 //ThreadNode *threadNodeTail = NULL;
-ThreadNode threadArray[100];
+ThreadNode threadArray[MAX_THREADS];
 
 // mmio library call arguments and data structures
 typedef struct memNode {
@@ -575,65 +612,302 @@ void printBacktraceUnwind(const CONTEXT * 	ctxt) {
     // }
 }
 
-int printBacktrace(const CONTEXT * 	ctxt) {
+// Trace records are written per thread to a file per thread, so threads do
+// not serialize on the output file. The files are written through shared
+// mappings, so what is written is in the page cache right away and a tool
+// that is killed before Fini still leaves its records behind, for pathfinder
+// to merge. Fini merges the files into the output in timestamp order.
+std::string traceFilename(THREADID tid) {
+	return of_knob.Value() + "." + std::to_string(PIN_GetPid()) + "." + std::to_string(tid);
+}
+
+std::string symFilename() {
+	return of_knob.Value() + "." + std::to_string(PIN_GetPid()) + ".sym";
+}
+
+void traceSyncFrames(THREADID tid);
+
+// Map the next window of this thread's file, starting where its records end
+// and with room for at least need bytes.
+void traceMapWindow(THREADID tid, size_t need) {
+	ThreadNode *t = &threadArray[tid];
+	off_t pos = t->traceOff + t->traceLen;
+	off_t base = pos & ~(off_t)((1UL << PAGE_SHIFT) - 1);
+	size_t len = TRACE_BUFFER_SIZE;
+
+	if (t->traceFd < 0) {
+		t->traceFd = open(traceFilename(tid).c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (t->traceFd < 0) {
+			PIN_GetLock(&pinLock, tid+1);
+			fprintf(out, "[%d] %s: open() failed. (ERROR)\n", tid, __func__);
+			fflush(out);
+			PIN_ReleaseLock(&pinLock);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (t->traceMap != NULL) {
+		munmap(t->traceMap, t->traceMapLen);
+		// a good point to let the sym file catch up with the records
+		traceSyncFrames(tid);
+	}
+	while (len < (size_t)(pos - base) + need)
+		len *= 2;
+	if (ftruncate(t->traceFd, base + len) < 0) {
+		PIN_GetLock(&pinLock, tid+1);
+		fprintf(out, "[%d] %s: ftruncate() failed. (ERROR)\n", tid, __func__);
+		fflush(out);
+		PIN_ReleaseLock(&pinLock);
+		exit(EXIT_FAILURE);
+	}
+	t->traceMap = (char *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, t->traceFd, base);
+	if (t->traceMap == MAP_FAILED) {
+		PIN_GetLock(&pinLock, tid+1);
+		fprintf(out, "[%d] %s: mmap() failed. (ERROR)\n", tid, __func__);
+		fflush(out);
+		PIN_ReleaseLock(&pinLock);
+		exit(EXIT_FAILURE);
+	}
+	t->traceMapLen = len;
+	t->traceOff = pos;
+	t->traceBuf = t->traceMap + (pos - base);
+	t->traceCap = len - (pos - base);
+	t->traceLen = 0;
+}
+
+// Unmap this thread's file and cut it back to the records in it.
+void traceFlush(THREADID tid) {
+	ThreadNode *t = &threadArray[tid];
+
+	if (t->traceMap == NULL)
+		return;
+	munmap(t->traceMap, t->traceMapLen);
+	if (ftruncate(t->traceFd, t->traceOff + t->traceLen) < 0) {
+		PIN_GetLock(&pinLock, tid+1);
+		fprintf(out, "[%d] %s: ftruncate() failed. (ERROR)\n", tid, __func__);
+		fflush(out);
+		PIN_ReleaseLock(&pinLock);
+		exit(EXIT_FAILURE);
+	}
+	t->traceOff += t->traceLen;
+	t->traceMap = NULL;
+	t->traceBuf = NULL;
+	t->traceMapLen = 0;
+	t->traceCap = 0;
+	t->traceLen = 0;
+}
+
+void traceWrite(THREADID tid, const char *fmt, ...) {
+	ThreadNode *t = &threadArray[tid];
+	va_list ap;
+	int n;
+
+	if (t->traceMap == NULL)
+		traceMapWindow(tid, 0);
+	va_start(ap, fmt);
+	n = vsnprintf(t->traceBuf + t->traceLen, t->traceCap - t->traceLen, fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return;
+	if ((size_t)n >= t->traceCap - t->traceLen) {
+		// did not fit, move on to the next window and try again
+		traceMapWindow(tid, n + 1);
+		va_start(ap, fmt);
+		vsnprintf(t->traceBuf, t->traceCap, fmt, ap);
+		va_end(ap);
+	}
+	t->traceLen += n;
+}
+
+// Append a symbolized frame to the sym file. The file is only a fallback for
+// a tool that is killed, so failing to write it is not an error. Callers hold
+// symLock.
+void symWrite(ADDRINT addr, const std::string &frame) {
+	char head[32];
+	std::string line;
+
+	if (symFd < 0) {
+		symFd = open(symFilename().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+		if (symFd < 0)
+			return;
+	}
+	snprintf(head, sizeof(head), "%lx\t", (unsigned long)addr);
+	line = head + frame + "\n";
+	if (write(symFd, line.data(), line.size()) < 0)
+		return;
+}
+
+// Callers hold the client lock and symLock.
+const std::string &symbolizeFrame(ADDRINT addr) {
 	// we are not interested in stack frames from standard libraries, so might as well filter out
-	std::vector<std::string> filters = {"/usr/include"};
-	void* buf[BACKTRACE_SIZE];
-	PIN_LockClient();
-	int nptrs = PIN_Backtrace(ctxt, buf, sizeof(buf)/sizeof(buf[0]));
-    char** bt = backtrace_symbols(buf, nptrs);
-	PIN_UnlockClient();
-	// for (int i = 0; i < nptrs && i <= 2; i++) {
-	// 	fprintf(out, "%s,", bt[i]);
-	// }
-	// fprintf(out, "\n");
-	// for now just print the first trace
-	// if (nptrs > 0) {
-	// fprintf(out, "%s\n", bt[0]);
-	// }
+	static const std::vector<std::string> filters = {"/usr/include"};
+	std::unordered_map<ADDRINT, std::string>::iterator it = symbolizedFrames.find(addr);
+	std::string frame;
+	void *buf[1] = {(void *)addr};
+	char **bt;
 
-	// use parseFunctionInfo to parse each line of bt
-	for (int i = 0; i < nptrs; i++) {
+	if (it != symbolizedFrames.end())
+		return it->second;
+
+	bt = backtrace_symbols(buf, 1);
+	if (bt != NULL) {
 		std::string str;
 		int status;
-		char* demangled_name = abi::__cxa_demangle(bt[i], NULL, NULL, &status);
+		char* demangled_name = abi::__cxa_demangle(bt[0], NULL, NULL, &status);
 		if (status == 0 && demangled_name != NULL) {
 			// Use demangled_name
 			str = demangled_name;
 		} else {
-			// Use original mangled name (bt[i])
-			str = bt[i];
+			// Use original mangled name (bt[0])
+			str = bt[0];
 		}
 		// Free the memory allocated by __cxa_demangle
 		free(demangled_name);
 		auto [func, file, line, offset] = parseFunctionInfo(str);
 		bool skip = false;
-		for (auto filter : filters) {
+		for (const std::string &filter : filters) {
 			if (file.find(filter) != std::string::npos) {
 				skip = true;
 				break;
 			}
 		}
 		if (!skip) {
-			fprintf(out, "%s,%s,%s,%s;", func.c_str(), file.c_str(), line.c_str(), offset.c_str());
+			frame = func + "," + file + "," + line + "," + offset + ";";
 		}
+		free(bt);
+	}
+	symWrite(addr, frame);
+	return symbolizedFrames[addr] = frame;
+}
+
+// Symbolize the pending addresses in [low, high], while their image is
+// still loaded. Callers hold the client lock and symLock.
+void symbolizePendingFrames(ADDRINT low, ADDRINT high) {
+	size_t i, j;
+
+	for (i = 0, j = 0; i < pendingFrames.size(); i++) {
+		if (pendingFrames[i] >= low && pendingFrames[i] <= high)
+			symbolizeFrame(pendingFrames[i]);
+		else
+			pendingFrames[j++] = pendingFrames[i];
+	}
+	pendingFrames.resize(j);
+}
+
+// Symbolize all pending addresses, so the sym file covers the records
+// written so far. Done whenever a thread moves on to the next window of its
+// file, and at most once a second when new addresses come up.
+void traceSyncFrames(THREADID tid) {
+	PIN_LockClient();
+	PIN_GetLock(&symLock, tid+1);
+	symTime.store(time(NULL));
+	symbolizePendingFrames(0, ~(ADDRINT)0);
+	PIN_ReleaseLock(&symLock);
+	PIN_UnlockClient();
+}
+
+// Write a record to out, replacing its raw "@<address>;" frames.
+void tracePutRecord(const std::string &line) {
+	size_t pos = 0, end;
+
+	while (pos < line.size()) {
+		end = line.find(';', pos);
+		if (end == std::string::npos)
+			end = line.size();
+		if (line[pos] == '@') {
+			fputs(symbolizeFrame(strtoul(line.c_str() + pos + 1, NULL, 16)).c_str(), out);
+		}
+		else {
+			fwrite(line.data() + pos, 1, end - pos, out);
+			if (end < line.size())
+				fputc(';', out);
+		}
+		pos = end + 1;
+	}
+	fputc('\n', out);
+}
+
+// Write all buffered records to out, ordered by their leading timestamp.
+// Records of one thread are already in order, so this is a merge.
+void traceMerge() {
+	typedef std::pair<unsigned long, size_t> Head;
+	std::vector<std::ifstream *> files;
+	std::vector<std::string> lines;
+	std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+	int tid;
+	size_t i;
+
+	PIN_LockClient();
+	PIN_GetLock(&symLock, PIN_ThreadId()+1);
+	symbolizePendingFrames(0, ~(ADDRINT)0);
+	for (tid = 0; tid < MAX_THREADS; tid++) {
+		if (threadArray[tid].traceFd < 0)
+			continue;
+		traceFlush(tid);
+		close(threadArray[tid].traceFd);
+		threadArray[tid].traceFd = -1;
+		threadArray[tid].traceOff = 0;
+		files.push_back(new std::ifstream(traceFilename(tid)));
+		lines.push_back(std::string());
+		unlink(traceFilename(tid).c_str());
+	}
+	for (i = 0; i < files.size(); i++) {
+		if (std::getline(*files[i], lines[i]))
+			heads.push(Head(strtoul(lines[i].c_str(), NULL, 10), i));
+	}
+	while (!heads.empty()) {
+		i = heads.top().second;
+		heads.pop();
+		tracePutRecord(lines[i]);
+		if (std::getline(*files[i], lines[i]))
+			heads.push(Head(strtoul(lines[i].c_str(), NULL, 10), i));
 	}
-	fprintf(out, "\n");
 	fflush(out);
+	if (symFd >= 0) {
+		close(symFd);
+		symFd = -1;
+		unlink(symFilename().c_str());
+	}
+	PIN_ReleaseLock(&symLock);
+	PIN_UnlockClient();
+	for (i = 0; i < files.size(); i++)
+		delete files[i];
+}
+
+int printBacktrace(const CONTEXT * 	ctxt, THREADID tid) {
+	ThreadNode *t = &threadArray[tid];
+	void* buf[BACKTRACE_SIZE];
+	bool added = false;
+	PIN_LockClient();
+	int nptrs = PIN_Backtrace(ctxt, buf, sizeof(buf)/sizeof(buf[0]));
+	PIN_UnlockClient();
 
-	free(bt);
+	if (t->seenFrames == NULL)
+		t->seenFrames = new std::unordered_set<ADDRINT>();
+	for (int i = 0; i < nptrs; i++) {
+		ADDRINT addr = (ADDRINT)buf[i];
+		if (t->seenFrames->insert(addr).second) {
+			PIN_GetLock(&symLock, tid+1);
+			pendingFrames.push_back(addr);
+			PIN_ReleaseLock(&symLock);
+			added = true;
+		}
+		traceWrite(tid, "@%lx;", (unsigned long)addr);
+	}
+	if (added && time(NULL) != symTime.load())
+		traceSyncFrames(tid);
+	traceWrite(tid, "\n");
 	return nptrs;
 }
 
 VOID BeforeMalloc(CONTEXT* ctxt, CHAR* name, ADDRINT size) { 
 	fprintf(out, "%s begins (%lu)\n", name, size);
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, PIN_ThreadId());
  }
  
 VOID AfterMalloc(CONTEXT* ctxt, ADDRINT ret) { 
 	// print ret in pointer form
 	fprintf(out, "malloc() ends = %p\n", (void *)ret);
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, PIN_ThreadId());
  }
 
 VOID BeforeFree(CONTEXT* ctxt, CHAR* name, ADDRINT addr) { 
@@ -868,7 +1142,7 @@ VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v) {
 	// fflush(out);
 	// PIN_ReleaseLock(&pinLock);
 
-	if (tid > 1000) {
+	if (tid >= MAX_THREADS) {
 		PIN_GetLock(&pinLock, tid+1);
 		fprintf(out, "%d, %s: There are too many threads. (ERROR)\n", tid, __func__);
 		fflush(out);
@@ -889,6 +1163,30 @@ VOID ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v) {
 	// fflush(out);
 	// PIN_ReleaseLock(&pinLock);
 	//deleteThreadNode(tid);
+	traceFlush(tid);
+}
+
+// The child starts with the parent's mappings and files, which the parent
+// still writes out itself.
+VOID ForkChild(THREADID tid, const CONTEXT *ctxt, VOID *v) {
+	int i;
+
+	for (i = 0; i < MAX_THREADS; i++) {
+		if (threadArray[i].traceMap != NULL)
+			munmap(threadArray[i].traceMap, threadArray[i].traceMapLen);
+		if (threadArray[i].traceFd >= 0)
+			close(threadArray[i].traceFd);
+		threadArray[i].traceMap = NULL;
+		threadArray[i].traceMapLen = 0;
+		threadArray[i].traceBuf = NULL;
+		threadArray[i].traceCap = 0;
+		threadArray[i].traceLen = 0;
+		threadArray[i].traceOff = 0;
+		threadArray[i].traceFd = -1;
+	}
+	if (symFd >= 0)
+		close(symFd);
+	symFd = -1;
 }
 
 // This routine is executed each time mmap() is called.
@@ -973,21 +1271,16 @@ VOID AfterMmap(THREADID tid, MmapArgs *args, void *ret, CONTEXT *ctxt) {
 	PIN_RWMutexUnlock(&RWMutex);
 
 	if (result) {
-		PIN_GetLock(&pinLock, tid+1);
-		fprintf(out, "%lu,%d,REGISTER_FILE,%s,0x%lx,%lu,%ld,%d,%d;", timestamp, tid, args->filename, args->addr, args->length, args->offset, args->prot, args->flags);
+		unsigned long ts = timestamp++;
+		traceWrite(tid, "%lu,%d,REGISTER_FILE,%s,0x%lx,%lu,%ld,%d,%d;", ts, tid, args->filename, args->addr, args->length, args->offset, args->prot, args->flags);
 		#if PRINT_BACKTRACE
-		printBacktrace(ctxt);
+		printBacktrace(ctxt, tid);
 		#else
-		fprintf(out, "\n");
+		traceWrite(tid, "\n");
 		#endif
-		fflush(out);
 		#if DEBUG
-		printf("%lu,%d,REGISTER_FILE,%s,0x%lx,%lu,%ld,%d,%d;", timestamp, tid, args->filename, args->addr, args->length, args->offset, args->prot, args->flags);
+		printf("%lu,%d,REGISTER_FILE,%s,0x%lx,%lu,%ld,%d,%d;", ts, tid, args->filename, args->addr, args->length, args->offset, args->prot, args->flags);
 		#endif
-		PIN_RWMutexWriteLock(&RWMutex);
-		timestamp++;
-		PIN_RWMutexUnlock(&RWMutex);
-		PIN_ReleaseLock(&pinLock);
 	}
 	else {
 		PIN_GetLock(&pinLock, tid+1);
@@ -1058,21 +1351,16 @@ VOID AfterMunmap(THREADID tid, MunmapArgs *args, int ret, CONTEXT *ctxt) {
 	PIN_RWMutexUnlock(&RWMutex);
 
 	if (result) {
-		PIN_GetLock(&pinLock, tid+1);
-		fprintf(out, "%lu,%d,UNREGISTER_FILE,%s,0x%lx,%lu;", timestamp, tid, args->filename, args->addr, args->length);	
+		unsigned long ts = timestamp++;
+		traceWrite(tid, "%lu,%d,UNREGISTER_FILE,%s,0x%lx,%lu;", ts, tid, args->filename, args->addr, args->length);	
 		#if PRINT_BACKTRACE
-		printBacktrace(ctxt);
+		printBacktrace(ctxt, tid);
 		#else
-		fprintf(out, "\n");
+		traceWrite(tid, "\n");
 		#endif
-		fflush(out);
 		#if DEBUG
-		printf("%lu,%d,UNREGISTER_FILE,%s,0x%lx,%lu;", timestamp, tid, args->filename, args->addr, args->length);
+		printf("%lu,%d,UNREGISTER_FILE,%s,0x%lx,%lu;", ts, tid, args->filename, args->addr, args->length);
 		#endif
-		PIN_RWMutexWriteLock(&RWMutex);
-		timestamp++;
-		PIN_RWMutexUnlock(&RWMutex);
-		PIN_ReleaseLock(&pinLock);
 	}
 	else {
 		PIN_GetLock(&pinLock, tid+1);
@@ -1134,21 +1422,16 @@ VOID AfterMsync(THREADID tid, MsyncArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,MSYNC,%s,0x%lx,%lu,%d;", timestamp, tid, args->filename, args->addr, args->length, args->flags);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,MSYNC,%s,0x%lx,%lu,%d;", ts, tid, args->filename, args->addr, args->length, args->flags);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,MSYNC,%s,0x%lx,%lu,%d;", timestamp, tid, args->filename, args->addr, args->length, args->flags);
+	printf("%lu,%d,MSYNC,%s,0x%lx,%lu,%d;", ts, tid, args->filename, args->addr, args->length, args->flags);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock); 
 	free(args);
 }
 
@@ -1190,21 +1473,16 @@ VOID AfterFtruncate(THREADID tid, FtruncateArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,FTRUNCATE,%d,%s,%ld;", timestamp, tid, args->fd, args->filename, args->length);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,FTRUNCATE,%d,%s,%ld;", ts, tid, args->fd, args->filename, args->length);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,FTRUNCATE,%d,%s,%ld;", timestamp, tid, args->fd, args->filename, args->length);
+	printf("%lu,%d,FTRUNCATE,%d,%s,%ld;", ts, tid, args->fd, args->filename, args->length);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1248,51 +1526,46 @@ VOID AfterPwrite64(THREADID tid, Pwrite64Args *args, ssize_t ret, CONTEXT *ctxt)
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
+	unsigned long ts = timestamp++;
 	std::string encoded_result;
 	if (record_value) {
 		encoded_result = base64_encode((char *)args->buf, args->count);
 		// debug print char array in out
-		// fprintf(out, "hexdump of args->buf before encode \n");
+		// traceWrite(tid, "hexdump of args->buf before encode \n");
 		// for (size_t i = 0; i < args->count; i++) {
-		// 	fprintf(out, "%02x ", ((char *)args->buf)[i]);
+		// 	traceWrite(tid, "%02x ", ((char *)args->buf)[i]);
 		// }
-		// fprintf(out, "\n");
+		// traceWrite(tid, "\n");
 
 		// char* decode_result = base64_decode(encoded_result.c_str(), encoded_result.size());
-		// fprintf(out, "hexdump of args->buf after decode \n");
+		// traceWrite(tid, "hexdump of args->buf after decode \n");
 		// for (size_t i = 0; i < args->count; i++) {
-		// 	fprintf(out, "%02x ", decode_result[i]);
+		// 	traceWrite(tid, "%02x ", decode_result[i]);
 		// }
-		// fprintf(out, "\n");
+		// traceWrite(tid, "\n");
 		if (encoded_result[encoded_result.size()-1] == '\n') {
-			fprintf(out, "%lu,%d,PWRITE64,%d,%s,%ld,%lu,%s;", timestamp, tid, args->fd, args->filename, args->offset, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
+			traceWrite(tid, "%lu,%d,PWRITE64,%d,%s,%ld,%lu,%s;", ts, tid, args->fd, args->filename, args->offset, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
 		}
 		else {
-			fprintf(out, "%lu,%d,PWRITE64,%d,%s,%ld,%lu,%s;", timestamp, tid, args->fd, args->filename, args->offset, args->count, encoded_result.c_str());
+			traceWrite(tid, "%lu,%d,PWRITE64,%d,%s,%ld,%lu,%s;", ts, tid, args->fd, args->filename, args->offset, args->count, encoded_result.c_str());
 		}
 	}
 	else {
-		fprintf(out, "%lu,%d,PWRITE64,%d,%s,%ld,%lu,;", timestamp, tid, args->fd, args->filename, args->offset, args->count);
+		traceWrite(tid, "%lu,%d,PWRITE64,%d,%s,%ld,%lu,;", ts, tid, args->fd, args->filename, args->offset, args->count);
 	}
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
 	if (record_value) {
-		printf("%lu,%d,PWRITE64,%d,%s,%ld,%lu,%s;", timestamp, tid, args->fd, args->filename, args->offset, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
+		printf("%lu,%d,PWRITE64,%d,%s,%ld,%lu,%s;", ts, tid, args->fd, args->filename, args->offset, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
 	}
 	else {
-		printf("%lu,%d,PWRITE64,%d,%s,%ld,%lu,;", timestamp, tid, args->fd, args->filename, args->offset, args->count);
+		printf("%lu,%d,PWRITE64,%d,%s,%ld,%lu,;", ts, tid, args->fd, args->filename, args->offset, args->count);
 	}
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1334,44 +1607,39 @@ VOID AfterRead(THREADID tid, ReadArgs *args, ssize_t ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
+	unsigned long ts = timestamp++;
 	std::string encoded_result;
 	if (record_value) {
 		encoded_result = base64_encode((char *)args->buf, args->count);
 		// encoded_result = std::string(static_cast<char*>(args->buf), args->count);
 		if (encoded_result[encoded_result.size()-1] == '\n') {
-			fprintf(out, "%lu,%d,READ,%d,%s,%lu,%s;", timestamp, tid, args->fd, args->filename, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
+			traceWrite(tid, "%lu,%d,READ,%d,%s,%lu,%s;", ts, tid, args->fd, args->filename, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
 		}
 		else {
-			fprintf(out, "%lu,%d,READ,%d,%s,%lu,%s;", timestamp, tid, args->fd, args->filename, args->count, encoded_result.c_str());
+			traceWrite(tid, "%lu,%d,READ,%d,%s,%lu,%s;", ts, tid, args->fd, args->filename, args->count, encoded_result.c_str());
 		}
 	}
 	else {
-		fprintf(out, "%lu,%d,READ,%d,%s,%lu,;", timestamp, tid, args->fd, args->filename, args->count);
+		traceWrite(tid, "%lu,%d,READ,%d,%s,%lu,;", ts, tid, args->fd, args->filename, args->count);
 	}
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
 	if (record_value) {
 		if (encoded_result[encoded_result.size()-1] == '\n') {
-			printf("%lu,%d,READ,%d,%s,%lu,%s;", timestamp, tid, args->fd, args->filename, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
+			printf("%lu,%d,READ,%d,%s,%lu,%s;", ts, tid, args->fd, args->filename, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
 		}
 		else {
-			printf("%lu,%d,READ,%d,%s,%lu,%s;", timestamp, tid, args->fd, args->filename, args->count, encoded_result.c_str());
+			printf("%lu,%d,READ,%d,%s,%lu,%s;", ts, tid, args->fd, args->filename, args->count, encoded_result.c_str());
 		}
 	}
 	else {
-		printf("%lu,%d,READ,%d,%s,%lu,;", timestamp, tid, args->fd, args->filename, args->count);
+		printf("%lu,%d,READ,%d,%s,%lu,;", ts, tid, args->fd, args->filename, args->count);
 	}
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1415,40 +1683,35 @@ VOID AfterReadv(THREADID tid, ReadvArgs *args, ssize_t ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
+	unsigned long ts = timestamp++;
 	if (record_value) {
-		fprintf(out, "%lu,%d,READV,%d,%s,%d", timestamp, tid, args->fd, args->filename, args->iovcnt);
+		traceWrite(tid, "%lu,%d,READV,%d,%s,%d", ts, tid, args->fd, args->filename, args->iovcnt);
 		for (int i = 0; i < args->iovcnt; i++) {
 			std::string encoded_result = base64_encode((char *)args->iov[i].iov_base, args->iov[i].iov_len);
 			if (encoded_result[encoded_result.size()-1] == '\n') {
-				fprintf(out, ",%lu,%s", args->iov[i].iov_len, encoded_result.substr(0, encoded_result.size()-1).c_str());
+				traceWrite(tid, ",%lu,%s", args->iov[i].iov_len, encoded_result.substr(0, encoded_result.size()-1).c_str());
 			}
 			else {
-				fprintf(out, ",%lu,%s", args->iov[i].iov_len, encoded_result.c_str());
+				traceWrite(tid, ",%lu,%s", args->iov[i].iov_len, encoded_result.c_str());
 			}
 		}
-		fprintf(out, ";");
+		traceWrite(tid, ";");
 	}
 	else {
-		fprintf(out, "%lu,%d,READV,%d,%s,%d", timestamp, tid, args->fd, args->filename, args->iovcnt);
+		traceWrite(tid, "%lu,%d,READV,%d,%s,%d", ts, tid, args->fd, args->filename, args->iovcnt);
 		for (int i = 0; i < args->iovcnt; i++) {
-			fprintf(out, ",%lu,", args->iov[i].iov_len);
+			traceWrite(tid, ",%lu,", args->iov[i].iov_len);
 		}
-		fprintf(out, ";");
+		traceWrite(tid, ";");
 	}
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
 	#if DEBUG
-	printf("%lu,%d,READV,%d,%s,%d \n", timestamp, tid, args->fd, args->filename, args->iovcnt);
+	printf("%lu,%d,READV,%d,%s,%d \n", ts, tid, args->fd, args->filename, args->iovcnt);
 	#endif
-	fflush(out);
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 
 }
@@ -1492,44 +1755,39 @@ VOID AfterPread(THREADID tid, PreadArgs *args, ssize_t ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
+	unsigned long ts = timestamp++;
 	std::string encoded_result;
 	if (record_value) {
 		encoded_result = base64_encode((char *)args->buf, args->count);
 		// encoded_result = std::string(static_cast<char*>(args->buf), args->count);
 		if (encoded_result[encoded_result.size()-1] == '\n') {
-			fprintf(out, "%lu,%d,PREAD,%d,%s,%ld,%lu,%s;", timestamp, tid, args->fd, args->filename, args->offset, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
+			traceWrite(tid, "%lu,%d,PREAD,%d,%s,%ld,%lu,%s;", ts, tid, args->fd, args->filename, args->offset, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
 		}
 		else {
-			fprintf(out, "%lu,%d,PREAD,%d,%s,%ld,%lu,%s;", timestamp, tid, args->fd, args->filename, args->offset, args->count, encoded_result.c_str());
+			traceWrite(tid, "%lu,%d,PREAD,%d,%s,%ld,%lu,%s;", ts, tid, args->fd, args->filename, args->offset, args->count, encoded_result.c_str());
 		}
 	}
 	else {
-		fprintf(out, "%lu,%d,PREAD,%d,%s,%ld,%lu;", timestamp, tid, args->fd, args->filename, args->offset, args->count);
+		traceWrite(tid, "%lu,%d,PREAD,%d,%s,%ld,%lu;", ts, tid, args->fd, args->filename, args->offset, args->count);
 	}
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
 	if (record_value) {
 		if (encoded_result[encoded_result.size()-1] == '\n') {
-			printf("%lu,%d,PREAD,%d,%s,%ld,%lu,%s;", timestamp, tid, args->fd, args->filename, args->offset, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
+			printf("%lu,%d,PREAD,%d,%s,%ld,%lu,%s;", ts, tid, args->fd, args->filename, args->offset, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
 		}
 		else {
-			printf("%lu,%d,PREAD,%d,%s,%ld,%lu,%s;", timestamp, tid, args->fd, args->filename, args->offset, args->count, encoded_result.c_str());
+			printf("%lu,%d,PREAD,%d,%s,%ld,%lu,%s;", ts, tid, args->fd, args->filename, args->offset, args->count, encoded_result.c_str());
 		}
 	}
 	else {
-		printf("%lu,%d,PREAD,%d,%s,%ld,%lu,;", timestamp, tid, args->fd, args->filename, args->offset, args->count);
+		printf("%lu,%d,PREAD,%d,%s,%ld,%lu,;", ts, tid, args->fd, args->filename, args->offset, args->count);
 	}
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1572,42 +1830,37 @@ VOID AfterPreadv(THREADID tid, PreadvArgs *args, ssize_t ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
+	unsigned long ts = timestamp++;
 	if (record_value) {
-		fprintf(out, "%lu,%d,PREADV,%d,%s,%d", timestamp, tid, args->fd, args->filename, args->iovcnt);
+		traceWrite(tid, "%lu,%d,PREADV,%d,%s,%d", ts, tid, args->fd, args->filename, args->iovcnt);
 		for (int i = 0; i < args->iovcnt; i++) {
 			std::string encoded_result = base64_encode((char *)args->iov[i].iov_base, args->iov[i].iov_len);
 			if (encoded_result[encoded_result.size()-1] == '\n') {
-				fprintf(out, ",%lu,%s", args->iov[i].iov_len, encoded_result.substr(0, encoded_result.size()-1).c_str());
+				traceWrite(tid, ",%lu,%s", args->iov[i].iov_len, encoded_result.substr(0, encoded_result.size()-1).c_str());
 			}
 			else {
-				fprintf(out, ",%lu,%s", args->iov[i].iov_len, encoded_result.c_str());
+				traceWrite(tid, ",%lu,%s", args->iov[i].iov_len, encoded_result.c_str());
 			}
-			fprintf(out, ",%ld", args->offset);
+			traceWrite(tid, ",%ld", args->offset);
 		}
-		fprintf(out, ";");
+		traceWrite(tid, ";");
 	}
 	else {
-		fprintf(out, "%lu,%d,PREADV,%d,%s,%d", timestamp, tid, args->fd, args->filename, args->iovcnt);
+		traceWrite(tid, "%lu,%d,PREADV,%d,%s,%d", ts, tid, args->fd, args->filename, args->iovcnt);
 		for (int i = 0; i < args->iovcnt; i++) {
-			fprintf(out, ",%lu,", args->iov[i].iov_len);
+			traceWrite(tid, ",%lu,", args->iov[i].iov_len);
 		}
-		fprintf(out, ",%ld", args->offset);
-		fprintf(out, ";");
+		traceWrite(tid, ",%ld", args->offset);
+		traceWrite(tid, ";");
 	}
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
 	#if DEBUG
-	printf("%lu,%d,PREADV,%d,%s,%d,%ld \n", timestamp, tid, args->fd, args->filename, args->iovcnt, args->offset);
+	printf("%lu,%d,PREADV,%d,%s,%d,%ld \n", ts, tid, args->fd, args->filename, args->iovcnt, args->offset);
 	#endif
-	fflush(out);
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1651,58 +1904,53 @@ VOID AfterWrite(THREADID tid, WriteArgs *args, ssize_t ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
+	unsigned long ts = timestamp++;
 	std::string encoded_result;
 	if (record_value) {
 		encoded_result = base64_encode((char *)args->buf, args->count);
 		if (encoded_result[encoded_result.size()-1] == '\n') {
-			fprintf(out, "%lu,%d,WRITE,%d,%s,%lu,%s;", timestamp, tid, args->fd, args->filename, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
+			traceWrite(tid, "%lu,%d,WRITE,%d,%s,%lu,%s;", ts, tid, args->fd, args->filename, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
 		}
 		else {
-			fprintf(out, "%lu,%d,WRITE,%d,%s,%lu,%s;", timestamp, tid, args->fd, args->filename, args->count, encoded_result.c_str());
+			traceWrite(tid, "%lu,%d,WRITE,%d,%s,%lu,%s;", ts, tid, args->fd, args->filename, args->count, encoded_result.c_str());
 		}
 	}
 	else {
-		fprintf(out, "%lu,%d,WRITE,%d,%s,%lu,;", timestamp, tid, args->fd, args->filename, args->count);
+		traceWrite(tid, "%lu,%d,WRITE,%d,%s,%lu,;", ts, tid, args->fd, args->filename, args->count);
 	
 	}
-	// fprintf(out, "%lu,%d,WRITE,%s,%lu,%s;\n", timestamp, tid, args->filename, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
-	// fprintf(out, "encoded_result: %s|||\n", encoded_result.c_str());
+	// traceWrite(tid, "%lu,%d,WRITE,%s,%lu,%s;\n", ts, tid, args->filename, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
+	// traceWrite(tid, "encoded_result: %s|||\n", encoded_result.c_str());
 	// // hexdump of args->buf
-	// fprintf(out, "hexdump of args->buf before encode \n");
+	// traceWrite(tid, "hexdump of args->buf before encode \n");
 	// for (size_t i = 0; i < args->count; i++) {
-	// 	fprintf(out, "%02x", ((char *)args->buf)[i]);
+	// 	traceWrite(tid, "%02x", ((char *)args->buf)[i]);
 	// }
 	// char * decode_result = base64_decode((encoded_result.substr(0, encoded_result.size()-1)+"\n").c_str(), encoded_result.size());
-	// fprintf(out, "\nhexdump of args->buf after decode \n");
+	// traceWrite(tid, "\nhexdump of args->buf after decode \n");
 	// for (size_t i = 0; i < args->count; i++) {
-	// 	fprintf(out, "%02x", decode_result[i]);
+	// 	traceWrite(tid, "%02x", decode_result[i]);
 	// }
-	// fprintf(out, "\n");
+	// traceWrite(tid, "\n");
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
 	if (record_value) {
 		if (encoded_result[encoded_result.size()-1] == '\n') {
-			printf("%lu,%d,WRITE,%d,%s,%lu,%s;", timestamp, tid, args->fd, args->filename, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
+			printf("%lu,%d,WRITE,%d,%s,%lu,%s;", ts, tid, args->fd, args->filename, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
 		}
 		else {
-			printf("%lu,%d,WRITE,%d,%s,%lu,%s;", timestamp, tid, args->fd, args->filename, args->count, encoded_result.c_str());
+			printf("%lu,%d,WRITE,%d,%s,%lu,%s;", ts, tid, args->fd, args->filename, args->count, encoded_result.c_str());
 		}
 	}
 	else {
-		printf("%lu,%d,WRITE,%d,%s,%lu,;", timestamp, tid, args->fd, args->filename, args->count);
+		printf("%lu,%d,WRITE,%d,%s,%lu,;", ts, tid, args->fd, args->filename, args->count);
 	
 	}
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1746,40 +1994,35 @@ VOID AfterWritev(THREADID tid, WritevArgs *args, ssize_t ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
+	unsigned long ts = timestamp++;
 	if (record_value) {
-		fprintf(out, "%lu,%d,WRITEV,%d,%s,%d", timestamp, tid, args->fd, args->filename, args->iovcnt);
+		traceWrite(tid, "%lu,%d,WRITEV,%d,%s,%d", ts, tid, args->fd, args->filename, args->iovcnt);
 		for (int i = 0; i < args->iovcnt; i++) {
 			std::string encoded_result = base64_encode((char *)args->iov[i].iov_base, args->iov[i].iov_len);
 			if (encoded_result[encoded_result.size()-1] == '\n') {
-				fprintf(out, ",%lu,%s", args->iov[i].iov_len, encoded_result.substr(0, encoded_result.size()-1).c_str());
+				traceWrite(tid, ",%lu,%s", args->iov[i].iov_len, encoded_result.substr(0, encoded_result.size()-1).c_str());
 			}
 			else {
-				fprintf(out, ",%lu,%s", args->iov[i].iov_len, encoded_result.c_str());
+				traceWrite(tid, ",%lu,%s", args->iov[i].iov_len, encoded_result.c_str());
 			}
 		}
-		fprintf(out, ";");
+		traceWrite(tid, ";");
 	}
 	else {
-		fprintf(out, "%lu,%d,WRITEV,%d,%s,%d", timestamp, tid, args->fd, args->filename, args->iovcnt);
+		traceWrite(tid, "%lu,%d,WRITEV,%d,%s,%d", ts, tid, args->fd, args->filename, args->iovcnt);
 		for (int i = 0; i < args->iovcnt; i++) {
-			fprintf(out, ",%lu,", args->iov[i].iov_len);
+			traceWrite(tid, ",%lu,", args->iov[i].iov_len);
 		}
-		fprintf(out, ";");
+		traceWrite(tid, ";");
 	}
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
 	#if DEBUG
-	printf("%lu,%d,WRITEV,%d,%s,%d \n", timestamp, tid, args->fd, args->filename, args->iovcnt);
+	printf("%lu,%d,WRITEV,%d,%s,%d \n", ts, tid, args->fd, args->filename, args->iovcnt);
 	#endif
-	fflush(out);
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1822,21 +2065,16 @@ VOID AfterLseek(THREADID tid, LseekArgs *args, off_t ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,LSEEK,%d,%s,%ld,%d;", timestamp, tid, args->fd, args->filename, args->offset, args->whence);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,LSEEK,%d,%s,%ld,%d;", ts, tid, args->fd, args->filename, args->offset, args->whence);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,LSEEK,%d,%s,%ld,%d;", timestamp, tid, args->fd, args->filename, args->offset, args->whence);
+	printf("%lu,%d,LSEEK,%d,%s,%ld,%d;", ts, tid, args->fd, args->filename, args->offset, args->whence);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1891,21 +2129,16 @@ VOID AfterRename(THREADID tid, RenameArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,RENAME,%s,%s;", timestamp, tid, args->oldpath, args->newpath);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,RENAME,%s,%s;", ts, tid, args->oldpath, args->newpath);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,RENAME,%s,%s;", timestamp, tid, args->oldpath, args->newpath);
+	printf("%lu,%d,RENAME,%s,%s;", ts, tid, args->oldpath, args->newpath);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1946,21 +2179,16 @@ VOID AfterUnlink(THREADID tid, UnlinkArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,UNLINK,%s;", timestamp, tid, args->filename);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,UNLINK,%s;", ts, tid, args->filename);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,UNLINK,%s;", timestamp, tid, args->filename);
+	printf("%lu,%d,UNLINK,%s;", ts, tid, args->filename);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2001,21 +2229,16 @@ VOID AfterFsync(THREADID tid, FsyncArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,FSYNC,%d,%s;", timestamp, tid, args->fd, args->filename);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,FSYNC,%d,%s;", ts, tid, args->fd, args->filename);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,FSYNC,%d,%s;", timestamp, tid, args->fd, args->filename);
+	printf("%lu,%d,FSYNC,%d,%s;", ts, tid, args->fd, args->filename);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2056,21 +2279,16 @@ VOID AfterFdatasync(THREADID tid, FdatasyncArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,FDATASYNC,%d,%s;", timestamp, tid, args->fd, args->filename);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,FDATASYNC,%d,%s;", ts, tid, args->fd, args->filename);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,FDATASYNC,%d,%s;", timestamp, tid, args->fd, args->filename);
+	printf("%lu,%d,FDATASYNC,%d,%s;", ts, tid, args->fd, args->filename);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2114,21 +2332,16 @@ VOID AfterFallocate(THREADID tid, FallocateArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,FALLOCATE,%d,%s,%d,%ld,%ld;", timestamp, tid, args->fd, args->filename, args->mode, args->offset, args->len);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,FALLOCATE,%d,%s,%d,%ld,%ld;", ts, tid, args->fd, args->filename, args->mode, args->offset, args->len);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,FALLOCATE,%d,%s,%d,%ld,%ld;", timestamp, tid, args->fd, args->filename, args->mode, args->offset, args->len);
+	printf("%lu,%d,FALLOCATE,%d,%s,%d,%ld,%ld;", ts, tid, args->fd, args->filename, args->mode, args->offset, args->len);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2185,38 +2398,35 @@ VOID AfterOpen(THREADID tid, OpenArgs *args, int ret, CONTEXT *ctxt) {
 	if (S_ISDIR(st.st_mode)) {
 		is_directory = true;
 	}
-	PIN_GetLock(&pinLock, tid+1);
+	unsigned long ts = timestamp++;
 
 	if (is_directory) {
 		// if open with O_APPEND, get file size
 		if (args->flags & O_APPEND) {
 			struct stat st;
 			if (fstat(ret, &st) == -1) {
+				PIN_GetLock(&pinLock, tid+1);
 				fprintf(out, "[%d] fstat() failed (ERROR)\n", tid);
 				fflush(out);
+				PIN_ReleaseLock(&pinLock);
 				free(args);
 				exit(EXIT_FAILURE);
 			}
-			fprintf(out, "%lu,%d,OPEN,%s,%d,%d,%d,%ld;", timestamp, tid, args->filename, args->flags, args->mode, ret, st.st_size);
+			traceWrite(tid, "%lu,%d,OPEN,%s,%d,%d,%d,%ld;", ts, tid, args->filename, args->flags, args->mode, ret, st.st_size);
 		}
 		else {
-			fprintf(out, "%lu,%d,OPEN,%s,%d,%d,%d,%ld;", timestamp, tid, args->filename, args->flags, args->mode, ret, (long int)-1);
+			traceWrite(tid, "%lu,%d,OPEN,%s,%d,%d,%d,%ld;", ts, tid, args->filename, args->flags, args->mode, ret, (long int)-1);
 		}
-		// fprintf(out, "%lu,%d,OPEN,%s,%d,%d,%d;", timestamp, tid, args->filename, args->flags, args->mode, ret);
+		// traceWrite(tid, "%lu,%d,OPEN,%s,%d,%d,%d;", ts, tid, args->filename, args->flags, args->mode, ret);
 		#if PRINT_BACKTRACE
-		printBacktrace(ctxt);
+		printBacktrace(ctxt, tid);
 		#else
-		fprintf(out, "\n");
+		traceWrite(tid, "\n");
 		#endif
-		fflush(out);
 	}
 	#if DEBUG
-	printf("%lu,%d,OPEN,%s,%d,%d;", timestamp, tid, args->filename, args->flags, args->mode);
+	printf("%lu,%d,OPEN,%s,%d,%d;", ts, tid, args->filename, args->flags, args->mode);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2254,21 +2464,16 @@ VOID AfterCreat(THREADID tid, CreatArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,CREAT,%s,%d,%d;", timestamp, tid, args->filename, args->mode, ret);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,CREAT,%s,%d,%d;", ts, tid, args->filename, args->mode, ret);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,CREAT,%s,%d,%d;", timestamp, tid, args->filename, args->mode, ret);
+	printf("%lu,%d,CREAT,%s,%d,%d;", ts, tid, args->filename, args->mode, ret);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2366,37 +2571,34 @@ VOID AfterOpenat(THREADID tid, OpenatArgs *args, int ret, CONTEXT *ctxt) {
 		is_directory = true;
 	}
 
-	PIN_GetLock(&pinLock, tid+1);
+	unsigned long ts = timestamp++;
 
 	if (is_directory) {
 		// if open with O_APPEND, get file size
 		if (args->flags & O_APPEND) {
 			struct stat st;
 			if (fstat(ret, &st) == -1) {
+				PIN_GetLock(&pinLock, tid+1);
 				fprintf(out, "[%d] fstat() failed (ERROR)\n", tid);
 				fflush(out);
+				PIN_ReleaseLock(&pinLock);
 				free(args);
 				exit(EXIT_FAILURE);
 			}
-			fprintf(out, "%lu,%d,OPEN,%s,%d,%d,%d,%ld;", timestamp, tid, args->filename, args->flags, args->mode, ret, st.st_size);
+			traceWrite(tid, "%lu,%d,OPEN,%s,%d,%d,%d,%ld;", ts, tid, args->filename, args->flags, args->mode, ret, st.st_size);
 		}
 		else {
-			fprintf(out, "%lu,%d,OPEN,%s,%d,%d,%d,%ld;", timestamp, tid, args->filename, args->flags, args->mode, ret, (long int)-1);
+			traceWrite(tid, "%lu,%d,OPEN,%s,%d,%d,%d,%ld;", ts, tid, args->filename, args->flags, args->mode, ret, (long int)-1);
 		}
 		#if PRINT_BACKTRACE
-		printBacktrace(ctxt);
+		printBacktrace(ctxt, tid);
 		#else
-		fprintf(out, "\n");
+		traceWrite(tid, "\n");
 		#endif
-		fflush(out);
 	}
 	#if DEBUG
-	printf("%lu,%d,OPEN,%s,%d,%d,%d;", timestamp, tid, args->filename, args->flags, args->mode, ret);
+	printf("%lu,%d,OPEN,%s,%d,%d,%d;", ts, tid, args->filename, args->flags, args->mode, ret);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2439,21 +2641,16 @@ VOID AfterClose(THREADID tid, CloseArgs *args, int ret, CONTEXT *ctxt) {
 		return;
 	}
 
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,CLOSE,%d,%s;", timestamp, tid, args->fd, args->filename);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,CLOSE,%d,%s;", ts, tid, args->fd, args->filename);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,CLOSE,%d,%s;", timestamp, tid, args->fd, args->filename);
+	printf("%lu,%d,CLOSE,%d,%s;", ts, tid, args->fd, args->filename);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2491,21 +2688,16 @@ VOID AfterMkdir(THREADID tid, MkdirArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,MKDIR,%s,%d;", timestamp, tid, args->filename, args->mode);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,MKDIR,%s,%d;", ts, tid, args->filename, args->mode);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,MKDIR,%s,%d;", timestamp, tid, args->filename, args->mode);
+	printf("%lu,%d,MKDIR,%s,%d;", ts, tid, args->filename, args->mode);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2545,21 +2737,16 @@ VOID AfterMkdirat(THREADID tid, MkdiratArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,MKDIRAT,%d,%s,%d;", timestamp, tid, args->dirfd, args->filename, args->mode);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,MKDIRAT,%d,%s,%d;", ts, tid, args->dirfd, args->filename, args->mode);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,MKDIRAT,%d,%s,%d;", timestamp, tid, args->dirfd, args->filename, args->mode);
+	printf("%lu,%d,MKDIRAT,%d,%s,%d;", ts, tid, args->dirfd, args->filename, args->mode);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2596,21 +2783,16 @@ VOID AfterRmdir(THREADID tid, RmdirArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,RMDIR,%s;", timestamp, tid, args->filename);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,RMDIR,%s;", ts, tid, args->filename);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,RMDIR,%s;", timestamp, tid, args->filename);
+	printf("%lu,%d,RMDIR,%s;", ts, tid, args->filename);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2635,21 +2817,16 @@ VOID AfterSync(THREADID tid, SyncArgs *args, CONTEXT *ctxt) {
 	if (threadArray[tid].sType == S_SKIP) {
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,SYNC;", timestamp, tid);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,SYNC;", ts, tid);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,SYNC;", timestamp, tid);
+	printf("%lu,%d,SYNC;", ts, tid);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2691,21 +2868,16 @@ VOID AfterSyncfs(THREADID tid, SyncfsArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,SYNCFS,%d,%s;", timestamp, tid, args->fd, args->filename);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,SYNCFS,%d,%s;", ts, tid, args->fd, args->filename);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,SYNCFS,%d,%s;", timestamp, tid, args->fd, args->filename);
+	printf("%lu,%d,SYNCFS,%d,%s;", ts, tid, args->fd, args->filename);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2750,21 +2922,16 @@ VOID AfterSyncFileRange(THREADID tid, SyncFileRangeArgs *args, int ret, CONTEXT
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,SYNC_FILE_RANGE,%d,%s,%ld,%ld,%d;", timestamp, tid, args->fd, args->filename, args->offset, args->nbytes, args->flags);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,SYNC_FILE_RANGE,%d,%s,%ld,%ld,%d;", ts, tid, args->fd, args->filename, args->offset, args->nbytes, args->flags);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,SYNC_FILE_RANGE,%d,%s,%ld,%ld,%d;", timestamp, tid, args->fd, args->filename, args->offset, args->nbytes, args->flags);
+	printf("%lu,%d,SYNC_FILE_RANGE,%d,%s,%ld,%ld,%d;", ts, tid, args->fd, args->filename, args->offset, args->nbytes, args->flags);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -3478,31 +3645,28 @@ VOID PrintMemWrite(CONTEXT * ctx, THREADID tid) {
 	if (filename == NULL || (target_filename != "" && strstr(filename, target_filename.c_str()) == NULL))
 		return;
 
-	PIN_GetLock(&pinLock, tid+1);
+	PIN_GetLock(&storeLock, tid+1);
+	unsigned long ts = timestamp++;
+	unsigned long sid = store_id++;
+	PIN_ReleaseLock(&storeLock);
 	// unsigned long ip_addr = (unsigned long)PIN_GetContextReg(ctx, REG_INST_PTR);
 	uint32_t size = threadArray[tid].mem_size;
 	// std::string result((char *)mem_addr, size);
 	if (record_value) {
 		std::string encoded_result = base64_encode((char *)mem_addr, size);
 		// TODO: do we need page offset here?
-		fprintf(out, "%lu,%d,STORE,%lu,%s,0x%lx,%u,%s;", timestamp, tid, store_id, filename, mem_addr, size, encoded_result.substr(0, encoded_result.size()-1).c_str());
+		traceWrite(tid, "%lu,%d,STORE,%lu,%s,0x%lx,%u,%s;", ts, tid, sid, filename, mem_addr, size, encoded_result.substr(0, encoded_result.size()-1).c_str());
 	}
 	else {
-		fprintf(out, "%lu,%d,STORE,%lu,%s,0x%lx,%u,;", timestamp, tid, store_id, filename, mem_addr, size);
+		traceWrite(tid, "%lu,%d,STORE,%lu,%s,0x%lx,%u,;", ts, tid, sid, filename, mem_addr, size);
 	}
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	store_id++;
 
 	// // if filename contains testdb then print backtrace
 	// if (strstr(filename, "testdb") != NULL) {
-	// 	printBacktrace(ctx);
+	// 	printBacktrace(ctx, tid);
 	// }
 
-	printBacktrace(ctx);
-	fflush(out);
-	PIN_ReleaseLock(&pinLock);
+	printBacktrace(ctx, tid);
 	threadArray[tid].mem_addr = NULL;
 }
 
@@ -3522,33 +3686,23 @@ VOID * IfuncMemcpyWrapper(CONTEXT * context, AFUNPTR orgFuncptr, THREADID tid)
 }
 
 VOID BeforePathfinderOpBegin(THREADID tid, ADDRINT workload_tid, ADDRINT op_count) {
-	PIN_GetLock(&pinLock, tid+1);
+	unsigned long ts = timestamp++;
 	PIN_RWMutexWriteLock(&RWMutex);
 	// if (op_count.find(tid) == op_count.end()) {
 	// 	op_count[tid] = 0;
 	// }
 	PIN_RWMutexUnlock(&RWMutex);
-	fprintf(out, "%lu,%d,PATHFINDER_OP_BEGIN,%d,%d\n", timestamp, tid, (int)workload_tid, (int)op_count);
-	fflush(out);
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
+	traceWrite(tid, "%lu,%d,PATHFINDER_OP_BEGIN,%d,%d\n", ts, tid, (int)workload_tid, (int)op_count);
 
 }
 
 VOID BeforePathfinderOpEnd(THREADID tid, ADDRINT workload_tid, ADDRINT op_count) {
-	PIN_GetLock(&pinLock, tid+1);
+	unsigned long ts = timestamp++;
 	// PIN_RWMutexWriteLock(&RWMutex);
 	// assert(op_count.find(tid) != op_count.end());
 	// PIN_RWMutexUnlock(&RWMutex);
-	fprintf(out, "%lu,%d,PATHFINDER_OP_END,%d,%d\n", timestamp, tid, (int)workload_tid, (int)op_count);
-	fflush(out);
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
+	traceWrite(tid, "%lu,%d,PATHFINDER_OP_END,%d,%d\n", ts, tid, (int)workload_tid, (int)op_count);
 	// op_count[tid]++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 }
 
 
@@ -3824,8 +3978,17 @@ VOID Instruction(INS ins, VOID *v)
 	}
 }
 
+// Addresses in an unloaded image can not be symbolized any more. Pin holds
+// the client lock here.
+VOID ImageUnload(IMG img, VOID *v) {
+	PIN_GetLock(&symLock, PIN_ThreadId()+1);
+	symbolizePendingFrames(IMG_LowAddress(img), IMG_HighAddress(img));
+	PIN_ReleaseLock(&symLock);
+}
+
 // This routine is executed once at the end.
 VOID Fini(INT32 code, VOID *v) {
+	traceMerge();
 	fclose(out);
 	PIN_RWMutexFini(&RWMutex);
 }
@@ -3847,7 +4010,11 @@ INT32 Usage() {
 int main(INT32 argc, CHAR **argv) {
 	// Initialize the pin lock
 	PIN_InitLock(&pinLock);
+	PIN_InitLock(&storeLock);
+	PIN_InitLock(&symLock);
 	PIN_RWMutexInit(&RWMutex);
+	for (int i = 0; i < MAX_THREADS; i++)
+		threadArray[i].traceFd = -1;
 
 	// Initialize pin
 	if (PIN_Init(argc, argv))
@@ -3864,11 +4031,14 @@ int main(INT32 argc, CHAR **argv) {
 	PIN_AddThreadStartFunction(ThreadStart, 0);
 	PIN_AddThreadFiniFunction(ThreadFini, 0);
 
+	PIN_AddForkFunction(FPOINT_AFTER_IN_CHILD, ForkChild, 0);
+
 	PIN_AddSyscallEntryFunction(SyscallEntry, 0);
 	PIN_AddSyscallExitFunction(SyscallExit, 0);
 
 	// Register Image to be called to instrument functions.
 	IMG_AddInstrumentFunction(Image, 0);
+	IMG_AddUnloadFunction(ImageUnload, 0);
 	
 	INS_AddInstrumentFunction(Instruction, 0);
 
@@ -45,6 +45,13 @@ END_LEGAL */
 #include <cxxabi.h>
 #include <cstdlib>
 #include <unordered_map>
+#include <atomic>
+#include <climits>
+#include <fstream>
+#include <queue>
+#include <unordered_set>
+#include <stdarg.h>
+#include <time.h>
 
 // #include <ucontext.h>
 // #include <libunwind.h>
@@ -67,6 +74,8 @@ extern "C" {
 
 #define FILENAME_SIZE 512
 #define BACKTRACE_SIZE 100
+#define MAX_THREADS 1024
+#define TRACE_BUFFER_SIZE (4UL << 20)
 
 #define MALLOC "malloc"
 #define FREE "free"
@@ -87,6 +96,9 @@ KNOB< std::string > of_knob(KNOB_MODE_WRITEONCE, "pintool",
 KNOB< bool > rv_knob(KNOB_MODE_WRITEONCE, "pintool",
 		"record-value", "1", "record write values for each write syscall");
 
+KNOB< bool > stream_knob(KNOB_MODE_WRITEONCE, "pintool",
+		"stream", "0", "write each record to the output as soon as it is complete, e.g. into a pipe. Records come out roughly in timestamp order");
+
 //==============================================================
 //  Analysis Routines
 //==============================================================
@@ -101,10 +113,30 @@ PIN_RWMUTEX RWMutex;
 std::string target_filename;
 std::string at_fdcwd = "";
 bool record_value = false;
+bool stream_output = false;
 
-// global counters
-unsigned long timestamp = 0;
+// global counters. Every trace record takes the next timestamp; storeLock
+// keeps store ids in timestamp order.
+std::atomic<unsigned long> timestamp(0);
 unsigned long store_id = 0;
+PIN_LOCK storeLock;
+// with -stream, records not written out yet (guarded by symLock)
+std::string streamOut;
+
+// Backtraces are recorded as raw return addresses and symbolized once per
+// address, when an image is unloaded or the trace is written out.
+// return address -> "function,file,line,offset;", empty for filtered frames
+std::unordered_map<ADDRINT, std::string> symbolizedFrames;
+// recorded addresses not symbolized yet
+std::vector<ADDRINT> pendingFrames;
+// Symbolizing needs the client lock, and Pin holds it around ImageUnload, so
+// it is always taken before symLock.
+PIN_LOCK symLock;
+// symbolized frames are also appended to a file of their own, as
+// "<address>\t<frame>" lines, so pathfinder can still symbolize the records
+// of a tool that never got to Fini. The time of the last traceSyncFrames().
+int symFd = -1;
+std::atomic<time_t> symTime(0);
 
 // for recording op count if pathfinder markers are used
 // thread id -> op count
@@ -162,24 +194,56 @@ typedef struct threadNode {
 	struct threadNode *next;
 	void *mem_addr;
 	uint32_t mem_size;
+	// trace records of this thread go to a file of their own, through a
+	// shared mapping of part of it. traceBuf is where the mapping has room
+	// left, at file offset traceOff, and traceLen how much of it is used.
+	char *traceMap;
+	size_t traceMapLen;
+	char *traceBuf;
+	size_t traceCap;
+	size_t traceLen;
+	off_t traceOff;
+	int traceFd;
+	// return addresses this thread already added to pendingFrames
+	std::unordered_set<ADDRINT> *seenFrames;
+	// with -stream, the record this thread is writing
+	std::string *streamRecord;
+	// memMapEpoch this thread saw when it started a lookup, 0 when not in one
+	std::atomic<unsigned long> memMapEpoch;
 } ThreadNode;
 
 //ThreadNode *threadNodeHead = NULL;
 //ThreadNode *threadNodeTail = NULL;
-ThreadNode threadArray[100];
+ThreadNode threadArray[MAX_THREADS];
 
 // mmio library call arguments and data structures
 typedef struct memNode {
-	char filename[FILENAME_SIZE];
+	// interned, valid for the rest of the run
+	char *filename;
 	unsigned long start;
 	unsigned long end;
 	unsigned long length;
 	unsigned long nrpages;
-	struct memNode *next;
+	// largest end of this and all earlier nodes, to find overlapping regions
+	unsigned long maxEnd;
+	// insertion order, the oldest region wins where regions overlap
+	unsigned long seq;
 } MemNode;
 
-MemNode *memNodeHead = NULL;
-MemNode *memNodeTail = NULL;
+// Mapped regions sorted by start. A map is never modified once published:
+// mmap/munmap build a new one under RWMutex and swap it in, so lookups on
+// every store take no lock. Replaced maps are freed once no thread can still
+// be reading them.
+typedef struct memMap {
+	size_t count;
+	MemNode *nodes;
+} MemMap;
+
+std::atomic<MemMap *> memMap(NULL);
+std::atomic<unsigned long> memMapEpoch(1);
+unsigned long memNodeSeq = 0;
+std::vector<std::pair<unsigned long, MemMap *>> retiredMemMaps;
+std::unordered_map<std::string, char *> memNodeFilenames;
 
 typedef struct mmapArgs {
 	char filename[FILENAME_SIZE];
@@ -531,65 +595,367 @@ void printBacktraceUnwind(const CONTEXT * 	ctxt) {
     // }
 }
 
-int printBacktrace(const CONTEXT * 	ctxt) {
+// Trace records are written per thread to a file per thread, so threads do
+// not serialize on the output file. The files are written through shared
+// mappings, so what is written is in the page cache right away and a tool
+// that is killed before Fini still leaves its records behind, for pathfinder
+// to merge. Fini merges the files into the output in timestamp order.
+std::string traceFilename(THREADID tid) {
+	return of_knob.Value() + "." + std::to_string(PIN_GetPid()) + "." + std::to_string(tid);
+}
+
+std::string symFilename() {
+	return of_knob.Value() + "." + std::to_string(PIN_GetPid()) + ".sym";
+}
+
+void traceSyncFrames(THREADID tid);
+
+// Map the next window of this thread's file, starting where its records end
+// and with room for at least need bytes.
+void traceMapWindow(THREADID tid, size_t need) {
+	ThreadNode *t = &threadArray[tid];
+	off_t pos = t->traceOff + t->traceLen;
+	off_t base = pos & ~(off_t)((1UL << PAGE_SHIFT) - 1);
+	size_t len = TRACE_BUFFER_SIZE;
+
+	if (t->traceFd < 0) {
+		t->traceFd = open(traceFilename(tid).c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (t->traceFd < 0) {
+			PIN_GetLock(&pinLock, tid+1);
+			fprintf(out, "[%d] %s: open() failed. (ERROR)\n", tid, __func__);
+			fflush(out);
+			PIN_ReleaseLock(&pinLock);
+			exit(EXIT_FAILURE);
+		}
+	}
+	if (t->traceMap != NULL) {
+		munmap(t->traceMap, t->traceMapLen);
+		// a good point to let the sym file catch up with the records
+		traceSyncFrames(tid);
+	}
+	while (len < (size_t)(pos - base) + need)
+		len *= 2;
+	if (ftruncate(t->traceFd, base + len) < 0) {
+		PIN_GetLock(&pinLock, tid+1);
+		fprintf(out, "[%d] %s: ftruncate() failed. (ERROR)\n", tid, __func__);
+		fflush(out);
+		PIN_ReleaseLock(&pinLock);
+		exit(EXIT_FAILURE);
+	}
+	t->traceMap = (char *)mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, t->traceFd, base);
+	if (t->traceMap == MAP_FAILED) {
+		PIN_GetLock(&pinLock, tid+1);
+		fprintf(out, "[%d] %s: mmap() failed. (ERROR)\n", tid, __func__);
+		fflush(out);
+		PIN_ReleaseLock(&pinLock);
+		exit(EXIT_FAILURE);
+	}
+	t->traceMapLen = len;
+	t->traceOff = pos;
+	t->traceBuf = t->traceMap + (pos - base);
+	t->traceCap = len - (pos - base);
+	t->traceLen = 0;
+}
+
+// Unmap this thread's file and cut it back to the records in it.
+void traceFlush(THREADID tid) {
+	ThreadNode *t = &threadArray[tid];
+
+	if (t->traceMap == NULL)
+		return;
+	munmap(t->traceMap, t->traceMapLen);
+	if (ftruncate(t->traceFd, t->traceOff + t->traceLen) < 0) {
+		PIN_GetLock(&pinLock, tid+1);
+		fprintf(out, "[%d] %s: ftruncate() failed. (ERROR)\n", tid, __func__);
+		fflush(out);
+		PIN_ReleaseLock(&pinLock);
+		exit(EXIT_FAILURE);
+	}
+	t->traceOff += t->traceLen;
+	t->traceMap = NULL;
+	t->traceBuf = NULL;
+	t->traceMapLen = 0;
+	t->traceCap = 0;
+	t->traceLen = 0;
+}
+
+void traceStreamWrite(THREADID tid, const char *fmt, va_list ap);
+
+void traceWrite(THREADID tid, const char *fmt, ...) {
+	ThreadNode *t = &threadArray[tid];
+	va_list ap;
+	int n;
+
+	if (stream_output) {
+		va_start(ap, fmt);
+		traceStreamWrite(tid, fmt, ap);
+		va_end(ap);
+		return;
+	}
+	if (t->traceMap == NULL)
+		traceMapWindow(tid, 0);
+	va_start(ap, fmt);
+	n = vsnprintf(t->traceBuf + t->traceLen, t->traceCap - t->traceLen, fmt, ap);
+	va_end(ap);
+	if (n < 0)
+		return;
+	if ((size_t)n >= t->traceCap - t->traceLen) {
+		// did not fit, move on to the next window and try again
+		traceMapWindow(tid, n + 1);
+		va_start(ap, fmt);
+		vsnprintf(t->traceBuf, t->traceCap, fmt, ap);
+		va_end(ap);
+	}
+	t->traceLen += n;
+}
+
+// Append a symbolized frame to the sym file. The file is only a fallback for
+// a tool that is killed, so failing to write it is not an error. Callers hold
+// symLock.
+void symWrite(ADDRINT addr, const std::string &frame) {
+	char head[32];
+	std::string line;
+
+	if (symFd < 0) {
+		symFd = open(symFilename().c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+		if (symFd < 0)
+			return;
+	}
+	snprintf(head, sizeof(head), "%lx\t", (unsigned long)addr);
+	line = head + frame + "\n";
+	if (write(symFd, line.data(), line.size()) < 0)
+		return;
+}
+
+// Callers hold the client lock and symLock.
+const std::string &symbolizeFrame(ADDRINT addr) {
 	// we are not interested in stack frames from standard libraries, so might as well filter out
-	std::vector<std::string> filters = {"/usr/include"};
-	void* buf[BACKTRACE_SIZE];
-	PIN_LockClient();
-	int nptrs = PIN_Backtrace(ctxt, buf, sizeof(buf)/sizeof(buf[0]));
-    char** bt = backtrace_symbols(buf, nptrs);
-	PIN_UnlockClient();
-	// for (int i = 0; i < nptrs && i <= 2; i++) {
-	// 	fprintf(out, "%s,", bt[i]);
-	// }
-	// fprintf(out, "\n");
-	// for now just print the first trace
-	// if (nptrs > 0) {
-	// fprintf(out, "%s\n", bt[0]);
-	// }
+	static const std::vector<std::string> filters = {"/usr/include"};
+	std::unordered_map<ADDRINT, std::string>::iterator it = symbolizedFrames.find(addr);
+	std::string frame;
+	void *buf[1] = {(void *)addr};
+	char **bt;
 
-	// use parseFunctionInfo to parse each line of bt
-	for (int i = 0; i < nptrs; i++) {
+	if (it != symbolizedFrames.end())
+		return it->second;
+
+	bt = backtrace_symbols(buf, 1);
+	if (bt != NULL) {
 		std::string str;
 		int status;
-		char* demangled_name = abi::__cxa_demangle(bt[i], NULL, NULL, &status);
+		char* demangled_name = abi::__cxa_demangle(bt[0], NULL, NULL, &status);
 		if (status == 0 && demangled_name != NULL) {
 			// Use demangled_name
 			str = demangled_name;
 		} else {
-			// Use original mangled name (bt[i])
-			str = bt[i];
+			// Use original mangled name (bt[0])
+			str = bt[0];
 		}
 		// Free the memory allocated by __cxa_demangle
 		free(demangled_name);
 		auto [func, file, line, offset] = parseFunctionInfo(str);
 		bool skip = false;
-		for (auto filter : filters) {
+		for (const std::string &filter : filters) {
 			if (file.find(filter) != std::string::npos) {
 				skip = true;
 				break;
 			}
 		}
 		if (!skip) {
-			fprintf(out, "%s,%s,%s,%s;", func.c_str(), file.c_str(), line.c_str(), offset.c_str());
+			frame = func + "," + file + "," + line + "," + offset + ";";
+		}
+		free(bt);
+	}
+	symWrite(addr, frame);
+	return symbolizedFrames[addr] = frame;
+}
+
+// Symbolize the pending addresses in [low, high], while their image is
+// still loaded. Callers hold the client lock and symLock.
+void symbolizePendingFrames(ADDRINT low, ADDRINT high) {
+	size_t i, j;
+
+	for (i = 0, j = 0; i < pendingFrames.size(); i++) {
+		if (pendingFrames[i] >= low && pendingFrames[i] <= high)
+			symbolizeFrame(pendingFrames[i]);
+		else
+			pendingFrames[j++] = pendingFrames[i];
+	}
+	pendingFrames.resize(j);
+}
+
+// Symbolize all pending addresses, so the sym file covers the records
+// written so far. Done whenever a thread moves on to the next window of its
+// file, and at most once a second when new addresses come up.
+void traceSyncFrames(THREADID tid) {
+	PIN_LockClient();
+	PIN_GetLock(&symLock, tid+1);
+	symTime.store(time(NULL));
+	symbolizePendingFrames(0, ~(ADDRINT)0);
+	PIN_ReleaseLock(&symLock);
+	PIN_UnlockClient();
+}
+
+// Append a record to dst, replacing its raw "@<address>;" frames. Callers
+// hold the client lock and symLock.
+void tracePutRecord(const std::string &line, std::string &dst) {
+	size_t pos = 0, end;
+
+	while (pos < line.size()) {
+		end = line.find(';', pos);
+		if (end == std::string::npos)
+			end = line.size();
+		if (line[pos] == '@') {
+			dst += symbolizeFrame(strtoul(line.c_str() + pos + 1, NULL, 16));
+		}
+		else {
+			dst.append(line, pos, end - pos);
+			if (end < line.size())
+				dst += ';';
 		}
+		pos = end + 1;
+	}
+	dst += '\n';
+}
+
+// Callers hold symLock.
+void traceStreamFlush() {
+	size_t done = 0;
+	ssize_t n;
+
+	while (done < streamOut.size()) {
+		n = write(fileno(out), streamOut.data() + done, streamOut.size() - done);
+		if (n < 0) {
+			// the reader went away, nothing else to do with the trace
+			break;
+		}
+		done += n;
+	}
+	streamOut.clear();
+}
+
+// With -stream, records are written to out as they are completed. Each thread
+// formats its record on its own, so records can come out of timestamp order
+// (by about as many records as there are threads); the reader puts them back
+// in order.
+void traceStreamWrite(THREADID tid, const char *fmt, va_list ap) {
+	ThreadNode *t = &threadArray[tid];
+	size_t len;
+	va_list aq;
+	int n;
+
+	if (t->streamRecord == NULL)
+		t->streamRecord = new std::string();
+	std::string &record = *t->streamRecord;
+
+	va_copy(aq, ap);
+	n = vsnprintf(NULL, 0, fmt, aq);
+	va_end(aq);
+	if (n <= 0)
+		return;
+	len = record.size();
+	record.resize(len + n + 1);
+	vsnprintf(&record[len], n + 1, fmt, ap);
+	record.resize(len + n);
+	if (record[record.size() - 1] != '\n')
+		return;
+
+	record.resize(record.size() - 1);
+	PIN_LockClient();
+	PIN_GetLock(&symLock, tid+1);
+	tracePutRecord(record, streamOut);
+	if (streamOut.size() >= (1 << 16))
+		traceStreamFlush();
+	PIN_ReleaseLock(&symLock);
+	PIN_UnlockClient();
+	record.clear();
+}
+
+// Write all buffered records to out, ordered by their leading timestamp.
+// Records of one thread are already in order, so this is a merge.
+void traceMerge() {
+	typedef std::pair<unsigned long, size_t> Head;
+	std::vector<std::ifstream *> files;
+	std::vector<std::string> lines;
+	std::priority_queue<Head, std::vector<Head>, std::greater<Head>> heads;
+	std::string record;
+	int tid;
+	size_t i;
+
+	PIN_LockClient();
+	PIN_GetLock(&symLock, PIN_ThreadId()+1);
+	symbolizePendingFrames(0, ~(ADDRINT)0);
+	for (tid = 0; tid < MAX_THREADS; tid++) {
+		if (threadArray[tid].traceFd < 0)
+			continue;
+		traceFlush(tid);
+		close(threadArray[tid].traceFd);
+		threadArray[tid].traceFd = -1;
+		threadArray[tid].traceOff = 0;
+		files.push_back(new std::ifstream(traceFilename(tid)));
+		lines.push_back(std::string());
+		unlink(traceFilename(tid).c_str());
+	}
+	for (i = 0; i < files.size(); i++) {
+		if (std::getline(*files[i], lines[i]))
+			heads.push(Head(strtoul(lines[i].c_str(), NULL, 10), i));
+	}
+	while (!heads.empty()) {
+		i = heads.top().second;
+		heads.pop();
+		record.clear();
+		tracePutRecord(lines[i], record);
+		fwrite(record.data(), 1, record.size(), out);
+		if (std::getline(*files[i], lines[i]))
+			heads.push(Head(strtoul(lines[i].c_str(), NULL, 10), i));
 	}
-	fprintf(out, "\n");
 	fflush(out);
+	if (symFd >= 0) {
+		close(symFd);
+		symFd = -1;
+		unlink(symFilename().c_str());
+	}
+	PIN_ReleaseLock(&symLock);
+	PIN_UnlockClient();
+	for (i = 0; i < files.size(); i++)
+		delete files[i];
+}
+
+int printBacktrace(const CONTEXT * 	ctxt, THREADID tid) {
+	ThreadNode *t = &threadArray[tid];
+	void* buf[BACKTRACE_SIZE];
+	bool added = false;
+	PIN_LockClient();
+	int nptrs = PIN_Backtrace(ctxt, buf, sizeof(buf)/sizeof(buf[0]));
+	PIN_UnlockClient();
 
-	free(bt);
+	if (t->seenFrames == NULL)
+		t->seenFrames = new std::unordered_set<ADDRINT>();
+	for (int i = 0; i < nptrs; i++) {
+		ADDRINT addr = (ADDRINT)buf[i];
+		if (!stream_output && t->seenFrames->insert(addr).second) {
+			PIN_GetLock(&symLock, tid+1);
+			pendingFrames.push_back(addr);
+			PIN_ReleaseLock(&symLock);
+			added = true;
+		}
+		traceWrite(tid, "@%lx;", (unsigned long)addr);
+	}
+	if (added && time(NULL) != symTime.load())
+		traceSyncFrames(tid);
+	traceWrite(tid, "\n");
 	return nptrs;
 }
 
 VOID BeforeMalloc(CONTEXT* ctxt, CHAR* name, ADDRINT size) { 
 	fprintf(out, "%s begins (%lu)\n", name, size);
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, PIN_ThreadId());
  }
  
 VOID AfterMalloc(CONTEXT* ctxt, ADDRINT ret) { 
 	// print ret in pointer form
 	fprintf(out, "malloc() ends = %p\n", (void *)ret);
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, PIN_ThreadId());
  }
 
 VOID BeforeFree(CONTEXT* ctxt, CHAR* name, ADDRINT addr) { 
@@ -599,40 +965,115 @@ VOID BeforeFree(CONTEXT* ctxt, CHAR* name, ADDRINT addr) {
 
 
 char *findMemNode(unsigned long addr, unsigned long *pgoff, THREADID tid) {
-	MemNode *curr = NULL;
-
-	curr = memNodeHead;
-	while (curr) {
-		if ((curr->start <= addr) && (addr < curr->end)) {
-			*pgoff = ((addr & PAGE_MASK) - curr->start) >> PAGE_SHIFT;
-			return curr->filename;
+	std::atomic<unsigned long> &seen = threadArray[tid].memMapEpoch;
+	MemMap *map;
+	MemNode *found = NULL;
+	char *filename = NULL;
+	size_t lo, hi, mid, i;
+
+	seen.store(memMapEpoch.load());
+	map = memMap.load();
+	if (map) {
+		// first node starting after addr
+		lo = 0;
+		hi = map->count;
+		while (lo < hi) {
+			mid = (lo + hi) / 2;
+			if (map->nodes[mid].start <= addr)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		// usually only the node right before it can contain addr
+		for (i = lo; i > 0 && map->nodes[i - 1].maxEnd > addr; i--) {
+			MemNode *curr = &map->nodes[i - 1];
+			if (addr < curr->end && (found == NULL || curr->seq < found->seq))
+				found = curr;
+		}
+		if (found) {
+			*pgoff = ((addr & PAGE_MASK) - found->start) >> PAGE_SHIFT;
+			filename = found->filename;
 		}
-		curr = curr->next;
 	}
-	return NULL;
+	// map may be freed from here on
+	seen.store(0);
+	return filename;
+}
+
+// The functions below replace the map; callers hold RWMutex for writing.
+MemMap *allocMemMap(size_t count) {
+	MemMap *map = (MemMap *)malloc(sizeof(MemMap) + count * sizeof(MemNode));
+
+	if (map == NULL)
+		return NULL;
+	map->count = count;
+	map->nodes = (MemNode *)(map + 1);
+	return map;
+}
+
+void publishMemMap(MemMap *map) {
+	MemMap *prev;
+	unsigned long epoch, oldest = ULONG_MAX, seen;
+	size_t i, j;
+	int t;
+
+	for (i = 0; i < map->count; i++) {
+		map->nodes[i].maxEnd = map->nodes[i].end;
+		if (i > 0 && map->nodes[i - 1].maxEnd > map->nodes[i].maxEnd)
+			map->nodes[i].maxEnd = map->nodes[i - 1].maxEnd;
+	}
+	prev = memMap.exchange(map);
+	// lookups that started before this epoch may still use prev
+	epoch = memMapEpoch.fetch_add(1) + 1;
+	if (prev)
+		retiredMemMaps.push_back(std::make_pair(epoch, prev));
+
+	for (t = 0; t < MAX_THREADS; t++) {
+		seen = threadArray[t].memMapEpoch.load();
+		if (seen != 0 && seen < oldest)
+			oldest = seen;
+	}
+	for (i = 0, j = 0; i < retiredMemMaps.size(); i++) {
+		if (retiredMemMaps[i].first <= oldest)
+			free(retiredMemMaps[i].second);
+		else
+			retiredMemMaps[j++] = retiredMemMaps[i];
+	}
+	retiredMemMaps.resize(j);
 }
 
 int insertMemNode(char *filename, unsigned long start, unsigned long end, unsigned long length,
 		unsigned long nrpages, THREADID tid) {
-	MemNode *newNode = (MemNode *)malloc(sizeof(MemNode));
+	MemMap *prev = memMap.load();
+	size_t count = prev ? prev->count : 0;
+	MemMap *map = allocMemMap(count + 1);
+	MemNode newNode;
+	size_t i, j;
 
-	if (newNode == NULL) {
+	if (map == NULL) {
 		fprintf(out, "[%d] %s: malloc() failed. (ERROR)\n", tid, __func__);
 		fflush(out);
 		return FALSE;
 	}
-	strcpy(newNode->filename, filename);
-	newNode->start = start;
-	newNode->end = end;
-	newNode->length = length;
-	newNode->nrpages = nrpages;
-	newNode->next = NULL;
-
-	if (memNodeHead == NULL)
-		memNodeHead = newNode;
-	if (memNodeTail != NULL)
-		memNodeTail->next = newNode;
-	memNodeTail = newNode;
+	// filenames are handed out by findMemNode without a lock, so never free them
+	char *&name = memNodeFilenames[filename];
+	if (name == NULL)
+		name = strdup(filename);
+	newNode.filename = name;
+	newNode.start = start;
+	newNode.end = end;
+	newNode.length = length;
+	newNode.nrpages = nrpages;
+	newNode.seq = memNodeSeq++;
+
+	for (i = 0, j = 0; i < count; i++) {
+		if (j == i && start < prev->nodes[i].start)
+			map->nodes[j++] = newNode;
+		map->nodes[j++] = prev->nodes[i];
+	}
+	if (j == count)
+		map->nodes[j] = newNode;
+	publishMemMap(map);
 	//fprintf(out, "[%d] %s: A memNode was inserted into the memNode list.\n", tid, __func__);
 	//fflush(out);
 	return TRUE;
@@ -666,29 +1107,37 @@ int insertThreadNode(THREADID tid) {
 #endif
 
 int deleteMemNode(unsigned long start, unsigned long length, THREADID tid) {
-	MemNode *prev = NULL;
-	MemNode *curr = NULL;
-
-	curr = memNodeHead;
-	while (curr) {
-		if ((curr->start == start) && (curr->length == length)) {
-			if (prev != NULL)
-				prev->next = curr->next;
-			else
-				memNodeHead = curr->next;
-			if (curr->next == NULL)
-				memNodeTail = prev;
-			free(curr);
-			//fprintf(out, "[%d] %s: A memNode was deleted.\n", tid, __func__);
-			//fflush(out);
-			return TRUE;
-		}
-		prev = curr;
-		curr = curr->next;
+	MemMap *prev = memMap.load();
+	size_t count = prev ? prev->count : 0;
+	MemMap *map;
+	size_t i, j, victim = count;
+
+	// the oldest node for this mapping, as findMemNode would return
+	for (i = 0; i < count; i++) {
+		MemNode *curr = &prev->nodes[i];
+		if ((curr->start == start) && (curr->length == length) &&
+				(victim == count || curr->seq < prev->nodes[victim].seq))
+			victim = i;
+	}
+	if (victim == count) {
+		fprintf(out, "[%d] %s: This memNode can not be deleted. (ERROR)\n", tid, __func__);
+		fflush(out);
+		return FALSE;
 	}
-	fprintf(out, "[%d] %s: This memNode can not be deleted. (ERROR)\n", tid, __func__);
-	fflush(out);
-	return FALSE;
+	map = allocMemMap(count - 1);
+	if (map == NULL) {
+		fprintf(out, "[%d] %s: malloc() failed. (ERROR)\n", tid, __func__);
+		fflush(out);
+		return FALSE;
+	}
+	for (i = 0, j = 0; i < count; i++) {
+		if (i != victim)
+			map->nodes[j++] = prev->nodes[i];
+	}
+	publishMemMap(map);
+	//fprintf(out, "[%d] %s: A memNode was deleted.\n", tid, __func__);
+	//fflush(out);
+	return TRUE;
 }
 
 #if 0
@@ -824,7 +1273,7 @@ VOID ThreadStart(THREADID tid, CONTEXT *ctxt, INT32 flags, VOID *v) {
 	// fflush(out);
 	// PIN_ReleaseLock(&pinLock);
 
-	if (tid > 1000) {
+	if (tid >= MAX_THREADS) {
 		PIN_GetLock(&pinLock, tid+1);
 		fprintf(out, "%d, %s: There are too many threads. (ERROR)\n", tid, __func__);
 		fflush(out);
@@ -845,6 +1294,35 @@ VOID ThreadFini(THREADID tid, const CONTEXT *ctxt, INT32 code, VOID *v) {
 	// fflush(out);
 	// PIN_ReleaseLock(&pinLock);
 	//deleteThreadNode(tid);
+	traceFlush(tid);
+}
+
+// The child starts with the parent's mappings and files, which the parent
+// still writes out itself.
+VOID ForkChild(THREADID tid, const CONTEXT *ctxt, VOID *v) {
+	int i;
+
+	// records started by other threads are only finished in the parent, and
+	// the parent writes out what it had
+	streamOut.clear();
+	for (i = 0; i < MAX_THREADS; i++) {
+		if (threadArray[i].streamRecord)
+			threadArray[i].streamRecord->clear();
+		if (threadArray[i].traceMap != NULL)
+			munmap(threadArray[i].traceMap, threadArray[i].traceMapLen);
+		if (threadArray[i].traceFd >= 0)
+			close(threadArray[i].traceFd);
+		threadArray[i].traceMap = NULL;
+		threadArray[i].traceMapLen = 0;
+		threadArray[i].traceBuf = NULL;
+		threadArray[i].traceCap = 0;
+		threadArray[i].traceLen = 0;
+		threadArray[i].traceOff = 0;
+		threadArray[i].traceFd = -1;
+	}
+	if (symFd >= 0)
+		close(symFd);
+	symFd = -1;
 }
 
 // This routine is executed each time mmap() is called.
@@ -929,21 +1407,16 @@ VOID AfterMmap(THREADID tid, MmapArgs *args, void *ret, CONTEXT *ctxt) {
 	PIN_RWMutexUnlock(&RWMutex);
 
 	if (result) {
-		PIN_GetLock(&pinLock, tid+1);
-		fprintf(out, "%lu,%d,REGISTER_FILE,%s,0x%lx,%lu,%ld,%d,%d;", timestamp, tid, args->filename, args->addr, args->length, args->offset, args->prot, args->flags);
+		unsigned long ts = timestamp++;
+		traceWrite(tid, "%lu,%d,REGISTER_FILE,%s,0x%lx,%lu,%ld,%d,%d;", ts, tid, args->filename, args->addr, args->length, args->offset, args->prot, args->flags);
 		#if PRINT_BACKTRACE
-		printBacktrace(ctxt);
+		printBacktrace(ctxt, tid);
 		#else
-		fprintf(out, "\n");
+		traceWrite(tid, "\n");
 		#endif
-		fflush(out);
 		#if DEBUG
-		printf("%lu,%d,REGISTER_FILE,%s,0x%lx,%lu,%ld,%d,%d;", timestamp, tid, args->filename, args->addr, args->length, args->offset, args->prot, args->flags);
+		printf("%lu,%d,REGISTER_FILE,%s,0x%lx,%lu,%ld,%d,%d;", ts, tid, args->filename, args->addr, args->length, args->offset, args->prot, args->flags);
 		#endif
-		PIN_RWMutexWriteLock(&RWMutex);
-		timestamp++;
-		PIN_RWMutexUnlock(&RWMutex);
-		PIN_ReleaseLock(&pinLock);
 	}
 	else {
 		PIN_GetLock(&pinLock, tid+1);
@@ -962,11 +1435,7 @@ VOID BeforeMunmap(THREADID tid, unsigned long addr, size_t length) {
 	char *filename;
 	unsigned long pgoff;
 
-	//PIN_GetLock(&pinLock, tid+1);
-	PIN_RWMutexWriteLock(&RWMutex);
 	filename = findMemNode(addr, &pgoff, tid);
-	//PIN_ReleaseLock(&pinLock);
-	PIN_RWMutexUnlock(&RWMutex);
 
 	if (filename == NULL || (target_filename != "" && strstr(filename, target_filename.c_str()) == NULL)) {
 		threadArray[tid].sType = S_SKIP;
@@ -1014,21 +1483,16 @@ VOID AfterMunmap(THREADID tid, MunmapArgs *args, int ret, CONTEXT *ctxt) {
 	PIN_RWMutexUnlock(&RWMutex);
 
 	if (result) {
-		PIN_GetLock(&pinLock, tid+1);
-		fprintf(out, "%lu,%d,UNREGISTER_FILE,%s,0x%lx,%lu;", timestamp, tid, args->filename, args->addr, args->length);	
+		unsigned long ts = timestamp++;
+		traceWrite(tid, "%lu,%d,UNREGISTER_FILE,%s,0x%lx,%lu;", ts, tid, args->filename, args->addr, args->length);	
 		#if PRINT_BACKTRACE
-		printBacktrace(ctxt);
+		printBacktrace(ctxt, tid);
 		#else
-		fprintf(out, "\n");
+		traceWrite(tid, "\n");
 		#endif
-		fflush(out);
 		#if DEBUG
-		printf("%lu,%d,UNREGISTER_FILE,%s,0x%lx,%lu;", timestamp, tid, args->filename, args->addr, args->length);
+		printf("%lu,%d,UNREGISTER_FILE,%s,0x%lx,%lu;", ts, tid, args->filename, args->addr, args->length);
 		#endif
-		PIN_RWMutexWriteLock(&RWMutex);
-		timestamp++;
-		PIN_RWMutexUnlock(&RWMutex);
-		PIN_ReleaseLock(&pinLock);
 	}
 	else {
 		PIN_GetLock(&pinLock, tid+1);
@@ -1046,11 +1510,7 @@ VOID BeforeMsync(THREADID tid, unsigned long addr, size_t length, int flags) {
 	char *filename;
 	unsigned long pgoff;
 
-	//PIN_GetLock(&pinLock, tid+1);
-	PIN_RWMutexWriteLock(&RWMutex);
 	filename = findMemNode(addr, &pgoff, tid);
-	//PIN_ReleaseLock(&pinLock);
-	PIN_RWMutexUnlock(&RWMutex);
 
 	if (filename == NULL || (target_filename != "" && strstr(filename, target_filename.c_str()) == NULL)) {
 		threadArray[tid].sType = S_SKIP;
@@ -1090,21 +1550,16 @@ VOID AfterMsync(THREADID tid, MsyncArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,MSYNC,%s,0x%lx,%lu,%d;", timestamp, tid, args->filename, args->addr, args->length, args->flags);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,MSYNC,%s,0x%lx,%lu,%d;", ts, tid, args->filename, args->addr, args->length, args->flags);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,MSYNC,%s,0x%lx,%lu,%d;", timestamp, tid, args->filename, args->addr, args->length, args->flags);
+	printf("%lu,%d,MSYNC,%s,0x%lx,%lu,%d;", ts, tid, args->filename, args->addr, args->length, args->flags);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock); 
 	free(args);
 }
 
@@ -1146,21 +1601,16 @@ VOID AfterFtruncate(THREADID tid, FtruncateArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,FTRUNCATE,%d,%s,%ld;", timestamp, tid, args->fd, args->filename, args->length);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,FTRUNCATE,%d,%s,%ld;", ts, tid, args->fd, args->filename, args->length);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,FTRUNCATE,%d,%s,%ld;", timestamp, tid, args->fd, args->filename, args->length);
+	printf("%lu,%d,FTRUNCATE,%d,%s,%ld;", ts, tid, args->fd, args->filename, args->length);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1204,51 +1654,46 @@ VOID AfterPwrite64(THREADID tid, Pwrite64Args *args, ssize_t ret, CONTEXT *ctxt)
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
+	unsigned long ts = timestamp++;
 	std::string encoded_result;
 	if (record_value) {
 		encoded_result = base64_encode((char *)args->buf, args->count);
 		// debug print char array in out
-		// fprintf(out, "hexdump of args->buf before encode \n");
+		// traceWrite(tid, "hexdump of args->buf before encode \n");
 		// for (size_t i = 0; i < args->count; i++) {
-		// 	fprintf(out, "%02x ", ((char *)args->buf)[i]);
+		// 	traceWrite(tid, "%02x ", ((char *)args->buf)[i]);
 		// }
-		// fprintf(out, "\n");
+		// traceWrite(tid, "\n");
 
 		// char* decode_result = base64_decode(encoded_result.c_str(), encoded_result.size());
-		// fprintf(out, "hexdump of args->buf after decode \n");
+		// traceWrite(tid, "hexdump of args->buf after decode \n");
 		// for (size_t i = 0; i < args->count; i++) {
-		// 	fprintf(out, "%02x ", decode_result[i]);
+		// 	traceWrite(tid, "%02x ", decode_result[i]);
 		// }
-		// fprintf(out, "\n");
+		// traceWrite(tid, "\n");
 		if (encoded_result[encoded_result.size()-1] == '\n') {
-			fprintf(out, "%lu,%d,PWRITE64,%d,%s,%ld,%lu,%s;", timestamp, tid, args->fd, args->filename, args->offset, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
+			traceWrite(tid, "%lu,%d,PWRITE64,%d,%s,%ld,%lu,%s;", ts, tid, args->fd, args->filename, args->offset, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
 		}
 		else {
-			fprintf(out, "%lu,%d,PWRITE64,%d,%s,%ld,%lu,%s;", timestamp, tid, args->fd, args->filename, args->offset, args->count, encoded_result.c_str());
+			traceWrite(tid, "%lu,%d,PWRITE64,%d,%s,%ld,%lu,%s;", ts, tid, args->fd, args->filename, args->offset, args->count, encoded_result.c_str());
 		}
 	}
 	else {
-		fprintf(out, "%lu,%d,PWRITE64,%d,%s,%ld,%lu,;", timestamp, tid, args->fd, args->filename, args->offset, args->count);
+		traceWrite(tid, "%lu,%d,PWRITE64,%d,%s,%ld,%lu,;", ts, tid, args->fd, args->filename, args->offset, args->count);
 	}
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
 	if (record_value) {
-		printf("%lu,%d,PWRITE64,%d,%s,%ld,%lu,%s;", timestamp, tid, args->fd, args->filename, args->offset, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
+		printf("%lu,%d,PWRITE64,%d,%s,%ld,%lu,%s;", ts, tid, args->fd, args->filename, args->offset, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
 	}
 	else {
-		printf("%lu,%d,PWRITE64,%d,%s,%ld,%lu,;", timestamp, tid, args->fd, args->filename, args->offset, args->count);
+		printf("%lu,%d,PWRITE64,%d,%s,%ld,%lu,;", ts, tid, args->fd, args->filename, args->offset, args->count);
 	}
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1291,58 +1736,53 @@ VOID AfterWrite(THREADID tid, WriteArgs *args, ssize_t ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
+	unsigned long ts = timestamp++;
 	std::string encoded_result;
 	if (record_value) {
 		encoded_result = base64_encode((char *)args->buf, args->count);
 		if (encoded_result[encoded_result.size()-1] == '\n') {
-			fprintf(out, "%lu,%d,WRITE,%d,%s,%lu,%s;", timestamp, tid, args->fd, args->filename, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
+			traceWrite(tid, "%lu,%d,WRITE,%d,%s,%lu,%s;", ts, tid, args->fd, args->filename, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
 		}
 		else {
-			fprintf(out, "%lu,%d,WRITE,%d,%s,%lu,%s;", timestamp, tid, args->fd, args->filename, args->count, encoded_result.c_str());
+			traceWrite(tid, "%lu,%d,WRITE,%d,%s,%lu,%s;", ts, tid, args->fd, args->filename, args->count, encoded_result.c_str());
 		}
 	}
 	else {
-		fprintf(out, "%lu,%d,WRITE,%d,%s,%lu,;", timestamp, tid, args->fd, args->filename, args->count);
+		traceWrite(tid, "%lu,%d,WRITE,%d,%s,%lu,;", ts, tid, args->fd, args->filename, args->count);
 	
 	}
-	// fprintf(out, "%lu,%d,WRITE,%s,%lu,%s;\n", timestamp, tid, args->filename, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
-	// fprintf(out, "encoded_result: %s|||\n", encoded_result.c_str());
+	// traceWrite(tid, "%lu,%d,WRITE,%s,%lu,%s;\n", ts, tid, args->filename, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
+	// traceWrite(tid, "encoded_result: %s|||\n", encoded_result.c_str());
 	// // hexdump of args->buf
-	// fprintf(out, "hexdump of args->buf before encode \n");
+	// traceWrite(tid, "hexdump of args->buf before encode \n");
 	// for (size_t i = 0; i < args->count; i++) {
-	// 	fprintf(out, "%02x", ((char *)args->buf)[i]);
+	// 	traceWrite(tid, "%02x", ((char *)args->buf)[i]);
 	// }
 	// char * decode_result = base64_decode((encoded_result.substr(0, encoded_result.size()-1)+"\n").c_str(), encoded_result.size());
-	// fprintf(out, "\nhexdump of args->buf after decode \n");
+	// traceWrite(tid, "\nhexdump of args->buf after decode \n");
 	// for (size_t i = 0; i < args->count; i++) {
-	// 	fprintf(out, "%02x", decode_result[i]);
+	// 	traceWrite(tid, "%02x", decode_result[i]);
 	// }
-	// fprintf(out, "\n");
+	// traceWrite(tid, "\n");
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
 	if (record_value) {
 		if (encoded_result[encoded_result.size()-1] == '\n') {
-			printf("%lu,%d,WRITE,%d,%s,%lu,%s;", timestamp, tid, args->fd, args->filename, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
+			printf("%lu,%d,WRITE,%d,%s,%lu,%s;", ts, tid, args->fd, args->filename, args->count, encoded_result.substr(0, encoded_result.size()-1).c_str());
 		}
 		else {
-			printf("%lu,%d,WRITE,%d,%s,%lu,%s;", timestamp, tid, args->fd, args->filename, args->count, encoded_result.c_str());
+			printf("%lu,%d,WRITE,%d,%s,%lu,%s;", ts, tid, args->fd, args->filename, args->count, encoded_result.c_str());
 		}
 	}
 	else {
-		printf("%lu,%d,WRITE,%d,%s,%lu,;", timestamp, tid, args->fd, args->filename, args->count);
+		printf("%lu,%d,WRITE,%d,%s,%lu,;", ts, tid, args->fd, args->filename, args->count);
 	
 	}
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1386,40 +1826,35 @@ VOID AfterWritev(THREADID tid, WritevArgs *args, ssize_t ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
+	unsigned long ts = timestamp++;
 	if (record_value) {
-		fprintf(out, "%lu,%d,WRITEV,%d,%s,%d", timestamp, tid, args->fd, args->filename, args->iovcnt);
+		traceWrite(tid, "%lu,%d,WRITEV,%d,%s,%d", ts, tid, args->fd, args->filename, args->iovcnt);
 		for (int i = 0; i < args->iovcnt; i++) {
 			std::string encoded_result = base64_encode((char *)args->iov[i].iov_base, args->iov[i].iov_len);
 			if (encoded_result[encoded_result.size()-1] == '\n') {
-				fprintf(out, ",%lu,%s", args->iov[i].iov_len, encoded_result.substr(0, encoded_result.size()-1).c_str());
+				traceWrite(tid, ",%lu,%s", args->iov[i].iov_len, encoded_result.substr(0, encoded_result.size()-1).c_str());
 			}
 			else {
-				fprintf(out, ",%lu,%s", args->iov[i].iov_len, encoded_result.c_str());
+				traceWrite(tid, ",%lu,%s", args->iov[i].iov_len, encoded_result.c_str());
 			}
 		}
-		fprintf(out, ";");
+		traceWrite(tid, ";");
 	}
 	else {
-		fprintf(out, "%lu,%d,WRITEV,%d,%s,%d", timestamp, tid, args->fd, args->filename, args->iovcnt);
+		traceWrite(tid, "%lu,%d,WRITEV,%d,%s,%d", ts, tid, args->fd, args->filename, args->iovcnt);
 		for (int i = 0; i < args->iovcnt; i++) {
-			fprintf(out, ",%lu,", args->iov[i].iov_len);
+			traceWrite(tid, ",%lu,", args->iov[i].iov_len);
 		}
-		fprintf(out, ";");
+		traceWrite(tid, ";");
 	}
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
 	#if DEBUG
-	printf("%lu,%d,WRITEV,%d,%s,%d \n", timestamp, tid, args->fd, args->filename, args->iovcnt);
+	printf("%lu,%d,WRITEV,%d,%s,%d \n", ts, tid, args->fd, args->filename, args->iovcnt);
 	#endif
-	fflush(out);
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1462,21 +1897,16 @@ VOID AfterLseek(THREADID tid, LseekArgs *args, off_t ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,LSEEK,%d,%s,%ld,%d;", timestamp, tid, args->fd, args->filename, args->offset, args->whence);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,LSEEK,%d,%s,%ld,%d;", ts, tid, args->fd, args->filename, args->offset, args->whence);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,LSEEK,%d,%s,%ld,%d;", timestamp, tid, args->fd, args->filename, args->offset, args->whence);
+	printf("%lu,%d,LSEEK,%d,%s,%ld,%d;", ts, tid, args->fd, args->filename, args->offset, args->whence);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1531,21 +1961,16 @@ VOID AfterRename(THREADID tid, RenameArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,RENAME,%s,%s;", timestamp, tid, args->oldpath, args->newpath);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,RENAME,%s,%s;", ts, tid, args->oldpath, args->newpath);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,RENAME,%s,%s;", timestamp, tid, args->oldpath, args->newpath);
+	printf("%lu,%d,RENAME,%s,%s;", ts, tid, args->oldpath, args->newpath);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1586,21 +2011,16 @@ VOID AfterUnlink(THREADID tid, UnlinkArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,UNLINK,%s;", timestamp, tid, args->filename);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,UNLINK,%s;", ts, tid, args->filename);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,UNLINK,%s;", timestamp, tid, args->filename);
+	printf("%lu,%d,UNLINK,%s;", ts, tid, args->filename);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1641,21 +2061,16 @@ VOID AfterFsync(THREADID tid, FsyncArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,FSYNC,%d,%s;", timestamp, tid, args->fd, args->filename);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,FSYNC,%d,%s;", ts, tid, args->fd, args->filename);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,FSYNC,%d,%s;", timestamp, tid, args->fd, args->filename);
+	printf("%lu,%d,FSYNC,%d,%s;", ts, tid, args->fd, args->filename);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1696,21 +2111,16 @@ VOID AfterFdatasync(THREADID tid, FdatasyncArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,FDATASYNC,%d,%s;", timestamp, tid, args->fd, args->filename);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,FDATASYNC,%d,%s;", ts, tid, args->fd, args->filename);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,FDATASYNC,%d,%s;", timestamp, tid, args->fd, args->filename);
+	printf("%lu,%d,FDATASYNC,%d,%s;", ts, tid, args->fd, args->filename);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1754,21 +2164,16 @@ VOID AfterFallocate(THREADID tid, FallocateArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,FALLOCATE,%d,%s,%d,%ld,%ld;", timestamp, tid, args->fd, args->filename, args->mode, args->offset, args->len);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,FALLOCATE,%d,%s,%d,%ld,%ld;", ts, tid, args->fd, args->filename, args->mode, args->offset, args->len);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,FALLOCATE,%d,%s,%d,%ld,%ld;", timestamp, tid, args->fd, args->filename, args->mode, args->offset, args->len);
+	printf("%lu,%d,FALLOCATE,%d,%s,%d,%ld,%ld;", ts, tid, args->fd, args->filename, args->mode, args->offset, args->len);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1813,35 +2218,32 @@ VOID AfterOpen(THREADID tid, OpenArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
+	unsigned long ts = timestamp++;
 	// if open with O_APPEND, get file size
 	if (args->flags & O_APPEND) {
 		struct stat st;
 		if (fstat(ret, &st) == -1) {
+			PIN_GetLock(&pinLock, tid+1);
 			fprintf(out, "[%d] fstat() failed (ERROR)\n", tid);
 			fflush(out);
+			PIN_ReleaseLock(&pinLock);
 			free(args);
 			exit(EXIT_FAILURE);
 		}
-		fprintf(out, "%lu,%d,OPEN,%s,%d,%d,%d,%ld;", timestamp, tid, args->filename, args->flags, args->mode, ret, st.st_size);
+		traceWrite(tid, "%lu,%d,OPEN,%s,%d,%d,%d,%ld;", ts, tid, args->filename, args->flags, args->mode, ret, st.st_size);
 	}
 	else {
-		fprintf(out, "%lu,%d,OPEN,%s,%d,%d,%d,%ld;", timestamp, tid, args->filename, args->flags, args->mode, ret, (long int)-1);
+		traceWrite(tid, "%lu,%d,OPEN,%s,%d,%d,%d,%ld;", ts, tid, args->filename, args->flags, args->mode, ret, (long int)-1);
 	}
-	// fprintf(out, "%lu,%d,OPEN,%s,%d,%d,%d;", timestamp, tid, args->filename, args->flags, args->mode, ret);
+	// traceWrite(tid, "%lu,%d,OPEN,%s,%d,%d,%d;", ts, tid, args->filename, args->flags, args->mode, ret);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,OPEN,%s,%d,%d;", timestamp, tid, args->filename, args->flags, args->mode);
+	printf("%lu,%d,OPEN,%s,%d,%d;", ts, tid, args->filename, args->flags, args->mode);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1879,21 +2281,16 @@ VOID AfterCreat(THREADID tid, CreatArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,CREAT,%s,%d,%d;", timestamp, tid, args->filename, args->mode, ret);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,CREAT,%s,%d,%d;", ts, tid, args->filename, args->mode, ret);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,CREAT,%s,%d,%d;", timestamp, tid, args->filename, args->mode, ret);
+	printf("%lu,%d,CREAT,%s,%d,%d;", ts, tid, args->filename, args->mode, ret);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -1978,34 +2375,31 @@ VOID AfterOpenat(THREADID tid, OpenatArgs *args, int ret, CONTEXT *ctxt) {
 		return;
 	}
 
-	PIN_GetLock(&pinLock, tid+1);
+	unsigned long ts = timestamp++;
 	// if open with O_APPEND, get file size
 	if (args->flags & O_APPEND) {
 		struct stat st;
 		if (fstat(ret, &st) == -1) {
+			PIN_GetLock(&pinLock, tid+1);
 			fprintf(out, "[%d] fstat() failed (ERROR)\n", tid);
 			fflush(out);
+			PIN_ReleaseLock(&pinLock);
 			free(args);
 			exit(EXIT_FAILURE);
 		}
-		fprintf(out, "%lu,%d,OPEN,%s,%d,%d,%d,%ld;", timestamp, tid, args->filename, args->flags, args->mode, ret, st.st_size);
+		traceWrite(tid, "%lu,%d,OPEN,%s,%d,%d,%d,%ld;", ts, tid, args->filename, args->flags, args->mode, ret, st.st_size);
 	}
 	else {
-		fprintf(out, "%lu,%d,OPEN,%s,%d,%d,%d,%ld;", timestamp, tid, args->filename, args->flags, args->mode, ret, (long int)-1);
+		traceWrite(tid, "%lu,%d,OPEN,%s,%d,%d,%d,%ld;", ts, tid, args->filename, args->flags, args->mode, ret, (long int)-1);
 	}
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,OPEN,%s,%d,%d,%d;", timestamp, tid, args->filename, args->flags, args->mode, ret);
+	printf("%lu,%d,OPEN,%s,%d,%d,%d;", ts, tid, args->filename, args->flags, args->mode, ret);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2048,21 +2442,16 @@ VOID AfterClose(THREADID tid, CloseArgs *args, int ret, CONTEXT *ctxt) {
 		return;
 	}
 
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,CLOSE,%d,%s;", timestamp, tid, args->fd, args->filename);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,CLOSE,%d,%s;", ts, tid, args->fd, args->filename);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,CLOSE,%d,%s;", timestamp, tid, args->fd, args->filename);
+	printf("%lu,%d,CLOSE,%d,%s;", ts, tid, args->fd, args->filename);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2100,21 +2489,16 @@ VOID AfterMkdir(THREADID tid, MkdirArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,MKDIR,%s,%d;", timestamp, tid, args->filename, args->mode);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,MKDIR,%s,%d;", ts, tid, args->filename, args->mode);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,MKDIR,%s,%d;", timestamp, tid, args->filename, args->mode);
+	printf("%lu,%d,MKDIR,%s,%d;", ts, tid, args->filename, args->mode);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2154,21 +2538,16 @@ VOID AfterMkdirat(THREADID tid, MkdiratArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,MKDIRAT,%d,%s,%d;", timestamp, tid, args->dirfd, args->filename, args->mode);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,MKDIRAT,%d,%s,%d;", ts, tid, args->dirfd, args->filename, args->mode);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,MKDIRAT,%d,%s,%d;", timestamp, tid, args->dirfd, args->filename, args->mode);
+	printf("%lu,%d,MKDIRAT,%d,%s,%d;", ts, tid, args->dirfd, args->filename, args->mode);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2205,21 +2584,16 @@ VOID AfterRmdir(THREADID tid, RmdirArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,RMDIR,%s;", timestamp, tid, args->filename);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,RMDIR,%s;", ts, tid, args->filename);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,RMDIR,%s;", timestamp, tid, args->filename);
+	printf("%lu,%d,RMDIR,%s;", ts, tid, args->filename);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2244,21 +2618,16 @@ VOID AfterSync(THREADID tid, SyncArgs *args, CONTEXT *ctxt) {
 	if (threadArray[tid].sType == S_SKIP) {
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,SYNC;", timestamp, tid);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,SYNC;", ts, tid);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,SYNC;", timestamp, tid);
+	printf("%lu,%d,SYNC;", ts, tid);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2300,21 +2669,16 @@ VOID AfterSyncfs(THREADID tid, SyncfsArgs *args, int ret, CONTEXT *ctxt) {
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,SYNCFS,%d,%s;", timestamp, tid, args->fd, args->filename);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,SYNCFS,%d,%s;", ts, tid, args->fd, args->filename);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,SYNCFS,%d,%s;", timestamp, tid, args->fd, args->filename);
+	printf("%lu,%d,SYNCFS,%d,%s;", ts, tid, args->fd, args->filename);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2359,21 +2723,16 @@ VOID AfterSyncFileRange(THREADID tid, SyncFileRangeArgs *args, int ret, CONTEXT
 		free(args);
 		return;
 	}
-	PIN_GetLock(&pinLock, tid+1);
-	fprintf(out, "%lu,%d,SYNC_FILE_RANGE,%d,%s,%ld,%ld,%d;", timestamp, tid, args->fd, args->filename, args->offset, args->nbytes, args->flags);
+	unsigned long ts = timestamp++;
+	traceWrite(tid, "%lu,%d,SYNC_FILE_RANGE,%d,%s,%ld,%ld,%d;", ts, tid, args->fd, args->filename, args->offset, args->nbytes, args->flags);
 	#if PRINT_BACKTRACE
-	printBacktrace(ctxt);
+	printBacktrace(ctxt, tid);
 	#else
-	fprintf(out, "\n");
+	traceWrite(tid, "\n");
 	#endif
-	fflush(out);
 	#if DEBUG
-	printf("%lu,%d,SYNC_FILE_RANGE,%d,%s,%ld,%ld,%d;", timestamp, tid, args->fd, args->filename, args->offset, args->nbytes, args->flags);
+	printf("%lu,%d,SYNC_FILE_RANGE,%d,%s,%ld,%ld,%d;", ts, tid, args->fd, args->filename, args->offset, args->nbytes, args->flags);
 	#endif
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 	free(args);
 }
 
@@ -2487,6 +2846,12 @@ VOID SyscallEntry(THREADID tid, CONTEXT *ctxt, SYSCALL_STANDARD std, VOID *v)
 {
 	int number = (int)PIN_GetSyscallNumber(ctxt, std);
 	// std::cout << "Syscall starts, syscall number: " << number << std::endl;
+	if ((number == __NR_execve || number == __NR_execveat) && stream_output) {
+		// the new program gets a new tool instance, Fini does not run for this one
+		PIN_GetLock(&symLock, tid+1);
+		traceStreamFlush();
+		PIN_ReleaseLock(&symLock);
+	}
 	if (number == __NR_mmap) {
 		// std::cout << "mmap begins" << std::endl;
 		BeforeMmap(tid, (unsigned long)PIN_GetSyscallArgument(ctxt, std, 0),
@@ -2732,11 +3097,7 @@ VOID BeforeMemcpy(ADDRINT arg0, ADDRINT arg1, ADDRINT arg2, THREADID tid)
 	unsigned long src = (unsigned long)arg1;
 	size_t length = (size_t)arg2;
 
-	//PIN_GetLock(&pinLock, tid+1);
-	PIN_RWMutexWriteLock(&RWMutex);
 	filename = findMemNode(dst, &pgoff, tid);
-	//PIN_ReleaseLock(&pinLock);
-	PIN_RWMutexUnlock(&RWMutex);
 
 	if (filename == NULL || (target_filename != "" && strstr(filename, target_filename.c_str()) == NULL)) {
 		threadArray[tid].libcallArgs = NULL;
@@ -2810,11 +3171,7 @@ VOID BeforeMemset(ADDRINT arg0, ADDRINT arg1, ADDRINT arg2, THREADID tid)
 	int c = (int)arg1;
 	size_t length = (size_t)arg2;
 
-	//PIN_GetLock(&pinLock, tid+1);
-	PIN_RWMutexWriteLock(&RWMutex);
 	filename = findMemNode(addr, &pgoff, tid);
-	//PIN_ReleaseLock(&pinLock);
-	PIN_RWMutexUnlock(&RWMutex);
 
 	if (filename == NULL || (target_filename != "" && strstr(filename, target_filename.c_str()) == NULL)) {
 		threadArray[tid].libcallArgs = NULL;
@@ -2944,11 +3301,7 @@ VOID RecordMemRead(CONTEXT * ctx, VOID * ip, VOID * addr, THREADID tid)
 	unsigned long ip_addr = (unsigned long)ip;
 	unsigned long mem_addr = (unsigned long)addr;
 
-	//PIN_GetLock(&pinLock, tid+1);
-	PIN_RWMutexWriteLock(&RWMutex);
 	filename = findMemNode(mem_addr, &pgoff, tid);
-	//PIN_ReleaseLock(&pinLock);
-	PIN_RWMutexUnlock(&RWMutex);
 
 	if (filename == NULL || (target_filename != "" && strstr(filename, target_filename.c_str()) == NULL))
 		return;
@@ -2973,11 +3326,7 @@ VOID RecordMemWrite(CONTEXT * ctx, VOID * ip, VOID * addr, uint32_t size, THREAD
 	// unsigned long ip_addr = (unsigned long)ip;
 	unsigned long mem_addr = (unsigned long)addr;
 
-	//PIN_GetLock(&pinLock, tid+1);
-	PIN_RWMutexWriteLock(&RWMutex);
 	filename = findMemNode(mem_addr, &pgoff, tid);
-	//PIN_ReleaseLock(&pinLock);
-	PIN_RWMutexUnlock(&RWMutex);
 
 	if (filename == NULL || (target_filename != "" && strstr(filename, target_filename.c_str()) == NULL))
 		return;
@@ -3041,40 +3390,33 @@ VOID PrintMemWrite(CONTEXT * ctx, THREADID tid) {
 	char *filename;
 	unsigned long mem_addr = (unsigned long)threadArray[tid].mem_addr;
 
-	//PIN_GetLock(&pinLock, tid+1);
-	PIN_RWMutexWriteLock(&RWMutex);
 	filename = findMemNode(mem_addr, &pgoff, tid);
-	//PIN_ReleaseLock(&pinLock);
-	PIN_RWMutexUnlock(&RWMutex);
 
 	if (filename == NULL || (target_filename != "" && strstr(filename, target_filename.c_str()) == NULL))
 		return;
 
-	PIN_GetLock(&pinLock, tid+1);
+	PIN_GetLock(&storeLock, tid+1);
+	unsigned long ts = timestamp++;
+	unsigned long sid = store_id++;
+	PIN_ReleaseLock(&storeLock);
 	// unsigned long ip_addr = (unsigned long)PIN_GetContextReg(ctx, REG_INST_PTR);
 	uint32_t size = threadArray[tid].mem_size;
 	// std::string result((char *)mem_addr, size);
 	if (record_value) {
 		std::string encoded_result = base64_encode((char *)mem_addr, size);
 		// TODO: do we need page offset here?
-		fprintf(out, "%lu,%d,STORE,%lu,%s,0x%lx,%u,%s;", timestamp, tid, store_id, filename, mem_addr, size, encoded_result.substr(0, encoded_result.size()-1).c_str());
+		traceWrite(tid, "%lu,%d,STORE,%lu,%s,0x%lx,%u,%s;", ts, tid, sid, filename, mem_addr, size, encoded_result.substr(0, encoded_result.size()-1).c_str());
 	}
 	else {
-		fprintf(out, "%lu,%d,STORE,%lu,%s,0x%lx,%u,;", timestamp, tid, store_id, filename, mem_addr, size);
+		traceWrite(tid, "%lu,%d,STORE,%lu,%s,0x%lx,%u,;", ts, tid, sid, filename, mem_addr, size);
 	}
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	store_id++;
 
 	// // if filename contains testdb then print backtrace
 	// if (strstr(filename, "testdb") != NULL) {
-	// 	printBacktrace(ctx);
+	// 	printBacktrace(ctx, tid);
 	// }
 
-	printBacktrace(ctx);
-	fflush(out);
-	PIN_ReleaseLock(&pinLock);
+	printBacktrace(ctx, tid);
 	threadArray[tid].mem_addr = NULL;
 }
 
@@ -3094,33 +3436,23 @@ VOID * IfuncMemcpyWrapper(CONTEXT * context, AFUNPTR orgFuncptr, THREADID tid)
 }
 
 VOID BeforePathfinderOpBegin(THREADID tid, ADDRINT workload_tid, ADDRINT op_count) {
-	PIN_GetLock(&pinLock, tid+1);
+	unsigned long ts = timestamp++;
 	PIN_RWMutexWriteLock(&RWMutex);
 	// if (op_count.find(tid) == op_count.end()) {
 	// 	op_count[tid] = 0;
 	// }
 	PIN_RWMutexUnlock(&RWMutex);
-	fprintf(out, "%lu,%d,PATHFINDER_OP_BEGIN,%d,%d\n", timestamp, tid, (int)workload_tid, (int)op_count);
-	fflush(out);
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
+	traceWrite(tid, "%lu,%d,PATHFINDER_OP_BEGIN,%d,%d\n", ts, tid, (int)workload_tid, (int)op_count);
 
 }
 
 VOID BeforePathfinderOpEnd(THREADID tid, ADDRINT workload_tid, ADDRINT op_count) {
-	PIN_GetLock(&pinLock, tid+1);
+	unsigned long ts = timestamp++;
 	// PIN_RWMutexWriteLock(&RWMutex);
 	// assert(op_count.find(tid) != op_count.end());
 	// PIN_RWMutexUnlock(&RWMutex);
-	fprintf(out, "%lu,%d,PATHFINDER_OP_END,%d,%d\n", timestamp, tid, (int)workload_tid, (int)op_count);
-	fflush(out);
-	PIN_RWMutexWriteLock(&RWMutex);
-	timestamp++;
+	traceWrite(tid, "%lu,%d,PATHFINDER_OP_END,%d,%d\n", ts, tid, (int)workload_tid, (int)op_count);
 	// op_count[tid]++;
-	PIN_RWMutexUnlock(&RWMutex);
-	PIN_ReleaseLock(&pinLock);
 }
 
 #if 0
@@ -3395,8 +3727,22 @@ VOID Instruction(INS ins, VOID *v)
 	}
 }
 
+// Addresses in an unloaded image can not be symbolized any more. Pin holds
+// the client lock here.
+VOID ImageUnload(IMG img, VOID *v) {
+	PIN_GetLock(&symLock, PIN_ThreadId()+1);
+	symbolizePendingFrames(IMG_LowAddress(img), IMG_HighAddress(img));
+	PIN_ReleaseLock(&symLock);
+}
+
 // This routine is executed once at the end.
 VOID Fini(INT32 code, VOID *v) {
+	if (stream_output) {
+		PIN_GetLock(&symLock, PIN_ThreadId()+1);
+		traceStreamFlush();
+		PIN_ReleaseLock(&symLock);
+	}
+	traceMerge();
 	fclose(out);
 	PIN_RWMutexFini(&RWMutex);
 }
@@ -3418,7 +3764,11 @@ INT32 Usage() {
 int main(INT32 argc, CHAR **argv) {
 	// Initialize the pin lock
 	PIN_InitLock(&pinLock);
+	PIN_InitLock(&storeLock);
+	PIN_InitLock(&symLock);
 	PIN_RWMutexInit(&RWMutex);
+	for (int i = 0; i < MAX_THREADS; i++)
+		threadArray[i].traceFd = -1;
 
 	// Initialize pin
 	if (PIN_Init(argc, argv))
@@ -3430,16 +3780,20 @@ int main(INT32 argc, CHAR **argv) {
 	out = fopen(of_knob.Value().c_str(), "w");
 	target_filename = tf_knob.Value();
 	record_value = rv_knob.Value();
+	stream_output = stream_knob.Value();
 
 	// Register Analysis routines to be called when a thread begins/ends
 	PIN_AddThreadStartFunction(ThreadStart, 0);
 	PIN_AddThreadFiniFunction(ThreadFini, 0);
 
+	PIN_AddForkFunction(FPOINT_AFTER_IN_CHILD, ForkChild, 0);
+
 	PIN_AddSyscallEntryFunction(SyscallEntry, 0);
 	PIN_AddSyscallExitFunction(SyscallExit, 0);
 
 	// Register Image to be called to instrument functions.
 	IMG_AddInstrumentFunction(Image, 0);
+	IMG_AddUnloadFunction(ImageUnload, 0);
 	
 	INS_AddInstrumentFunction(Instruction, 0);
 